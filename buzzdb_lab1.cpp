@@ -9,8 +9,42 @@
 #include <chrono>
 #include <mutex>
 #include <unordered_set>
+#include <unordered_map>
+#include <memory>
+#include <array>
+#include <shared_mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <type_traits>
+#include <optional>
+#include <numeric>
+#include <cmath>
+#include <tuple>
+#include <list>
+#include <variant>
+#include <limits>
+#include <string_view>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
 #include <signal.h>
 #include <unistd.h>
+#include <sys/wait.h>
 #include <charconv>
 #include <algorithm>
 #include <sstream>
@@ -82,1630 +116,10129 @@ public:
     }
 };
 
-// ----------------------------- FlatFile -----------------------------
-//use the helper function
-static void rewrite_post_views_file(const std::string& posts_csv_path, int post_id, int new_views);
+// ----------------------------- Block storage -----------------------------
+// Optional compressed table format. A block file holds the CSV text (header line included) as
+// independently compressed blocks of about kBlockRawBytes, cut at line ends, followed by an
+// index of the blocks. Engagement appends go after the index as a raw CSV tail until the next
+// rewrite compresses them. Readers tell the formats apart by the magic, so LineReader, the
+// loaders and the file rewrites work on either.
+//
+//   header | block 0 .. block n-1 | index (n x BlockIndexEntry) | raw CSV tail
+//
+// The codec is LZ77 in the LZ4 sequence layout: a token (literal length << 4 | match length - 4,
+// 15 meaning "more length bytes follow"), the literals, then a 2-byte little-endian match
+// offset. The last sequence has literals only.
+
+static constexpr size_t kBlockRawBytes = size_t(64) << 10;
+static constexpr char kBlockMagic[8] = {'B', 'U', 'Z', 'Z', 'B', 'L', 'K', '1'};
+
+struct BlockFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t blocks;
+    uint64_t index_offset;
+    uint64_t tail_offset;   // first byte after the index
+    uint64_t raw_bytes;     // CSV bytes held in blocks
+};
 
+struct BlockIndexEntry {
+    uint64_t offset;
+    uint32_t stored_len;    // == raw_len: stored uncompressed
+    uint32_t raw_len;
+    uint32_t lines;
+    uint32_t checksum;      // FNV-1a of the raw bytes
+};
 
-class FlatFile {
-    private:
-        std::map<int, std::unique_ptr<User>> users;
-        std::map<int, std::unique_ptr<Post>> posts;
-        std::map<int, std::unique_ptr<Engagement>> engagements;
-        // CSV paths + table-level mutexes
-        string users_path_, posts_path_, engagements_path_;
-        mutex users_mtx_, posts_mtx_, eng_mtx_;
+static uint32_t fnv1a32(const char* p, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) h = (h ^ static_cast<uint8_t>(p[i])) * 16777619u;
+    return h;
+}
 
-    public:
-    
-        FlatFile(std::string users_csv_path, std::string posts_csv_path, std::string engagements_csv_path): 
-        users_path_(move(users_csv_path)), 
-        posts_path_(move(posts_csv_path)), 
-        engagements_path_(move(engagements_csv_path)) {
-            // UNUSED(users_csv_path);
-            // UNUSED(posts_csv_path);
-            // UNUSED(engagements_csv_path);
-         
+/**
+ * @brief LZ-compress `src`.
+ * @complexity O(n): one 16K-entry hash probe per position without a match.
+ */
+static std::string lz_compress(std::string_view src) {
+    constexpr size_t kMinMatch = 4, kHashBits = 14, kMaxOffset = 0xffff;
+    constexpr uint32_t kEmpty = UINT32_MAX;
+    std::vector<uint32_t> table(size_t(1) << kHashBits, kEmpty);
+    std::string out;
+    out.reserve(src.size() / 2 + 16);
+    const size_t n = src.size();
+    size_t anchor = 0, i = 0;
+
+    auto read32 = [&](size_t p) { uint32_t v; memcpy(&v, src.data() + p, 4); return v; };
+    auto put_length = [&](size_t len) {
+        for (; len >= 255; len -= 255) out += char(255);
+        out += char(len);
+    };
+    auto emit = [&](size_t literal_end, size_t match_len, size_t offset) {
+        size_t lit = literal_end - anchor;
+        size_t ml = match_len ? match_len - kMinMatch : 0;
+        out += char((std::min<size_t>(lit, 15) << 4) | std::min<size_t>(ml, 15));
+        if (lit >= 15) put_length(lit - 15);
+        out.append(src.data() + anchor, lit);
+        if (!match_len) return;
+        out += char(offset & 0xff);
+        out += char(offset >> 8);
+        if (ml >= 15) put_length(ml - 15);
+    };
+
+    while (i + kMinMatch <= n) {
+        uint32_t v = read32(i);
+        uint32_t& slot = table[(v * 2654435761u) >> (32 - kHashBits)];
+        uint32_t cand = slot;
+        slot = static_cast<uint32_t>(i);
+        if (cand == kEmpty || i - cand > kMaxOffset || read32(cand) != v) {
+            ++i;
+            continue;
         }
+        size_t len = kMinMatch;
+        while (i + len < n && src[cand + len] == src[i + len]) ++len;
+        emit(i, len, i - cand);
+        i += len;
+        anchor = i;
+    }
+    emit(n, 0, 0);
+    return out;
+}
 
-        ~FlatFile() = default;
-
-        /**
-         * @brief Single-threaded load of users, posts, and engagements from CSVs.
-         *
-         * @details
-         *  - Reads from the instance paths (users_path, posts_path, engagements_path).
-         *  - Skip the first header line; ignore empty/malformed rows rather than throwing.
-         *  - Parse into temporary maps, then swap into shared maps under mutexes.
-         *  - Ensure referential integrity across tables
-         *
-         * @thread_safety  Safe to call concurrently; the final commit is serialized by internal mutexes.
-         * @throws Aborts via ASSERT_WITH_MESSAGE if a CSV cannot be opened.
-         * @complexity  O(U + P + E) over rows read, plus I/O.
-         */
-        void loadFlatFile() {
-            
-            // TODO: add your implementation here
+/**
+ * @brief Decompress `src` into exactly `out_len` bytes at `out`.
+ * @return false on malformed input (bad offset, overrun, wrong total length).
+ */
+static bool lz_decompress(std::string_view src, char* out, size_t out_len) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(src.data());
+    const uint8_t* end = p + src.size();
+    size_t w = 0;
+    auto get_length = [&](size_t len, bool& ok) {
+        uint8_t b;
+        do {
+            if (p == end) { ok = false; return len; }
+            b = *p++;
+            len += b;
+        } while (b == 255);
+        return len;
+    };
+    while (p < end) {
+        uint8_t token = *p++;
+        bool ok = true;
+        size_t lit = token >> 4;
+        if (lit == 15) lit = get_length(lit, ok);
+        if (!ok || lit > size_t(end - p) || lit > out_len - w) return false;
+        memcpy(out + w, p, lit);
+        p += lit;
+        w += lit;
+        if (p == end) break;   // literals-only last sequence
+
+        if (end - p < 2) return false;
+        size_t offset = p[0] | (size_t(p[1]) << 8);
+        p += 2;
+        size_t len = token & 15;
+        if (len == 15) len = get_length(len, ok);
+        len += 4;
+        if (!ok || offset == 0 || offset > w || len > out_len - w) return false;
+        // byte-wise: a match may overlap the bytes it produces
+        for (size_t k = 0; k < len; ++k, ++w) out[w] = out[w - offset];
+    }
+    return w == out_len;
+}
 
-            //remove head and tail blank and special symbols
-            auto trim = [](string &s) {
-                // get pure lines
-                size_t start = s.find_first_not_of(" \t\n\r\f\v");
-                size_t end = s.find_last_not_of(" \t\n\r\f\v");
-                //clear blank lines
-                if (start == string::npos) {
-                    s.clear();
-                } else {
-                    s = s.substr(start, end - start + 1);
-                }
-            };
+struct BlockFileStats {
+    uint64_t raw_bytes = 0, stored_bytes = 0, blocks = 0;
 
-            //convert string to integer and check if available
-            auto to_int = [](const string &str, int &value) -> bool {
-                if (str.empty()) return false;
-                
-                stringstream ss(str);
-                ss >> value;
+    double ratio() const { return raw_bytes ? double(stored_bytes) / double(raw_bytes) : 1.0; }
+};
 
-                // check the format
-                if (ss.fail() || !ss.eof()) return false;
+/**
+ * @brief Write the CSV at `csv_path` as a block file at `out_path` (not atomic: callers
+ *        write a tmp path and rename it).
+ * @details The CSV is streamed: at most one block plus one read chunk is held in memory,
+ *          and each block is cut at the first line end past `block_bytes`.
+ * @throws Aborts via ASSERT_WITH_MESSAGE if either file cannot be opened or written.
+ */
+static BlockFileStats write_block_file(const std::string& csv_path, const std::string& out_path,
+                                       size_t block_bytes = kBlockRawBytes) {
+    std::ifstream in(csv_path, std::ios::binary);
+    ASSERT_WITH_MESSAGE(in.good(), "File failed: " + csv_path);
+    std::ofstream out(out_path, std::ios::binary | std::ios::trunc);
+    ASSERT_WITH_MESSAGE(out.good(), "File failed: " + out_path);
+    BlockFileHeader h{};
+    memcpy(h.magic, kBlockMagic, sizeof h.magic);
+    h.version = 1;
+    out.write(reinterpret_cast<const char*>(&h), sizeof h);
+
+    std::vector<BlockIndexEntry> index;
+    uint64_t offset = sizeof h;
+    auto emit = [&](std::string_view raw) {
+        std::string packed = lz_compress(raw);
+        bool keep_raw = packed.size() >= raw.size();
+        std::string_view stored = keep_raw ? raw : std::string_view(packed);
+        out.write(stored.data(), static_cast<std::streamsize>(stored.size()));
+        index.push_back({offset, static_cast<uint32_t>(stored.size()), static_cast<uint32_t>(raw.size()),
+                         static_cast<uint32_t>(std::count(raw.begin(), raw.end(), '\n')), fnv1a32(raw.data(), raw.size())});
+        offset += stored.size();
+        h.raw_bytes += raw.size();
+    };
+
+    std::string pending;                  // bytes read but not yet cut into a block
+    std::vector<char> chunk(std::max<size_t>(block_bytes, 4096));
+    size_t scanned = 0;                   // no '\n' in pending before this offset past the cut point
+    for (bool eof = false; !eof;) {
+        in.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        size_t got = static_cast<size_t>(in.gcount());
+        eof = got < chunk.size();
+        pending.append(chunk.data(), got);
+        size_t begin = 0;
+        while (pending.size() - begin > block_bytes) {
+            size_t from = std::max(begin + block_bytes - 1, scanned);
+            size_t nl = pending.find('\n', from);
+            if (nl == std::string::npos) { scanned = pending.size(); break; }  // line spans the next read
+            emit(std::string_view(pending.data() + begin, nl + 1 - begin));
+            begin = nl + 1;
+            scanned = 0;
+        }
+        pending.erase(0, begin);
+        if (scanned) scanned -= begin;
+    }
+    // appended tail lines must start on a fresh line
+    if (!pending.empty() && pending.back() != '\n') pending += '\n';
+    if (!pending.empty()) emit(pending);
+    ASSERT_WITH_MESSAGE(!in.bad(), "Reading failed: " + csv_path);
+
+    h.blocks = static_cast<uint32_t>(index.size());
+    h.index_offset = offset;
+    h.tail_offset = offset + index.size() * sizeof(BlockIndexEntry);
+    out.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(BlockIndexEntry)));
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&h), sizeof h);
+    out.close();
+    ASSERT_WITH_MESSAGE(out.good(), "Writing block file failed: " + out_path);
+    return {h.raw_bytes, h.tail_offset, h.blocks};
+}
 
-                return true;
-            };
+/**
+ * @brief Read-only view of a block file: header, block index and per-block decompression.
+ * @thread_safety read_block()/read_tail() use pread and may run concurrently.
+ */
+class BlockFile {
+public:
+    explicit BlockFile(const std::string& path) : BlockFile(::open(path.c_str(), O_RDONLY | O_CLOEXEC), path) {}
+
+    // Takes ownership of an open `fd`; when !ok() the caller may take it back with release().
+    BlockFile(int fd, const std::string& path) : fd_(fd) {
+        if (fd_ < 0) return;
+        struct stat st{};
+        fstat(fd_, &st);
+        size_ = static_cast<uint64_t>(st.st_size);
+        if (size_ < sizeof h_ || pread(fd_, &h_, sizeof h_, 0) != ssize_t(sizeof h_) ||
+            memcmp(h_.magic, kBlockMagic, sizeof kBlockMagic) != 0) {
+            return;
+        }
+        ASSERT_WITH_MESSAGE(h_.version == 1 && h_.tail_offset == h_.index_offset + uint64_t(h_.blocks) * sizeof(BlockIndexEntry) &&
+                            h_.tail_offset <= size_, "Corrupt block file: " + path);
+        index_.resize(h_.blocks);
+        size_t bytes = index_.size() * sizeof(BlockIndexEntry);
+        ASSERT_WITH_MESSAGE(pread(fd_, index_.data(), bytes, static_cast<off_t>(h_.index_offset)) == ssize_t(bytes),
+                            "Corrupt block file: " + path);
+        path_ = path;
+        valid_ = true;
+    }
 
-            auto split_csv = [&](const string& line)->vector<string>{
-                vector<string> arr;
-                stringstream ss(line);
-                string str;
+    ~BlockFile() { if (fd_ >= 0) close(fd_); }
+    BlockFile(const BlockFile&) = delete;
+    BlockFile& operator=(const BlockFile&) = delete;
+
+    // True for a block file; false for a missing file or a plain CSV.
+    bool ok() const { return valid_; }
+    size_t blocks() const { return index_.size(); }
+    const BlockIndexEntry& entry(size_t i) const { return index_[i]; }
+    uint64_t raw_bytes() const { return h_.raw_bytes; }
+    uint64_t tail_bytes() const { return size_ - h_.tail_offset; }
+    uint64_t file_bytes() const { return size_; }
+
+    int release() { int fd = fd_; fd_ = -1; return fd; }
+
+    // Decompress block i into `out`; returns the bytes read from disk.
+    size_t read_block(size_t i, std::string& out) const {
+        const BlockIndexEntry& e = index_[i];
+        std::string stored(e.stored_len, '\0');
+        ASSERT_WITH_MESSAGE(pread_fully(stored.data(), e.stored_len, e.offset), "Short read in " + path_);
+        if (e.stored_len == e.raw_len) {
+            out.swap(stored);
+        } else {
+            out.resize(e.raw_len);
+            ASSERT_WITH_MESSAGE(lz_decompress(stored, out.data(), out.size()), "Corrupt block in " + path_);
+        }
+        ASSERT_WITH_MESSAGE(fnv1a32(out.data(), out.size()) == e.checksum, "Block checksum mismatch in " + path_);
+        return e.stored_len;
+    }
 
-                while (getline(ss, str, ',')) 
-                    arr.push_back(str);
+    // The raw CSV appended after the index; returns the bytes read.
+    size_t read_tail(std::string& out) const {
+        out.resize(static_cast<size_t>(tail_bytes()));
+        ASSERT_WITH_MESSAGE(pread_fully(out.data(), out.size(), h_.tail_offset), "Short read in " + path_);
+        return out.size();
+    }
 
-                return arr;
-            };
+private:
+    int fd_ = -1;
+    uint64_t size_ = 0;
+    bool valid_ = false;
+    std::string path_;
+    BlockFileHeader h_{};
+    std::vector<BlockIndexEntry> index_;
+
+    bool pread_fully(char* dst, size_t n, uint64_t off) const {
+        for (size_t got = 0; got < n;) {
+            ssize_t r = pread(fd_, dst + got, n - got, static_cast<off_t>(off + got));
+            if (r <= 0) return false;
+            got += static_cast<size_t>(r);
+        }
+        return true;
+    }
+};
 
-            // declare temp map, set id as key
-            map<int, unique_ptr<User>> tmp_users;
-            map<int, unique_ptr<Post>> tmp_posts;
-            map<int, unique_ptr<Engagement>> tmp_eng;
+// Sniffs the magic only; a corrupt index is reported when the file is opened for reading.
+static bool is_block_file(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    char magic[sizeof kBlockMagic];
+    bool ok = pread(fd, magic, sizeof magic, 0) == ssize_t(sizeof magic) && memcmp(magic, kBlockMagic, sizeof magic) == 0;
+    close(fd);
+    return ok;
+}
 
-            // map users.csv
-            {
-                ifstream f(users_path_);
-                ASSERT_WITH_MESSAGE(f.is_open(), "File failed: " + users_path_);
+/**
+ * @brief Lines of blocks [first, last) of a block file, plus the raw tail if `tail`.
+ * @details Blocks are decompressed one at a time as the lines are consumed.
+ */
+class BlockLineReader {
+public:
+    BlockLineReader(std::shared_ptr<const BlockFile> file, size_t first, size_t last, bool tail)
+        : file_(std::move(file)), next_(first), last_(last), tail_(tail) {}
+
+    bool is_open() const { return file_ && file_->ok(); }
+    uint64_t bytes_read() const { return bytes_read_; }
+
+    // Next line without its '\n'; the view is valid until the next call.
+    bool next(std::string_view& line) {
+        while (pos_ >= buf_.size()) {
+            if (next_ < last_) {
+                bytes_read_ += file_->read_block(next_++, buf_);
+            } else if (tail_) {
+                tail_ = false;
+                bytes_read_ += file_->read_tail(buf_);
+            } else {
+                return false;
+            }
+            pos_ = 0;
+        }
+        size_t nl = buf_.find('\n', pos_);
+        size_t end = nl == std::string::npos ? buf_.size() : nl;
+        line = std::string_view(buf_.data() + pos_, end - pos_);
+        pos_ = end + 1;
+        return true;
+    }
 
-                string line; 
-                bool header_if = true;
+    bool getline(std::string& line) {
+        std::string_view v;
+        if (!next(v)) return false;
+        line.assign(v.data(), v.size());
+        return true;
+    }
 
-                while (getline(f, line)) {
-                    if (header_if) { 
-                        header_if = false; 
-                        continue; 
-                    }
+private:
+    std::shared_ptr<const BlockFile> file_;
+    size_t next_, last_;
+    bool tail_;
+    std::string buf_;
+    size_t pos_ = 0;
+    uint64_t bytes_read_ = 0;
+};
 
-                    if (line.empty()) 
-                        continue;
-                        
-                    vector<string> arr = split_csv(line);
+// ----------------------------- File I/O -----------------------------
+// Loader reads and engagement log appends go through an IoBackend. The io_uring backend
+// keeps several requests in flight on one ring (raw syscalls, no liburing); the pread
+// backend runs each request synchronously. make_io_backend() picks io_uring when the
+// kernel allows it; BUZZDB_IO=pread forces the fallback.
 
-                    if (arr.size() != 3) 
-                        continue; 
+struct IoCompletion {
+    uint64_t tag;
+    ssize_t result;   // bytes transferred, or -errno
+};
 
-                    for (size_t i = 0; i < arr.size(); ++i) {
-                        trim(arr[i]);
-                    }
+class IoBackend {
+public:
+    virtual ~IoBackend() = default;
+    virtual const char* name() const = 0;
+    // Max requests in flight; callers wait_one() before submitting more.
+    virtual unsigned depth() const = 0;
+    // offset == kAppend writes at the end of an O_APPEND file.
+    virtual void submit_read(int fd, void* buf, size_t len, uint64_t offset, uint64_t tag) = 0;
+    virtual void submit_write(int fd, const void* buf, size_t len, uint64_t offset, uint64_t tag) = 0;
+    // Block until one submitted request completes.
+    virtual IoCompletion wait_one() = 0;
+
+    static constexpr uint64_t kAppend = ~uint64_t(0);
+};
 
-                    int id;
-                    if (!to_int(arr[0], id)) 
-                        continue;
+class PreadBackend : public IoBackend {
+public:
+    const char* name() const override { return "pread"; }
+    unsigned depth() const override { return 64; }
+    void submit_read(int fd, void* buf, size_t len, uint64_t offset, uint64_t tag) override {
+        ssize_t n = ::pread(fd, buf, len, static_cast<off_t>(offset));
+        done_.push_back({tag, n < 0 ? -errno : n});
+    }
+    void submit_write(int fd, const void* buf, size_t len, uint64_t offset, uint64_t tag) override {
+        ssize_t n = offset == kAppend ? ::write(fd, buf, len) : ::pwrite(fd, buf, len, static_cast<off_t>(offset));
+        done_.push_back({tag, n < 0 ? -errno : n});
+    }
+    IoCompletion wait_one() override {
+        IoCompletion c = done_.front();
+        done_.pop_front();
+        return c;
+    }
+private:
+    std::deque<IoCompletion> done_;
+};
 
-                    tmp_users[id] = make_unique<User>(id, arr[1], arr[2]);
-                }
-            }
+#if __has_include(<linux/io_uring.h>)
+class IoUringBackend : public IoBackend {
+public:
+    // nullptr if the kernel (or a seccomp filter) refuses io_uring.
+    static std::unique_ptr<IoUringBackend> create(unsigned entries) {
+        std::unique_ptr<IoUringBackend> b(new IoUringBackend());
+        return b->setup(entries) ? std::move(b) : nullptr;
+    }
 
-            // referential integrity on posts， engagements
-            unordered_set<string> usernames_set;
+    ~IoUringBackend() override {
+        if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_size_);
+        if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_size_);
+        if (sq_ptr_ != MAP_FAILED) munmap(sq_ptr_, sq_size_);
+        if (ring_fd_ >= 0) close(ring_fd_);
+    }
 
-            for (auto i = tmp_users.begin(); i != tmp_users.end(); ++i) {
-                User* user_ptr = i->second.get();
-                string username = user_ptr->username;
-                usernames_set.insert(username);
-            }
+    const char* name() const override { return "io_uring"; }
+    unsigned depth() const override { return entries_; }
 
-            // map posts.csv // id,content,username,views
-            {
-                ifstream f(posts_path_);
-                ASSERT_WITH_MESSAGE(f.is_open(), "File failed: " + posts_path_);
+    void submit_read(int fd, void* buf, size_t len, uint64_t offset, uint64_t tag) override {
+        push(IORING_OP_READ, fd, buf, len, offset, tag);
+    }
+    void submit_write(int fd, const void* buf, size_t len, uint64_t offset, uint64_t tag) override {
+        push(IORING_OP_WRITE, fd, const_cast<void*>(buf), len, offset, tag);
+    }
 
-                string line; 
-                bool header_if = true;
+    IoCompletion wait_one() override {
+        for (;;) {
+            unsigned head = *cq_head_;
+            if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+                const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+                IoCompletion c{cqe.user_data, cqe.res};
+                __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+                return c;
+            }
+            int rc = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+            ASSERT_WITH_MESSAGE(rc >= 0 || errno == EINTR, "io_uring_enter failed: " + std::string(strerror(errno)));
+        }
+    }
 
-                while (getline(f, line)) {
+private:
+    int ring_fd_ = -1;
+    unsigned entries_ = 0;
+    void* sq_ptr_ = MAP_FAILED;
+    void* cq_ptr_ = MAP_FAILED;
+    io_uring_sqe* sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sq_size_ = 0, cq_size_ = 0, sqes_size_ = 0;
+    unsigned *sq_tail_ = nullptr, *sq_mask_ = nullptr, *sq_array_ = nullptr;
+    unsigned *cq_head_ = nullptr, *cq_tail_ = nullptr, *cq_mask_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+
+    IoUringBackend() = default;
+
+    bool setup(unsigned entries) {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+        if (ring_fd_ < 0) return false;
+        entries_ = p.sq_entries;
+
+        sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+
+        sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+        if (sq_ptr_ == MAP_FAILED) return false;
+        cq_ptr_ = single ? sq_ptr_
+                         : mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) return false;
+        sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+        if (sqes_ == MAP_FAILED) return false;
+
+        char* sq = static_cast<char*>(sq_ptr_);
+        char* cq = static_cast<char*>(cq_ptr_);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        return true;
+    }
 
+    void push(uint8_t op, int fd, void* buf, size_t len, uint64_t offset, uint64_t tag) {
+        unsigned tail = *sq_tail_;
+        unsigned idx = tail & *sq_mask_;
+        io_uring_sqe& sqe = sqes_[idx];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = op;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(buf);
+        sqe.len = static_cast<uint32_t>(len);
+        sqe.off = offset;   // ~0 = current file position
+        sqe.user_data = tag;
+        sq_array_[idx] = idx;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        int rc;
+        do {
+            rc = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd_, 1, 0, 0, nullptr, 0));
+        } while (rc < 0 && errno == EINTR);
+        ASSERT_WITH_MESSAGE(rc >= 0, "io_uring_enter failed: " + std::string(strerror(errno)));
+    }
+};
+#endif
 
-                    if (header_if) { 
-                        header_if = false; 
-                        continue; 
-                    }
+static std::unique_ptr<IoBackend> make_io_backend(unsigned depth = 8) {
+    const char* forced = std::getenv("BUZZDB_IO");
+#if __has_include(<linux/io_uring.h>)
+    if (!forced || std::string(forced) != "pread") {
+        if (auto uring = IoUringBackend::create(depth)) return uring;
+    }
+#else
+    UNUSED(depth);
+#endif
+    UNUSED(forced);
+    return std::make_unique<PreadBackend>();
+}
 
-                    if (line.empty()) 
-                        continue;
-                        
-                    vector<string> arr = split_csv(line);
+/**
+ * @brief Buffered line reader over an IoBackend, with the same contract as std::getline.
+ * @details The file is read in `chunk`-byte pieces into page-aligned buffers with up to
+ *          `depth` reads in flight, so the next chunks load while the caller parses the
+ *          current one. Lines are split on '\n'; a line that spans two chunks is stitched
+ *          together in a carry buffer.
+ */
+class LineReader {
+public:
+    explicit LineReader(const std::string& path, size_t chunk = 1 << 20, unsigned depth = 4) : chunk_(chunk) {
+        // block files decompress block by block instead; a plain CSV keeps the same fd
+        auto block_file = std::make_shared<BlockFile>(::open(path.c_str(), O_RDONLY | O_CLOEXEC), path);
+        if (block_file->ok()) {
+            size_t n = block_file->blocks();
+            blocks_ = std::make_unique<BlockLineReader>(std::move(block_file), 0, n, true);
+            return;
+        }
+        io_ = make_io_backend(depth);
+        fd_ = block_file->release();
+        if (fd_ < 0) return;
+        size_ = block_file->file_bytes();
+        nchunks_ = (size_ + chunk_ - 1) / chunk_;
+        depth_ = static_cast<unsigned>(std::min<uint64_t>({depth, io_->depth(), std::max<uint64_t>(nchunks_, 1)}));
+        for (unsigned i = 0; i < depth_; ++i) {
+            void* p = nullptr;
+            ASSERT_WITH_MESSAGE(posix_memalign(&p, 4096, chunk_) == 0, "aligned buffer allocation failed");
+            bufs_.emplace_back(static_cast<char*>(p));
+            got_.push_back(-1);
+        }
+        for (uint64_t c = 0; c < std::min<uint64_t>(depth_, nchunks_); ++c) submit(c);
+    }
 
-                    if (arr.size() != 4) 
-                        continue; 
+    ~LineReader() {
+        // every submitted read must land before its buffer is freed
+        while (inflight_ > 0) { io_->wait_one(); --inflight_; }
+        if (fd_ >= 0) close(fd_);
+    }
 
-                    for (size_t i = 0; i < arr.size(); ++i) {
-                        trim(arr[i]);
+    LineReader(const LineReader&) = delete;
+    LineReader& operator=(const LineReader&) = delete;
+
+    bool is_open() const { return blocks_ || fd_ >= 0; }
+    const char* backend() const { return blocks_ ? "blocks" : io_->name(); }
+    uint64_t bytes_read() const { return blocks_ ? blocks_->bytes_read() : bytes_read_; }
+
+    // Next line without its '\n'; the view is valid until the next call.
+    bool next(std::string_view& line) {
+        if (blocks_) return blocks_->next(line);
+        if (carry_done_) { carry_.clear(); carry_done_ = false; }
+        for (;;) {
+            if (pos_ < len_) {
+                const char* base = bufs_[cur_ % depth_].get();
+                const char* nl = static_cast<const char*>(memchr(base + pos_, '\n', len_ - pos_));
+                if (nl) {
+                    size_t end = static_cast<size_t>(nl - base);
+                    if (carry_.empty()) {
+                        line = std::string_view(base + pos_, end - pos_);
+                    } else {
+                        carry_.append(base + pos_, end - pos_);
+                        line = carry_;
+                        carry_done_ = true;
                     }
+                    pos_ = end + 1;
+                    return true;
+                }
+                carry_.append(base + pos_, len_ - pos_);
+                pos_ = len_;
+            }
+            if (!advance()) {
+                if (carry_.empty()) return false;
+                line = carry_;
+                carry_done_ = true;
+                return true;
+            }
+        }
+    }
 
-                    int id;
-                    if (!to_int(arr[0], id)) 
-                        continue;
+    bool getline(std::string& line) {
+        std::string_view v;
+        if (!next(v)) return false;
+        line.assign(v.data(), v.size());
+        return true;
+    }
 
-                    int views;
-                    if (!to_int(arr[3], views)) 
-                        continue;
-                    
-                    if (usernames_set.find(arr[2]) == usernames_set.end()) 
-                        continue;
+private:
+    struct FreeDeleter { void operator()(char* p) const { free(p); } };
+
+    int fd_ = -1;
+    size_t chunk_;
+    std::unique_ptr<BlockLineReader> blocks_;
+    std::unique_ptr<IoBackend> io_;
+    uint64_t size_ = 0, nchunks_ = 0, bytes_read_ = 0;
+    unsigned depth_ = 0, inflight_ = 0;
+    std::vector<std::unique_ptr<char, FreeDeleter>> bufs_;
+    std::vector<ssize_t> got_;            // per buffer: bytes landed, -1 while pending
+    uint64_t cur_ = 0;                    // chunk being parsed
+    bool started_ = false;
+    size_t pos_ = 0, len_ = 0;
+    std::string carry_;
+    bool carry_done_ = false;
+
+    size_t chunk_len(uint64_t c) const { return static_cast<size_t>(std::min<uint64_t>(chunk_, size_ - c * chunk_)); }
+
+    void submit(uint64_t c) {
+        got_[c % depth_] = -1;
+        io_->submit_read(fd_, bufs_[c % depth_].get(), chunk_len(c), c * chunk_, c);
+        ++inflight_;
+    }
 
-                    tmp_posts[id] = make_unique<Post>(id, arr[1], arr[2], views);
-                }
+    // Recycle the parsed buffer for a later chunk and wait for the next chunk to land.
+    bool advance() {
+        if (started_) {
+            if (cur_ + depth_ < nchunks_) submit(cur_ + depth_);
+            ++cur_;
+        }
+        started_ = true;
+        if (cur_ >= nchunks_) return false;
+
+        while (got_[cur_ % depth_] < 0) {
+            IoCompletion c = io_->wait_one();
+            --inflight_;
+            ASSERT_WITH_MESSAGE(c.result >= 0, "read failed: " + std::string(strerror(static_cast<int>(-c.result))));
+            got_[c.tag % depth_] = c.result;
+        }
+        len_ = static_cast<size_t>(got_[cur_ % depth_]);
+        // a short read is not EOF here (the size came from fstat): finish it synchronously
+        size_t want = chunk_len(cur_);
+        while (len_ < want) {
+            ssize_t n = ::pread(fd_, bufs_[cur_ % depth_].get() + len_, want - len_, static_cast<off_t>(cur_ * chunk_ + len_));
+            if (n <= 0) break;
+            len_ += static_cast<size_t>(n);
+        }
+        bytes_read_ += len_;
+        pos_ = 0;
+        return true;
+    }
+};
+
+/**
+ * @brief Batched appender for a log file.
+ * @details Concurrent append() calls are combined: the first caller to find no write in
+ *          progress becomes the leader and writes every queued byte with one request, then
+ *          wakes the callers it covered. append() returns once the caller's bytes are written.
+ */
+class GroupAppender {
+public:
+    explicit GroupAppender(std::string path) : path_(std::move(path)) {}
+
+    void append(const std::string& bytes) {
+        std::unique_lock<std::mutex> lk(mtx_);
+        pending_ += bytes;
+        uint64_t ticket = ++enqueued_;
+        while (written_ < ticket) {
+            if (leader_) {
+                cv_.wait(lk);
+                continue;
             }
+            leader_ = true;
+            std::string batch;
+            batch.swap(pending_);
+            uint64_t upto = enqueued_;
+            lk.unlock();
+
+            write_all(batch);
+
+            lk.lock();
+            written_ = upto;
+            leader_ = false;
+            cv_.notify_all();
+        }
+    }
 
-            // post id set for engagements RI
-            unordered_set<int> post_ids;
+    uint64_t batches() const { return batches_.load(); }
+
+private:
+    std::string path_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::string pending_;
+    uint64_t enqueued_ = 0, written_ = 0;
+    bool leader_ = false;
+    std::unique_ptr<IoBackend> io_;       // used by the leader only
+    std::atomic<uint64_t> batches_{0};
+
+    void write_all(const std::string& data) {
+        if (!io_) io_ = make_io_backend(2);
+        // reopened each batch: renames (updateUserName) replace the file underneath us
+        int fd = ::open(path_.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        ASSERT_WITH_MESSAGE(fd >= 0, "File failed: " + path_);
+        size_t off = 0;
+        while (off < data.size()) {
+            io_->submit_write(fd, data.data() + off, data.size() - off, IoBackend::kAppend, 0);
+            IoCompletion c = io_->wait_one();
+            ASSERT_WITH_MESSAGE(c.result > 0, "append failed: " + path_);
+            off += static_cast<size_t>(c.result);
+        }
+        close(fd);
+        batches_.fetch_add(1);
+    }
+};
 
-            for (auto i = tmp_posts.begin(); i != tmp_posts.end(); ++i) {
-                int id = i->first;
-                post_ids.insert(id);
-            }
+// ----------------------------- Thread pool -----------------------------
+// Work-stealing pool owned by a FlatFile. Every worker has its own deque: it pushes and
+// pops its own tasks at the back and, when empty, steals from the front of the others.
+// Threads outside the pool submit round-robin. A thread that blocks on a pool result
+// should use wait()/parallel_for(), which run queued tasks instead of sleeping, so
+// nested submissions cannot deadlock the pool.
 
-            // map engagements.csv // id,postId,username,type,comment,timestamp
-            {
-                ifstream f(engagements_path_);
-                ASSERT_WITH_MESSAGE(f.is_open(), "File failed: " + engagements_path_);
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned threads) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i < threads; ++i) workers_.push_back(std::make_unique<Worker>());
+        for (unsigned i = 0; i < threads; ++i) threads_.emplace_back([this, i] { worker_loop(i); });
+    }
 
-                string line; 
-                bool header_if = true;
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lk(sleep_mtx_);
+            stop_ = true;
+        }
+        sleep_cv_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
 
-                while (getline(f, line)) {
-                    if (header_if) { 
-                        header_if = false; 
-                        continue; 
-                    }
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    unsigned size() const { return static_cast<unsigned>(threads_.size()); }
+
+    /**
+     * @brief Queue fn on the pool.
+     * @return Future for fn's result; exceptions propagate through it.
+     */
+    template <typename Fn>
+    auto submit(Fn&& fn) -> std::future<std::invoke_result_t<Fn>> {
+        using R = std::invoke_result_t<Fn>;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<Fn>(fn));
+        std::future<R> fut = task->get_future();
+        push([task] { (*task)(); });
+        return fut;
+    }
 
-                    if (line.empty()) 
-                        continue;
-                        
-                    vector<string> arr = split_csv(line);
+    // Run one queued task on the calling thread; false if there was none.
+    bool run_one() {
+        std::function<void()> task;
+        if (!take(home_index(), task)) return false;
+        task();
+        return true;
+    }
 
-                    if (arr.size() != 6) 
-                        continue; 
+    // Block on fut, running queued tasks while it is not ready.
+    template <typename T>
+    T wait(std::future<T>& fut) {
+        while (fut.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            if (!run_one()) fut.wait_for(std::chrono::microseconds(100));
+        }
+        return fut.get();
+    }
 
-                    for (size_t i = 0; i < arr.size(); ++i) {
-                        trim(arr[i]);
-                    }
+    /**
+     * @brief Run fn(i) for i in [0, n) across the pool and the calling thread.
+     * @details Indices are claimed from a shared counter, so uneven ranges balance themselves.
+     */
+    template <typename Fn>
+    void parallel_for(size_t n, Fn&& fn) {
+        if (n == 0) return;
+        if (n == 1) { fn(size_t{0}); return; }
+        auto next = std::make_shared<std::atomic<size_t>>(0);
+        auto body = [next, n, &fn] {
+            for (size_t i; (i = next->fetch_add(1)) < n; ) fn(i);
+        };
+        std::vector<std::future<void>> helpers;
+        size_t extra = std::min<size_t>(size(), n - 1);
+        for (size_t k = 0; k < extra; ++k) helpers.push_back(submit(body));
+        body();
+        for (auto& h : helpers) wait(h);
+    }
 
-                    int id, post_id, timestamp;
-                    if (!to_int(arr[0], id)) 
-                        continue;
-                    if (!to_int(arr[1], post_id)) 
-                        continue;
-                    if (!to_int(arr[5], timestamp)) 
-                        continue;
-                    if (post_ids.find(post_id) == post_ids.end())
-                        continue;           // post must exist
-                    if (usernames_set.find(arr[2]) == usernames_set.end())
-                        continue;  // user must exist
+private:
+    struct Worker {
+        std::mutex mtx;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::mutex sleep_mtx_;
+    std::condition_variable sleep_cv_;
+    std::atomic<size_t> queued_{0};
+    std::atomic<size_t> next_victim_{0};
+    bool stop_ = false;
+
+    static thread_local WorkStealingPool* tl_pool_;
+    static thread_local size_t tl_index_;
+
+    size_t home_index() const {
+        return tl_pool_ == this ? tl_index_ : next_victim_.load(std::memory_order_relaxed) % workers_.size();
+    }
 
-                    tmp_eng[id] = make_unique<Engagement>(id, post_id, arr[2], arr[3], arr[4], timestamp);
-                }
-            }
+    void push(std::function<void()> task) {
+        size_t i = tl_pool_ == this ? tl_index_ : next_victim_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+        {
+            // counted under the deque lock, so a take() can never decrement it first
+            std::lock_guard<std::mutex> lk(workers_[i]->mtx);
+            workers_[i]->tasks.push_back(std::move(task));
+            queued_.fetch_add(1);
+        }
+        // an empty critical section orders the count against a worker's predicate check
+        { std::lock_guard<std::mutex> lk(sleep_mtx_); }
+        sleep_cv_.notify_one();
+    }
 
-            // - Parse into temporary maps, then swap into shared maps under mutexes.
-            {
-                scoped_lock lk(users_mtx_, posts_mtx_, eng_mtx_);
-                
-                users.swap(tmp_users);
-                posts.swap(tmp_posts);
-                engagements.swap(tmp_eng);
+    // Own queue from the back (LIFO, cache-warm), everyone else's from the front.
+    bool take(size_t home, std::function<void()>& out) {
+        if (queued_.load() == 0) return false;
+        for (size_t k = 0; k < workers_.size(); ++k) {
+            Worker& w = *workers_[(home + k) % workers_.size()];
+            std::lock_guard<std::mutex> lk(w.mtx);
+            if (w.tasks.empty()) continue;
+            if (k == 0) { out = std::move(w.tasks.back()); w.tasks.pop_back(); }
+            else        { out = std::move(w.tasks.front()); w.tasks.pop_front(); }
+            queued_.fetch_sub(1);
+            return true;
+        }
+        return false;
+    }
+
+    void worker_loop(size_t i) {
+        tl_pool_ = this;
+        tl_index_ = i;
+        std::function<void()> task;
+        for (;;) {
+            if (take(i, task)) {
+                task();
+                task = nullptr;
+                continue;
             }
+            std::unique_lock<std::mutex> lk(sleep_mtx_);
+            sleep_cv_.wait(lk, [this] { return stop_ || queued_.load() > 0; });
+            if (stop_ && queued_.load() == 0) return;
         }
+    }
+};
 
-        /**
-         * @brief Parallel loader for users, posts, and engagements from CSVs.
-         *
-         * @details
-         *  - Spawn one short-lived thread per CSV file; each thread parses its CSV file into local containers.
-         *  - Parse into temporary maps, then swap into shared maps under mutexes.
-         *
-         * @thread_safety Safe to call concurrently; the final commit is serialized by internal mutexes.
-         * @throws Aborts via ASSERT_WITH_MESSAGE if any CSV cannot be opened.
-         * @complexity  O(U + P + E) total work; wall time reduced by parallel I/O/parse.
-         */
-        void loadMultipleFlatFilesInParallel() {
-            //helpers from serial
-            
-            auto trim = [](string &s) {
-                // get pure lines
-                size_t start = s.find_first_not_of(" \t\n\r\f\v");
-                size_t end = s.find_last_not_of(" \t\n\r\f\v");
-                //clear blank lines
-                if (start == string::npos) {
-                    s.clear();
-                } else {
-                    s = s.substr(start, end - start + 1);
-                }
-            };
+thread_local WorkStealingPool* WorkStealingPool::tl_pool_ = nullptr;
+thread_local size_t WorkStealingPool::tl_index_ = 0;
+
+// ----------------------------- MVCC snapshots -----------------------------
+// Readers never touch the writer-side maps. They pin an immutable DbSnapshot that
+// writers publish with std::atomic_store; an old version is freed when its last
+// reader drops the shared_ptr.
+//
+// Tables are stored as segments of kSegmentRows rows, one ColumnBlock per column.
+// A new version shares every block it does not change:
+//  - appends write the next free slot of the tail block (no reader can see that slot yet)
+//  - updates copy only the block of the column/segment they touch (copy-on-write)
+
+static constexpr size_t kSegmentRows = 4096;
+
+template <typename T>
+struct ColumnBlock {
+    std::vector<T> v;
+    ColumnBlock() : v(kSegmentRows) {}
+};
 
-            auto split_csv = [&](const string& line)->vector<string>{
-                vector<string> arr;
-                stringstream ss(line);
-                string str;
+template <typename T>
+using BlockPtr = std::shared_ptr<ColumnBlock<T>>;
 
-                while (getline(ss, str, ',')) 
-                    arr.push_back(str);
+struct UserSegment {
+    BlockPtr<int> id;
+    BlockPtr<std::string> username;
+    BlockPtr<std::string> location;
+};
 
-                return arr;
-            };
+struct PostSegment {
+    BlockPtr<int> id;
+    BlockPtr<std::string> content;
+    BlockPtr<std::string> username;
+    BlockPtr<int> views;
+};
 
-            auto to_int_fc = [](const string &str, int &value) -> bool {
-                if (str.empty()) return false;
-                
-                stringstream ss(str);
-                ss >> value;
+struct EngagementSegment {
+    BlockPtr<int> id;
+    BlockPtr<int> postId;
+    BlockPtr<std::string> username;
+    BlockPtr<std::string> type;
+    BlockPtr<std::string> comment;
+    BlockPtr<int> timestamp;
+};
 
-                // check the format
-                if (ss.fail() || !ss.eof()) return false;
+template <typename Seg>
+struct TableVersion {
+    std::shared_ptr<const std::vector<std::shared_ptr<const Seg>>> segs;
+    size_t rows = 0;
+
+    const Seg& segment(size_t row) const { return *(*segs)[row / kSegmentRows]; }
+    static size_t slot(size_t row) { return row % kSegmentRows; }
+
+    // Visit every visible row as (segment, slot).
+    template <typename Fn>
+    void scan(Fn&& fn) const {
+        for (size_t base = 0; base < rows; base += kSegmentRows) {
+            const Seg& seg = *(*segs)[base / kSegmentRows];
+            size_t n = std::min(kSegmentRows, rows - base);
+            for (size_t i = 0; i < n; ++i) fn(seg, i);
+        }
+    }
+};
 
-                return true;
-            };
+class DbSnapshot {
+public:
+    uint64_t version = 0;
+    TableVersion<UserSegment> users;
+    TableVersion<PostSegment> posts;
+    TableVersion<EngagementSegment> engagements;
+    // id -> row; users and posts are only inserted by a load, so these are shared until the next one
+    std::shared_ptr<const std::unordered_map<int, uint32_t>> user_row;
+    std::shared_ptr<const std::unordered_map<int, uint32_t>> post_row;
+    // username -> number of users holding it; used for lock-free foreign-key checks
+    std::shared_ptr<const std::unordered_map<std::string, uint32_t>> username_count;
+};
 
-            // set a struct for each csv file
-            struct URow { 
-                int id; 
-                string username, 
-                location; 
-            };
+template <typename T>
+static BlockPtr<T> new_block() { return std::make_shared<ColumnBlock<T>>(); }
 
-            struct PRow { 
-                int id; 
-                string content;
-                string username; 
-                int views; 
-            };
+template <typename T>
+static BlockPtr<T> cow_block(const BlockPtr<T>& b) { return std::make_shared<ColumnBlock<T>>(*b); }
 
-            struct ERow { 
-                int id;
-                int postId; 
-                string username;
-                string type; 
-                string comment; 
-                int ts; 
-            };
+static UserSegment new_segment(const UserSegment*) {
+    return {new_block<int>(), new_block<std::string>(), new_block<std::string>()};
+}
+static PostSegment new_segment(const PostSegment*) {
+    return {new_block<int>(), new_block<std::string>(), new_block<std::string>(), new_block<int>()};
+}
+static EngagementSegment new_segment(const EngagementSegment*) {
+    return {new_block<int>(), new_block<int>(), new_block<std::string>(),
+            new_block<std::string>(), new_block<std::string>(), new_block<int>()};
+}
 
-            // prase 3 files once
-            auto parse_users = [&, path = users_path_]() -> vector<URow> {
-                ifstream f(path);
-                ASSERT_WITH_MESSAGE(f.is_open(), "File failed: " + path);
-                vector<URow> r; 
-                r.reserve(12000);
-                string line; 
-                bool header_if = true;
+static void fill_slot(const UserSegment& s, size_t i, const User& u) {
+    s.id->v[i] = u.id; s.username->v[i] = u.username; s.location->v[i] = u.location;
+}
+static void fill_slot(const PostSegment& s, size_t i, const Post& p) {
+    s.id->v[i] = p.id; s.content->v[i] = p.content; s.username->v[i] = p.username; s.views->v[i] = p.views;
+}
+static void fill_slot(const EngagementSegment& s, size_t i, const Engagement& e) {
+    s.id->v[i] = e.id; s.postId->v[i] = e.postId; s.username->v[i] = e.username;
+    s.type->v[i] = e.type; s.comment->v[i] = e.comment; s.timestamp->v[i] = e.timestamp;
+}
 
-                while (getline(f, line)) {
-                    if (header_if) { 
-                        header_if = false; 
-                        continue; 
-                    }
+/**
+ * @brief Append one row to the head version of a table.
+ * @details Writes into the tail block when it has room; only a new segment copies the segment list.
+ * @thread_safety Caller must be the single publisher (holds the version mutex).
+ */
+template <typename Seg, typename Row>
+static void append_row(TableVersion<Seg>& t, const Row& row) {
+    size_t slot = t.rows % kSegmentRows;
+    if (slot == 0) {
+        auto segs = t.segs ? std::make_shared<std::vector<std::shared_ptr<const Seg>>>(*t.segs)
+                           : std::make_shared<std::vector<std::shared_ptr<const Seg>>>();
+        segs->push_back(std::make_shared<const Seg>(new_segment(static_cast<const Seg*>(nullptr))));
+        t.segs = segs;
+    }
+    fill_slot(*t.segs->back(), slot, row);
+    ++t.rows;
+}
 
-                    if (line.empty()) 
-                        continue;
-                        
-                    vector<string> arr = split_csv(line);
+/**
+ * @brief Copy-on-write edit of selected segments.
+ * @param edit Called as edit(Seg& copy, segment_index) on a shallow copy of each segment in seg_ids;
+ *        it must cow_block() every column it modifies before writing.
+ */
+template <typename Seg, typename Edit>
+static void cow_segments(TableVersion<Seg>& t, const std::vector<size_t>& seg_ids, Edit&& edit) {
+    if (seg_ids.empty()) return;
+    auto segs = std::make_shared<std::vector<std::shared_ptr<const Seg>>>(*t.segs);
+    for (size_t s : seg_ids) {
+        Seg copy = *(*segs)[s];
+        edit(copy, s);
+        (*segs)[s] = std::make_shared<const Seg>(std::move(copy));
+    }
+    t.segs = segs;
+}
 
-                    if (arr.size() != 3) 
-                        continue; 
+/**
+ * @brief Copy-on-write rename of every `username == from` cell in a posts/engagements table.
+ * @details Only segments that contain a match get a new username block.
+ */
+template <typename Seg>
+static void rename_in_table(TableVersion<Seg>& t, const std::string& from, const std::string& to) {
+    std::vector<size_t> hit;
+    for (size_t base = 0; base < t.rows; base += kSegmentRows) {
+        const Seg& seg = t.segment(base);
+        size_t n = std::min(kSegmentRows, t.rows - base);
+        for (size_t i = 0; i < n; ++i) {
+            if (seg.username->v[i] == from) { hit.push_back(base / kSegmentRows); break; }
+        }
+    }
+    cow_segments(t, hit, [&](Seg& seg, size_t s) {
+        seg.username = cow_block(seg.username);
+        size_t n = std::min(kSegmentRows, t.rows - s * kSegmentRows);
+        for (size_t i = 0; i < n; ++i) {
+            if (seg.username->v[i] == from) seg.username->v[i] = to;
+        }
+    });
+}
 
-                    for (size_t i = 0; i < arr.size(); ++i) {
-                        trim(arr[i]);
-                    }
+/**
+ * @brief Build a fresh snapshot from fully-parsed tables.
+ * @param eng_row If set, receives engagement id -> row for later in-place writes.
+ * @param pool If set, the three tables are built concurrently on it.
+ * @complexity O(U + P + E); runs outside every lock.
+ */
+static std::shared_ptr<DbSnapshot> build_snapshot(const std::map<int, std::unique_ptr<User>>& users,
+                                                  const std::map<int, std::unique_ptr<Post>>& posts,
+                                                  const std::map<int, std::unique_ptr<Engagement>>& engagements,
+                                                  std::unordered_map<int, uint32_t>* eng_row = nullptr,
+                                                  WorkStealingPool* pool = nullptr) {
+    auto snap = std::make_shared<DbSnapshot>();
+
+    auto build_users = [&] {
+        auto user_row = std::make_shared<std::unordered_map<int, uint32_t>>();
+        auto username_count = std::make_shared<std::unordered_map<std::string, uint32_t>>();
+        user_row->reserve(users.size());
+        for (const auto& kv : users) {
+            ++(*username_count)[kv.second->username];
+            (*user_row)[kv.first] = static_cast<uint32_t>(snap->users.rows);
+            append_row(snap->users, *kv.second);
+        }
+        snap->user_row = user_row;
+        snap->username_count = username_count;
+    };
+    auto build_posts = [&] {
+        auto post_row = std::make_shared<std::unordered_map<int, uint32_t>>();
+        post_row->reserve(posts.size());
+        for (const auto& kv : posts) {
+            (*post_row)[kv.first] = static_cast<uint32_t>(snap->posts.rows);
+            append_row(snap->posts, *kv.second);
+        }
+        snap->post_row = post_row;
+    };
+    auto build_engagements = [&] {
+        if (eng_row) eng_row->reserve(engagements.size());
+        for (const auto& kv : engagements) {
+            if (eng_row) (*eng_row)[kv.first] = static_cast<uint32_t>(snap->engagements.rows);
+            append_row(snap->engagements, *kv.second);
+        }
+    };
+
+    if (pool) {
+        // each builder writes disjoint members of snap
+        auto fu_users = pool->submit(build_users);
+        auto fu_posts = pool->submit(build_posts);
+        build_engagements();
+        pool->wait(fu_users);
+        pool->wait(fu_posts);
+    } else {
+        build_users();
+        build_posts();
+        build_engagements();
+    }
+    return snap;
+}
 
-                    int id;
-                    if (!to_int_fc(arr[0], id)) 
-                        continue;
-                    
-                    r.push_back({id, std::move(arr[1]), std::move(arr[2])});
+// ----------------------------- Parallel scan -----------------------------
+
+/**
+ * @brief Partitioned scan of a snapshot table with per-range partial results.
+ * @details The table is split into segment-aligned ranges. scan(seg, n, partial) evaluates
+ *          the predicate/aggregate over the first n rows of one segment into that range's
+ *          own Partial; merge(into, from) then folds the partials in range order, so the
+ *          result does not depend on scheduling.
+ * @param pool Runs the ranges concurrently when set; the calling thread takes ranges too.
+ */
+template <typename Partial, typename Seg, typename ScanFn, typename MergeFn>
+static Partial parallel_scan(const TableVersion<Seg>& t, WorkStealingPool* pool, ScanFn&& scan, MergeFn&& merge) {
+    size_t nseg = (t.rows + kSegmentRows - 1) / kSegmentRows;
+    std::vector<Partial> parts(nseg);
+    auto run = [&](size_t s) {
+        scan(*(*t.segs)[s], std::min(kSegmentRows, t.rows - s * kSegmentRows), parts[s]);
+    };
+    if (pool && nseg > 1) {
+        pool->parallel_for(nseg, run);
+    } else {
+        for (size_t s = 0; s < nseg; ++s) run(s);
+    }
+    Partial out{};
+    for (auto& p : parts) merge(out, p);
+    return out;
+}
 
-                    //tmp_users[id] = make_unique<User>(id, arr[1], arr[2]);
-                }
-                return r;
-            };
-            auto parse_posts = [&, path = posts_path_]() -> std::vector<PRow> {
-                ifstream f(path);
-                ASSERT_WITH_MESSAGE(f.is_open(), "File failed: " + path);
-                vector<PRow> r; 
-                r.reserve(5000);
-                string line; 
-                bool header_if = true;
+// ----------------------------- Query API -----------------------------
+// Single-table filter / group-by / aggregate queries over a snapshot. Each segment is
+// processed kQueryBatch rows at a time: predicates narrow a selection vector one column
+// at a time, group keys are resolved for the survivors, then each aggregate folds its
+// column over the selection. Segments run in parallel through parallel_scan.
 
-                while (getline(f, line)) {
+enum class QueryTable { Users, Posts, Engagements };
+enum class CmpOp { Eq, Ne, Lt, Le, Gt, Ge };
+enum class AggOp { Count, Sum, Min, Max };
 
-                    if (header_if) { 
-                        header_if = false; 
-                        continue; 
-                    }
+// Group key / literal: int columns widen to long long; monostate = "no group-by".
+using QueryValue = std::variant<std::monostate, long long, std::string>;
 
-                    if (line.empty()) 
-                        continue;
-                        
-                    vector<string> arr = split_csv(line);
+struct QueryRow {
+    QueryValue key;
+    std::vector<long long> values;   // one per aggregate, in the order they were added
+};
 
-                    if (arr.size() != 4) 
-                        continue; 
+struct QueryResult {
+    std::vector<std::string> columns;   // group column (if any) followed by aggregate labels
+    std::vector<QueryRow> rows;         // sorted by key; empty when nothing matched
+};
 
-                    for (size_t i = 0; i < arr.size(); ++i) {
-                        trim(arr[i]);
-                    }
+static constexpr size_t kQueryBatch = 1024;
 
-                    int id;
-                    if (!to_int_fc(arr[0], id)) 
-                        continue;
+struct ColumnDesc {
+    int index;
+    bool is_int;
+};
 
-                    int views;
-                    if (!to_int_fc(arr[3], views)) 
-                        continue;
-                    
-                    // if (usernames_set.find(arr[2]) == usernames_set.end()) 
-                    //     continue;
+static ColumnDesc resolve_column(QueryTable t, const std::string& name) {
+    static const std::vector<std::pair<std::string, bool>> users = {
+        {"id", true}, {"username", false}, {"location", false}};
+    static const std::vector<std::pair<std::string, bool>> posts = {
+        {"id", true}, {"content", false}, {"username", false}, {"views", true}};
+    static const std::vector<std::pair<std::string, bool>> engagements = {
+        {"id", true}, {"postId", true}, {"username", false}, {"type", false}, {"comment", false}, {"timestamp", true}};
+    const auto& cols = t == QueryTable::Users ? users : t == QueryTable::Posts ? posts : engagements;
+    for (size_t i = 0; i < cols.size(); ++i) {
+        if (cols[i].first == name) return {static_cast<int>(i), cols[i].second};
+    }
+    ASSERT_WITH_MESSAGE(false, "Unknown column: " + name);
+    return {-1, false};
+}
 
-                    r.push_back({id, move(arr[1]), move(arr[2]), views});
-                    //tmp_posts[id] = make_unique<Post>(id, arr[1], arr[2], views);
-                }
-                return r;
-            };
-            auto parse_engs = [&, path = engagements_path_]() -> std::vector<ERow> {
-                ifstream f(path);
-                ASSERT_WITH_MESSAGE(f.is_open(), "File failed: " + path);
-                vector<ERow> r; 
-                r.reserve(12000);
-                string line; 
-                bool header_if = true;
+// Column storage of one segment by resolve_column() index; ints -> const int*, strings -> const std::string*.
+static const void* column_data(const UserSegment& s, int c) {
+    switch (c) {
+        case 0: return s.id->v.data();
+        case 1: return s.username->v.data();
+        default: return s.location->v.data();
+    }
+}
+static const void* column_data(const PostSegment& s, int c) {
+    switch (c) {
+        case 0: return s.id->v.data();
+        case 1: return s.content->v.data();
+        case 2: return s.username->v.data();
+        default: return s.views->v.data();
+    }
+}
+static const void* column_data(const EngagementSegment& s, int c) {
+    switch (c) {
+        case 0: return s.id->v.data();
+        case 1: return s.postId->v.data();
+        case 2: return s.username->v.data();
+        case 3: return s.type->v.data();
+        case 4: return s.comment->v.data();
+        default: return s.timestamp->v.data();
+    }
+}
 
-                while (getline(f, line)) {
-                    if (header_if) { 
-                        header_if = false; 
-                        continue; 
-                    }
+/**
+ * @brief Declarative single-table query: predicates (ANDed), optional group-by, aggregates.
+ * @details Built fluently and executed with FlatFile::runQuery(), e.g.
+ *          Query(QueryTable::Engagements).where("type", CmpOp::Eq, "like")
+ *              .where("timestamp", CmpOp::Gt, t0).groupBy("postId").count();
+ *          Unknown columns and sum/min/max over string columns abort via ASSERT_WITH_MESSAGE.
+ */
+class Query {
+public:
+    struct Predicate {
+        ColumnDesc col;
+        CmpOp op;
+        long long int_value = 0;
+        std::string str_value;
+    };
+    struct Aggregate {
+        AggOp op;
+        ColumnDesc col;
+        std::string label;
+    };
+
+    explicit Query(QueryTable table) : table_(table) {}
+
+    // Any integer type, so a plain 0 does not also match the const char* overload.
+    template <typename T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, int> = 0>
+    Query& where(const std::string& column, CmpOp op, T value) {
+        ColumnDesc c = resolve_column(table_, column);
+        ASSERT_WITH_MESSAGE(c.is_int, "Integer literal compared with string column: " + column);
+        preds_.push_back({c, op, static_cast<long long>(value), {}});
+        return *this;
+    }
+    Query& where(const std::string& column, CmpOp op, std::string value) {
+        ColumnDesc c = resolve_column(table_, column);
+        ASSERT_WITH_MESSAGE(!c.is_int, "String literal compared with integer column: " + column);
+        preds_.push_back({c, op, 0, std::move(value)});
+        return *this;
+    }
+    Query& where(const std::string& column, CmpOp op, const char* value) {
+        return where(column, op, std::string(value));
+    }
+    Query& groupBy(const std::string& column) {
+        group_ = resolve_column(table_, column);
+        group_name_ = column;
+        return *this;
+    }
+    Query& count() { aggs_.push_back({AggOp::Count, {-1, true}, "count"}); return *this; }
+    Query& sum(const std::string& column) { return numeric(AggOp::Sum, column, "sum"); }
+    Query& min(const std::string& column) { return numeric(AggOp::Min, column, "min"); }
+    Query& max(const std::string& column) { return numeric(AggOp::Max, column, "max"); }
+
+    QueryTable table() const { return table_; }
+    const std::vector<Predicate>& predicates() const { return preds_; }
+    const std::optional<ColumnDesc>& group() const { return group_; }
+    const std::string& groupName() const { return group_name_; }
+    const std::vector<Aggregate>& aggregates() const { return aggs_; }
+
+private:
+    QueryTable table_;
+    std::vector<Predicate> preds_;
+    std::optional<ColumnDesc> group_;
+    std::string group_name_;
+    std::vector<Aggregate> aggs_;
+
+    Query& numeric(AggOp op, const std::string& column, const char* fn) {
+        ColumnDesc c = resolve_column(table_, column);
+        ASSERT_WITH_MESSAGE(c.is_int, std::string(fn) + " needs an integer column: " + column);
+        aggs_.push_back({op, c, std::string(fn) + "(" + column + ")"});
+        return *this;
+    }
+};
 
-                    if (line.empty()) 
-                        continue;
-                        
-                    vector<string> arr = split_csv(line);
+// Keep the selected positions whose value satisfies `cmp(value, literal)`; returns the new count.
+template <typename T, typename Lit, typename Cmp>
+static size_t filter_batch(const T* col, uint32_t* sel, size_t m, const Lit& lit, Cmp cmp) {
+    size_t out = 0;
+    for (size_t k = 0; k < m; ++k) {
+        uint32_t i = sel[k];
+        sel[out] = i;
+        out += cmp(col[i], lit) ? 1 : 0;   // branch-free keep
+    }
+    return out;
+}
 
-                    if (arr.size() != 6) 
-                        continue; 
+template <typename T, typename Lit>
+static size_t filter_batch(const T* col, uint32_t* sel, size_t m, const Lit& lit, CmpOp op) {
+    switch (op) {
+        case CmpOp::Eq: return filter_batch(col, sel, m, lit, std::equal_to<>());
+        case CmpOp::Ne: return filter_batch(col, sel, m, lit, std::not_equal_to<>());
+        case CmpOp::Lt: return filter_batch(col, sel, m, lit, std::less<>());
+        case CmpOp::Le: return filter_batch(col, sel, m, lit, std::less_equal<>());
+        case CmpOp::Gt: return filter_batch(col, sel, m, lit, std::greater<>());
+        default:        return filter_batch(col, sel, m, lit, std::greater_equal<>());
+    }
+}
 
-                    for (size_t i = 0; i < arr.size(); ++i) {
-                        trim(arr[i]);
-                    }
+// Per-range partial result: group key -> dense group id -> one accumulator per aggregate.
+struct QueryPartial {
+    std::unordered_map<QueryValue, uint32_t> index;
+    std::vector<QueryValue> keys;
+    std::vector<long long> acc;   // keys.size() * aggregate count
+
+    uint32_t group_of(QueryValue&& key, const std::vector<Query::Aggregate>& aggs) {
+        auto it = index.find(key);
+        if (it != index.end()) return it->second;
+        uint32_t g = static_cast<uint32_t>(keys.size());
+        index.emplace(key, g);
+        keys.push_back(std::move(key));
+        for (const auto& a : aggs) {
+            acc.push_back(a.op == AggOp::Min ? std::numeric_limits<long long>::max()
+                        : a.op == AggOp::Max ? std::numeric_limits<long long>::min() : 0);
+        }
+        return g;
+    }
+};
 
-                    int id, post_id, timestamp;
-                    if (!to_int_fc(arr[0], id)) 
-                        continue;
-                    if (!to_int_fc(arr[1], post_id)) 
-                        continue;
-                    if (!to_int_fc(arr[5], timestamp)) 
-                        continue;
-                    // if (post_ids.find(post_id) == post_ids.end())
-                    //     continue;           // post must exist
-                    // if (usernames_set.find(arr[2]) == usernames_set.end())
-                    //     continue;  // user must exist
-                    r.push_back({id, post_id, move(arr[2]), move(arr[3]), move(arr[4]), timestamp});
-                    //tmp_eng[id] = make_unique<Engagement>(id, post_id, arr[2], arr[3], arr[4], timestamp);
-                }
-                return r;
-            };
+static void fold(AggOp op, long long& into, long long v) {
+    switch (op) {
+        case AggOp::Count:
+        case AggOp::Sum: into += v; break;
+        case AggOp::Min: into = std::min(into, v); break;
+        case AggOp::Max: into = std::max(into, v); break;
+    }
+}
 
-            // 真正并行：各自只读一次文件
-            auto fu_users = async(launch::async, parse_users);
-            auto fu_posts = async(launch::async, parse_posts);
-            auto fu_engs  = async(launch::async, parse_engs);
+// Narrow sel[0..m) to the rows of `seg` that satisfy every predicate; returns the new count.
+template <typename Seg>
+static size_t apply_predicates(const Seg& seg, const std::vector<Query::Predicate>& preds, uint32_t* sel, size_t m) {
+    for (const auto& p : preds) {
+        if (m == 0) break;
+        const void* col = column_data(seg, p.col.index);
+        m = p.col.is_int ? filter_batch(static_cast<const int*>(col), sel, m, p.int_value, p.op)
+                         : filter_batch(static_cast<const std::string*>(col), sel, m, p.str_value, p.op);
+    }
+    return m;
+}
 
-            // get result after parsing
-            vector<URow> urows = fu_users.get();
-            vector<PRow> prows = fu_posts.get();
-            vector<ERow> erows = fu_engs.get();
+// Fold row pairs (sel[k], gid[k]) of `seg` into the per-group accumulators.
+template <typename Seg>
+static void accumulate(const Seg& seg, const std::vector<Query::Aggregate>& aggs, QueryPartial& part,
+                       const uint32_t* sel, const uint32_t* gid, size_t m) {
+    const size_t na = aggs.size();
+    for (size_t a = 0; a < na; ++a) {
+        long long* acc = part.acc.data() + a;
+        if (aggs[a].op == AggOp::Count) {
+            for (size_t k = 0; k < m; ++k) acc[gid[k] * na] += 1;
+            continue;
+        }
+        const int* col = static_cast<const int*>(column_data(seg, aggs[a].col.index));
+        for (size_t k = 0; k < m; ++k) fold(aggs[a].op, acc[gid[k] * na], col[sel[k]]);
+    }
+}
 
-            // build username set
-            unordered_set<string> usernames_set;
-            usernames_set.reserve(urows.size() * 2 + 1);
-            for (auto& u : urows) usernames_set.insert(u.username);
+static void merge_partial(QueryPartial& into, QueryPartial& from, const std::vector<Query::Aggregate>& aggs) {
+    const size_t na = aggs.size();
+    for (size_t g = 0; g < from.keys.size(); ++g) {
+        uint32_t dst = into.group_of(std::move(from.keys[g]), aggs);
+        for (size_t a = 0; a < na; ++a) {
+            fold(aggs[a].op == AggOp::Count ? AggOp::Sum : aggs[a].op, into.acc[dst * na + a], from.acc[g * na + a]);
+        }
+    }
+}
 
-            // check user exists
-            {
-                size_t count = 0;
-                for (size_t i = 0; i < prows.size(); ++i) {
-                    if (usernames_set.count(prows[i].username)) {
-                        if (count != i) 
-                            prows[count] = move(prows[i]);
-                        ++count;
-                    }
-                }
-                prows.resize(count);
-            }
+static QueryResult to_result(QueryPartial& total, const std::string* group_name, const std::vector<Query::Aggregate>& aggs) {
+    const size_t na = aggs.size();
+    QueryResult out;
+    if (group_name) out.columns.push_back(*group_name);
+    for (const auto& a : aggs) out.columns.push_back(a.label);
+    out.rows.reserve(total.keys.size());
+    for (size_t g = 0; g < total.keys.size(); ++g) {
+        out.rows.push_back({std::move(total.keys[g]),
+                            std::vector<long long>(total.acc.begin() + g * na, total.acc.begin() + (g + 1) * na)});
+    }
+    std::sort(out.rows.begin(), out.rows.end(), [](const QueryRow& a, const QueryRow& b) { return a.key < b.key; });
+    return out;
+}
 
-            // filter engagements
-            unordered_set<int> post_ids;
-            post_ids.reserve(prows.size() * 2 + 1);
-            // for (auto& p : prows) post_ids.insert(p.id);
-            for (size_t i = 0; i < prows.size(); i++) {
-                post_ids.insert(prows[i].id);
-            }
+static QueryValue value_at(const void* col, bool is_int, uint32_t i) {
+    if (is_int) return QueryValue(static_cast<long long>(static_cast<const int*>(col)[i]));
+    return QueryValue(static_cast<const std::string*>(col)[i]);
+}
 
-            // filter engagements guarentee postId, username 
-            {
-                size_t w = 0;
-                for (size_t i = 0; i < erows.size(); ++i) {
-                    if (post_ids.count(erows[i].postId) && usernames_set.count(erows[i].username)) {
-                        if (w != i) erows[w] = move(erows[i]);
-                        ++w;
-                    }
-                }
-                erows.resize(w);
+/**
+ * @brief Execute a Query against one table of a snapshot.
+ * @param pool Runs segments concurrently when set (see parallel_scan).
+ * @complexity O(rows * (predicates + aggregates)) with tight per-column loops.
+ */
+template <typename Seg>
+static QueryResult run_query(const TableVersion<Seg>& t, const Query& q, WorkStealingPool* pool) {
+    const auto& aggs = q.aggregates();
+
+    auto scan = [&](const Seg& seg, size_t n, QueryPartial& part) {
+        uint32_t sel[kQueryBatch];
+        uint32_t gid[kQueryBatch];
+        for (size_t base = 0; base < n; base += kQueryBatch) {
+            size_t m = std::min(kQueryBatch, n - base);
+            for (size_t k = 0; k < m; ++k) sel[k] = static_cast<uint32_t>(base + k);
+            m = apply_predicates(seg, q.predicates(), sel, m);
+            if (m == 0) continue;
+
+            if (!q.group()) {
+                std::fill(gid, gid + m, part.group_of(QueryValue(), aggs));
+            } else {
+                const void* col = column_data(seg, q.group()->index);
+                for (size_t k = 0; k < m; ++k) gid[k] = part.group_of(value_at(col, q.group()->is_int, sel[k]), aggs);
             }
+            accumulate(seg, aggs, part, sel, gid, m);
+        }
+    };
+    auto merge = [&](QueryPartial& into, QueryPartial& from) { merge_partial(into, from, aggs); };
 
-            // built temp arr
-            map<int, unique_ptr<User>> tmp_users;
-            map<int, unique_ptr<Post>> tmp_posts;
-            map<int, unique_ptr<Engagement>> tmp_eng;
+    QueryPartial total = parallel_scan<QueryPartial>(t, pool, scan, merge);
+    return to_result(total, q.group() ? &q.groupName() : nullptr, aggs);
+}
 
-            for (size_t i = 0; i < urows.size(); ++i) {
-                User* userPtr = new User(urows[i].id, urows[i].username, urows[i].location);
-                tmp_users.insert(make_pair(urows[i].id, unique_ptr<User>(userPtr)));
-            }
+/**
+ * @brief Equi-join of a probe table against a build table, with grouped aggregates.
+ * @details probe() and build() are ordinary Query objects over each side: predicates on either
+ *          side filter rows before the join, the group-by may come from either side (not both),
+ *          and aggregates must be on the probe side. Every (probe row, matching build
+ *          row) pair counts once, so duplicate build keys multiply. Example, total views of posts
+ *          by users in location L:
+ *            JoinQuery j(QueryTable::Posts, "username", QueryTable::Users, "username");
+ *            j.build().where("location", CmpOp::Eq, L);
+ *            j.probe().sum("views");
+ *          Build side must be Users or Posts, probe side Posts or Engagements.
+ */
+class JoinQuery {
+public:
+    JoinQuery(QueryTable probe_table, const std::string& probe_key, QueryTable build_table, const std::string& build_key)
+        : probe_(probe_table), build_(build_table),
+          probe_key_(resolve_column(probe_table, probe_key)), build_key_(resolve_column(build_table, build_key)) {
+        ASSERT_WITH_MESSAGE(probe_key_.is_int == build_key_.is_int, "Join keys must have the same type");
+        ASSERT_WITH_MESSAGE(build_table != QueryTable::Engagements && probe_table != QueryTable::Users,
+            "Unsupported join: build side must be users/posts, probe side posts/engagements");
+    }
 
-            // posts
-            for (size_t i = 0; i < prows.size(); ++i) {
-                Post* postPtr = new Post(prows[i].id, prows[i].content, prows[i].username, prows[i].views);
-                tmp_posts.insert(make_pair(prows[i].id, unique_ptr<Post>(postPtr)));
-            }
+    Query& probe() { return probe_; }
+    Query& build() { return build_; }
+    const Query& probe() const { return probe_; }
+    const Query& build() const { return build_; }
+    ColumnDesc probeKey() const { return probe_key_; }
+    ColumnDesc buildKey() const { return build_key_; }
 
-            // engagements
-            for (size_t i = 0; i < erows.size(); ++i) {
-                Engagement* engPtr = new Engagement(erows[i].id, erows[i].postId,
-                                                    erows[i].username, erows[i].type,
-                                                    erows[i].comment, erows[i].ts);
-                tmp_eng.insert(make_pair(erows[i].id, unique_ptr<Engagement>(engPtr)));
-            }
+private:
+    Query probe_, build_;
+    ColumnDesc probe_key_, build_key_;
+};
 
-            // Atomic Commit
-            {
-                scoped_lock lk(users_mtx_, posts_mtx_, eng_mtx_);
-                users.swap(tmp_users);
-                posts.swap(tmp_posts);
-                engagements.swap(tmp_eng);
-            }
+static constexpr unsigned kJoinPartitionBits = 4;
+static constexpr size_t kJoinPartitions = size_t(1) << kJoinPartitionBits;
 
-        }
+// Join keys view the pinned snapshot's storage: no string copies on either side.
+template <typename K>
+static K join_key(const void* col, uint32_t i);
+template <>
+long long join_key<long long>(const void* col, uint32_t i) { return static_cast<const int*>(col)[i]; }
+template <>
+std::string_view join_key<std::string_view>(const void* col, uint32_t i) { return static_cast<const std::string*>(col)[i]; }
 
-        /**
-         * @brief Atomically increment a post’s view count and persist to CSV.
-         * @param post_id Target post id.
-         * @param views_count Amount to add (may be >1).
-         * @return true on success; false if post_id not found.
-         * @thread_safety Writers are serialized via internal mutex.
-         * @side_effects Rewrites posts CSV with the updated row.
-         */
-        bool updatePostViews(int post_id, int views_count) {
-            // TODO: add your implementation here.     
-            //UNUSED(post_id);
-            //UNUSED(views_count);
-            //return false;
-            // Lock posts table for the whole update (read+modify+persist)
-            scoped_lock lock(posts_mtx_);
+template <typename K>
+static size_t join_partition(const K& k) {
+    return (static_cast<uint64_t>(std::hash<K>()(k)) * 0x9E3779B97F4A7C15ull) >> (64 - kJoinPartitionBits);
+}
 
+// Run fn(segment_index, seg, n) for every segment, concurrently when a pool is given.
+template <typename Seg, typename Fn>
+static void for_each_segment(const TableVersion<Seg>& t, WorkStealingPool* pool, Fn&& fn) {
+    size_t nseg = (t.rows + kSegmentRows - 1) / kSegmentRows;
+    auto run = [&](size_t s) { fn(s, *(*t.segs)[s], std::min(kSegmentRows, t.rows - s * kSegmentRows)); };
+    if (pool && nseg > 1) {
+        pool->parallel_for(nseg, run);
+    } else {
+        for (size_t s = 0; s < nseg; ++s) run(s);
+    }
+}
 
-             if (posts.find(post_id) == posts.end()) 
-                return false; 
-    
+/**
+ * @brief Partitioned hash join + hash aggregate.
+ * @details Build: each build segment filters its rows and scatters (key, group value) pairs
+ *          into kJoinPartitions buckets; the partitions' hash tables are then built
+ *          concurrently, one per task. Probe: each probe segment is filtered batch-at-a-time,
+ *          probes the partition of each surviving key and folds matches into per-range
+ *          groups, merged as in run_query.
+ * @complexity O(build rows + probe rows + matches).
+ */
+template <typename K, typename ProbeSeg, typename BuildSeg>
+static QueryResult run_join(const TableVersion<ProbeSeg>& probe, const TableVersion<BuildSeg>& build,
+                            const JoinQuery& j, WorkStealingPool* pool) {
+    using Bucket = std::vector<std::pair<K, QueryValue>>;
+    using HashTable = std::unordered_map<K, std::vector<QueryValue>>;
+    const Query& bq = j.build();
+    const Query& pq = j.probe();
+    ASSERT_WITH_MESSAGE(!(bq.group() && pq.group()), "Join can group by one side only");
+    ASSERT_WITH_MESSAGE(bq.aggregates().empty(), "Join aggregates must be on the probe side");
+    const auto& aggs = pq.aggregates();
+
+    // Build, phase 1: filter and scatter by partition.
+    size_t nseg = (build.rows + kSegmentRows - 1) / kSegmentRows;
+    std::vector<std::array<Bucket, kJoinPartitions>> scattered(nseg);
+    for_each_segment(build, pool, [&](size_t s, const BuildSeg& seg, size_t n) {
+        uint32_t sel[kQueryBatch];
+        const void* key_col = column_data(seg, j.buildKey().index);
+        const void* group_col = bq.group() ? column_data(seg, bq.group()->index) : nullptr;
+        for (size_t base = 0; base < n; base += kQueryBatch) {
+            size_t m = std::min(kQueryBatch, n - base);
+            for (size_t k = 0; k < m; ++k) sel[k] = static_cast<uint32_t>(base + k);
+            m = apply_predicates(seg, bq.predicates(), sel, m);
+            for (size_t k = 0; k < m; ++k) {
+                K key = join_key<K>(key_col, sel[k]);
+                QueryValue g = group_col ? value_at(group_col, bq.group()->is_int, sel[k]) : QueryValue();
+                scattered[s][join_partition(key)].emplace_back(key, std::move(g));
+            }
+        }
+    });
 
-            // Update in-memory
-            Post* p = posts[post_id].get();
+    // Build, phase 2: one hash table per partition.
+    std::vector<HashTable> tables(kJoinPartitions);
+    auto build_partition = [&](size_t p) {
+        for (auto& seg_buckets : scattered) {
+            for (auto& kv : seg_buckets[p]) tables[p][kv.first].push_back(std::move(kv.second));
+        }
+    };
+    if (pool) {
+        pool->parallel_for(kJoinPartitions, build_partition);
+    } else {
+        for (size_t p = 0; p < kJoinPartitions; ++p) build_partition(p);
+    }
 
-            int new_views = p->views + views_count;
-            if (new_views < 0) {
-                new_views = 0; 
+    // Probe.
+    auto scan = [&](const ProbeSeg& seg, size_t n, QueryPartial& part) {
+        uint32_t sel[kQueryBatch];
+        std::vector<uint32_t> match_sel, match_gid;
+        const void* key_col = column_data(seg, j.probeKey().index);
+        const void* group_col = pq.group() ? column_data(seg, pq.group()->index) : nullptr;
+        for (size_t base = 0; base < n; base += kQueryBatch) {
+            size_t m = std::min(kQueryBatch, n - base);
+            for (size_t k = 0; k < m; ++k) sel[k] = static_cast<uint32_t>(base + k);
+            m = apply_predicates(seg, pq.predicates(), sel, m);
+            match_sel.clear();
+            match_gid.clear();
+            for (size_t k = 0; k < m; ++k) {
+                K key = join_key<K>(key_col, sel[k]);
+                const HashTable& ht = tables[join_partition(key)];
+                auto hit = ht.find(key);
+                if (hit == ht.end()) continue;
+                for (const QueryValue& bg : hit->second) {
+                    QueryValue g = group_col ? value_at(group_col, pq.group()->is_int, sel[k]) : bg;
+                    match_sel.push_back(sel[k]);
+                    match_gid.push_back(part.group_of(std::move(g), aggs));
+                }
             }
-                
+            accumulate(seg, aggs, part, match_sel.data(), match_gid.data(), match_sel.size());
+        }
+    };
+    auto merge = [&](QueryPartial& into, QueryPartial& from) { merge_partial(into, from, aggs); };
 
-            // write tmp then atomic rename
-            rewrite_post_views_file(posts_path_, post_id, new_views);
+    QueryPartial total = parallel_scan<QueryPartial>(probe, pool, scan, merge);
+    const std::string* group_name = bq.group() ? &bq.groupName() : pq.group() ? &pq.groupName() : nullptr;
+    return to_result(total, group_name, aggs);
+}
 
-            // Commit in-memory after successful rewrite
-            p->views = new_views;
-            return true;
-        }
+// ----------------------------- Cursors -----------------------------
+
+/**
+ * @brief Incremental, ordered iteration over one user's comments.
+ * @details Yields (postId, comment) in the order of getAllUserComments, with ties broken by
+ *          engagement id. Only row numbers are collected and sorted; comments are returned as
+ *          string_views into the pinned snapshot, valid for the cursor's lifetime. token()
+ *          names the position after the last yielded item: passing it to
+ *          FlatFile::openUserComments() resumes there, on whatever version is current then;
+ *          a malformed token yields an empty cursor whose ok() is false.
+ * @thread_safety One cursor per thread; any number of cursors can be open concurrently.
+ */
+class CommentCursor {
+public:
+    using Item = std::pair<int, std::string_view>;
 
-        /**
-         * @brief Append a new engagement and persist to CSV.
-         * @param record Engagement to add.
-         * @thread_safety Serialized by internal mutexes.
-         * @side_effects Appends to engagements CSV; ignores rows failing foreign-key checks.
-         */
-        void addEngagementRecord(Engagement& record) {
-            // TODO: add your implementation here.
-            //UNUSED(record);
-            // Validate username postId 
-            bool user_if = false;
-            bool post_if = false;
-            {
-                scoped_lock lock(users_mtx_, posts_mtx_);
-                // check postId
+    CommentCursor(std::shared_ptr<const DbSnapshot> snap, std::vector<uint32_t> rows, bool ok = true)
+        : snap_(std::move(snap)), rows_(std::move(rows)), ok_(ok) {}
 
-                if (posts.find(record.postId) != posts.end()) {
-                    post_if = true;
-                }
-                // check username
-                for (auto i = users.begin(); i != users.end(); ++i) {
-                    if (i->second->username == record.username) {
-                        user_if = true;
-                        break;
-                    }
-                }
-            }
-            if (!user_if || !post_if) 
-                return; 
+    bool next(Item& out) {
+        if (pos_ >= rows_.size()) return false;
+        last_ = rows_[pos_++];
+        out = item(last_);
+        return true;
+    }
 
-            // update memory under engagements lock
-            {
-                scoped_lock lock(eng_mtx_);
-                ofstream outFile(engagements_path_, ios::app);
-                ASSERT_WITH_MESSAGE(outFile.good(), "File failed: " + engagements_path_);
-                outFile << record.toCSV();
-                outFile.close();
+    // Up to `limit` further items.
+    std::vector<Item> page(size_t limit) {
+        std::vector<Item> out;
+        out.reserve(std::min(limit, rows_.size() - pos_));
+        Item it;
+        while (out.size() < limit && next(it)) out.push_back(it);
+        return out;
+    }
 
-                engagements[record.id] = make_unique<Engagement>(record.id, record.postId, record.username,record.type, record.comment, record.timestamp);
-            }
-        }
-    
+    bool done() const { return pos_ >= rows_.size(); }
 
-        /**
-         * @brief All comments by a user, ordered by (post_id, comment).
-         * @param user_id User id.
-         * @return Vector of <post_id, comment>.
-         * @thread_safety Reads are synchronized.
-         */
-        vector<pair<int, string> > getAllUserComments(int user_id) {
-            // TODO: add your implementation here.
-            vector<pair<int, string>> arr;
+    // False if the cursor was opened with a malformed resume token (it yields nothing).
+    bool ok() const { return ok_; }
 
-            // Find username based on id
-            string user_name = "";
-            {
-                scoped_lock lock(users_mtx_);
+    // Resume token for the position after the last yielded item ("" before the first).
+    std::string token() const {
+        if (pos_ == 0) return {};
+        const auto& seg = snap_->engagements.segment(last_);
+        size_t i = TableVersion<EngagementSegment>::slot(last_);
+        return std::to_string(seg.postId->v[i]) + ":" + std::to_string(seg.id->v[i]) + ":" + seg.comment->v[i];
+    }
 
-                auto id_temp = users.find(user_id);
-                if (id_temp == users.end()) 
-                    return arr; 
+    // Sort key of a row: (postId, comment, engagement id).
+    static std::tuple<int, std::string_view, int> key(const DbSnapshot& snap, uint32_t row) {
+        const auto& seg = snap.engagements.segment(row);
+        size_t i = TableVersion<EngagementSegment>::slot(row);
+        return {seg.postId->v[i], seg.comment->v[i], seg.id->v[i]};
+    }
 
-                user_name = id_temp->second->username;
-            }
+    // Parse a token() string; std::nullopt if malformed (tokens come from clients).
+    static std::optional<std::tuple<int, std::string, int>> parse_token(const std::string& token) {
+        size_t a = token.find(':');
+        size_t b = a == std::string::npos ? a : token.find(':', a + 1);
+        int post_id = 0, id = 0;
+        bool ok = b != std::string::npos &&
+                  std::from_chars(token.data(), token.data() + a, post_id).ec == std::errc() &&
+                  std::from_chars(token.data() + a + 1, token.data() + b, id).ec == std::errc();
+        if (!ok) return std::nullopt;
+        return std::make_tuple(post_id, token.substr(b + 1), id);
+    }
 
-            // Collect all comments
-            {
-                scoped_lock lock(eng_mtx_);
+private:
+    std::shared_ptr<const DbSnapshot> snap_;   // keeps every viewed string alive
+    std::vector<uint32_t> rows_;
+    size_t pos_ = 0;
+    uint32_t last_ = 0;
+    bool ok_;
+
+    Item item(uint32_t row) const {
+        const auto& seg = snap_->engagements.segment(row);
+        size_t i = TableVersion<EngagementSegment>::slot(row);
+        return {seg.postId->v[i], seg.comment->v[i]};
+    }
+};
 
-                for (auto i = engagements.begin(); i != engagements.end(); ++i) {
+// ----------------------------- Ingest queue -----------------------------
+// Bounded lock-free multi-producer queue (Vyukov's sequence-numbered ring) drained by a
+// single consumer. A producer claims a position with one CAS and publishes its cell by
+// bumping the cell's sequence; the consumer pops strictly in position order, so
+// "position + 1" doubles as a durability ticket.
 
-                    const Engagement* engage_temp = i->second.get();
+template <typename T>
+class MpscRing {
+public:
+    explicit MpscRing(size_t capacity) {
+        size_t cap = 1;
+        while (cap < std::max<size_t>(capacity, 2)) cap <<= 1;
+        mask_ = cap - 1;
+        cells_.reset(new Cell[cap]);
+        for (size_t i = 0; i < cap; ++i) cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
 
-                    if (engage_temp->username == user_name && engage_temp->type == "comment") {
-                        arr.push_back(make_pair(engage_temp->postId, engage_temp->comment));
-                    }
+    size_t capacity() const { return mask_ + 1; }
+
+    // Returns the item's ticket (position + 1), or 0 when the ring is full.
+    uint64_t try_push(T&& v) {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& c = cells_[pos & mask_];
+            size_t seq = c.seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.value = std::move(v);
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return pos + 1;
                 }
+            } else if (diff < 0) {
+                return 0;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
             }
-
-            sort(arr.begin(), arr.end());
-            return arr;
-            //UNUSED(user_id);
-            //return {};
         }
-        
+    }
 
-        /**
-         * @brief Count likes/comments for users in a location.
-         * @param location Exact location string.
-         * @return <likes_count, comments_count>.
-         * @thread_safety Reads are synchronized.
-         */
-        pair<int,int> getAllEngagementsByLocation(string location) {
-            // TODO: add your implementation here.
-            //UNUSED(location);
-            //return {};
-            unordered_set<string> users_all;
-            {
-                scoped_lock lock(users_mtx_);
+    // Consumer only.
+    bool try_pop(T& out) {
+        Cell& c = cells_[tail_ & mask_];
+        if (c.seq.load(std::memory_order_acquire) != tail_ + 1) return false;
+        out = std::move(*c.value);
+        c.value.reset();
+        c.seq.store(tail_ + mask_ + 1, std::memory_order_release);
+        ++tail_;
+        return true;
+    }
 
-                for (auto i = users.begin(); i != users.end(); ++i) {
+    // Tickets handed out so far.
+    uint64_t issued() const { return head_.load(std::memory_order_acquire); }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        std::optional<T> value;
+    };
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) size_t tail_ = 0;
+};
 
-                    User* user = i->second.get();
-                    if (user->location == location) {
-                        users_all.insert(user->username);
-                    }
-                }
-            }
-            if (users_all.empty()) 
-                return make_pair(0, 0);
+enum class IngestBackpressure {
+    Block,   // producers wait for free space
+    Reject   // producers get ticket 0 and the record is dropped
+};
 
-            // Scan engagements and count (engagements lock)
-            int likes_count  = 0, comments_count  = 0;
-            {
-                scoped_lock lock(eng_mtx_);
+struct IngestOptions {
+    size_t capacity = 1 << 16;       // rounded up to a power of two
+    IngestBackpressure backpressure = IngestBackpressure::Block;
+    size_t max_batch = 4096;         // records per append/publish
+};
 
-                for (auto i = engagements.begin(); i != engagements.end(); ++i) {
+// ----------------------------- Memory accounting -----------------------------
+// Footprints are computed from container sizes and capacities with libstdc++ node layouts:
+// they count what is asked of malloc, not what malloc rounds it up to, so treat them as
+// estimates that are comparable across tables, indexes and loads.
+
+static constexpr size_t kSmallStringCapacity = 15;   // libstdc++ SSO buffer
+static constexpr size_t kTreeNodeHeader = 32;        // color + parent/left/right
+static constexpr size_t kSharedControlBlock = 16;    // make_shared use/weak counts
+
+static size_t heap_bytes(const std::string& s) { return s.capacity() > kSmallStringCapacity ? s.capacity() + 1 : 0; }
+static size_t heap_bytes(int) { return 0; }
+static size_t heap_bytes(uint32_t) { return 0; }
+static size_t heap_bytes(uint64_t) { return 0; }
+static size_t heap_bytes(const User& u) { return heap_bytes(u.username) + heap_bytes(u.location); }
+static size_t heap_bytes(const Post& p) { return heap_bytes(p.content) + heap_bytes(p.username); }
+static size_t heap_bytes(const Engagement& e) { return heap_bytes(e.username) + heap_bytes(e.type) + heap_bytes(e.comment); }
+
+template <typename T> static size_t heap_bytes(const std::unique_ptr<T>& p);
+template <typename T> static size_t heap_bytes(const std::vector<T>& v);
+template <typename K, typename V> static size_t heap_bytes(const std::map<K, V>& m);
+template <typename K, typename V> static size_t heap_bytes(const std::unordered_map<K, V>& m);
+template <typename K> static size_t heap_bytes(const std::unordered_set<K>& s);
+
+template <typename T>
+static size_t heap_bytes(const std::unique_ptr<T>& p) { return p ? sizeof(T) + heap_bytes(*p) : 0; }
+
+template <typename T>
+static size_t heap_bytes(const std::vector<T>& v) {
+    size_t b = v.capacity() * sizeof(T);
+    if constexpr (!std::is_arithmetic<T>::value) {
+        for (const T& x : v) b += heap_bytes(x);
+    }
+    return b;
+}
 
-                    Engagement* temp_engage = i->second.get();
+template <typename K, typename V>
+static size_t heap_bytes(const std::map<K, V>& m) {
+    size_t b = m.size() * (kTreeNodeHeader + sizeof(std::pair<const K, V>));
+    for (const auto& kv : m) b += heap_bytes(kv.first) + heap_bytes(kv.second);
+    return b;
+}
 
-                    if (users_all.find(temp_engage->username) == users_all.end()) {
-                        continue;
-                    }
+// Bucket array plus one node per element: next pointer, value and (for non-integral keys) the cached hash.
+template <typename K>
+static constexpr size_t hash_node_bytes(size_t value_size) {
+    return sizeof(void*) + value_size + (std::is_integral<K>::value ? 0 : sizeof(size_t));
+}
 
-                    if (temp_engage->type == "like") {
-                        likes_count++;
-                    } else if (temp_engage->type == "comment") {
-                        comments_count++;
-                    }
-                }
-            }
-             return make_pair(likes_count, comments_count);
-        }
+template <typename K, typename V>
+static size_t heap_bytes(const std::unordered_map<K, V>& m) {
+    size_t b = m.bucket_count() * sizeof(void*) + m.size() * hash_node_bytes<K>(sizeof(std::pair<const K, V>));
+    for (const auto& kv : m) b += heap_bytes(kv.first) + heap_bytes(kv.second);
+    return b;
+}
 
-        /**
-         * @brief Rename a user everywhere and persist to all CSVs.
-         * @param user_id Target user id.
-         * @param new_username New username.
-         * @return true if user exists and all rewrites succeed; otherwise false.
-         * @thread_safety Serialized updates; readers see a consistent state after commit.
-         * @side_effects Rewrites users, posts, and engagements CSVs.
-         */
-        bool updateUserName(int user_id, std::string new_username){    
-            // TODO: add your implementation here.
-            //UNUSED(user_id);
-            //UNUSED(new_username);
-            //return false;
-            // take 3 locks
-            scoped_lock lock(users_mtx_, posts_mtx_, eng_mtx_);
+template <typename K>
+static size_t heap_bytes(const std::unordered_set<K>& s) {
+    size_t b = s.bucket_count() * sizeof(void*) + s.size() * hash_node_bytes<K>(sizeof(K));
+    for (const K& k : s) b += heap_bytes(k);
+    return b;
+}
 
-            auto uit = users.find(user_id);
-            if (uit == users.end()) 
-                return false; 
-            const string old_username = uit->second->username;
-            if (old_username == new_username) 
-                return true; 
+template <typename T>
+static size_t heap_bytes(const BlockPtr<T>& b) {
+    return b ? kSharedControlBlock + sizeof(ColumnBlock<T>) + heap_bytes(b->v) : 0;
+}
 
-            // Rewrite users.csv id,username,location
-            {
-                ifstream in(users_path_);
-                ASSERT_WITH_MESSAGE(in.good(), "File failed： " + users_path_);
-                string tmp_users = users_path_ + ".tmp";
-                ofstream out(tmp_users);
-                ASSERT_WITH_MESSAGE(out.good(), "File failed " + tmp_users);
+static size_t heap_bytes(const UserSegment& s) { return heap_bytes(s.id) + heap_bytes(s.username) + heap_bytes(s.location); }
+static size_t heap_bytes(const PostSegment& s) {
+    return heap_bytes(s.id) + heap_bytes(s.content) + heap_bytes(s.username) + heap_bytes(s.views);
+}
+static size_t heap_bytes(const EngagementSegment& s) {
+    return heap_bytes(s.id) + heap_bytes(s.postId) + heap_bytes(s.username) + heap_bytes(s.type) +
+           heap_bytes(s.comment) + heap_bytes(s.timestamp);
+}
 
-                string line; 
-                bool header_if = true;
+// Column blocks of one table version; blocks still shared with older versions are counted here too.
+template <typename Seg>
+static size_t heap_bytes(const TableVersion<Seg>& t) {
+    if (!t.segs) return 0;
+    size_t b = kSharedControlBlock + t.segs->capacity() * sizeof(std::shared_ptr<const Seg>);
+    for (const auto& seg : *t.segs) b += kSharedControlBlock + sizeof(Seg) + heap_bytes(*seg);
+    return b;
+}
 
-                while (getline(in, line)) {
-                    if (header_if) { 
-                        out << line << "\n"; 
-                        header_if = false; 
-                        continue; 
-                    }
-                    if (line.empty()) {
-                        out << line << "\n"; 
-                        continue; 
-                    }
+struct MemoryUsage {
+    std::string name;
+    size_t rows = 0;
+    size_t bytes = 0;        // currently held
+    size_t peak_bytes = 0;   // high-water mark (load buffers); equals bytes for resident structures
 
-                    stringstream ss(line);
-                    string id_str, username, location;
-                    getline(ss, id_str, ',');
-                    getline(ss, username, ',');
-                    getline(ss, location,  ',');
+    double bytes_per_row() const { return rows ? double(bytes ? bytes : peak_bytes) / rows : 0.0; }
+};
 
-                    int id_val = 0;
-                    bool same_user = false;
-                    try {
-                        id_val = std::stoi(id_str);
-                        same_user = (id_val == user_id);
-                    } catch (...) {
-                        same_user = false; 
-                    }
+/**
+ * @brief Footprint of the engine: resident tables and indexes, plus the transient buffers of
+ *        the most recent load.
+ */
+struct MemoryReport {
+    std::vector<MemoryUsage> tables;    // row objects + snapshot column blocks
+    std::vector<MemoryUsage> indexes;   // id maps, id -> row maps, username counts, derived views, result cache
+    std::vector<MemoryUsage> load;      // per-buffer peaks of the last measured load
+    size_t load_peak_bytes = 0;         // most load buffers alive at once
+    size_t budget_bytes = 0;            // 0 = no budget
+    size_t refused_loads = 0;           // loads the budget turned away
+
+    size_t resident_bytes() const {
+        size_t b = 0;
+        for (const MemoryUsage& u : tables) b += u.bytes;
+        for (const MemoryUsage& u : indexes) b += u.bytes;
+        return b;
+    }
 
-                    if (same_user) {
-                        out << id_str << "," << new_username << "," << location << "\n";
-                    } else {
-                        out << line << "\n";
-                    }
-                }
-                in.close(); 
-                out.close();
+    // Resident size plus the last load's transient peak: roughly what the next reload needs.
+    size_t peak_bytes() const { return resident_bytes() + load_peak_bytes; }
 
-                remove(users_path_.c_str());
-                int rc = rename(tmp_users.c_str(), users_path_.c_str());
-                ASSERT_WITH_MESSAGE(rc == 0, "Update name failed: " + users_path_);
+    bool over_budget() const { return budget_bytes && peak_bytes() > budget_bytes; }
+
+    const MemoryUsage* find(const std::string& name) const {
+        for (const auto* v : {&tables, &indexes, &load}) {
+            for (const MemoryUsage& u : *v) if (u.name == name) return &u;
+        }
+        return nullptr;
+    }
+
+    std::string to_text() const {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1);
+        auto kb = [](size_t b) { return b / 1024.0; };
+        auto section = [&](const char* title, const std::vector<MemoryUsage>& v, bool peak) {
+            out << title << "\n";
+            for (const MemoryUsage& u : v) {
+                out << "  " << u.name << ": " << kb(peak ? u.peak_bytes : u.bytes) << " kB";
+                if (u.rows) out << ", " << u.rows << " rows, " << u.bytes_per_row() << " B/row";
+                out << "\n";
             }
+        };
+        section("tables", tables, false);
+        section("indexes", indexes, false);
+        section("last load (peak)", load, true);
+        out << "resident " << kb(resident_bytes()) << " kB, load peak +" << kb(load_peak_bytes) << " kB";
+        if (budget_bytes) out << ", budget " << kb(budget_bytes) << " kB" << (over_budget() ? " EXCEEDED" : "");
+        if (refused_loads) out << ", " << refused_loads << " loads refused";
+        out << "\n";
+        return out.str();
+    }
+};
 
-            // Rewrite posts.csv id,content,username,views
-            {
-                ifstream in(posts_path_);
-                ASSERT_WITH_MESSAGE(in.good(), "File failed： " + posts_path_);
-                string tmp_posts = posts_path_ + ".tmp";
-                ofstream out(tmp_posts);
-                ASSERT_WITH_MESSAGE(out.good(), "File failed： " + tmp_posts);
+// Transient structures a load holds before its tables become resident.
+enum class LoadBuffer { ParsedUsers, ParsedPosts, ParsedEngagements, IntegritySets, RowObjects, NewSnapshot, kCount };
 
-                string line; 
-                bool header_if = true;
+static const char* load_buffer_name(LoadBuffer b) {
+    static const char* const names[] = {"parsed users", "parsed posts", "parsed engagements",
+                                        "integrity sets", "row objects", "new snapshot"};
+    return names[static_cast<size_t>(b)];
+}
 
-                while (getline(in, line)) {
-                    if (header_if) {
-                        out << line << "\n"; 
-                        header_if = false; 
-                        continue; 
-                    }
+/**
+ * @brief Charges and releases the load buffers of one load at a time, keeping each buffer's
+ *        peak and the peak of their sum.
+ * @details Measuring a buffer walks it, so a charge's `bytes` is a callable that runs only for
+ *          loads begun while the ledger is enabled.
+ * @thread_safety Thread-safe (parsers charge from pool threads); a few calls per load.
+ */
+class LoadMemoryLedger {
+public:
+    static constexpr size_t kBuffers = static_cast<size_t>(LoadBuffer::kCount);
 
-                    if (line.empty()) {
-                        out << line << "\n"; 
-                        continue; 
-                    }
+    void set_enabled(bool on) { enabled_.store(on, std::memory_order_relaxed); }
 
-                    stringstream ss(line);
-                    string id_str, content, username, views;
-                    getline(ss, id_str,    ',');
-                    getline(ss, content, ',');
-                    getline(ss, username,   ',');
-                    getline(ss, views, ',');
+    // Start a load; returns whether it is measured.
+    bool begin() {
+        std::lock_guard<std::mutex> lk(mtx_);
+        cur_ = {}; peak_ = {}; rows_ = {};
+        live_ = live_peak_ = 0;
+        measuring_ = enabled_.load(std::memory_order_relaxed);
+        return measuring_;
+    }
 
-                    if (username == old_username) {
-                        out << id_str << "," << content << "," << new_username << "," << views << "\n";
-                    } else {
-                        out << line << "\n";
-                    }
-                }
-                in.close(); 
-                out.close();
+    bool measuring() const {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return measuring_;
+    }
 
-                remove(posts_path_.c_str());
-                int rc = rename(tmp_posts.c_str(), posts_path_.c_str());
-                ASSERT_WITH_MESSAGE(rc == 0, "Update name failed: " + posts_path_);
-            }
+    template <typename Bytes>
+    void charge(LoadBuffer b, Bytes&& bytes, size_t rows = 0) {
+        if (!measuring()) return;
+        size_t n = bytes();
+        size_t i = static_cast<size_t>(b);
+        std::lock_guard<std::mutex> lk(mtx_);
+        cur_[i] += n;
+        rows_[i] += rows;
+        peak_[i] = std::max(peak_[i], cur_[i]);
+        live_ += n;
+        live_peak_ = std::max(live_peak_, live_);
+    }
 
-            // Rewrite engagements.csv id,postId,username,type,comment,timestamp
-            {
-                ifstream in(engagements_path_);
-                ASSERT_WITH_MESSAGE(in.good(), "File failed： " + engagements_path_);
-                string tmp_engage = engagements_path_ + ".tmp";
-                ofstream out(tmp_engage);
-                ASSERT_WITH_MESSAGE(out.good(), "File failed： " + tmp_engage);
+    // The whole buffer was freed or became resident.
+    void release(LoadBuffer b) {
+        size_t i = static_cast<size_t>(b);
+        std::lock_guard<std::mutex> lk(mtx_);
+        live_ -= cur_[i];
+        cur_[i] = 0;
+    }
 
-                string line; 
-                bool header_if = true;
+    void release_all() {
+        for (size_t i = 0; i < kBuffers; ++i) release(LoadBuffer(i));
+    }
 
-                while (getline(in, line)) {
-                    if (header_if) {
-                        out << line << "\n"; 
-                        header_if = false; 
-                        continue; 
-                    }
+    std::vector<MemoryUsage> usage() const {
+        std::lock_guard<std::mutex> lk(mtx_);
+        std::vector<MemoryUsage> out;
+        for (size_t i = 0; i < kBuffers; ++i) {
+            if (peak_[i]) out.push_back({load_buffer_name(LoadBuffer(i)), rows_[i], cur_[i], peak_[i]});
+        }
+        return out;
+    }
 
-                    if (line.empty()) {
-                        out << line << "\n"; 
-                        continue; 
-                    }
+    size_t peak() const {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return live_peak_;
+    }
 
-                    stringstream ss(line);
-                    string id_str, postId_s, username, type, comment, timestamp;
-                    getline(ss, id_str,     ',');
-                    getline(ss, postId_s, ',');
-                    getline(ss, username,    ',');
-                    getline(ss, type,     ',');
-                    getline(ss, comment,  ',');
-                    getline(ss, timestamp,     ',');
-
-                    if (username == old_username) {
-                        out << id_str << "," << postId_s << "," << new_username << ","
-                            << type << "," << comment << "," << timestamp << "\n";
-                    } else {
-                        out << line << "\n";
-                    }
-                }
-                in.close(); 
-                out.close();
+    // Bytes charged and not yet released.
+    size_t live() const {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return live_;
+    }
 
-                remove(engagements_path_.c_str());
-                int rc = rename(tmp_engage.c_str(), engagements_path_.c_str());
-                ASSERT_WITH_MESSAGE(rc == 0, "Update name failed: " + engagements_path_);
-            }
+private:
+    mutable std::mutex mtx_;
+    std::array<size_t, kBuffers> cur_{}, peak_{}, rows_{};
+    size_t live_ = 0, live_peak_ = 0;
+    bool measuring_ = false;
+    std::atomic<bool> enabled_{false};
+};
 
-            // Update in-memory state after rewrites
-            // update users
-            {
-    
-                unique_ptr<User>& user_ptr = uit->second; 
-                User* user = user_ptr.get();             
-                user->username = new_username;            
-            }
+// ----------------------------- Sketches -----------------------------
+// Bounded-memory approximate answers for "distinct engagers of a post" (HyperLogLog)
+// and "most active users" (count-min sketch + top-k candidate list).
+
+static uint64_t sketch_hash(std::string_view s) {
+    // FNV-1a, then the splitmix64 finalizer to spread low-entropy names over all 64 bits
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : s) { h ^= c; h *= 1099511628211ull; }
+    h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27; h *= 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
 
-            // update post
-            for (auto it = posts.begin();
-                it != posts.end(); ++it)
-            {
-                Post* post = it->second.get();
-                if (post->username == old_username) {
-                    post->username = new_username;
-                }
-            }
+/**
+ * @brief HyperLogLog distinct counter: exact up to kSparseMax values, then 2^kP one-byte registers.
+ * @details While small the counter keeps the distinct hashes themselves (8 bytes each, at most
+ *          512 B); past kSparseMax it promotes to 1 KiB of registers with relative standard
+ *          error 1.04 / sqrt(2^kP) ~= 3.3%, using linear counting below 2.5 * 2^kP.
+ */
+class HyperLogLog {
+public:
+    static constexpr unsigned kP = 10;
+    static constexpr size_t kRegisters = size_t(1) << kP;
+    static constexpr size_t kSparseMax = 64;
+
+    void add(uint64_t hash) {
+        if (!reg_.empty()) {
+            add_dense(hash);
+            return;
+        }
+        auto pos = std::lower_bound(sparse_.begin(), sparse_.end(), hash);
+        if (pos != sparse_.end() && *pos == hash) return;
+        sparse_.insert(pos, hash);
+        if (sparse_.size() > kSparseMax) densify();
+    }
 
-            // update engagement
-            for (auto it = engagements.begin();
-                it != engagements.end(); ++it)
-            {
-                Engagement* e = it->second.get();
-                if (e->username == old_username) {
-                    e->username = new_username;
-                }
-            }
+    // Swap one counted value for another. Exact while sparse; registers cannot forget a value,
+    // so a dense counter only adds `to` and may keep counting `from`.
+    void replace(uint64_t from, uint64_t to) {
+        if (reg_.empty()) {
+            auto pos = std::lower_bound(sparse_.begin(), sparse_.end(), from);
+            if (pos != sparse_.end() && *pos == from) sparse_.erase(pos);
+        }
+        add(to);
+    }
 
-            return true;
-                    
+    void merge(const HyperLogLog& o) {
+        if (o.reg_.empty()) {
+            for (uint64_t h : o.sparse_) add(h);
+            return;
         }
+        if (reg_.empty()) densify();
+        for (size_t i = 0; i < kRegisters; ++i) reg_[i] = std::max(reg_[i], o.reg_[i]);
+    }
 
-        // Accessors
-        std::map<int, std::unique_ptr<User>>& getUsers() { return users; }
-        std::map<int, std::unique_ptr<Post>>& getPosts() { return posts; }
-        std::map<int, std::unique_ptr<Engagement>>& getEngagements() { return engagements; }
-};
+    uint64_t estimate() const {
+        if (reg_.empty()) return sparse_.size();
+        const double m = static_cast<double>(kRegisters);
+        double sum = 0;
+        size_t zeros = 0;
+        for (uint8_t r : reg_) {
+            sum += std::ldexp(1.0, -static_cast<int>(r));
+            zeros += r == 0;
+        }
+        double e = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+        if (e <= 2.5 * m && zeros) e = m * std::log(m / static_cast<double>(zeros));
+        return static_cast<uint64_t>(e + 0.5);
+    }
 
+    bool sparse() const { return reg_.empty(); }
 
-#ifndef MAIN_DEFINED
-#define MAIN_DEFINED
+    size_t memory_bytes() const { return heap_bytes(sparse_) + heap_bytes(reg_); }
 
-// ---------- Helpers (timing, memory, CPU, copying) ----------
+private:
+    std::vector<uint64_t> sparse_;   // distinct hashes, ascending; empty once dense
+    std::vector<uint8_t> reg_;       // empty while sparse
 
-static size_t peakRSSkB() {
-    struct rusage ru{};
-    getrusage(RUSAGE_SELF, &ru);
-#if defined(__APPLE__) && defined(__MACH__)
-    // On macOS, ru_maxrss is in bytes.
-    return static_cast<size_t>(ru.ru_maxrss / 1024);
-#else
-    // On Linux, ru_maxrss is in kilobytes.
-    return static_cast<size_t>(ru.ru_maxrss);
-#endif
-}
+    void add_dense(uint64_t hash) {
+        size_t idx = hash >> (64 - kP);
+        uint64_t rest = (hash << kP) | (uint64_t(1) << (kP - 1));   // sentinel bit bounds the rank
+        uint8_t rank = static_cast<uint8_t>(__builtin_clzll(rest) + 1);
+        if (rank > reg_[idx]) reg_[idx] = rank;
+    }
 
-static double cpu_user_seconds() {
-    struct rusage ru{};
-    getrusage(RUSAGE_SELF, &ru);
-    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
-}
+    void densify() {
+        reg_.assign(kRegisters, 0);
+        for (uint64_t h : sparse_) add_dense(h);
+        std::vector<uint64_t>().swap(sparse_);
+    }
+};
 
-static double cpu_sys_seconds() {
-    struct rusage ru{};
-    getrusage(RUSAGE_SELF, &ru);
-    return ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
-}
+static size_t heap_bytes(const HyperLogLog& h) { return h.memory_bytes(); }
 
-class ScopedTimer {
-    std::string label;
-    std::chrono::steady_clock::time_point t0;
-    double limit_sec; // if > 0, assert wall-time under this
+/**
+ * @brief Count-min sketch over usernames plus the kTopK heaviest candidates seen.
+ * @details With width w = 2^14 and depth d = 4, an estimate never undercounts and exceeds
+ *          the true count by more than e/w * N ~= 0.017% of all engagements N with
+ *          probability at most e^-d ~= 1.8%. Memory: 512 KiB of counters.
+ */
+class HeavyHitters {
 public:
-    explicit ScopedTimer(std::string s, double limit = -1.0)
-        : label(std::move(s)), t0(std::chrono::steady_clock::now()), limit_sec(limit) {}
-    ~ScopedTimer() {
-        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
-        std::cout << label << ": " << sec << " s\n";
-        if (limit_sec > 0) {
-            ASSERT_WITH_MESSAGE(sec < limit_sec, label + " too slow: " + std::to_string(sec) + "s (limit " + std::to_string(limit_sec) + "s)");
+    static constexpr size_t kWidth = size_t(1) << 14;
+    static constexpr size_t kDepth = 4;
+    static constexpr size_t kTopK = 64;
+
+    HeavyHitters() : counts_(kWidth * kDepth, 0) {}
+
+    void add(const std::string& name, uint64_t n = 1) {
+        uint64_t h = sketch_hash(name);
+        total_ += n;
+        uint64_t est = UINT64_MAX;
+        for (size_t d = 0; d < kDepth; ++d) {
+            uint64_t& c = counts_[d * kWidth + cell(h, d)];
+            c += n;
+            est = std::min(est, c);
         }
+        offer(name, est);
     }
-};
 
-// Function to copy files line by line
-void copy_files(const std::vector<std::string>& input_files, const std::vector<std::string>& output_files) {
-    for (size_t i = 0; i < input_files.size(); i++) {
-        std::ifstream src(input_files[i]);
-        std::ofstream dst(output_files[i], std::ios::trunc);
-        ASSERT_WITH_MESSAGE(src.is_open(), "copy_files: cannot open " + input_files[i]);
-        ASSERT_WITH_MESSAGE(dst.is_open(), "copy_files: cannot open " + output_files[i]);
-        std::string line;
-        while (std::getline(src, line)) {
-            dst << line << "\n";
-        }
+    uint64_t estimate(const std::string& name) const {
+        uint64_t h = sketch_hash(name);
+        uint64_t est = UINT64_MAX;
+        for (size_t d = 0; d < kDepth; ++d) est = std::min(est, counts_[d * kWidth + cell(h, d)]);
+        return est;
     }
-}
-
-// Overwrite the 'views' column for a specific post_id in a CSV file (header preserved).
-static void rewrite_post_views_file(const std::string& posts_csv_path, int post_id, int new_views) {
-    std::ifstream in(posts_csv_path);
-    ASSERT_WITH_MESSAGE(in.good(), "Cannot open " + posts_csv_path);
-    std::string tmp = posts_csv_path + ".tmp";
-    std::ofstream out(tmp);
-    ASSERT_WITH_MESSAGE(out.good(), "Cannot open tmp for " + posts_csv_path);
 
-    std::string line;
-    bool header = true;
-    while (std::getline(in, line)) {
-        if (header) { out << line << "\n"; header = false; continue; }
-        std::stringstream ss(line);
-        std::string id_str, content, username, views_str;
-        std::getline(ss, id_str, ',');
-        std::getline(ss, content, ',');
-        std::getline(ss, username, ',');
-        std::getline(ss, views_str, ',');
-        if (!id_str.empty() && std::stoi(id_str) == post_id) {
-            out << id_str << "," << content << "," << username << "," << new_views << "\n";
-        } else {
-            out << line << "\n";
+    // Re-attribute n of `from`'s counts to `to`. Taking back no more than `from` added keeps
+    // every estimate an upper bound.
+    void transfer(const std::string& from, const std::string& to, uint64_t n) {
+        uint64_t h = sketch_hash(from);
+        for (size_t d = 0; d < kDepth; ++d) {
+            uint64_t& c = counts_[d * kWidth + cell(h, d)];
+            c -= std::min(c, n);
         }
+        total_ -= std::min(total_, n);
+        top_.erase(from);
+        add(to, n);
     }
-    in.close(); out.close();
-    std::remove(posts_csv_path.c_str());
-    int rc = std::rename(tmp.c_str(), posts_csv_path.c_str());
-    ASSERT_WITH_MESSAGE(rc == 0, "rename failed for " + posts_csv_path);
-}
 
-// Quick referential-integrity sweep
-// ensure every engagement.postId exists in posts.
-static bool check_no_dangling_post_ids(const std::map<int, std::unique_ptr<Engagement>>& eng,
-                                       const std::map<int, std::unique_ptr<Post>>& posts) {
-    for (const auto& kv : eng) {
-        int pid = kv.second->postId;
-        if (posts.find(pid) == posts.end()) return false;
+    void merge(const HeavyHitters& o) {
+        for (size_t i = 0; i < counts_.size(); ++i) counts_[i] += o.counts_[i];
+        total_ += o.total_;
+        std::vector<std::string> names;
+        for (const auto& kv : top_) names.push_back(kv.first);
+        for (const auto& kv : o.top_) names.push_back(kv.first);
+        top_.clear();
+        for (const auto& n : names) offer(n, estimate(n));
     }
-    return true;
-}
-
-int main(int argc, char* argv[]) {
-    bool execute_all = false;
-    std::string selected_test = "-1";
-    int seed = std::chrono::system_clock::now().time_since_epoch().count();
 
-    if(argc < 2) {
-        execute_all = true;
-    } else {
-        selected_test = argv[1];
+    // Up to k candidates by estimated count, heaviest first.
+    std::vector<std::pair<std::string, uint64_t>> top(size_t k) const {
+        std::vector<std::pair<std::string, uint64_t>> out(top_.begin(), top_.end());
+        std::sort(out.begin(), out.end(), [](const auto& a, const auto& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+        if (out.size() > k) out.resize(k);
+        return out;
     }
 
-    // duplicate copies of test input files to avoid modifying originals
-    std::vector<std::string> input_files = {"users.csv", "posts.csv", "engagements.csv"};
-    std::vector<std::string> output_files = {"users_copy.csv", "posts_copy.csv", "engagements_copy.csv"};
-    srand(seed);
+    uint64_t total() const { return total_; }
 
-    // Test 1: LoadCSV [Single threaded]
-    if (execute_all || selected_test == "1") {
-        std::cout << "Executing Test 1: Single threaded loadFlatFile" << std::endl;
+    size_t memory_bytes() const { return heap_bytes(counts_) + heap_bytes(top_); }
 
-        auto start_time = std::chrono::steady_clock::now();
-        FlatFile flatFile("users.csv", "posts.csv", "engagements.csv");
-        flatFile.loadFlatFile();
-        auto end_time = std::chrono::steady_clock::now();
-        std::chrono::duration<double> elapsed_seconds = end_time - start_time;
-        std::cout << "Elapsed time: " << elapsed_seconds.count() << "s\n";
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t total_ = 0;
+    std::unordered_map<std::string, uint64_t> top_;   // candidate -> last estimate
 
-        std::set<std::string> usernames, post_usernames;
-        std::set<int> engagement_post_ids, post_ids;
-        for (auto& entry : flatFile.getUsers()) {
-            usernames.insert(entry.second->username);
-        }
-        for (auto& entry : flatFile.getPosts()) {
-            post_ids.insert(entry.second->id);
-            post_usernames.insert(entry.second->username);
-        }
-        for (auto& entry : flatFile.getEngagements()) {
-            engagement_post_ids.insert(entry.second->postId);
+    static size_t cell(uint64_t h, size_t d) {
+        // double hashing: row d uses h1 + d * h2
+        uint64_t h1 = h & 0xffffffffull, h2 = (h >> 32) | 1;
+        return static_cast<size_t>((h1 + d * h2) & (kWidth - 1));
+    }
+
+    void offer(const std::string& name, uint64_t est) {
+        auto it = top_.find(name);
+        if (it != top_.end()) { it->second = est; return; }
+        if (top_.size() < kTopK) { top_.emplace(name, est); return; }
+        auto lowest = std::min_element(top_.begin(), top_.end(),
+            [](const auto& a, const auto& b) { return a.second < b.second; });
+        if (est > lowest->second) {
+            top_.erase(lowest);
+            top_.emplace(name, est);
         }
+    }
+};
 
-        ASSERT_WITH_MESSAGE(usernames.size() == 10000, "users size mismatch. Expected: 10000 Actual: " + std::to_string(usernames.size()));
-        ASSERT_WITH_MESSAGE(post_usernames.size() == 4000, "posts users size mismatch. Expected: 4000 Actual: " + std::to_string(post_usernames.size()));
-        ASSERT_WITH_MESSAGE(flatFile.getEngagements().size() == 10000, "engagements size mismatch. Expected: 10000 Actual: " + std::to_string(flatFile.getEngagements().size()));
+/**
+ * @brief Per-post HyperLogLogs and global heavy hitters over one engagements table.
+ * @thread_safety Not synchronized; FlatFile guards it with its own mutex.
+ */
+struct EngagementSketches {
+    std::unordered_map<int, HyperLogLog> engagers;   // postId -> distinct usernames
+    HeavyHitters activity;                           // username -> engagements
+
+    void add(int post_id, const std::string& username) {
+        engagers[post_id].add(sketch_hash(username));
+        activity.add(username);
+    }
 
-        ASSERT_WITH_MESSAGE(usernames.find("knorman") != usernames.end(), "user knorman not found in flatfile DB");
-        ASSERT_WITH_MESSAGE(usernames.find("wchaney") != usernames.end(), "user wchaney not found in flatfile DB");
-        ASSERT_WITH_MESSAGE(usernames.find("richardbishop") != usernames.end(), "user richardbishop not found in flatfile DB");
+    // The n engagements of `from`, on post_ids, now carry `to`. Per-post counts stay exact
+    // while a post's counter is sparse; a dense one may still count `from`.
+    void rename_user(const std::string& from, const std::string& to, const std::vector<int>& post_ids, uint64_t n) {
+        uint64_t hf = sketch_hash(from), ht = sketch_hash(to);
+        for (int p : post_ids) engagers[p].replace(hf, ht);
+        activity.transfer(from, to, n);
+    }
 
-        ASSERT_WITH_MESSAGE(engagement_post_ids.find(1496) != engagement_post_ids.end(), "post 1496 missing");
-        ASSERT_WITH_MESSAGE(engagement_post_ids.find(6936) != engagement_post_ids.end(), "post 6936 missing");
-        ASSERT_WITH_MESSAGE(engagement_post_ids.find(4826) != engagement_post_ids.end(), "post 4826 missing");
+    void merge(EngagementSketches& o) {
+        for (auto& kv : o.engagers) {
+            auto it = engagers.find(kv.first);
+            if (it == engagers.end()) engagers.emplace(kv.first, std::move(kv.second));
+            else it->second.merge(kv.second);
+        }
+        activity.merge(o.activity);
+    }
 
-        std::vector<std::string> username_intersection;
-        std::vector<int> post_ids_intersection;
-        username_intersection.reserve(std::min(usernames.size(), post_usernames.size()));
-        post_ids_intersection.reserve(std::min(post_ids.size(), engagement_post_ids.size()));
+    // Build from a snapshot table; with a pool, ranges of segments are sketched concurrently.
+    static EngagementSketches build(const TableVersion<EngagementSegment>& t, WorkStealingPool* pool) {
+        size_t nseg = (t.rows + kSegmentRows - 1) / kSegmentRows;
+        size_t nparts = pool ? std::min<size_t>(nseg, pool->size() + 1) : std::min<size_t>(nseg, 1);
+        std::vector<EngagementSketches> parts(nparts);
+        auto run = [&](size_t p) {
+            for (size_t s = p; s < nseg; s += nparts) {
+                const EngagementSegment& seg = *(*t.segs)[s];
+                size_t n = std::min(kSegmentRows, t.rows - s * kSegmentRows);
+                for (size_t i = 0; i < n; ++i) parts[p].add(seg.postId->v[i], seg.username->v[i]);
+            }
+        };
+        if (pool && nparts > 1) {
+            pool->parallel_for(nparts, run);
+        } else {
+            for (size_t p = 0; p < nparts; ++p) run(p);
+        }
+        EngagementSketches out;
+        for (auto& p : parts) out.merge(p);
+        return out;
+    }
 
-        set_intersection(usernames.begin(), usernames.end(),
-                         post_usernames.begin(), post_usernames.end(),
-                         back_inserter(username_intersection));
+    size_t memory_bytes() const { return heap_bytes(engagers) + activity.memory_bytes(); }
+};
 
-        set_intersection(post_ids.begin(), post_ids.end(),
-                         engagement_post_ids.begin(), engagement_post_ids.end(),
-                         back_inserter(post_ids_intersection));
+// ----------------------------- Rollups -----------------------------
+// Like/comment counts pre-aggregated per post and per location in minute, hour and day
+// buckets of Engagement::timestamp (seconds). Only non-empty buckets are stored.
 
-        ASSERT_WITH_MESSAGE(username_intersection.size() == post_usernames.size(), "username mismatch in posts and users.");
-        ASSERT_WITH_MESSAGE(post_ids_intersection.size() == engagement_post_ids.size(), "post ids mismatch in posts and engagements.");
+enum class Granularity { Minute, Hour, Day };
 
-        std::cout << "Test 1: PASSED" << std::endl;
-    }
+static constexpr int64_t bucket_seconds(Granularity g) {
+    return g == Granularity::Minute ? 60 : g == Granularity::Hour ? 3600 : 86400;
+}
 
-    // Test 2: Parallel loader must be faster 
-    if (execute_all || selected_test == "2") {
-        std::cout << "Executing Test 2: Parallel loader speedup vs serial\n";
-        copy_files(input_files, output_files);
+struct RollupPoint {
+    int64_t start;        // first second of the bucket
+    uint64_t likes = 0;
+    uint64_t comments = 0;
 
-        auto time_once = [](auto&& fn){
-            auto t0 = std::chrono::steady_clock::now();
-            fn();
-            auto t1 = std::chrono::steady_clock::now();
-            return std::chrono::duration<double>(t1 - t0).count();
-        };
-        auto median = [](std::vector<double> v){
-            std::sort(v.begin(), v.end());
-            return v[v.size()/2];
-        };
+    bool operator==(const RollupPoint& o) const { return start == o.start && likes == o.likes && comments == o.comments; }
+};
 
-        // Functions to run each mode on the SAME (copy) paths
-        auto run_serial = [&](){
-            FlatFile ff("users_copy.csv","posts_copy.csv","engagements_copy.csv");
-            ff.loadFlatFile();
-            // sanity: non-empty
-            ASSERT_WITH_MESSAGE(!ff.getUsers().empty() && !ff.getPosts().empty() && !ff.getEngagements().empty(),
-                                "serial load produced empty structures");
-        };
-        auto run_parallel = [&](){
-            FlatFile ff("users_copy.csv","posts_copy.csv","engagements_copy.csv");
-            ff.loadMultipleFlatFilesInParallel();
-            ASSERT_WITH_MESSAGE(!ff.getUsers().empty() && !ff.getPosts().empty() && !ff.getEngagements().empty(),
-                                "parallel load produced empty structures");
-        };
+static size_t heap_bytes(const RollupPoint&) { return 0; }
 
-        // Warm-up to populate OS page cache
-        run_serial();
+/**
+ * @brief Time-bucketed like/comment rollups keyed by post and by the engager's location.
+ * @details Each series is a sorted vector of its non-empty buckets (24 bytes each). A row that
+ *          overwrites an engagement id must remove() the old row's counts before add().
+ * @thread_safety Not synchronized; FlatFile guards it with its own mutex.
+ */
+class EngagementRollups {
+public:
+    static constexpr size_t kGranularities = 3;
+    using Series = std::vector<RollupPoint>;   // non-empty buckets, ascending start
+    using UserLocations = std::unordered_map<std::string, std::vector<std::string>>;
 
-        // Repeat and use **median** to reduce timing noise
-        std::vector<double> ts_serial, ts_parallel;
-        for (int i = 0; i < 5; ++i) ts_serial.push_back(time_once(run_serial));
-        for (int i = 0; i < 5; ++i) ts_parallel.push_back(time_once(run_parallel));
-        double serial_s = median(ts_serial);
-        double parallel_s = median(ts_parallel);
+    void add(int post_id, const std::string& username, const std::string& type, int64_t ts) {
+        apply(post_id, username, type, ts, false);
+    }
 
-        std::cout << "Serial median:   " << serial_s   << " s\n";
-        std::cout << "Parallel median: " << parallel_s << " s\n";
+    // Undo one add() of the same row.
+    void remove(int post_id, const std::string& username, const std::string& type, int64_t ts) {
+        apply(post_id, username, type, ts, true);
+    }
 
-        /* THIS IS FLAKY ON GRADESCOPE 
-        // On single-core machines
-        // don’t force a speedup (I/O bound or no parallelism available).
-        unsigned cores = std::thread::hardware_concurrency();
-        // 10% faster required if >=2 cores, else no requirement
-        double required_factor = (cores >= 2) ? 0.90 : 1.50; 
+    // Non-empty buckets overlapping [from, to), in time order.
+    std::vector<RollupPoint> post_series(int post_id, Granularity g, int64_t from, int64_t to) const {
+        const auto& m = by_post_[static_cast<size_t>(g)];
+        auto it = m.find(post_id);
+        return it == m.end() ? std::vector<RollupPoint>() : window(it->second, g, from, to);
+    }
+    std::vector<RollupPoint> location_series(const std::string& location, Granularity g, int64_t from, int64_t to) const {
+        const auto& m = by_location_[static_cast<size_t>(g)];
+        auto it = m.find(location);
+        return it == m.end() ? std::vector<RollupPoint>() : window(it->second, g, from, to);
+    }
 
-        ASSERT_WITH_MESSAGE(parallel_s < serial_s * required_factor,
-            "Parallel loader not sufficiently faster (serial=" + std::to_string(serial_s) +
-            "s, parallel=" + std::to_string(parallel_s) + "s, cores=" + std::to_string(cores) + ")");
-        */
+    // The user at `location` now holds `to`; `from` stays held at from_locations (empty: nowhere).
+    // Callers remove() the rows whose attribution changes before and add() them back after.
+    void rename_user(const std::string& from, const std::string& to, const std::string& location,
+                     std::vector<std::string> from_locations) {
+        if (!user_locations_) user_locations_ = std::make_shared<UserLocations>();
+        auto& to_locs = (*user_locations_)[to];
+        if (std::find(to_locs.begin(), to_locs.end(), location) == to_locs.end()) to_locs.push_back(location);
+        if (from_locations.empty()) user_locations_->erase(from);
+        else (*user_locations_)[from] = std::move(from_locations);
+    }
 
-        // Final equivalence check: both paths load the same cardinalities.
-        {
-            FlatFile a("users_copy.csv","posts_copy.csv","engagements_copy.csv"); a.loadFlatFile();
-            FlatFile b("users_copy.csv","posts_copy.csv","engagements_copy.csv"); b.loadMultipleFlatFilesInParallel();
-            ASSERT_WITH_MESSAGE(a.getUsers().size() == b.getUsers().size(), "users size mismatch between serial and parallel");
-            ASSERT_WITH_MESSAGE(a.getPosts().size() == b.getPosts().size(), "posts size mismatch between serial and parallel");
-            ASSERT_WITH_MESSAGE(a.getEngagements().size() == b.getEngagements().size(), "engagements size mismatch between serial and parallel");
+    void merge(EngagementRollups& o) {
+        for (size_t g = 0; g < kGranularities; ++g) {
+            merge_maps(by_post_[g], o.by_post_[g]);
+            merge_maps(by_location_[g], o.by_location_[g]);
         }
-
-        std::cout << "Test 2: PASSED\n";
     }
 
-    // Test 3: GetAllUserComments
+    // Build from a snapshot; with a pool, ranges of engagement segments are rolled up concurrently.
+    static EngagementRollups build(const DbSnapshot& snap, WorkStealingPool* pool) {
+        auto user_locations = std::make_shared<UserLocations>();
+        snap.users.scan([&](const UserSegment& seg, size_t i) {
+            auto& locs = (*user_locations)[seg.username->v[i]];
+            if (std::find(locs.begin(), locs.end(), seg.location->v[i]) == locs.end()) locs.push_back(seg.location->v[i]);
+        });
+
+        const auto& t = snap.engagements;
+        size_t nseg = (t.rows + kSegmentRows - 1) / kSegmentRows;
+        size_t nparts = pool ? std::min<size_t>(nseg, pool->size() + 1) : std::min<size_t>(nseg, 1);
+        std::vector<EngagementRollups> parts(nparts);
+        auto run = [&](size_t p) {
+            parts[p].user_locations_ = user_locations;   // shared read-only while the parts build
+            for (size_t s = p; s < nseg; s += nparts) {
+                const EngagementSegment& seg = *(*t.segs)[s];
+                size_t n = std::min(kSegmentRows, t.rows - s * kSegmentRows);
+                for (size_t i = 0; i < n; ++i) {
+                    parts[p].add(seg.postId->v[i], seg.username->v[i], seg.type->v[i], seg.timestamp->v[i]);
+                }
+            }
+        };
+        if (pool && nparts > 1) {
+            pool->parallel_for(nparts, run);
+        } else {
+            for (size_t p = 0; p < nparts; ++p) run(p);
+        }
+        EngagementRollups out;
+        for (auto& p : parts) out.merge(p);
+        parts.clear();
+        out.user_locations_ = std::move(user_locations);
+        for (size_t g = 0; g < kGranularities; ++g) {
+            for (auto& kv : out.by_post_[g]) kv.second.shrink_to_fit();
+            for (auto& kv : out.by_location_[g]) kv.second.shrink_to_fit();
+        }
+        return out;
+    }
+
+    size_t memory_bytes() const {
+        size_t b = user_locations_ ? heap_bytes(*user_locations_) : 0;
+        for (size_t g = 0; g < kGranularities; ++g) b += heap_bytes(by_post_[g]) + heap_bytes(by_location_[g]);
+        return b;
+    }
+
+private:
+    std::array<std::unordered_map<int, Series>, kGranularities> by_post_;
+    std::array<std::unordered_map<std::string, Series>, kGranularities> by_location_;
+    // username -> distinct locations of the users holding it
+    std::shared_ptr<UserLocations> user_locations_;
+
+    static int64_t floor_bucket(int64_t ts, Granularity g) {
+        int64_t w = bucket_seconds(g);
+        int64_t q = ts / w;
+        if (ts % w < 0) --q;
+        return q * w;
+    }
+
+    static Series::iterator find_bucket(Series& s, int64_t start) {
+        return std::lower_bound(s.begin(), s.end(), start, [](const RollupPoint& p, int64_t t) { return p.start < t; });
+    }
+
+    void apply(int post_id, const std::string& username, const std::string& type, int64_t ts, bool undo) {
+        bool like = type == "like";
+        if (!like && type != "comment") return;
+        const std::vector<std::string>* locs = nullptr;
+        if (user_locations_) {
+            auto it = user_locations_->find(username);
+            if (it != user_locations_->end()) locs = &it->second;
+        }
+        for (size_t g = 0; g < kGranularities; ++g) {
+            int64_t start = floor_bucket(ts, static_cast<Granularity>(g));
+            bump(by_post_[g], post_id, start, like, undo);
+            if (!locs) continue;
+            for (const std::string& loc : *locs) bump(by_location_[g], loc, start, like, undo);
+        }
+    }
+
+    template <typename Key>
+    static void bump(std::unordered_map<Key, Series>& m, const Key& key, int64_t start, bool like, bool undo) {
+        if (undo) {
+            auto found = m.find(key);
+            if (found == m.end()) return;
+            Series& s = found->second;
+            auto it = find_bucket(s, start);
+            if (it == s.end() || it->start != start) return;
+            uint64_t& n = like ? it->likes : it->comments;
+            if (n) --n;
+            if (!it->likes && !it->comments) s.erase(it);
+            if (s.empty()) m.erase(found);
+            return;
+        }
+        Series& s = m[key];
+        auto it = find_bucket(s, start);
+        if (it == s.end() || it->start != start) it = s.insert(it, RollupPoint{start});
+        if (like) ++it->likes; else ++it->comments;
+    }
+
+    static std::vector<RollupPoint> window(const Series& s, Granularity g, int64_t from, int64_t to) {
+        std::vector<RollupPoint> out;
+        auto it = std::lower_bound(s.begin(), s.end(), floor_bucket(from, g),
+                                   [](const RollupPoint& p, int64_t t) { return p.start < t; });
+        for (; it != s.end() && it->start < to; ++it) out.push_back(*it);
+        return out;
+    }
+
+    template <typename Key>
+    static void merge_maps(std::unordered_map<Key, Series>& into, std::unordered_map<Key, Series>& from) {
+        for (auto& kv : from) {
+            Series& dst = into[kv.first];
+            if (dst.empty()) {
+                dst = std::move(kv.second);
+                continue;
+            }
+            Series merged;
+            merged.reserve(dst.size() + kv.second.size());
+            auto a = dst.begin(), b = kv.second.begin();
+            while (a != dst.end() || b != kv.second.end()) {
+                if (b == kv.second.end() || (a != dst.end() && a->start < b->start)) {
+                    merged.push_back(*a++);
+                } else if (a == dst.end() || b->start < a->start) {
+                    merged.push_back(*b++);
+                } else {
+                    merged.push_back({a->start, a->likes + b->likes, a->comments + b->comments});
+                    ++a; ++b;
+                }
+            }
+            dst.swap(merged);
+        }
+    }
+};
+
+// ----------------------------- Activity feed -----------------------------
+
+/**
+ * @brief One feed event: an engagement made by the user and/or on one of the user's posts.
+ * @details 16 bytes; the comment text and engager stay in the engagements table.
+ */
+struct FeedEntry {
+    enum : uint8_t { kOwn = 1, kOnMyPost = 2 };
+    enum : uint8_t { kLike = 0, kComment = 1, kOther = 2 };
+
+    int32_t timestamp;
+    int32_t engagement_id;
+    int32_t post_id;
+    uint8_t kind;   // kOwn | kOnMyPost
+    uint8_t type;   // kLike / kComment / kOther
+
+    // newest first; engagement id breaks timestamp ties
+    bool newer_than(const FeedEntry& o) const {
+        return timestamp != o.timestamp ? timestamp > o.timestamp : engagement_id > o.engagement_id;
+    }
+};
+
+static size_t heap_bytes(const FeedEntry&) { return 0; }
+
+/**
+ * @brief Per-username bounded feeds of the kFeedLength most recent events.
+ * @thread_safety Not synchronized; FlatFile guards it with its own mutex.
+ */
+class ActivityFeeds {
+public:
+    static constexpr size_t kFeedLength = 256;
+
+    // `author` is the username of the post's author ("" if unknown).
+    void add(const std::string& username, const std::string& author, int id, int post_id,
+             const std::string& type, int timestamp) {
+        uint8_t t = type == "like" ? FeedEntry::kLike : type == "comment" ? FeedEntry::kComment : FeedEntry::kOther;
+        if (username == author) {
+            insert(feeds_[username], {timestamp, id, post_id, FeedEntry::kOwn | FeedEntry::kOnMyPost, t});
+            return;
+        }
+        insert(feeds_[username], {timestamp, id, post_id, FeedEntry::kOwn, t});
+        if (!author.empty()) insert(feeds_[author], {timestamp, id, post_id, FeedEntry::kOnMyPost, t});
+    }
+
+    // Up to `limit` most recent events of `username`, newest first.
+    std::vector<FeedEntry> recent(const std::string& username, size_t limit) const {
+        auto it = feeds_.find(username);
+        if (it == feeds_.end()) return {};
+        size_t n = std::min(limit, it->second.size());
+        return std::vector<FeedEntry>(it->second.begin(), it->second.begin() + n);
+    }
+
+    // Every event of `from` now belongs to `to`. An engagement present in both feeds (one
+    // name engaging with the other's post) becomes a single entry with both kinds.
+    void rename_user(const std::string& from, const std::string& to) {
+        auto it = feeds_.find(from);
+        if (it == feeds_.end()) return;
+        std::vector<FeedEntry> moved = std::move(it->second);
+        feeds_.erase(it);
+        auto& dst = feeds_[to];
+        std::vector<FeedEntry> merged;
+        merged.reserve(std::min(kFeedLength, dst.size() + moved.size()));
+        auto a = dst.begin(), b = moved.begin();
+        while (merged.size() < kFeedLength && (a != dst.end() || b != moved.end())) {
+            if (b == moved.end() || (a != dst.end() && a->newer_than(*b))) {
+                merged.push_back(*a++);
+            } else if (a == dst.end() || b->newer_than(*a)) {
+                merged.push_back(*b++);
+            } else {
+                FeedEntry e = *a++;
+                e.kind |= (b++)->kind;
+                merged.push_back(e);
+            }
+        }
+        dst.swap(merged);
+    }
+
+    void merge(ActivityFeeds& o) {
+        for (auto& kv : o.feeds_) {
+            auto& dst = feeds_[kv.first];
+            for (const FeedEntry& e : kv.second) insert(dst, e);
+        }
+    }
+
+    // Build from a snapshot; with a pool, ranges of engagement segments are processed concurrently.
+    static ActivityFeeds build(const DbSnapshot& snap, WorkStealingPool* pool) {
+        const auto& t = snap.engagements;
+        size_t nseg = (t.rows + kSegmentRows - 1) / kSegmentRows;
+        size_t nparts = pool ? std::min<size_t>(nseg, pool->size() + 1) : std::min<size_t>(nseg, 1);
+        std::vector<ActivityFeeds> parts(nparts);
+        auto run = [&](size_t p) {
+            for (size_t s = p; s < nseg; s += nparts) {
+                const EngagementSegment& seg = *(*t.segs)[s];
+                size_t n = std::min(kSegmentRows, t.rows - s * kSegmentRows);
+                for (size_t i = 0; i < n; ++i) {
+                    parts[p].add(seg.username->v[i], author_of(snap, seg.postId->v[i]), seg.id->v[i],
+                                 seg.postId->v[i], seg.type->v[i], seg.timestamp->v[i]);
+                }
+            }
+        };
+        if (pool && nparts > 1) {
+            pool->parallel_for(nparts, run);
+        } else {
+            for (size_t p = 0; p < nparts; ++p) run(p);
+        }
+        ActivityFeeds out;
+        for (auto& p : parts) out.merge(p);
+        return out;
+    }
+
+    static const std::string& author_of(const DbSnapshot& snap, int post_id) {
+        static const std::string none;
+        auto it = snap.post_row->find(post_id);
+        if (it == snap.post_row->end()) return none;
+        return snap.posts.segment(it->second).username->v[TableVersion<PostSegment>::slot(it->second)];
+    }
+
+    size_t memory_bytes() const { return heap_bytes(feeds_); }
+
+private:
+    std::unordered_map<std::string, std::vector<FeedEntry>> feeds_;   // newest first, <= kFeedLength
+
+    static void insert(std::vector<FeedEntry>& feed, const FeedEntry& e) {
+        if (feed.size() == kFeedLength && !e.newer_than(feed.back())) return;
+        auto pos = std::upper_bound(feed.begin(), feed.end(), e,
+            [](const FeedEntry& a, const FeedEntry& b) { return a.newer_than(b); });
+        feed.insert(pos, e);
+        if (feed.size() > kFeedLength) feed.pop_back();
+    }
+};
+
+// ----------------------------- Result cache -----------------------------
+
+/**
+ * @brief Memory-bounded LRU cache of read-query results with tag-based invalidation.
+ * @details Each entry is stored with the usernames its result depends on (its tags);
+ *          invalidate(tag) drops exactly the entries carrying that tag. A reader takes
+ *          epoch() before pinning its snapshot and passes it to put(); the put is dropped if
+ *          any invalidation ran in between, so a result computed on a version older than a
+ *          write is never cached after that write's invalidation.
+ * @thread_safety All methods are safe to call concurrently (one internal mutex).
+ */
+template <typename Value>
+class ResultCache {
+public:
+    explicit ResultCache(size_t capacity_bytes) : capacity_(capacity_bytes) {}
+
+    uint64_t epoch() const { return epoch_.load(std::memory_order_acquire); }
+
+    std::optional<Value> get(const std::string& key) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            ++misses_;
+            return std::nullopt;
+        }
+        lru_.splice(lru_.begin(), lru_, it->second);
+        ++hits_;
+        return it->second->value;
+    }
+
+    void put(const std::string& key, Value value, std::vector<std::string> tags, size_t value_bytes, uint64_t epoch) {
+        size_t bytes = sizeof(Entry) + key.size() + value_bytes;
+        for (const auto& t : tags) bytes += t.size() + sizeof(std::string);
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (epoch != epoch_.load(std::memory_order_relaxed) || bytes > capacity_) return;
+        auto old = index_.find(key);
+        if (old != index_.end()) erase(old->second);
+        lru_.push_front({key, std::move(value), std::move(tags), bytes});
+        index_[key] = lru_.begin();
+        for (const auto& t : lru_.front().tags) by_tag_[t].insert(key);
+        bytes_ += bytes;
+        while (bytes_ > capacity_) erase(std::prev(lru_.end()));
+    }
+
+    void invalidate(const std::string& tag) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        epoch_.fetch_add(1, std::memory_order_release);
+        auto it = by_tag_.find(tag);
+        if (it == by_tag_.end()) return;
+        std::unordered_set<std::string> keys = std::move(it->second);
+        by_tag_.erase(it);
+        for (const auto& k : keys) {
+            auto e = index_.find(k);
+            if (e != index_.end()) erase(e->second);
+        }
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lk(mtx_);
+        epoch_.fetch_add(1, std::memory_order_release);
+        lru_.clear();
+        index_.clear();
+        by_tag_.clear();
+        bytes_ = 0;
+    }
+
+    void set_capacity(size_t capacity_bytes) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        capacity_ = capacity_bytes;
+        while (bytes_ > capacity_) erase(std::prev(lru_.end()));
+    }
+
+    size_t bytes() const { std::lock_guard<std::mutex> lk(mtx_); return bytes_; }
+    size_t size() const { std::lock_guard<std::mutex> lk(mtx_); return index_.size(); }
+    uint64_t hits() const { std::lock_guard<std::mutex> lk(mtx_); return hits_; }
+    uint64_t misses() const { std::lock_guard<std::mutex> lk(mtx_); return misses_; }
+
+private:
+    struct Entry {
+        std::string key;
+        Value value;
+        std::vector<std::string> tags;
+        size_t bytes;
+    };
+
+    mutable std::mutex mtx_;
+    size_t capacity_;
+    size_t bytes_ = 0;
+    std::atomic<uint64_t> epoch_{0};
+    uint64_t hits_ = 0, misses_ = 0;
+    std::list<Entry> lru_;   // most recently used first
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> index_;
+    std::unordered_map<std::string, std::unordered_set<std::string>> by_tag_;
+
+    void erase(typename std::list<Entry>::iterator e) {
+        for (const auto& t : e->tags) {
+            auto it = by_tag_.find(t);
+            if (it == by_tag_.end()) continue;
+            it->second.erase(e->key);
+            if (it->second.empty()) by_tag_.erase(it);
+        }
+        bytes_ -= e->bytes;
+        index_.erase(e->key);
+        lru_.erase(e);
+    }
+};
+
+// ----------------------------- Metrics -----------------------------
+// Always-on engine instrumentation. Latency histograms are HDR-style: each power-of-two range
+// of nanoseconds is split into 16 linear sub-buckets, which bounds the relative error of a
+// reported percentile to 1/16. Every bucket is a relaxed atomic, so recording costs one clz
+// and one uncontended fetch_add and never takes a lock.
+
+class LatencyHistogram {
+public:
+    static constexpr int kSubBits = 4;
+    static constexpr size_t kSub = size_t(1) << kSubBits;
+    static constexpr size_t kBuckets = (64 - kSubBits + 1) * kSub;
+
+    void record(uint64_t ns) {
+        buckets_[index_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t seen = max_.load(std::memory_order_relaxed);
+        while (ns > seen && !max_.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {}
+    }
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+    // Value at quantile q in [0, 1] (bucket midpoint; exact below 16 ns).
+    uint64_t percentile(double q) const {
+        uint64_t total = count();
+        if (total == 0) return 0;
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * double(total))));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) return std::min(max(), midpoint_of(i));
+        }
+        return max();
+    }
+
+    static size_t index_of(uint64_t v) {
+        if (v < kSub) return static_cast<size_t>(v);
+        int msb = 63 - __builtin_clzll(v);
+        return static_cast<size_t>(msb - kSubBits + 1) * kSub + ((v >> (msb - kSubBits)) & (kSub - 1));
+    }
+
+    static uint64_t midpoint_of(size_t i) {
+        if (i < kSub) return i;
+        int msb = static_cast<int>(i / kSub) + kSubBits - 1;
+        uint64_t width = uint64_t(1) << (msb - kSubBits);
+        uint64_t low = (uint64_t(1) << msb) + (i % kSub) * width;
+        return low + width / 2;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+    std::atomic<uint64_t> count_{0}, sum_{0}, max_{0};
+};
+
+enum class EngineOp : uint8_t {
+    LoadFlatFile, LoadParallel, UpdatePostViews, AddEngagement, UpdateUserName,
+    GetAllUserComments, OpenUserComments, GetAllEngagementsByLocation, RunQuery, RunJoin,
+    IngestEngagement, Sketches, EngagementSeries, UserFeed, PublishImage,
+    kCount
+};
+
+static const char* engine_op_name(EngineOp op) {
+    static const char* const names[] = {
+        "loadFlatFile", "loadMultipleFlatFilesInParallel", "updatePostViews", "addEngagementRecord",
+        "updateUserName", "getAllUserComments", "openUserComments", "getAllEngagementsByLocation",
+        "runQuery", "runJoin", "ingestEngagement", "approxSketches", "engagementSeries", "getUserFeed",
+        "publishImage"};
+    static_assert(sizeof(names) / sizeof(names[0]) == size_t(EngineOp::kCount), "one name per EngineOp");
+    return names[static_cast<size_t>(op)];
+}
+
+struct LatencySummary {
+    uint64_t count = 0;
+    double mean_us = 0, p50_us = 0, p90_us = 0, p99_us = 0, p999_us = 0, max_us = 0;
+
+    static LatencySummary of(const LatencyHistogram& h) {
+        LatencySummary s;
+        s.count = h.count();
+        if (s.count == 0) return s;
+        s.mean_us = double(h.sum()) / double(s.count) / 1e3;
+        s.p50_us = h.percentile(0.50) / 1e3;
+        s.p90_us = h.percentile(0.90) / 1e3;
+        s.p99_us = h.percentile(0.99) / 1e3;
+        s.p999_us = h.percentile(0.999) / 1e3;
+        s.max_us = h.max() / 1e3;
+        return s;
+    }
+};
+
+struct EngineStats {
+    std::vector<std::pair<std::string, LatencySummary>> ops;   // every EngineOp, in enum order
+    uint64_t bytes_read = 0;         // CSV bytes read by the loaders
+    uint64_t bytes_written = 0;      // CSV bytes appended or rewritten
+    uint64_t rows_loaded[3] = {};    // users, posts, engagements accepted by the last loads
+    uint64_t rows_rejected[3] = {};  // malformed or failing an integrity check (loads and inserts)
+    LatencySummary lock_wait;        // time writers spent acquiring table locks
+    LatencySummary lock_hold;        // time they then held them
+
+    const LatencySummary& op(EngineOp o) const { return ops[static_cast<size_t>(o)].second; }
+
+    // Reject rate of a table: rejected / (loaded + rejected).
+    double reject_rate(size_t table) const {
+        uint64_t seen = rows_loaded[table] + rows_rejected[table];
+        return seen ? double(rows_rejected[table]) / double(seen) : 0;
+    }
+
+    std::string to_text() const {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1);
+        auto line = [&](const std::string& name, const LatencySummary& s) {
+            out << "  " << std::left << std::setw(32) << name << std::right << " n=" << s.count
+                << " mean=" << s.mean_us << "us p50=" << s.p50_us << "us p90=" << s.p90_us
+                << "us p99=" << s.p99_us << "us p99.9=" << s.p999_us << "us max=" << s.max_us << "us\n";
+        };
+        out << "ops:\n";
+        for (const auto& kv : ops) {
+            if (kv.second.count) line(kv.first, kv.second);
+        }
+        out << "locks:\n";
+        line("wait", lock_wait);
+        line("hold", lock_hold);
+        out << "io: read=" << bytes_read << "B written=" << bytes_written << "B\n";
+        const char* tables[] = {"users", "posts", "engagements"};
+        out << std::setprecision(4);
+        for (size_t t = 0; t < 3; ++t) {
+            out << "rows." << tables[t] << ": loaded=" << rows_loaded[t] << " rejected=" << rows_rejected[t]
+                << " reject_rate=" << reject_rate(t) << "\n";
+        }
+        return out.str();
+    }
+};
+
+class EngineMetrics {
+public:
+    enum Table : size_t { kUsers = 0, kPosts = 1, kEngagements = 2 };
+
+    LatencyHistogram& op(EngineOp o) { return ops_[static_cast<size_t>(o)]; }
+
+    void add_read(uint64_t bytes) { bytes_read_.fetch_add(bytes, std::memory_order_relaxed); }
+    void add_written(uint64_t bytes) { bytes_written_.fetch_add(bytes, std::memory_order_relaxed); }
+    void add_loaded(Table t, uint64_t rows) { loaded_[t].fetch_add(rows, std::memory_order_relaxed); }
+    void add_rejected(Table t, uint64_t rows) { rejected_[t].fetch_add(rows, std::memory_order_relaxed); }
+    void lock_wait(uint64_t ns) { lock_wait_.record(ns); }
+    void lock_hold(uint64_t ns) { lock_hold_.record(ns); }
+
+    EngineStats snapshot() const {
+        EngineStats s;
+        for (size_t i = 0; i < size_t(EngineOp::kCount); ++i) {
+            s.ops.emplace_back(engine_op_name(static_cast<EngineOp>(i)), LatencySummary::of(ops_[i]));
+        }
+        s.bytes_read = bytes_read_.load(std::memory_order_relaxed);
+        s.bytes_written = bytes_written_.load(std::memory_order_relaxed);
+        for (size_t t = 0; t < 3; ++t) {
+            s.rows_loaded[t] = loaded_[t].load(std::memory_order_relaxed);
+            s.rows_rejected[t] = rejected_[t].load(std::memory_order_relaxed);
+        }
+        s.lock_wait = LatencySummary::of(lock_wait_);
+        s.lock_hold = LatencySummary::of(lock_hold_);
+        return s;
+    }
+
+private:
+    std::array<LatencyHistogram, size_t(EngineOp::kCount)> ops_;
+    std::atomic<uint64_t> bytes_read_{0}, bytes_written_{0};
+    std::array<std::atomic<uint64_t>, 3> loaded_{}, rejected_{};
+    LatencyHistogram lock_wait_, lock_hold_;
+};
+
+static uint64_t elapsed_ns(std::chrono::steady_clock::time_point since) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count());
+}
+
+// Call site of the current thread's table-lock acquisitions: the public operation it is running
+// (set by OpTimer), or kInternalSite for engine threads (async drain, ingest writer, pool tasks).
+static constexpr uint8_t kInternalSite = static_cast<uint8_t>(EngineOp::kCount);
+static constexpr uint8_t kNoHolder = 0xff;
+inline thread_local uint8_t tl_lock_site = kInternalSite;
+
+static const char* lock_site_name(uint8_t site) {
+    return site < kInternalSite ? engine_op_name(static_cast<EngineOp>(site)) : "internal";
+}
+
+// Records the enclosing scope's duration under one EngineOp, and tags the table locks it
+// takes meanwhile with that op (see ProfiledSharedMutex).
+class OpTimer {
+public:
+    OpTimer(EngineMetrics& m, EngineOp op)
+        : h_(m.op(op)), outer_site_(tl_lock_site), t0_(std::chrono::steady_clock::now()) {
+        tl_lock_site = static_cast<uint8_t>(op);
+    }
+    ~OpTimer() {
+        tl_lock_site = outer_site_;
+        h_.record(elapsed_ns(t0_));
+    }
+    OpTimer(const OpTimer&) = delete;
+    OpTimer& operator=(const OpTimer&) = delete;
+
+private:
+    LatencyHistogram& h_;
+    uint8_t outer_site_;
+    std::chrono::steady_clock::time_point t0_;
+};
+
+// Declare right after taking table locks with `requested` = the time before the first
+// acquisition: records the wait now and the hold time when the scope ends.
+class LockTimer {
+public:
+    LockTimer(EngineMetrics& m, std::chrono::steady_clock::time_point requested)
+        : m_(m), acquired_(std::chrono::steady_clock::now()) {
+        m_.lock_wait(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(acquired_ - requested).count()));
+    }
+    ~LockTimer() { m_.lock_hold(elapsed_ns(acquired_)); }
+    LockTimer(const LockTimer&) = delete;
+    LockTimer& operator=(const LockTimer&) = delete;
+
+private:
+    EngineMetrics& m_;
+    std::chrono::steady_clock::time_point acquired_;
+};
+
+struct LockSiteStats {
+    std::string site;
+    uint64_t acquisitions = 0, contended = 0;
+    double wait_us = 0, max_wait_us = 0;   // totals over contended acquisitions
+    double hold_us = 0, max_hold_us = 0;   // exclusive holds only
+};
+
+struct LockBlocker {
+    std::string waiter, holder;   // waiting call site, operation holding the lock exclusively
+    uint64_t waits = 0;
+    double wait_us = 0;
+};
+
+struct LockReport {
+    std::string name;
+    uint64_t acquisitions = 0, contended = 0;
+    LatencySummary wait, hold;                // wait: contended acquisitions; hold: exclusive holds
+    std::vector<LockSiteStats> sites;         // call sites that used the lock, by total wait
+    std::vector<LockBlocker> blockers;        // who waited behind whom, by total wait
+
+    double contention_rate() const { return acquisitions ? double(contended) / double(acquisitions) : 0; }
+    double total_wait_us() const { return wait.mean_us * double(wait.count); }
+};
+
+/**
+ * @brief Contention counters for one lock class (e.g. all 16 posts stripes), broken down by
+ *        call site and by (waiter, holder) pair.
+ * @thread_safety Lock-free; all counters are relaxed atomics.
+ */
+class LockProfile {
+public:
+    static constexpr size_t kSites = size_t(kInternalSite) + 1;
+
+    explicit LockProfile(std::string name) : name_(std::move(name)) {}
+
+    void acquired(uint8_t site, bool contended, uint64_t wait_ns, uint8_t holder) {
+        Site& s = sites_[site];
+        s.acquisitions.fetch_add(1, std::memory_order_relaxed);
+        if (!contended) return;
+        s.contended.fetch_add(1, std::memory_order_relaxed);
+        s.wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+        raise(s.max_wait_ns, wait_ns);
+        wait_.record(wait_ns);
+        if (holder < kSites) {
+            blocked_waits_[site * kSites + holder].fetch_add(1, std::memory_order_relaxed);
+            blocked_ns_[site * kSites + holder].fetch_add(wait_ns, std::memory_order_relaxed);
+        }
+    }
+
+    void released(uint8_t site, uint64_t hold_ns) {
+        Site& s = sites_[site];
+        s.hold_ns.fetch_add(hold_ns, std::memory_order_relaxed);
+        raise(s.max_hold_ns, hold_ns);
+        hold_.record(hold_ns);
+    }
+
+    LockReport report() const {
+        LockReport r;
+        r.name = name_;
+        r.wait = LatencySummary::of(wait_);
+        r.hold = LatencySummary::of(hold_);
+        for (size_t i = 0; i < kSites; ++i) {
+            const Site& s = sites_[i];
+            LockSiteStats st;
+            st.site = lock_site_name(static_cast<uint8_t>(i));
+            st.acquisitions = s.acquisitions.load(std::memory_order_relaxed);
+            if (st.acquisitions == 0) continue;
+            st.contended = s.contended.load(std::memory_order_relaxed);
+            st.wait_us = s.wait_ns.load(std::memory_order_relaxed) / 1e3;
+            st.max_wait_us = s.max_wait_ns.load(std::memory_order_relaxed) / 1e3;
+            st.hold_us = s.hold_ns.load(std::memory_order_relaxed) / 1e3;
+            st.max_hold_us = s.max_hold_ns.load(std::memory_order_relaxed) / 1e3;
+            r.acquisitions += st.acquisitions;
+            r.contended += st.contended;
+            r.sites.push_back(std::move(st));
+        }
+        for (size_t w = 0; w < kSites; ++w) {
+            for (size_t h = 0; h < kSites; ++h) {
+                uint64_t n = blocked_waits_[w * kSites + h].load(std::memory_order_relaxed);
+                if (n == 0) continue;
+                r.blockers.push_back({lock_site_name(static_cast<uint8_t>(w)), lock_site_name(static_cast<uint8_t>(h)), n,
+                                      blocked_ns_[w * kSites + h].load(std::memory_order_relaxed) / 1e3});
+            }
+        }
+        std::sort(r.sites.begin(), r.sites.end(), [](const LockSiteStats& a, const LockSiteStats& b) { return a.wait_us > b.wait_us; });
+        std::sort(r.blockers.begin(), r.blockers.end(), [](const LockBlocker& a, const LockBlocker& b) { return a.wait_us > b.wait_us; });
+        return r;
+    }
+
+private:
+    struct Site {
+        std::atomic<uint64_t> acquisitions{0}, contended{0}, wait_ns{0}, max_wait_ns{0}, hold_ns{0}, max_hold_ns{0};
+    };
+
+    static void raise(std::atomic<uint64_t>& slot, uint64_t v) {
+        uint64_t seen = slot.load(std::memory_order_relaxed);
+        while (v > seen && !slot.compare_exchange_weak(seen, v, std::memory_order_relaxed)) {}
+    }
+
+    std::string name_;
+    std::array<Site, kSites> sites_;
+    std::array<std::atomic<uint64_t>, kSites * kSites> blocked_waits_{}, blocked_ns_{};
+    LatencyHistogram wait_, hold_;
+};
+
+/**
+ * @brief std::shared_mutex that reports to a LockProfile (SharedMutex requirements, so it
+ *        works with unique_lock/shared_lock/lock_guard).
+ * @details An uncontended acquisition is a successful try_lock plus two clock reads (for the
+ *          hold time); only a failed try_lock times the wait. Shared holds are counted and
+ *          their waits timed, but not their hold time. Without a profile it is a plain
+ *          shared_mutex.
+ */
+class ProfiledSharedMutex {
+public:
+    void set_profile(LockProfile* p) { profile_ = p; }
+
+    void lock() {
+        if (!profile_) { m_.lock(); return; }
+        const uint8_t site = tl_lock_site;
+        if (m_.try_lock()) {
+            on_exclusive(site, false, 0, kNoHolder);
+            return;
+        }
+        const uint8_t holder = holder_.load(std::memory_order_relaxed);
+        auto t0 = std::chrono::steady_clock::now();
+        m_.lock();
+        on_exclusive(site, true, elapsed_ns(t0), holder);
+    }
+
+    bool try_lock() {
+        if (!m_.try_lock()) return false;
+        if (profile_) on_exclusive(tl_lock_site, false, 0, kNoHolder);
+        return true;
+    }
+
+    void unlock() {
+        if (!profile_) { m_.unlock(); return; }
+        const uint8_t site = holder_.exchange(kNoHolder, std::memory_order_relaxed);
+        const uint64_t held = elapsed_ns(acquired_);
+        m_.unlock();
+        profile_->released(site, held);
+    }
+
+    void lock_shared() {
+        if (!profile_) { m_.lock_shared(); return; }
+        const uint8_t site = tl_lock_site;
+        if (m_.try_lock_shared()) {
+            profile_->acquired(site, false, 0, kNoHolder);
+            return;
+        }
+        const uint8_t holder = holder_.load(std::memory_order_relaxed);
+        auto t0 = std::chrono::steady_clock::now();
+        m_.lock_shared();
+        profile_->acquired(site, true, elapsed_ns(t0), holder);
+    }
+
+    bool try_lock_shared() {
+        if (!m_.try_lock_shared()) return false;
+        if (profile_) profile_->acquired(tl_lock_site, false, 0, kNoHolder);
+        return true;
+    }
+
+    void unlock_shared() { m_.unlock_shared(); }
+
+private:
+    std::shared_mutex m_;
+    LockProfile* profile_ = nullptr;
+    std::atomic<uint8_t> holder_{kNoHolder};      // site of the exclusive holder, read by waiters
+    std::chrono::steady_clock::time_point acquired_;   // written and read by the exclusive holder
+
+    void on_exclusive(uint8_t site, bool contended, uint64_t wait_ns, uint8_t holder) {
+        acquired_ = std::chrono::steady_clock::now();
+        holder_.store(site, std::memory_order_relaxed);
+        profile_->acquired(site, contended, wait_ns, holder);
+    }
+};
+
+static std::string lock_reports_text(std::vector<LockReport> reports) {
+    std::sort(reports.begin(), reports.end(), [](const LockReport& a, const LockReport& b) {
+        return a.total_wait_us() > b.total_wait_us();
+    });
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    for (const LockReport& r : reports) {
+        out << r.name << ": acquisitions=" << r.acquisitions << " contended=" << r.contended
+            << " (" << 100 * r.contention_rate() << "%) wait p99=" << r.wait.p99_us << "us max=" << r.wait.max_us
+            << "us hold p99=" << r.hold.p99_us << "us max=" << r.hold.max_us << "us\n";
+        for (const LockSiteStats& s : r.sites) {
+            out << "  site " << std::left << std::setw(32) << s.site << std::right << " n=" << s.acquisitions
+                << " contended=" << s.contended << " wait=" << s.wait_us << "us (max " << s.max_wait_us
+                << ") hold=" << s.hold_us << "us (max " << s.max_hold_us << ")\n";
+        }
+        for (const LockBlocker& b : r.blockers) {
+            out << "  " << b.waiter << " waited behind " << b.holder << ": " << b.waits << "x, " << b.wait_us << "us\n";
+        }
+    }
+    return out.str();
+}
+
+/**
+ * @brief Background thread handing a text rendering of the stats to a sink every interval.
+ * @thread_safety start()/stop() from one thread; the sink runs on the dump thread.
+ */
+class StatsDumper {
+public:
+    ~StatsDumper() { stop(); }
+
+    void start(std::chrono::milliseconds interval, std::function<std::string()> render,
+               std::function<void(const std::string&)> sink) {
+        stop();
+        stop_ = false;
+        thread_ = std::thread([this, interval, render = std::move(render), sink = std::move(sink)] {
+            std::unique_lock<std::mutex> lk(mtx_);
+            while (!cv_.wait_for(lk, interval, [this] { return stop_; })) {
+                lk.unlock();
+                sink(render());
+                lk.lock();
+            }
+        });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) thread_.join();
+    }
+
+private:
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool stop_ = true;
+    std::thread thread_;
+};
+
+// ----------------------------- Tracing -----------------------------
+// Opt-in load tracing in Chrome trace-event format (chrome://tracing, ui.perfetto.dev). Spans
+// are recorded per load stage and per thread; the per-line phases of a CSV parse (I/O,
+// tokenizing, integer parsing, integrity filtering, object construction) interleave row by
+// row, so a parse span carries their accumulated times as args instead of child spans.
+
+struct TraceEvent {
+    std::string name;
+    const char* cat;
+    uint64_t ts_ns, dur_ns;
+    uint32_t tid;
+    std::vector<std::pair<std::string, double>> args;
+};
+
+// Small stable per-thread ids for the "tid" field.
+static uint32_t trace_thread_id() {
+    static std::atomic<uint32_t> next{1};
+    static thread_local uint32_t id = next.fetch_add(1);
+    return id;
+}
+
+/**
+ * @brief Collects complete ("X") trace events while enabled.
+ * @thread_safety Thread-safe; spans are coarse (per stage, per file), so one mutex suffices.
+ */
+class TraceRecorder {
+public:
+    void enable(bool on) { enabled_.store(on, std::memory_order_relaxed); }
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    void clear() {
+        std::lock_guard<std::mutex> lk(mtx_);
+        events_.clear();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return events_.size();
+    }
+
+    std::vector<TraceEvent> events() const {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return events_;
+    }
+
+    void complete(std::string name, const char* cat, std::chrono::steady_clock::time_point start,
+                  std::chrono::steady_clock::time_point end, std::vector<std::pair<std::string, double>> args = {}) {
+        auto ns = [&](std::chrono::steady_clock::time_point t) {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t - origin_).count());
+        };
+        TraceEvent e{std::move(name), cat, ns(start), ns(end) - ns(start), trace_thread_id(), std::move(args)};
+        std::lock_guard<std::mutex> lk(mtx_);
+        events_.push_back(std::move(e));
+    }
+
+    // {"traceEvents": [...]} with microsecond timestamps relative to the recorder's creation.
+    std::string to_json() const {
+        std::vector<TraceEvent> evs = events();
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(3);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << getpid() << ",\"tid\":0,\"args\":{\"name\":\"buzzdb\"}}";
+        for (const TraceEvent& e : evs) {
+            out << ",\n{\"name\":\"" << json_escape(e.name) << "\",\"cat\":\"" << e.cat << "\",\"ph\":\"X\",\"pid\":" << getpid()
+                << ",\"tid\":" << e.tid << ",\"ts\":" << e.ts_ns / 1e3 << ",\"dur\":" << e.dur_ns / 1e3;
+            if (!e.args.empty()) {
+                out << ",\"args\":{";
+                for (size_t i = 0; i < e.args.size(); ++i) {
+                    out << (i ? "," : "") << "\"" << json_escape(e.args[i].first) << "\":" << e.args[i].second;
+                }
+                out << "}";
+            }
+            out << "}";
+        }
+        out << "\n]}\n";
+        return out.str();
+    }
+
+    bool write_json(const std::string& path) const {
+        std::ofstream f(path, std::ios::trunc);
+        f << to_json();
+        return f.good();
+    }
+
+    // File rewritten by flush(); empty disables it.
+    void set_output(std::string path) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        output_ = std::move(path);
+    }
+
+    void flush() const {
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            path = output_;
+        }
+        if (enabled() && !path.empty()) write_json(path);
+    }
+
+private:
+    std::atomic<bool> enabled_{false};
+    mutable std::mutex mtx_;
+    std::string output_;
+    std::vector<TraceEvent> events_;
+    std::chrono::steady_clock::time_point origin_ = std::chrono::steady_clock::now();
+
+    static std::string json_escape(const std::string& s) {
+        std::string out;
+        for (char c : s) {
+            if (c == '"' || c == '\\') out += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20) out += c;
+        }
+        return out;
+    }
+};
+
+// Records the enclosing scope as one span when the recorder is enabled at construction.
+class TraceSpan {
+public:
+    TraceSpan(TraceRecorder& r, std::string name, const char* cat = "load")
+        : r_(r.enabled() ? &r : nullptr), name_(std::move(name)), cat_(cat) {
+        if (r_) start_ = std::chrono::steady_clock::now();
+    }
+    ~TraceSpan() {
+        if (r_) r_->complete(std::move(name_), cat_, start_, std::chrono::steady_clock::now(), std::move(args_));
+    }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    void arg(std::string key, double value) {
+        if (r_) args_.emplace_back(std::move(key), value);
+    }
+
+private:
+    TraceRecorder* r_;
+    std::string name_;
+    const char* cat_;
+    std::chrono::steady_clock::time_point start_;
+    std::vector<std::pair<std::string, double>> args_;
+};
+
+// Flushes the recorder to its output file when the enclosing load returns.
+class TraceFlush {
+public:
+    explicit TraceFlush(const TraceRecorder& r) : r_(r) {}
+    ~TraceFlush() { r_.flush(); }
+    TraceFlush(const TraceFlush&) = delete;
+    TraceFlush& operator=(const TraceFlush&) = delete;
+
+private:
+    const TraceRecorder& r_;
+};
+
+enum LoadPhase : size_t { kPhaseIo, kPhaseTokenize, kPhaseParseInt, kPhaseFilter, kPhaseConstruct, kLoadPhases };
+
+/**
+ * @brief Splits a parse loop's time between LoadPhases: enter(p) charges the time since the
+ *        previous enter() to the previous phase. A no-op unless tracing was on at construction.
+ */
+class PhaseClock {
+public:
+    explicit PhaseClock(bool on) : on_(on) {
+        if (on_) last_ = std::chrono::steady_clock::now();
+    }
+
+    void enter(LoadPhase p) {
+        if (!on_) return;
+        auto t = std::chrono::steady_clock::now();
+        ns_[cur_] += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t - last_).count());
+        last_ = t;
+        cur_ = p;
+    }
+
+    // Read the next line, charging the read to kPhaseIo and what follows to kPhaseTokenize.
+    template <typename Reader>
+    bool getline(Reader& f, std::string& line) {
+        enter(kPhaseIo);
+        bool ok = f.getline(line);
+        enter(kPhaseTokenize);
+        return ok;
+    }
+
+    // Close the running phase and attach the totals (ms), rows kept and bytes read to `span`.
+    void annotate(TraceSpan& span, size_t rows, size_t bytes) {
+        enter(cur_);
+        static const char* const names[kLoadPhases] = {"io_ms", "tokenize_ms", "parse_int_ms", "filter_ms", "construct_ms"};
+        for (size_t i = 0; i < kLoadPhases; ++i) span.arg(names[i], ns_[i] / 1e6);
+        span.arg("rows", double(rows));
+        span.arg("bytes", double(bytes));
+    }
+
+private:
+    bool on_;
+    LoadPhase cur_ = kPhaseIo;
+    std::array<uint64_t, kLoadPhases> ns_{};
+    std::chrono::steady_clock::time_point last_;
+};
+
+// ----------------------------- Striped tables -----------------------------
+// Writer-side row storage. Rows are hash-partitioned by id into kStripes std::maps,
+// each guarded by its own reader-writer lock, so single-row writers on different ids
+// do not contend. Whole-table operations lock every stripe in index order.
+//
+// The map-like members below (find/at/operator[]/iteration/size) do no locking
+// themselves; the caller holds the stripe lock(s) or owns the table exclusively.
+
+template <typename T>
+class StripedTable {
+public:
+    static constexpr size_t kStripes = 16;
+    using Map = std::map<int, std::unique_ptr<T>>;
+    using Parts = std::array<Map, kStripes>;
+
+    struct Stripe {
+        mutable ProfiledSharedMutex mtx;
+        Map rows;
+    };
+
+    template <typename Stripes, typename MapIt>
+    class basic_iterator {
+        Stripes* stripes_ = nullptr;
+        size_t s_ = kStripes;
+        MapIt it_{};
+
+        void skip_empty() {
+            while (s_ < kStripes && it_ == (*stripes_)[s_].rows.end()) {
+                if (++s_ < kStripes) it_ = (*stripes_)[s_].rows.begin();
+            }
+        }
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename MapIt::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = decltype(*std::declval<MapIt>());
+        using pointer = decltype(&*std::declval<MapIt>());
+
+        basic_iterator() = default;
+        basic_iterator(Stripes* stripes, size_t s, MapIt it) : stripes_(stripes), s_(s), it_(it) { skip_empty(); }
+        explicit basic_iterator(Stripes* stripes) : stripes_(stripes) {}
+
+        reference operator*() const { return *it_; }
+        pointer operator->() const { return &*it_; }
+        basic_iterator& operator++() { ++it_; skip_empty(); return *this; }
+        basic_iterator operator++(int) { basic_iterator t = *this; ++*this; return t; }
+        bool operator==(const basic_iterator& o) const { return s_ == o.s_ && (s_ == kStripes || it_ == o.it_); }
+        bool operator!=(const basic_iterator& o) const { return !(*this == o); }
+    };
+
+    using iterator = basic_iterator<std::array<Stripe, kStripes>, typename Map::iterator>;
+    using const_iterator = basic_iterator<const std::array<Stripe, kStripes>, typename Map::const_iterator>;
+
+    static size_t stripe_of(int id) {
+        // Fibonacci hashing: spreads sequential ids evenly over the stripes
+        return (static_cast<uint32_t>(id) * 2654435769u) >> 28;
+    }
+    static_assert(kStripes == 16, "stripe_of() takes the top log2(kStripes) bits");
+
+    ProfiledSharedMutex& mutex_of(int id) const { return stripes_[stripe_of(id)].mtx; }
+    ProfiledSharedMutex& stripe_mutex(size_t i) const { return stripes_[i].mtx; }
+
+    // Report every stripe's lock traffic to one profile.
+    void set_lock_profile(LockProfile* p) {
+        for (Stripe& s : stripes_) s.mtx.set_profile(p);
+    }
+
+    // Exclusive/shared lock on every stripe, always acquired in stripe order.
+    std::vector<std::unique_lock<ProfiledSharedMutex>> lock_all() const {
+        std::vector<std::unique_lock<ProfiledSharedMutex>> locks;
+        locks.reserve(kStripes);
+        for (const Stripe& s : stripes_) locks.emplace_back(s.mtx);
+        return locks;
+    }
+    std::vector<std::shared_lock<ProfiledSharedMutex>> lock_all_shared() const {
+        std::vector<std::shared_lock<ProfiledSharedMutex>> locks;
+        locks.reserve(kStripes);
+        for (const Stripe& s : stripes_) locks.emplace_back(s.mtx);
+        return locks;
+    }
+
+    // Split a fully-built map into stripes (moves the nodes, no copies).
+    static Parts partition(Map&& all) {
+        Parts parts;
+        while (!all.empty()) {
+            auto node = all.extract(all.begin());
+            parts[stripe_of(node.key())].insert(std::move(node));
+        }
+        return parts;
+    }
+
+    // Swap every stripe's rows with parts; caller holds lock_all().
+    void swap_rows(Parts& parts) {
+        for (size_t i = 0; i < kStripes; ++i) stripes_[i].rows.swap(parts[i]);
+    }
+
+    iterator begin() { return iterator(&stripes_, 0, stripes_[0].rows.begin()); }
+    iterator end() { return iterator(&stripes_); }
+    const_iterator begin() const { return const_iterator(&stripes_, 0, stripes_[0].rows.begin()); }
+    const_iterator end() const { return const_iterator(&stripes_); }
+
+    iterator find(int id) {
+        size_t s = stripe_of(id);
+        auto it = stripes_[s].rows.find(id);
+        return it == stripes_[s].rows.end() ? end() : iterator(&stripes_, s, it);
+    }
+    const_iterator find(int id) const {
+        size_t s = stripe_of(id);
+        auto it = stripes_[s].rows.find(id);
+        return it == stripes_[s].rows.end() ? end() : const_iterator(&stripes_, s, it);
+    }
+    size_t count(int id) const { return stripes_[stripe_of(id)].rows.count(id); }
+    const Map& stripe_rows(size_t i) const { return stripes_[i].rows; }
+    std::unique_ptr<T>& at(int id) { return stripes_[stripe_of(id)].rows.at(id); }
+    const std::unique_ptr<T>& at(int id) const { return stripes_[stripe_of(id)].rows.at(id); }
+    std::unique_ptr<T>& operator[](int id) { return stripes_[stripe_of(id)].rows[id]; }
+
+    size_t size() const {
+        size_t n = 0;
+        for (const Stripe& s : stripes_) n += s.rows.size();
+        return n;
+    }
+    bool empty() const { return size() == 0; }
+
+private:
+    std::array<Stripe, kStripes> stripes_;
+};
+
+// ----------------------------- Replication log -----------------------------
+// Committed changes are shipped to read replicas as frames over a stream fd (Unix socket
+// or pipe). A frame is a little-endian uint32 payload length followed by NUL-separated
+// fields: tag, version, commit time (steady-clock ns), then the tag's own fields:
+//   B            base snapshot written; the replica loads it
+//   V post views new absolute view count
+//   E id postId username type comment timestamp
+//   R user_id new_username
+//   C            end of a version's changes
+//   L            primary reloaded from disk; the replica must be re-attached
+//   H            heartbeat carrying the primary's current version
+
+// Paths of one users/posts/engagements CSV triple.
+struct ShardPaths {
+    std::string users, posts, engagements;
+};
+
+struct ReplChange {
+    char tag;
+    std::vector<std::string> fields;
+};
+
+static int64_t steady_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void append_frame(std::string& out, char tag, uint64_t version, int64_t ns, const std::vector<std::string>& fields) {
+    std::string payload(1, tag);
+    payload += '\0';
+    payload += std::to_string(version);
+    payload += '\0';
+    payload += std::to_string(ns);
+    for (const auto& f : fields) { payload += '\0'; payload += f; }
+    uint32_t len = static_cast<uint32_t>(payload.size());
+    for (int i = 0; i < 4; ++i) out += static_cast<char>((len >> (8 * i)) & 0xff);
+    out += payload;
+}
+
+// Write all of `data`; false once the peer has gone away.
+static bool write_fully(int fd, std::string_view data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = ::send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK) n = ::write(fd, data.data() + off, data.size() - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        off += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/**
+ * @brief Primary-side change stream fanned out to attached replicas by a shipper thread.
+ * @details Writers append under the engine's version mutex, so frames are in version order.
+ *          A replica is attached paused: frames queue up while its base snapshot is written,
+ *          then resume() puts the B frame in front and shipping starts. Replica fds are made
+ *          non-blocking and the shipper poll()s them, so a replica that stops reading only
+ *          grows its own backlog. The log writes through its own duplicate of each fd. A
+ *          replica whose fd fails, or whose unsent backlog exceeds the limit (kMaxBacklog by
+ *          default), is dropped: a socket is shut down for writing and the duplicate closed,
+ *          so its follower sees end of stream (on a pipe, once the caller's write end is
+ *          closed too).
+ * @thread_safety All methods are safe to call concurrently.
+ */
+class ReplicationLog {
+public:
+    static constexpr size_t kMaxBacklog = size_t(64) << 20;
+
+    ~ReplicationLog() {
+        stop();
+        for (auto& r : replicas_) {
+            if (r->fd >= 0) close(r->fd);
+        }
+        if (wake_fd_ >= 0) close(wake_fd_);
+    }
+
+    bool active() const { return active_.load(std::memory_order_acquire); }
+
+    // Register a duplicate of fd (switched to non-blocking); frames are buffered, not sent,
+    // until resume().
+    size_t add_paused(int fd) {
+        fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        ASSERT_WITH_MESSAGE(fd >= 0, "dup of replica fd failed: " + std::string(strerror(errno)));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (wake_fd_ < 0) {
+            wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            ASSERT_WITH_MESSAGE(wake_fd_ >= 0, "eventfd failed: " + std::string(strerror(errno)));
+        }
+        replicas_.push_back(std::make_unique<Replica>());
+        replicas_.back()->fd = fd;
+        active_.store(true, std::memory_order_release);
+        if (!shipper_.joinable()) shipper_ = std::thread([this] { ship_loop(); });
+        return replicas_.size() - 1;
+    }
+
+    void resume(size_t id, uint64_t base_version) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        Replica& r = *replicas_[id];
+        if (r.failed) return;
+        std::string head;
+        append_frame(head, 'B', base_version, steady_now_ns(), {});
+        r.buf = head + r.buf;
+        r.paused = false;
+        last_version_ = std::max(last_version_, base_version);
+        wake();
+    }
+
+    // One published version and its changes (possibly none).
+    void append(uint64_t version, const std::vector<ReplChange>& changes) {
+        std::string frames;
+        int64_t ns = steady_now_ns();
+        for (const auto& c : changes) append_frame(frames, c.tag, version, ns, c.fields);
+        append_frame(frames, 'C', version, ns, {});
+        std::lock_guard<std::mutex> lk(mtx_);
+        last_version_ = version;
+        for (auto& r : replicas_) queue(*r, frames);
+        wake();
+    }
+
+    // Unsent bytes at which a replica is dropped.
+    void set_max_backlog(size_t bytes) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        max_backlog_ = bytes;
+    }
+
+    size_t replicas() const {
+        std::lock_guard<std::mutex> lk(mtx_);
+        size_t n = 0;
+        for (const auto& r : replicas_) n += !r->failed;
+        return n;
+    }
+
+    // Ship what the replicas will take, then stop; a replica that accepts nothing for 100 ms
+    // is abandoned, so this never waits on a stalled reader.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            stop_ = true;
+            wake();
+        }
+        if (shipper_.joinable()) shipper_.join();
+    }
+
+private:
+    struct Replica {
+        int fd = -1;         // owned; closed by the shipper once the replica fails
+        bool paused = true;
+        bool failed = false;
+        std::string buf;     // frames the shipper has not taken yet
+        size_t unsent = 0;   // bytes taken by the shipper but not written yet
+    };
+
+    mutable std::mutex mtx_;
+    std::vector<std::unique_ptr<Replica>> replicas_;
+    std::thread shipper_;
+    int wake_fd_ = -1;   // new frames and stop()
+    bool stop_ = false;
+    std::atomic<bool> active_{false};
+    uint64_t last_version_ = 0;
+    size_t max_backlog_ = kMaxBacklog;
+
+    // Callers hold mtx_.
+    void wake() {
+        if (wake_fd_ < 0) return;
+        uint64_t one = 1;
+        ssize_t rc = write(wake_fd_, &one, sizeof(one));
+        UNUSED(rc);
+    }
+
+    void queue(Replica& r, const std::string& frames) {
+        if (r.failed) return;
+        r.buf += frames;
+        if (r.buf.size() + r.unsent > max_backlog_) fail(r);
+    }
+
+    // The shipper may be writing to r.fd right now; it closes the fd itself.
+    static void fail(Replica& r) {
+        r.failed = true;
+        std::string().swap(r.buf);
+        shutdown(r.fd, SHUT_WR);   // fails harmlessly on pipes
+    }
+
+    void ship_loop() {
+        struct Out {
+            Replica* r;
+            std::string data;
+            size_t off = 0;
+        };
+        std::vector<Out> outs;   // bytes taken from the replicas' buffers, owned by this thread
+        bool idle = false;       // the last poll timed out
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lk(mtx_);
+                if (idle && !stop_) {
+                    // tell replicas how far the primary is
+                    std::string hb;
+                    append_frame(hb, 'H', last_version_, steady_now_ns(), {});
+                    for (auto& r : replicas_) {
+                        if (!r->paused) queue(*r, hb);
+                    }
+                }
+                outs.erase(std::remove_if(outs.begin(), outs.end(), [](const Out& o) {
+                    return o.r->failed || o.off == o.data.size();
+                }), outs.end());
+                for (auto& r : replicas_) {
+                    if (r->failed && r->fd >= 0) { close(r->fd); r->fd = -1; }
+                }
+                for (auto& r : replicas_) {
+                    if (r->paused || r->failed || r->buf.empty()) continue;
+                    auto o = std::find_if(outs.begin(), outs.end(), [&](const Out& x) { return x.r == r.get(); });
+                    if (o == outs.end()) {
+                        outs.push_back({r.get(), std::move(r->buf)});
+                    } else {
+                        o->data.erase(0, o->off);
+                        o->off = 0;
+                        o->data += r->buf;
+                    }
+                    r->buf.clear();
+                }
+                for (auto& o : outs) o.r->unsent = o.data.size() - o.off;
+                // stopping: done once everything is written or nothing was writable for 100 ms
+                if (stop_ && (outs.empty() || idle)) return;
+            }
+
+            std::vector<pollfd> fds{{wake_fd_, POLLIN, 0}};
+            for (const auto& o : outs) fds.push_back({o.r->fd, POLLOUT, 0});
+            int n = ::poll(fds.data(), fds.size(), 100);
+            if (n < 0 && errno == EINTR) continue;
+            idle = n == 0;
+            if (fds[0].revents & POLLIN) {
+                uint64_t count;
+                ssize_t rc = read(wake_fd_, &count, sizeof(count));
+                UNUSED(rc);
+            }
+            std::vector<Replica*> dead;
+            for (size_t i = 0; i < outs.size(); ++i) {
+                if (!fds[i + 1].revents) continue;
+                Out& o = outs[i];
+                while (o.off < o.data.size()) {
+                    ssize_t w = ::send(o.r->fd, o.data.data() + o.off, o.data.size() - o.off, MSG_NOSIGNAL);
+                    if (w < 0 && errno == ENOTSOCK) w = ::write(o.r->fd, o.data.data() + o.off, o.data.size() - o.off);
+                    if (w > 0) { o.off += static_cast<size_t>(w); continue; }
+                    if (w < 0 && errno == EINTR) continue;
+                    if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                    dead.push_back(o.r);
+                    break;
+                }
+            }
+            if (!dead.empty()) {
+                std::lock_guard<std::mutex> lk(mtx_);
+                for (Replica* r : dead) fail(*r);
+            }
+        }
+    }
+};
+
+// ----------------------------- Shared image -----------------------------
+// A read-only, pointer-free image of one snapshot, published to a file (put it under /dev/shm
+// for a pure shared-memory segment) and mapped by any number of reader processes. Layout:
+//   ImageHeader | fixed-width sections (8-byte aligned) | string arena
+// Every string column is an array of ImageStr {offset, length} into the arena; low-cardinality
+// columns (usernames, locations, types) are interned so repeated values share arena bytes.
+// Publishing writes a temporary file and rename()s it over the image, so readers see either
+// the old or the new generation, never a partial one; a reader keeps its old mapping alive
+// until it moves on.
+
+enum ImageSection : uint32_t {
+    kImgUserId, kImgUserName, kImgUserLocation,
+    kImgPostId, kImgPostContent, kImgPostUser, kImgPostViews,
+    kImgEngId, kImgEngPost, kImgEngUser, kImgEngType, kImgEngComment, kImgEngTs,
+    kImgUserById,        // ImageKey, sorted by id
+    kImgPostById,        // ImageKey, sorted by id
+    kImgUserByLocation,  // uint32 user rows, sorted by (location, username)
+    kImgEngByUser,       // uint32 engagement rows, sorted by (username, type, postId, comment)
+    kImgStrings,         // string arena
+    kImgSectionCount
+};
+
+struct ImageStr { uint64_t offset; uint32_t length; uint32_t reserved; };
+struct ImageKey { int32_t id; uint32_t row; };
+struct ImageExtent { uint64_t offset; uint64_t count; };
+
+struct ImageHeader {
+    static constexpr char kMagic[8] = {'B', 'U', 'Z', 'Z', 'I', 'M', 'G', '1'};
+    char magic[8];
+    uint64_t generation;
+    uint64_t snapshot_version;
+    uint64_t file_bytes;
+    uint64_t users, posts, engagements;
+    ImageExtent sections[kImgSectionCount];
+};
+
+/**
+ * @brief Serialize a snapshot as generation `generation` of the image at `path`.
+ * @details Builds the indexes, writes `path`.tmp.<pid>, fsyncs it and renames it into place.
+ * @thread_safety The snapshot is immutable; concurrent publishers to one path must be serialized
+ *                by the caller (the generation is read from the image being replaced).
+ * @complexity O(N log N) for the sorted indexes; one sequential write of the image.
+ */
+static void write_table_image(const DbSnapshot& snap, const std::string& path, uint64_t generation) {
+    ImageHeader hdr{};
+    std::memcpy(hdr.magic, ImageHeader::kMagic, sizeof(hdr.magic));
+    hdr.generation = generation;
+    hdr.snapshot_version = snap.version;
+    hdr.users = snap.users.rows;
+    hdr.posts = snap.posts.rows;
+    hdr.engagements = snap.engagements.rows;
+
+    std::string arena;
+    std::unordered_map<std::string_view, ImageStr> interned;
+    auto put = [&](const std::string& s) {
+        ImageStr r{arena.size(), static_cast<uint32_t>(s.size()), 0};
+        arena += s;
+        return r;
+    };
+    auto put_interned = [&](const std::string& s) {
+        auto it = interned.find(s);
+        if (it != interned.end()) return it->second;
+        ImageStr r = put(s);
+        interned.emplace(s, r);   // keys view the snapshot's strings, which outlive this call
+        return r;
+    };
+
+    std::vector<int32_t> user_id, post_id, post_views, eng_id, eng_post, eng_ts;
+    std::vector<ImageStr> user_name, user_loc, post_content, post_user, eng_user, eng_type, eng_comment;
+    std::vector<ImageKey> user_by_id, post_by_id;
+    std::vector<std::string_view> user_name_sv, user_loc_sv, eng_user_sv, eng_type_sv, eng_comment_sv;
+    snap.users.scan([&](const UserSegment& seg, size_t i) {
+        user_by_id.push_back({seg.id->v[i], static_cast<uint32_t>(user_id.size())});
+        user_id.push_back(seg.id->v[i]);
+        user_name.push_back(put_interned(seg.username->v[i]));
+        user_loc.push_back(put_interned(seg.location->v[i]));
+        user_name_sv.push_back(seg.username->v[i]);
+        user_loc_sv.push_back(seg.location->v[i]);
+    });
+    snap.posts.scan([&](const PostSegment& seg, size_t i) {
+        post_by_id.push_back({seg.id->v[i], static_cast<uint32_t>(post_id.size())});
+        post_id.push_back(seg.id->v[i]);
+        post_content.push_back(put(seg.content->v[i]));
+        post_user.push_back(put_interned(seg.username->v[i]));
+        post_views.push_back(seg.views->v[i]);
+    });
+    snap.engagements.scan([&](const EngagementSegment& seg, size_t i) {
+        eng_id.push_back(seg.id->v[i]);
+        eng_post.push_back(seg.postId->v[i]);
+        eng_user.push_back(put_interned(seg.username->v[i]));
+        eng_type.push_back(put_interned(seg.type->v[i]));
+        eng_comment.push_back(put(seg.comment->v[i]));
+        eng_ts.push_back(seg.timestamp->v[i]);
+        eng_user_sv.push_back(seg.username->v[i]);
+        eng_type_sv.push_back(seg.type->v[i]);
+        eng_comment_sv.push_back(seg.comment->v[i]);
+    });
+
+    auto by_id = [](const ImageKey& a, const ImageKey& b) { return a.id < b.id || (a.id == b.id && a.row < b.row); };
+    std::sort(user_by_id.begin(), user_by_id.end(), by_id);
+    std::sort(post_by_id.begin(), post_by_id.end(), by_id);
+    std::vector<uint32_t> user_by_loc(user_id.size()), eng_by_user(eng_id.size());
+    std::iota(user_by_loc.begin(), user_by_loc.end(), 0u);
+    std::iota(eng_by_user.begin(), eng_by_user.end(), 0u);
+    std::sort(user_by_loc.begin(), user_by_loc.end(), [&](uint32_t a, uint32_t b) {
+        return std::tie(user_loc_sv[a], user_name_sv[a], a) < std::tie(user_loc_sv[b], user_name_sv[b], b);
+    });
+    std::sort(eng_by_user.begin(), eng_by_user.end(), [&](uint32_t a, uint32_t b) {
+        return std::tie(eng_user_sv[a], eng_type_sv[a], eng_post[a], eng_comment_sv[a], a) <
+               std::tie(eng_user_sv[b], eng_type_sv[b], eng_post[b], eng_comment_sv[b], b);
+    });
+
+    // lay the sections out after the header, then write them in order
+    std::vector<std::pair<const void*, size_t>> chunks(kImgSectionCount);
+    auto section = [&](ImageSection s, const auto& v) {
+        chunks[s] = {v.data(), v.size() * sizeof(v[0])};
+        hdr.sections[s].count = v.size();
+    };
+    section(kImgUserId, user_id);            section(kImgUserName, user_name);      section(kImgUserLocation, user_loc);
+    section(kImgPostId, post_id);            section(kImgPostContent, post_content); section(kImgPostUser, post_user);
+    section(kImgPostViews, post_views);      section(kImgEngId, eng_id);           section(kImgEngPost, eng_post);
+    section(kImgEngUser, eng_user);          section(kImgEngType, eng_type);       section(kImgEngComment, eng_comment);
+    section(kImgEngTs, eng_ts);              section(kImgUserById, user_by_id);    section(kImgPostById, post_by_id);
+    section(kImgUserByLocation, user_by_loc); section(kImgEngByUser, eng_by_user);  section(kImgStrings, arena);
+    uint64_t off = sizeof(ImageHeader);
+    for (uint32_t s = 0; s < kImgSectionCount; ++s) {
+        off = (off + 7) & ~uint64_t(7);
+        hdr.sections[s].offset = off;
+        off += chunks[s].second;
+    }
+    hdr.file_bytes = off;
+
+    const std::string tmp = path + ".tmp." + std::to_string(getpid());
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    ASSERT_WITH_MESSAGE(fd >= 0, "File failed: " + tmp);
+    std::string pad(8, '\0');
+    uint64_t pos = sizeof(ImageHeader);
+    bool ok = write_fully(fd, std::string_view(reinterpret_cast<const char*>(&hdr), sizeof(hdr)));
+    for (uint32_t s = 0; ok && s < kImgSectionCount; ++s) {
+        ok = write_fully(fd, std::string_view(pad.data(), hdr.sections[s].offset - pos)) &&
+             write_fully(fd, std::string_view(static_cast<const char*>(chunks[s].first), chunks[s].second));
+        pos = hdr.sections[s].offset + chunks[s].second;
+    }
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+    ASSERT_WITH_MESSAGE(ok && rename(tmp.c_str(), path.c_str()) == 0, "Publishing image failed: " + path);
+}
+
+/**
+ * @brief One mapped generation of a table image; queries read the mapping in place.
+ * @details Answers the same point lookups and reports as FlatFile (identical results for the
+ *          snapshot it was published from) without parsing or copying the tables.
+ * @thread_safety Immutable; any number of threads and processes may query one image.
+ */
+class SharedImage {
+public:
+    // Map the image currently at `path`; nullptr if there is none or it is not a valid image
+    // (wrong magic or size, a section outside the file, or a row or string reference out of range).
+    static std::shared_ptr<const SharedImage> attach(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return nullptr;
+        struct stat st{};
+        void* base = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(ImageHeader)) {
+            base = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (base == MAP_FAILED) return nullptr;
+        std::shared_ptr<SharedImage> img(new SharedImage(base, static_cast<size_t>(st.st_size), st.st_ino));
+        const ImageHeader& h = img->header();
+        if (std::memcmp(h.magic, ImageHeader::kMagic, sizeof(h.magic)) != 0 || h.file_bytes != img->bytes_) return nullptr;
+        if (!img->valid()) return nullptr;
+        return img;
+    }
+
+    ~SharedImage() { munmap(base_, bytes_); }
+    SharedImage(const SharedImage&) = delete;
+    SharedImage& operator=(const SharedImage&) = delete;
+
+    uint64_t generation() const { return header().generation; }
+    uint64_t snapshotVersion() const { return header().snapshot_version; }
+    uint64_t inode() const { return inode_; }
+    size_t userCount() const { return header().users; }
+    size_t postCount() const { return header().posts; }
+    size_t engagementCount() const { return header().engagements; }
+    size_t mappedBytes() const { return bytes_; }
+
+    std::optional<User> getUser(int id) const {
+        auto row = find(kImgUserById, id);
+        if (!row) return std::nullopt;
+        return User(col<int32_t>(kImgUserId)[*row], std::string(str(kImgUserName, *row)), std::string(str(kImgUserLocation, *row)));
+    }
+
+    std::optional<Post> getPost(int id) const {
+        auto row = find(kImgPostById, id);
+        if (!row) return std::nullopt;
+        return Post(col<int32_t>(kImgPostId)[*row], std::string(str(kImgPostContent, *row)),
+                    std::string(str(kImgPostUser, *row)), col<int32_t>(kImgPostViews)[*row]);
+    }
+
+    // Same result as FlatFile::getAllUserComments: <post_id, comment> ordered by (post_id, comment).
+    std::vector<std::pair<int, std::string>> getAllUserComments(int user_id) const {
+        std::vector<std::pair<int, std::string>> out;
+        auto row = find(kImgUserById, user_id);
+        if (!row) return out;
+        const uint32_t* first;
+        const uint32_t* last;
+        std::tie(first, last) = engagements_of(str(kImgUserName, *row), "comment");
+        const int32_t* post = col<int32_t>(kImgEngPost);
+        for (const uint32_t* r = first; r != last; ++r) out.emplace_back(post[*r], std::string(str(kImgEngComment, *r)));
+        return out;
+    }
+
+    // Same result as FlatFile::getAllEngagementsByLocation: <likes, comments>.
+    std::pair<int, int> getAllEngagementsByLocation(const std::string& location) const {
+        const uint32_t* rows = col<uint32_t>(kImgUserByLocation);
+        const uint32_t* end = rows + header().sections[kImgUserByLocation].count;
+        auto range = std::equal_range(rows, end, location, LocationLess{this});
+        std::pair<int, int> counts{0, 0};
+        std::string_view prev;
+        for (const uint32_t* r = range.first; r != range.second; ++r) {
+            std::string_view name = str(kImgUserName, *r);
+            if (r != range.first && name == prev) continue;   // rows are sorted by username within a location
+            prev = name;
+            auto likes = engagements_of(name, "like");
+            auto comments = engagements_of(name, "comment");
+            counts.first += static_cast<int>(likes.second - likes.first);
+            counts.second += static_cast<int>(comments.second - comments.first);
+        }
+        return counts;
+    }
+
+private:
+    void* base_;
+    size_t bytes_;
+    uint64_t inode_;
+
+    SharedImage(void* base, size_t bytes, uint64_t inode) : base_(base), bytes_(bytes), inode_(inode) {}
+
+    const ImageHeader& header() const { return *static_cast<const ImageHeader*>(base_); }
+
+    // Every section inside the file, aligned and sized for its table; every stored row index
+    // and arena span in range. Queries index the mapping without further checks.
+    bool valid() const {
+        const ImageHeader& h = header();
+        struct Expect { size_t elem; uint64_t rows; };
+        const Expect expect[kImgSectionCount] = {
+            {sizeof(int32_t), h.users}, {sizeof(ImageStr), h.users}, {sizeof(ImageStr), h.users},
+            {sizeof(int32_t), h.posts}, {sizeof(ImageStr), h.posts}, {sizeof(ImageStr), h.posts}, {sizeof(int32_t), h.posts},
+            {sizeof(int32_t), h.engagements}, {sizeof(int32_t), h.engagements}, {sizeof(ImageStr), h.engagements},
+            {sizeof(ImageStr), h.engagements}, {sizeof(ImageStr), h.engagements}, {sizeof(int32_t), h.engagements},
+            {sizeof(ImageKey), h.users}, {sizeof(ImageKey), h.posts},
+            {sizeof(uint32_t), h.users}, {sizeof(uint32_t), h.engagements},
+            {1, h.sections[kImgStrings].count},
+        };
+        for (uint32_t s = 0; s < kImgSectionCount; ++s) {
+            const ImageExtent& e = h.sections[s];
+            if (e.count != expect[s].rows || e.offset < sizeof(ImageHeader) || e.offset % 8 != 0 || e.offset > bytes_ ||
+                e.count > (bytes_ - e.offset) / expect[s].elem) {
+                return false;
+            }
+        }
+        const uint64_t arena = h.sections[kImgStrings].count;
+        for (ImageSection s : {kImgUserName, kImgUserLocation, kImgPostContent, kImgPostUser, kImgEngUser, kImgEngType, kImgEngComment}) {
+            const ImageStr* v = col<ImageStr>(s);
+            for (uint64_t i = 0; i < h.sections[s].count; ++i) {
+                if (v[i].offset > arena || v[i].length > arena - v[i].offset) return false;
+            }
+        }
+        auto rows_below = [&](ImageSection s, uint64_t limit) {
+            const uint32_t* v = col<uint32_t>(s);
+            return std::all_of(v, v + h.sections[s].count, [&](uint32_t r) { return r < limit; });
+        };
+        auto keys_below = [&](ImageSection s, uint64_t limit) {
+            const ImageKey* v = col<ImageKey>(s);
+            return std::all_of(v, v + h.sections[s].count, [&](const ImageKey& k) { return k.row < limit; });
+        };
+        return keys_below(kImgUserById, h.users) && keys_below(kImgPostById, h.posts) &&
+               rows_below(kImgUserByLocation, h.users) && rows_below(kImgEngByUser, h.engagements);
+    }
+
+    template <typename T>
+    const T* col(ImageSection s) const {
+        return reinterpret_cast<const T*>(static_cast<const char*>(base_) + header().sections[s].offset);
+    }
+
+    std::string_view str(ImageSection s, size_t row) const {
+        const ImageStr& r = col<ImageStr>(s)[row];
+        return std::string_view(col<char>(kImgStrings) + r.offset, r.length);
+    }
+
+    std::optional<uint32_t> find(ImageSection index, int id) const {
+        const ImageKey* keys = col<ImageKey>(index);
+        const ImageKey* end = keys + header().sections[index].count;
+        const ImageKey* it = std::lower_bound(keys, end, id, [](const ImageKey& k, int v) { return k.id < v; });
+        if (it == end || it->id != id) return std::nullopt;
+        return it->row;
+    }
+
+    struct LocationLess {
+        const SharedImage* img;
+        bool operator()(uint32_t row, const std::string& loc) const { return img->str(kImgUserLocation, row) < loc; }
+        bool operator()(const std::string& loc, uint32_t row) const { return loc < img->str(kImgUserLocation, row); }
+    };
+
+    // Engagement rows of (username, type), ordered by (postId, comment).
+    std::pair<const uint32_t*, const uint32_t*> engagements_of(std::string_view user, std::string_view type) const {
+        const uint32_t* rows = col<uint32_t>(kImgEngByUser);
+        const uint32_t* end = rows + header().sections[kImgEngByUser].count;
+        auto key = [&](uint32_t r) { return std::make_pair(str(kImgEngUser, r), str(kImgEngType, r)); };
+        auto target = std::make_pair(user, type);
+        const uint32_t* lo = std::lower_bound(rows, end, target, [&](uint32_t r, const auto& t) { return key(r) < t; });
+        const uint32_t* hi = std::upper_bound(lo, end, target, [&](const auto& t, uint32_t r) { return t < key(r); });
+        return {lo, hi};
+    }
+};
+
+/**
+ * @brief Follows the image at a path across generations.
+ * @details current() re-stats the path and remaps when a publish replaced the file; images
+ *          handed out earlier stay mapped until their last holder drops them.
+ * @thread_safety Thread-safe.
+ */
+class SharedImageReader {
+public:
+    explicit SharedImageReader(std::string path) : path_(std::move(path)) {}
+
+    // The newest published image, or nullptr if none exists yet.
+    std::shared_ptr<const SharedImage> current() {
+        struct stat st{};
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (stat(path_.c_str(), &st) == 0 && (!image_ || image_->inode() != st.st_ino)) {
+            if (auto fresh = SharedImage::attach(path_)) image_ = std::move(fresh);
+        }
+        return image_;
+    }
+
+private:
+    std::string path_;
+    std::mutex mtx_;
+    std::shared_ptr<const SharedImage> image_;
+};
+
+// ----------------------------- FlatFile -----------------------------
+// Re-encode a rewritten CSV in place as a block file, for tables stored in blocks (which the
+// rewrites below read through LineReader like any CSV). Returns the bytes written.
+static size_t keep_block_format(const std::string& tmp_csv, size_t block_bytes = kBlockRawBytes) {
+    std::string packed = tmp_csv + ".blk";
+    BlockFileStats st = write_block_file(tmp_csv, packed, block_bytes);
+    ASSERT_WITH_MESSAGE(std::rename(packed.c_str(), tmp_csv.c_str()) == 0, "rename failed for " + packed);
+    return st.stored_bytes;
+}
+
+// Overwrite the 'views' column for every post id in new_views (header preserved).
+// Writes a tmp file and rename()s it over the original, which replaces it atomically.
+// Returns the bytes written.
+static size_t rewrite_post_views_batch(const std::string& posts_csv_path, const std::unordered_map<int, int>& new_views) {
+    const bool blocked = is_block_file(posts_csv_path);
+    LineReader in(posts_csv_path);
+    ASSERT_WITH_MESSAGE(in.is_open(), "Cannot open " + posts_csv_path);
+    std::string tmp = posts_csv_path + ".tmp";
+    std::ofstream out(tmp);
+    ASSERT_WITH_MESSAGE(out.good(), "Cannot open tmp for " + posts_csv_path);
+
+    std::string line;
+    bool header = true;
+    while (in.getline(line)) {
+        if (header) { out << line << "\n"; header = false; continue; }
+        std::stringstream ss(line);
+        std::string id_str, content, username, views_str;
+        std::getline(ss, id_str, ',');
+        std::getline(ss, content, ',');
+        std::getline(ss, username, ',');
+        std::getline(ss, views_str, ',');
+
+        int id = 0;
+        auto res = std::from_chars(id_str.data(), id_str.data() + id_str.size(), id);
+        auto hit = (res.ec == std::errc()) ? new_views.find(id) : new_views.end();
+        if (hit != new_views.end()) {
+            out << id_str << "," << content << "," << username << "," << hit->second << "\n";
+        } else {
+            out << line << "\n";
+        }
+    }
+    size_t bytes = static_cast<size_t>(out.tellp());
+    out.close();
+    if (blocked) bytes += keep_block_format(tmp);
+    int rc = std::rename(tmp.c_str(), posts_csv_path.c_str());
+    ASSERT_WITH_MESSAGE(rc == 0, "rename failed for " + posts_csv_path);
+    return bytes;
+}
+
+
+
+class FlatFile {
+    private:
+        // Contention profiles of the table, file and version locks (see lockReport()); declared
+        // first so they outlive every lock reporting to them (heap: each holds two histograms)
+        struct LockProfiles {
+            LockProfile users{"users.stripes"}, posts{"posts.stripes"}, engagements{"engagements.stripes"},
+                        posts_file{"posts.file"}, version{"version"};
+        };
+        unique_ptr<LockProfiles> locks_ = make_unique<LockProfiles>();
+        // Striped tables; lock order is users -> posts -> engagements, stripes in index order
+        StripedTable<User> users;
+        StripedTable<Post> posts;
+        StripedTable<Engagement> engagements;
+        // CSV paths + file-level mutexes (a stripe lock does not cover the shared file)
+        string users_path_, posts_path_, engagements_path_;
+        ProfiledSharedMutex posts_file_mtx_;
+        GroupAppender eng_log_;
+        // Change stream for attached read replicas (see attachReplica)
+        ReplicationLog repl_;
+        // Published read version; writers serialize on version_mtx_ (always taken last)
+        shared_ptr<const DbSnapshot> snapshot_;
+        mutable ProfiledSharedMutex version_mtx_;
+        // engagement id -> row in the head snapshot; guarded by version_mtx_
+        unordered_map<int, uint32_t> eng_row_;
+        // Group commit of post views: updaters enqueue, one leader rewrites the CSV for all of them
+        mutex views_mtx_;
+        condition_variable views_cv_;
+        unordered_map<int, int> views_pending_;
+        uint64_t views_enqueued_ = 0, views_flushed_ = 0;
+        bool views_leader_ = false;
+        // Async scheduler: submitted operations wait here until one drain task picks them up
+        struct PendingOp {
+            enum class Kind { Read, PostViews, Engagement, Barrier, Fence } kind;
+            function<void()> run;                   // Read, Barrier
+            int post_id = 0, views_count = 0;       // PostViews
+            promise<bool> views_done;
+            unique_ptr<Engagement> record;          // Engagement
+            promise<bool> eng_done;
+
+            explicit PendingOp(Kind k, function<void()> fn = nullptr) : kind(k), run(move(fn)) {}
+        };
+        mutex async_mtx_;
+        deque<PendingOp> async_queue_;
+        bool async_draining_ = false;
+
+        // Ingest mode: producers push to ring, writer drains it in batches
+        struct IngestState {
+            IngestOptions opts;
+            MpscRing<Engagement> ring;
+            thread writer;
+            atomic<bool> stop{false};
+            atomic<bool> writer_sleeping{false};
+            atomic<uint64_t> durable{0};       // tickets <= durable are appended and published
+            atomic<uint64_t> rejected{0};
+            mutex mtx;
+            condition_variable wake_cv, space_cv, durable_cv;
+
+            explicit IngestState(IngestOptions o) : opts(o), ring(o.capacity) {}
+        };
+        unique_ptr<IngestState> ingest_;
+
+        void ingest_writer_loop(IngestState& st) {
+            vector<Engagement> batch;
+            vector<const Engagement*> ptrs;
+            for (;;) {
+                batch.clear();
+                Engagement e(0, 0, "", "", "", 0);
+                while (batch.size() < st.opts.max_batch && st.ring.try_pop(e)) batch.push_back(move(e));
+
+                if (!batch.empty()) {
+                    ptrs.clear();
+                    for (const Engagement& r : batch) ptrs.push_back(&r);
+                    add_engagements(ptrs);
+                    {
+                        lock_guard<mutex> lk(st.mtx);
+                        st.durable.fetch_add(batch.size());
+                    }
+                    st.durable_cv.notify_all();
+                    st.space_cv.notify_all();
+                    continue;
+                }
+                if (st.stop.load() && st.durable.load() == st.ring.issued())
+                    return;
+
+                // nothing ready: sleep until a producer pokes us (the timeout covers a missed poke)
+                unique_lock<mutex> lk(st.mtx);
+                st.writer_sleeping.store(true);
+                st.wake_cv.wait_for(lk, chrono::milliseconds(1));
+                st.writer_sleeping.store(false);
+            }
+        }
+
+        // Cached getAllUserComments / getAllEngagementsByLocation results, tagged by username
+        using CommentsResult = vector<pair<int, string>>;
+        using CachedResult = variant<CommentsResult, pair<int,int>>;
+        static constexpr size_t kDefaultResultCacheBytes = size_t(64) << 20;
+        ResultCache<CachedResult> result_cache_{kDefaultResultCacheBytes};
+
+        // Approximate-analytics sketches, kept in step with the engagements table
+        mutable mutex sketch_mtx_;
+        EngagementSketches sketches_;
+
+        // Time-bucketed like/comment counts, kept in step with the engagements table
+        mutable mutex rollup_mtx_;
+        EngagementRollups rollups_;
+
+        // Bounded per-username activity feeds
+        mutable mutex feed_mtx_;
+        ActivityFeeds feeds_;
+
+        // Latency histograms, I/O and reject counters (see stats()); on the heap, as the histograms
+        // are large. The dumper goes first on destruction.
+        unique_ptr<EngineMetrics> metrics_ = make_unique<EngineMetrics>();
+        StatsDumper stats_dumper_;
+
+        // Load-phase spans (see enableLoadTracing()); off unless BUZZDB_TRACE names an output file.
+        TraceRecorder trace_;
+
+        // Transient buffers of the current/last load and the budget reported by memoryReport()
+        LoadMemoryLedger load_mem_;
+        atomic<bool> track_load_memory_{false};
+        atomic<size_t> memory_budget_{0};
+        atomic<size_t> refused_loads_{0};
+        // What the last measured load left resident, its transient peak and its input size;
+        // admit_load() projects the next load from them
+        atomic<size_t> resident_after_load_{0}, last_load_peak_{0}, last_load_input_{0};
+
+        // Load buffers per CSV byte when no load has been measured yet: parsed rows, row objects
+        // and the new snapshot each hold the strings plus per-row overhead (~14 on short rows)
+        static constexpr size_t kLoadBytesPerInputByte = 16;
+
+        size_t input_bytes() const {
+            size_t b = 0;
+            struct stat st;
+            for (const string* p : {&users_path_, &posts_path_, &engagements_path_}) {
+                if (::stat(p->c_str(), &st) == 0) b += static_cast<size_t>(st.st_size);
+            }
+            return b;
+        }
+
+        // Resident tables plus the transient buffers of a load of `input` bytes: the last
+        // measured load's peak scaled by input size, or kLoadBytesPerInputByte before one.
+        size_t projected_load_peak(size_t input) const {
+            size_t seen_input = last_load_input_.load(memory_order_relaxed);
+            size_t seen_peak = last_load_peak_.load(memory_order_relaxed);
+            size_t transient = seen_input && seen_peak ? static_cast<size_t>(double(seen_peak) * double(input) / double(seen_input))
+                                                       : input * kLoadBytesPerInputByte;
+            return resident_after_load_.load(memory_order_relaxed) + transient;
+        }
+
+        // Start a load: false (and nothing is read) if its projected peak exceeds the budget.
+        bool admit_load() {
+            size_t budget = memory_budget_.load(memory_order_relaxed);
+            if (budget && projected_load_peak(input_bytes()) > budget) {
+                refused_loads_.fetch_add(1, memory_order_relaxed);
+                return false;
+            }
+            load_mem_.begin();
+            return true;
+        }
+
+        // Dump a snapshot as a CSV triple in the loaders' format.
+        static void write_snapshot_csv(const DbSnapshot& snap, const ShardPaths& out) {
+            auto open = [](const string& path) {
+                ofstream f(path, ios::trunc);
+                ASSERT_WITH_MESSAGE(f.good(), "File failed: " + path);
+                return f;
+            };
+            ofstream users_out = open(out.users);
+            users_out << "id,username,location\n";
+            snap.users.scan([&](const UserSegment& seg, size_t i) {
+                users_out << User(seg.id->v[i], seg.username->v[i], seg.location->v[i]).toCSV();
+            });
+            ofstream posts_out = open(out.posts);
+            posts_out << "id,content,username,views\n";
+            snap.posts.scan([&](const PostSegment& seg, size_t i) {
+                posts_out << Post(seg.id->v[i], seg.content->v[i], seg.username->v[i], seg.views->v[i]).toCSV();
+            });
+            ofstream eng_out = open(out.engagements);
+            eng_out << "id,postId,username,type,comment,timestamp\n";
+            snap.engagements.scan([&](const EngagementSegment& seg, size_t i) {
+                eng_out << Engagement(seg.id->v[i], seg.postId->v[i], seg.username->v[i], seg.type->v[i],
+                                      seg.comment->v[i], seg.timestamp->v[i]).toCSV();
+            });
+        }
+
+        // Everything derived from the engagements table: built by loads, maintained by writes
+        struct DerivedViews {
+            EngagementSketches sketches;
+            EngagementRollups rollups;
+            ActivityFeeds feeds;
+        };
+
+        static size_t derived_bytes(const DerivedViews& d) {
+            return d.sketches.memory_bytes() + d.rollups.memory_bytes() + d.feeds.memory_bytes();
+        }
+
+        // Column blocks and lookup maps of one version.
+        static size_t snapshot_bytes(const DbSnapshot& snap) {
+            size_t b = heap_bytes(snap.users) + heap_bytes(snap.posts) + heap_bytes(snap.engagements);
+            if (snap.user_row) b += heap_bytes(*snap.user_row);
+            if (snap.post_row) b += heap_bytes(*snap.post_row);
+            if (snap.username_count) b += heap_bytes(*snap.username_count);
+            return b;
+        }
+
+        static DerivedViews build_derived(const DbSnapshot& snap, WorkStealingPool* pool) {
+            return {EngagementSketches::build(snap.engagements, pool), EngagementRollups::build(snap, pool),
+                    ActivityFeeds::build(snap, pool)};
+        }
+
+        // Caller holds every engagements stripe, so no add_engagements update can be lost.
+        void install_derived(DerivedViews&& d) {
+            { lock_guard<mutex> lk(sketch_mtx_); sketches_ = move(d.sketches); }
+            { lock_guard<mutex> lk(rollup_mtx_); rollups_ = move(d.rollups); }
+            { lock_guard<mutex> lk(feed_mtx_); feeds_ = move(d.feeds); }
+        }
+
+        // Worker pool, created on first use; declared last so it is joined before the tables go away
+        unsigned pool_threads_;
+        once_flag pool_once_;
+        unique_ptr<WorkStealingPool> pool_;
+        // Scans of at least this many rows run on the pool
+        atomic<size_t> parallel_scan_min_rows_{2 * kSegmentRows};
+
+        WorkStealingPool* scan_pool(size_t rows) {
+            return rows >= parallel_scan_min_rows_.load(memory_order_relaxed) ? &threadPool() : nullptr;
+        }
+
+        // Replace the head version wholesale (loads).
+        void publish(shared_ptr<DbSnapshot> next, unordered_map<int, uint32_t>& eng_row) {
+            lock_guard<ProfiledSharedMutex> lk(version_mtx_);
+            eng_row_.swap(eng_row);
+            next->version = atomic_load(&snapshot_)->version + 1;
+            if (repl_.active()) repl_.append(next->version, {{'L', {}}});
+            atomic_store(&snapshot_, shared_ptr<const DbSnapshot>(move(next)));
+        }
+
+        // Swap freshly loaded tables in under every stripe lock and publish their snapshot.
+        // With a pool, the snapshot tables and the stripe partitions are built concurrently.
+        void commit_load(map<int, unique_ptr<User>>& tmp_users,
+                         map<int, unique_ptr<Post>>& tmp_posts,
+                         map<int, unique_ptr<Engagement>>& tmp_eng,
+                         WorkStealingPool* pool = nullptr) {
+            // build the read snapshot and stripe partitions before taking any lock
+            unordered_map<int, uint32_t> eng_row;
+            optional<TraceSpan> span(in_place, trace_, "build snapshot");
+            shared_ptr<DbSnapshot> snap = build_snapshot(tmp_users, tmp_posts, tmp_eng, &eng_row, pool);
+            span.emplace(trace_, "build derived views");
+            DerivedViews derived = build_derived(*snap, pool);
+            span.reset();
+            load_mem_.charge(LoadBuffer::NewSnapshot, [&] { return snapshot_bytes(*snap) + heap_bytes(eng_row) + derived_bytes(derived); });
+            metrics_->add_loaded(EngineMetrics::kUsers, tmp_users.size());
+            metrics_->add_loaded(EngineMetrics::kPosts, tmp_posts.size());
+            metrics_->add_loaded(EngineMetrics::kEngagements, tmp_eng.size());
+
+            StripedTable<User>::Parts user_parts;
+            StripedTable<Post>::Parts post_parts;
+            StripedTable<Engagement>::Parts eng_parts;
+            auto part_users = [&] { TraceSpan s(trace_, "partition users"); user_parts = StripedTable<User>::partition(move(tmp_users)); };
+            auto part_posts = [&] { TraceSpan s(trace_, "partition posts"); post_parts = StripedTable<Post>::partition(move(tmp_posts)); };
+            auto part_engs = [&] { TraceSpan s(trace_, "partition engagements"); eng_parts = StripedTable<Engagement>::partition(move(tmp_eng)); };
+            if (pool) {
+                auto fu_users = pool->submit(part_users);
+                auto fu_posts = pool->submit(part_posts);
+                part_engs();
+                pool->wait(fu_users);
+                pool->wait(fu_posts);
+            } else {
+                part_users();
+                part_posts();
+                part_engs();
+            }
+
+            TraceSpan commit_span(trace_, "commit swap");
+            auto requested = chrono::steady_clock::now();
+            auto ul = users.lock_all();
+            auto pl = posts.lock_all();
+            auto el = engagements.lock_all();
+            LockTimer held(*metrics_, requested);
+            users.swap_rows(user_parts);
+            posts.swap_rows(post_parts);
+            engagements.swap_rows(eng_parts);
+            publish(move(snap), eng_row);
+            install_derived(move(derived));
+            result_cache_.clear();
+            // the load's row objects and snapshot are the resident tables now
+            if (load_mem_.measuring()) {
+                resident_after_load_.store(load_mem_.live(), memory_order_relaxed);
+                last_load_peak_.store(load_mem_.peak(), memory_order_relaxed);
+                last_load_input_.store(input_bytes(), memory_order_relaxed);
+            }
+            load_mem_.release_all();
+        }
+
+        /**
+         * @brief Apply a views delta in memory and queue it for the next posts CSV rewrite.
+         * @param ticket Receives the group-commit ticket to pass to flush_post_views().
+         * @return false if post_id does not exist.
+         */
+        bool stage_post_views(int post_id, int views_count, uint64_t& ticket) {
+            // Lock the post's stripe for read+modify+enqueue
+            auto requested = chrono::steady_clock::now();
+            unique_lock<ProfiledSharedMutex> lock(posts.mutex_of(post_id));
+            LockTimer held(*metrics_, requested);
+
+            auto it = posts.find(post_id);
+            if (it == posts.end()) 
+                return false; 
+
+            // Update in-memory
+            Post* p = it->second.get();
+
+            int new_views = p->views + views_count;
+            if (new_views < 0) {
+                new_views = 0; 
+            }
+            p->views = new_views;
+
+            // same-post updates are ordered by the stripe lock, so the latest value wins
+            lock_guard<mutex> lk(views_mtx_);
+            views_pending_[post_id] = new_views;
+            ticket = ++views_enqueued_;
+            return true;
+        }
+
+        /**
+         * @brief Validate, append and publish engagements in submission order.
+         * @details Rows failing foreign-key checks are dropped. The survivors cost one CSV
+         *          append and one snapshot edit; their stripes are locked in index order.
+         * @return Per record, in batch order: whether it was applied.
+         */
+        vector<bool> add_engagements(const vector<const Engagement*>& batch) {
+            // Validate username postId (users and posts only change membership on load/rename)
+            vector<const Engagement*> valid;
+            vector<bool> applied(batch.size());
+            {
+                shared_ptr<const DbSnapshot> snap = snapshot();
+                for (size_t i = 0; i < batch.size(); ++i) {
+                    const Engagement* e = batch[i];
+                    if (snap->post_row->count(e->postId) && snap->username_count->count(e->username)) {
+                        valid.push_back(e);
+                        applied[i] = true;
+                    }
+                }
+            }
+            metrics_->add_rejected(EngineMetrics::kEngagements, batch.size() - valid.size());
+            if (valid.empty())
+                return applied;
+
+            // lock every touched stripe, in index order
+            set<size_t> stripe_ids;
+            for (const Engagement* e : valid) stripe_ids.insert(StripedTable<Engagement>::stripe_of(e->id));
+            auto requested = chrono::steady_clock::now();
+            vector<unique_lock<ProfiledSharedMutex>> locks;
+            for (size_t sid : stripe_ids) locks.emplace_back(engagements.stripe_mutex(sid));
+            LockTimer held(*metrics_, requested);
+
+            {
+                // concurrent callers on other stripes share one append
+                string lines;
+                for (const Engagement* e : valid) lines += e->toCSV();
+                eng_log_.append(lines);
+                metrics_->add_written(lines.size());
+            }
+
+            for (const Engagement* e : valid) {
+                engagements[e->id] = make_unique<Engagement>(e->id, e->postId, e->username, e->type, e->comment, e->timestamp);
+            }
+
+            // append to the snapshot, or rewrite the row in place when the id already exists
+            vector<string> replaced_owners;
+            vector<Engagement> replaced_rows;
+            publish_edit([&](DbSnapshot& next) {
+                for (const Engagement* e : valid) {
+                    auto found = eng_row_.find(e->id);
+                    if (found == eng_row_.end()) {
+                        eng_row_[e->id] = static_cast<uint32_t>(next.engagements.rows);
+                        append_row(next.engagements, *e);
+                        continue;
+                    }
+                    size_t row = found->second;
+                    const EngagementSegment& old_seg = next.engagements.segment(row);
+                    size_t slot = TableVersion<EngagementSegment>::slot(row);
+                    replaced_owners.push_back(old_seg.username->v[slot]);
+                    replaced_rows.emplace_back(e->id, old_seg.postId->v[slot], old_seg.username->v[slot], old_seg.type->v[slot],
+                                               old_seg.comment->v[slot], old_seg.timestamp->v[slot]);
+                    cow_segments(next.engagements, {row / kSegmentRows}, [&](EngagementSegment& seg, size_t) {
+                        seg.postId = cow_block(seg.postId);
+                        seg.username = cow_block(seg.username);
+                        seg.type = cow_block(seg.type);
+                        seg.comment = cow_block(seg.comment);
+                        seg.timestamp = cow_block(seg.timestamp);
+                        fill_slot(seg, TableVersion<EngagementSegment>::slot(row), *e);
+                    });
+                }
+            }, [&](vector<ReplChange>& log) {
+                for (const Engagement* e : valid) {
+                    log.push_back({'E', {to_string(e->id), to_string(e->postId), e->username, e->type, e->comment,
+                                         to_string(e->timestamp)}});
+                }
+            });
+
+            {
+                // an overwritten id is counted again; the next load rebuilds exactly
+                lock_guard<mutex> lk(sketch_mtx_);
+                for (const Engagement* e : valid) sketches_.add(e->postId, e->username);
+            }
+            {
+                // an overwritten id moves its counts from the old row to the new one
+                lock_guard<mutex> lk(rollup_mtx_);
+                for (const Engagement* e : valid) rollups_.add(e->postId, e->username, e->type, e->timestamp);
+                for (const Engagement& old : replaced_rows) rollups_.remove(old.postId, old.username, old.type, old.timestamp);
+            }
+            {
+                shared_ptr<const DbSnapshot> snap = snapshot();
+                lock_guard<mutex> lk(feed_mtx_);
+                for (const Engagement* e : valid) {
+                    feeds_.add(e->username, ActivityFeeds::author_of(*snap, e->postId), e->id, e->postId, e->type, e->timestamp);
+                }
+            }
+
+            // an overwritten row may have belonged to another user; drop that user's results too
+            set<string> touched;
+            for (const Engagement* e : valid) touched.insert(e->username);
+            for (const string& previous : replaced_owners) touched.insert(previous);
+            for (const string& name : touched) result_cache_.invalidate(name);
+            return applied;
+        }
+
+        void enqueue_async(PendingOp op) {
+            bool start = false;
+            {
+                lock_guard<mutex> lk(async_mtx_);
+                async_queue_.push_back(move(op));
+                start = !async_draining_;
+                async_draining_ = true;
+            }
+            if (start) threadPool().submit([this] { drain_async(); });
+        }
+
+        // Single drain task: takes everything queued so far as one batch until the queue is empty.
+        void drain_async() {
+            for (;;) {
+                deque<PendingOp> batch;
+                {
+                    lock_guard<mutex> lk(async_mtx_);
+                    if (async_queue_.empty()) {
+                        async_draining_ = false;
+                        return;
+                    }
+                    batch.swap(async_queue_);
+                }
+                run_async_batch(batch);
+            }
+        }
+
+        /**
+         * @brief Execute one batch of async operations.
+         * @details Between barriers (renames) and fences operations are independent and are
+         *          reordered: reads go to the pool right away, all views deltas share one group
+         *          commit, and all engagements share one append. Updates to the same post keep
+         *          their order. Reads behind a fence are held until the writes queued so far
+         *          are flushed, so they still share the batch's one group commit.
+         */
+        void run_async_batch(deque<PendingOp>& batch) {
+            vector<PendingOp*> views, engs;
+            vector<function<void()>> held;   // reads behind a fence
+            bool fenced = false;
+
+            auto flush = [&] {
+                uint64_t ticket = 0;
+                vector<bool> found(views.size());
+                for (size_t i = 0; i < views.size(); ++i) {
+                    uint64_t t = 0;
+                    found[i] = stage_post_views(views[i]->post_id, views[i]->views_count, t);
+                    ticket = max(ticket, t);
+                }
+                if (ticket) flush_post_views(ticket);
+                for (size_t i = 0; i < views.size(); ++i) views[i]->views_done.set_value(found[i]);
+
+                vector<const Engagement*> records;
+                for (PendingOp* op : engs) records.push_back(op->record.get());
+                vector<bool> applied = add_engagements(records);
+                for (size_t i = 0; i < engs.size(); ++i) engs[i]->eng_done.set_value(applied[i]);
+
+                views.clear();
+                engs.clear();
+                for (auto& read : held) threadPool().submit(move(read));
+                held.clear();
+                fenced = false;
+            };
+
+            for (PendingOp& op : batch) {
+                switch (op.kind) {
+                    case PendingOp::Kind::Read:
+                        if (fenced) held.push_back(move(op.run));
+                        else threadPool().submit(move(op.run));
+                        break;
+                    case PendingOp::Kind::PostViews:
+                        views.push_back(&op);
+                        break;
+                    case PendingOp::Kind::Engagement:
+                        engs.push_back(&op);
+                        break;
+                    case PendingOp::Kind::Barrier:
+                        flush();
+                        op.run();
+                        break;
+                    case PendingOp::Kind::Fence:
+                        fenced = fenced || !views.empty() || !engs.empty();
+                        break;
+                }
+            }
+            flush();
+        }
+
+        template <typename R, typename Fn>
+        future<R> submit_read(Fn&& fn) {
+            auto task = make_shared<packaged_task<R()>>(forward<Fn>(fn));
+            future<R> fut = task->get_future();
+            PendingOp op(PendingOp::Kind::Read, [task] { (*task)(); });
+            enqueue_async(move(op));
+            return fut;
+        }
+
+        /**
+         * @brief Block until the post views update holding `ticket` is on disk and published.
+         * @details The first waiter becomes the leader: it takes every pending update, rewrites
+         *          posts CSV once for all of them, publishes one snapshot and wakes the rest.
+         */
+        void flush_post_views(uint64_t ticket) {
+            unique_lock<mutex> lk(views_mtx_);
+            while (views_flushed_ < ticket) {
+                if (views_leader_) {
+                    views_cv_.wait(lk);
+                    continue;
+                }
+                views_leader_ = true;
+                unordered_map<int, int> batch;
+                batch.swap(views_pending_);
+                uint64_t upto = views_enqueued_;
+                lk.unlock();
+
+                {
+                    lock_guard<ProfiledSharedMutex> file_lk(posts_file_mtx_);
+                    metrics_->add_written(rewrite_post_views_batch(posts_path_, batch));
+                }
+                publish_edit([&](DbSnapshot& next) {
+                    map<size_t, vector<pair<size_t, int>>> by_seg;
+                    for (const auto& kv : batch) {
+                        auto row = next.post_row->find(kv.first);
+                        if (row != next.post_row->end()) // gone if a reload raced with us
+                            by_seg[row->second / kSegmentRows].push_back({row->second, kv.second});
+                    }
+                    vector<size_t> seg_ids;
+                    for (const auto& kv : by_seg) seg_ids.push_back(kv.first);
+                    cow_segments(next.posts, seg_ids, [&](PostSegment& seg, size_t s) {
+                        seg.views = cow_block(seg.views);
+                        for (const auto& rv : by_seg[s])
+                            seg.views->v[TableVersion<PostSegment>::slot(rv.first)] = rv.second;
+                    });
+                }, [&](vector<ReplChange>& log) {
+                    for (const auto& kv : batch) log.push_back({'V', {to_string(kv.first), to_string(kv.second)}});
+                });
+
+                lk.lock();
+                views_flushed_ = upto;
+                views_leader_ = false;
+                views_cv_.notify_all();
+            }
+        }
+
+        // Derive the next version from the head one; edit must copy-on-write what it changes.
+        // With replicas attached, log() describes the edit for the change stream; it runs under
+        // the version mutex so the stream stays in version order.
+        template <typename Edit>
+        void publish_edit(Edit&& edit, const function<void(vector<ReplChange>&)>& log = nullptr) {
+            lock_guard<ProfiledSharedMutex> lk(version_mtx_);
+            shared_ptr<const DbSnapshot> cur = atomic_load(&snapshot_);
+            auto next = make_shared<DbSnapshot>(*cur);
+            edit(*next);
+            next->version = cur->version + 1;
+            if (repl_.active()) {
+                vector<ReplChange> changes;
+                if (log) log(changes);
+                repl_.append(next->version, changes);
+            }
+            atomic_store(&snapshot_, shared_ptr<const DbSnapshot>(move(next)));
+        }
+
+    public:
+    
+        /**
+         * @param pool_threads Size of the engine's worker pool; 0 uses hardware_concurrency().
+         */
+        FlatFile(std::string users_csv_path, std::string posts_csv_path, std::string engagements_csv_path,
+                 unsigned pool_threads = 0): 
+        users_path_(move(users_csv_path)), 
+        posts_path_(move(posts_csv_path)), 
+        engagements_path_(move(engagements_csv_path)),
+        eng_log_(engagements_path_),
+        snapshot_(build_snapshot({}, {}, {})),
+        pool_threads_(pool_threads) {
+            // UNUSED(users_csv_path);
+            // UNUSED(posts_csv_path);
+            // UNUSED(engagements_csv_path);
+            users.set_lock_profile(&locks_->users);
+            posts.set_lock_profile(&locks_->posts);
+            engagements.set_lock_profile(&locks_->engagements);
+            posts_file_mtx_.set_profile(&locks_->posts_file);
+            version_mtx_.set_profile(&locks_->version);
+            if (const char* out = std::getenv("BUZZDB_TRACE"); out && *out) {
+                trace_.set_output(out);
+                trace_.enable(true);
+            }
+        }
+
+        ~FlatFile() { disableIngestMode(); }
+
+        /**
+         * @brief Single-threaded load of users, posts, and engagements from CSVs.
+         *
+         * @details
+         *  - Reads from the instance paths (users_path, posts_path, engagements_path).
+         *  - Skip the first header line; ignore empty/malformed rows rather than throwing.
+         *  - Parse into temporary maps, then swap into shared maps under mutexes.
+         *  - Ensure referential integrity across tables
+         *
+         * @return false if the memory budget refused the load (see setMemoryBudget); the
+         *         tables are then unchanged.
+         * @thread_safety  Safe to call concurrently; the final commit is serialized by internal mutexes.
+         * @throws Aborts via ASSERT_WITH_MESSAGE if a CSV cannot be opened.
+         * @complexity  O(U + P + E) over rows read, plus I/O.
+         */
+        bool loadFlatFile() {
+            OpTimer timed(*metrics_, EngineOp::LoadFlatFile);
+            TraceFlush flush_trace(trace_);
+            TraceSpan load_span(trace_, "loadFlatFile");
+            if (!admit_load()) return false;
+            
+            // TODO: add your implementation here
+
+            //remove head and tail blank and special symbols
+            auto trim = [](string &s) {
+                // get pure lines
+                size_t start = s.find_first_not_of(" \t\n\r\f\v");
+                size_t end = s.find_last_not_of(" \t\n\r\f\v");
+                //clear blank lines
+                if (start == string::npos) {
+                    s.clear();
+                } else {
+                    s = s.substr(start, end - start + 1);
+                }
+            };
+
+            //convert string to integer and check if available
+            auto to_int = [](const string &str, int &value) -> bool {
+                if (str.empty()) return false;
+                
+                stringstream ss(str);
+                ss >> value;
+
+                // check the format
+                if (ss.fail() || !ss.eof()) return false;
+
+                return true;
+            };
+
+            auto split_csv = [&](const string& line)->vector<string>{
+                vector<string> arr;
+                stringstream ss(line);
+                string str;
+
+                while (getline(ss, str, ',')) 
+                    arr.push_back(str);
+
+                return arr;
+            };
+
+            // non-empty data lines read vs. accepted per table, for the reject counters
+            size_t seen[3] = {}, kept[3] = {};
+
+            // declare temp map, set id as key
+            map<int, unique_ptr<User>> tmp_users;
+            map<int, unique_ptr<Post>> tmp_posts;
+            map<int, unique_ptr<Engagement>> tmp_eng;
+
+            // map users.csv
+            {
+                TraceSpan span(trace_, "parse " + users_path_);
+                PhaseClock ph(trace_.enabled());
+                LineReader f(users_path_);
+                ASSERT_WITH_MESSAGE(f.is_open(), "File failed: " + users_path_);
+
+                string line; 
+                bool header_if = true;
+
+                while (ph.getline(f, line)) {
+                    if (header_if) { 
+                        header_if = false; 
+                        continue; 
+                    }
+
+                    if (line.empty()) 
+                        continue;
+                        
+                    vector<string> arr = split_csv(line);
+                    ++seen[EngineMetrics::kUsers];
+
+                    if (arr.size() != 3) 
+                        continue; 
+
+                    for (size_t i = 0; i < arr.size(); ++i) {
+                        trim(arr[i]);
+                    }
+                    ph.enter(kPhaseParseInt);
+
+                    int id;
+                    if (!to_int(arr[0], id)) 
+                        continue;
+
+                    ph.enter(kPhaseConstruct);
+                    ++kept[EngineMetrics::kUsers];
+                    tmp_users[id] = make_unique<User>(id, arr[1], arr[2]);
+                }
+                metrics_->add_read(f.bytes_read());
+                ph.annotate(span, kept[EngineMetrics::kUsers], f.bytes_read());
+                load_mem_.charge(LoadBuffer::ParsedUsers, [&] { return heap_bytes(tmp_users); }, tmp_users.size());
+            }
+
+            // referential integrity on posts， engagements
+            unordered_set<string> usernames_set;
+
+            {
+                TraceSpan span(trace_, "index usernames");
+                for (auto i = tmp_users.begin(); i != tmp_users.end(); ++i) {
+                    User* user_ptr = i->second.get();
+                    string username = user_ptr->username;
+                    usernames_set.insert(username);
+                }
+            }
+
+            // map posts.csv // id,content,username,views
+            {
+                TraceSpan span(trace_, "parse " + posts_path_);
+                PhaseClock ph(trace_.enabled());
+                LineReader f(posts_path_);
+                ASSERT_WITH_MESSAGE(f.is_open(), "File failed: " + posts_path_);
+
+                string line; 
+                bool header_if = true;
+
+                while (ph.getline(f, line)) {
+
+
+                    if (header_if) { 
+                        header_if = false; 
+                        continue; 
+                    }
+
+                    if (line.empty()) 
+                        continue;
+                        
+                    vector<string> arr = split_csv(line);
+                    ++seen[EngineMetrics::kPosts];
+
+                    if (arr.size() != 4) 
+                        continue; 
+
+                    for (size_t i = 0; i < arr.size(); ++i) {
+                        trim(arr[i]);
+                    }
+                    ph.enter(kPhaseParseInt);
+
+                    int id;
+                    if (!to_int(arr[0], id)) 
+                        continue;
+
+                    int views;
+                    if (!to_int(arr[3], views)) 
+                        continue;
+
+                    ph.enter(kPhaseFilter);
+                    if (usernames_set.find(arr[2]) == usernames_set.end()) 
+                        continue;
+
+                    ph.enter(kPhaseConstruct);
+                    ++kept[EngineMetrics::kPosts];
+                    tmp_posts[id] = make_unique<Post>(id, arr[1], arr[2], views);
+                }
+                metrics_->add_read(f.bytes_read());
+                ph.annotate(span, kept[EngineMetrics::kPosts], f.bytes_read());
+                load_mem_.charge(LoadBuffer::ParsedPosts, [&] { return heap_bytes(tmp_posts); }, tmp_posts.size());
+            }
+
+            // post id set for engagements RI
+            unordered_set<int> post_ids;
+
+            {
+                TraceSpan span(trace_, "index post ids");
+                for (auto i = tmp_posts.begin(); i != tmp_posts.end(); ++i) {
+                    int id = i->first;
+                    post_ids.insert(id);
+                }
+            }
+            load_mem_.charge(LoadBuffer::IntegritySets, [&] { return heap_bytes(usernames_set) + heap_bytes(post_ids); });
+
+            // map engagements.csv // id,postId,username,type,comment,timestamp
+            {
+                TraceSpan span(trace_, "parse " + engagements_path_);
+                PhaseClock ph(trace_.enabled());
+                LineReader f(engagements_path_);
+                ASSERT_WITH_MESSAGE(f.is_open(), "File failed: " + engagements_path_);
+
+                string line; 
+                bool header_if = true;
+
+                while (ph.getline(f, line)) {
+                    if (header_if) { 
+                        header_if = false; 
+                        continue; 
+                    }
+
+                    if (line.empty()) 
+                        continue;
+                        
+                    vector<string> arr = split_csv(line);
+                    ++seen[EngineMetrics::kEngagements];
+
+                    if (arr.size() != 6) 
+                        continue; 
+
+                    for (size_t i = 0; i < arr.size(); ++i) {
+                        trim(arr[i]);
+                    }
+                    ph.enter(kPhaseParseInt);
+
+                    int id, post_id, timestamp;
+                    if (!to_int(arr[0], id)) 
+                        continue;
+                    if (!to_int(arr[1], post_id)) 
+                        continue;
+                    if (!to_int(arr[5], timestamp)) 
+                        continue;
+                    ph.enter(kPhaseFilter);
+                    if (post_ids.find(post_id) == post_ids.end())
+                        continue;           // post must exist
+                    if (usernames_set.find(arr[2]) == usernames_set.end())
+                        continue;  // user must exist
+
+                    ph.enter(kPhaseConstruct);
+                    ++kept[EngineMetrics::kEngagements];
+                    tmp_eng[id] = make_unique<Engagement>(id, post_id, arr[2], arr[3], arr[4], timestamp);
+                }
+                metrics_->add_read(f.bytes_read());
+                ph.annotate(span, kept[EngineMetrics::kEngagements], f.bytes_read());
+                load_mem_.charge(LoadBuffer::ParsedEngagements, [&] { return heap_bytes(tmp_eng); }, tmp_eng.size());
+            }
+
+            for (size_t t = 0; t < 3; ++t)
+                metrics_->add_rejected(EngineMetrics::Table(t), seen[t] - kept[t]);
+
+            // free the integrity sets before the snapshot build adds its own peak
+            unordered_set<string>().swap(usernames_set);
+            unordered_set<int>().swap(post_ids);
+            load_mem_.release(LoadBuffer::IntegritySets);
+
+            // - Parse into temporary maps, then swap into shared maps under mutexes.
+            commit_load(tmp_users, tmp_posts, tmp_eng);
+            return true;
+        }
+
+        /**
+         * @brief Parallel loader for users, posts, and engagements from CSVs.
+         *
+         * @details
+         *  - Parse each CSV file as its own task on the engine pool into local containers.
+         *  - Build the snapshot and stripe partitions on the pool, then swap them in under mutexes.
+         *
+         * @return false if the memory budget refused the load; the tables are then unchanged.
+         * @thread_safety Safe to call concurrently; the final commit is serialized by internal mutexes.
+         * @throws Aborts via ASSERT_WITH_MESSAGE if any CSV cannot be opened.
+         * @complexity  O(U + P + E) total work; wall time reduced by parallel I/O/parse.
+         */
+        bool loadMultipleFlatFilesInParallel() {
+            OpTimer timed(*metrics_, EngineOp::LoadParallel);
+            TraceFlush flush_trace(trace_);
+            TraceSpan load_span(trace_, "loadMultipleFlatFilesInParallel");
+            if (!admit_load()) return false;
+            //helpers from serial
+            
+            auto trim = [](string &s) {
+                // get pure lines
+                size_t start = s.find_first_not_of(" \t\n\r\f\v");
+                size_t end = s.find_last_not_of(" \t\n\r\f\v");
+                //clear blank lines
+                if (start == string::npos) {
+                    s.clear();
+                } else {
+                    s = s.substr(start, end - start + 1);
+                }
+            };
+
+            auto split_csv = [&](const string& line)->vector<string>{
+                vector<string> arr;
+                stringstream ss(line);
+                string str;
+
+                while (getline(ss, str, ',')) 
+                    arr.push_back(str);
+
+                return arr;
+            };
+
+            auto to_int_fc = [](const string &str, int &value) -> bool {
+                if (str.empty()) return false;
+                
+                stringstream ss(str);
+                ss >> value;
+
+                // check the format
+                if (ss.fail() || !ss.eof()) return false;
+
+                return true;
+            };
+
+            // set a struct for each csv file
+            struct URow { 
+                int id; 
+                string username, 
+                location; 
+            };
+
+            struct PRow { 
+                int id; 
+                string content;
+                string username; 
+                int views; 
+            };
+
+            struct ERow { 
+                int id;
+                int postId; 
+                string username;
+                string type; 
+                string comment; 
+                int ts; 
+            };
+
+            // non-empty data lines per table, for the reject counters (summed over a table's parse tasks)
+            atomic<size_t> seen[3] = {};
+
+            // prase 3 files once
+            auto parse_users = [&](auto& f, const string& name, bool header) -> vector<URow> {
+                TraceSpan span(trace_, "parse " + name);
+                PhaseClock ph(trace_.enabled());
+                ASSERT_WITH_MESSAGE(f.is_open(), "File failed: " + name);
+                vector<URow> r; 
+                r.reserve(12000);
+                string line; 
+                bool header_if = header;
+                size_t string_bytes = 0, seen_here = 0;
+
+                while (ph.getline(f, line)) {
+                    if (header_if) { 
+                        header_if = false; 
+                        continue; 
+                    }
+
+                    if (line.empty()) 
+                        continue;
+                        
+                    vector<string> arr = split_csv(line);
+                    ++seen_here;
+
+                    if (arr.size() != 3) 
+                        continue; 
+
+                    for (size_t i = 0; i < arr.size(); ++i) {
+                        trim(arr[i]);
+                    }
+                    ph.enter(kPhaseParseInt);
+
+                    int id;
+                    if (!to_int_fc(arr[0], id)) 
+                        continue;
+                    
+                    ph.enter(kPhaseConstruct);
+                    string_bytes += heap_bytes(arr[1]) + heap_bytes(arr[2]);
+                    r.push_back({id, std::move(arr[1]), std::move(arr[2])});
+
+                    //tmp_users[id] = make_unique<User>(id, arr[1], arr[2]);
+                }
+                metrics_->add_read(f.bytes_read());
+                ph.annotate(span, r.size(), f.bytes_read());
+                seen[EngineMetrics::kUsers] += seen_here;
+                load_mem_.charge(LoadBuffer::ParsedUsers, [&] { return r.capacity() * sizeof(URow) + string_bytes; }, r.size());
+                return r;
+            };
+            auto parse_posts = [&](auto& f, const string& name, bool header) -> std::vector<PRow> {
+                TraceSpan span(trace_, "parse " + name);
+                PhaseClock ph(trace_.enabled());
+                ASSERT_WITH_MESSAGE(f.is_open(), "File failed: " + name);
+                vector<PRow> r; 
+                r.reserve(5000);
+                string line; 
+                bool header_if = header;
+                size_t string_bytes = 0, seen_here = 0;
+
+                while (ph.getline(f, line)) {
+
+                    if (header_if) { 
+                        header_if = false; 
+                        continue; 
+                    }
+
+                    if (line.empty()) 
+                        continue;
+                        
+                    vector<string> arr = split_csv(line);
+                    ++seen_here;
+
+                    if (arr.size() != 4) 
+                        continue; 
+
+                    for (size_t i = 0; i < arr.size(); ++i) {
+                        trim(arr[i]);
+                    }
+                    ph.enter(kPhaseParseInt);
+
+                    int id;
+                    if (!to_int_fc(arr[0], id)) 
+                        continue;
+
+                    int views;
+                    if (!to_int_fc(arr[3], views)) 
+                        continue;
+                    
+                    // if (usernames_set.find(arr[2]) == usernames_set.end()) 
+                    //     continue;
+
+                    ph.enter(kPhaseConstruct);
+                    string_bytes += heap_bytes(arr[1]) + heap_bytes(arr[2]);
+                    r.push_back({id, move(arr[1]), move(arr[2]), views});
+                    //tmp_posts[id] = make_unique<Post>(id, arr[1], arr[2], views);
+                }
+                metrics_->add_read(f.bytes_read());
+                ph.annotate(span, r.size(), f.bytes_read());
+                seen[EngineMetrics::kPosts] += seen_here;
+                load_mem_.charge(LoadBuffer::ParsedPosts, [&] { return r.capacity() * sizeof(PRow) + string_bytes; }, r.size());
+                return r;
+            };
+            auto parse_engs = [&](auto& f, const string& name, bool header) -> std::vector<ERow> {
+                TraceSpan span(trace_, "parse " + name);
+                PhaseClock ph(trace_.enabled());
+                ASSERT_WITH_MESSAGE(f.is_open(), "File failed: " + name);
+                vector<ERow> r; 
+                r.reserve(12000);
+                string line; 
+                bool header_if = header;
+                size_t string_bytes = 0, seen_here = 0;
+
+                while (ph.getline(f, line)) {
+                    if (header_if) { 
+                        header_if = false; 
+                        continue; 
+                    }
+
+                    if (line.empty()) 
+                        continue;
+                        
+                    vector<string> arr = split_csv(line);
+                    ++seen_here;
+
+                    if (arr.size() != 6) 
+                        continue; 
+
+                    for (size_t i = 0; i < arr.size(); ++i) {
+                        trim(arr[i]);
+                    }
+                    ph.enter(kPhaseParseInt);
+
+                    int id, post_id, timestamp;
+                    if (!to_int_fc(arr[0], id)) 
+                        continue;
+                    if (!to_int_fc(arr[1], post_id)) 
+                        continue;
+                    if (!to_int_fc(arr[5], timestamp)) 
+                        continue;
+                    // if (post_ids.find(post_id) == post_ids.end())
+                    //     continue;           // post must exist
+                    // if (usernames_set.find(arr[2]) == usernames_set.end())
+                    //     continue;  // user must exist
+                    ph.enter(kPhaseConstruct);
+                    string_bytes += heap_bytes(arr[2]) + heap_bytes(arr[3]) + heap_bytes(arr[4]);
+                    r.push_back({id, post_id, move(arr[2]), move(arr[3]), move(arr[4]), timestamp});
+                    //tmp_eng[id] = make_unique<Engagement>(id, post_id, arr[2], arr[3], arr[4], timestamp);
+                }
+                metrics_->add_read(f.bytes_read());
+                ph.annotate(span, r.size(), f.bytes_read());
+                seen[EngineMetrics::kEngagements] += seen_here;
+                load_mem_.charge(LoadBuffer::ParsedEngagements, [&] { return r.capacity() * sizeof(ERow) + string_bytes; }, r.size());
+                return r;
+            };
+
+            // 真正并行：各自只读一次文件 (on the engine pool). A CSV is one task (or run right here
+            // when `here`); a block file is one task per range of blocks (the last also takes the
+            // raw tail), so its blocks are decompressed and parsed concurrently. Parts are
+            // concatenated in file order.
+            WorkStealingPool& pool = threadPool();
+            auto submit_parse = [&](const string& path, auto parse, bool here) {
+                using Rows = decltype(parse(declval<LineReader&>(), path, true));
+                vector<future<Rows>> parts;
+                auto file = make_shared<const BlockFile>(path);
+                if (!file->ok()) {
+                    auto whole = [=] {
+                        LineReader f(path);
+                        return parse(f, path, true);
+                    };
+                    if (!here) {
+                        parts.push_back(pool.submit(whole));
+                        return parts;
+                    }
+                    packaged_task<Rows()> task(whole);
+                    parts.push_back(task.get_future());
+                    task();
+                    return parts;
+                }
+                size_t nblocks = file->blocks();
+                size_t tasks = max<size_t>(1, min<size_t>(nblocks, pool.size() + 1));
+                for (size_t k = 0; k < tasks; ++k) {
+                    size_t first = nblocks * k / tasks, last = nblocks * (k + 1) / tasks;
+                    parts.push_back(pool.submit([=] {
+                        BlockLineReader f(file, first, last, k + 1 == tasks);
+                        return parse(f, path + " [" + to_string(first) + "," + to_string(last) + ")", first == 0);
+                    }));
+                }
+                return parts;
+            };
+            auto gather = [&](auto& parts) {
+                auto rows = pool.wait(parts[0]);
+                for (size_t k = 1; k < parts.size(); ++k) {
+                    auto more = pool.wait(parts[k]);
+                    rows.insert(rows.end(), make_move_iterator(more.begin()), make_move_iterator(more.end()));
+                }
+                return rows;
+            };
+            auto user_parts = submit_parse(users_path_, parse_users, false);
+            auto post_parts = submit_parse(posts_path_, parse_posts, false);
+            auto eng_parts = submit_parse(engagements_path_, parse_engs, true);
+
+            // get result after parsing (this thread runs queued parse tasks while it waits)
+            vector<ERow> erows = gather(eng_parts);
+            vector<URow> urows = gather(user_parts);
+            vector<PRow> prows = gather(post_parts);
+
+            // build username set
+            optional<TraceSpan> filter_span(in_place, trace_, "referential integrity");
+            unordered_set<string> usernames_set;
+            usernames_set.reserve(urows.size() * 2 + 1);
+            for (auto& u : urows) usernames_set.insert(u.username);
+
+            // check user exists
+            {
+                size_t count = 0;
+                for (size_t i = 0; i < prows.size(); ++i) {
+                    if (usernames_set.count(prows[i].username)) {
+                        if (count != i) 
+                            prows[count] = move(prows[i]);
+                        ++count;
+                    }
+                }
+                prows.resize(count);
+            }
+
+            // filter engagements
+            unordered_set<int> post_ids;
+            post_ids.reserve(prows.size() * 2 + 1);
+            // for (auto& p : prows) post_ids.insert(p.id);
+            for (size_t i = 0; i < prows.size(); i++) {
+                post_ids.insert(prows[i].id);
+            }
+
+            // filter engagements guarentee postId, username 
+            {
+                size_t w = 0;
+                for (size_t i = 0; i < erows.size(); ++i) {
+                    if (post_ids.count(erows[i].postId) && usernames_set.count(erows[i].username)) {
+                        if (w != i) erows[w] = move(erows[i]);
+                        ++w;
+                    }
+                }
+                erows.resize(w);
+            }
+
+            filter_span.reset();
+            load_mem_.charge(LoadBuffer::IntegritySets, [&] { return heap_bytes(usernames_set) + heap_bytes(post_ids); });
+
+            metrics_->add_rejected(EngineMetrics::kUsers, seen[EngineMetrics::kUsers] - urows.size());
+            metrics_->add_rejected(EngineMetrics::kPosts, seen[EngineMetrics::kPosts] - prows.size());
+            metrics_->add_rejected(EngineMetrics::kEngagements, seen[EngineMetrics::kEngagements] - erows.size());
+
+            // built temp arr
+            optional<TraceSpan> construct_span(in_place, trace_, "construct objects");
+            map<int, unique_ptr<User>> tmp_users;
+            map<int, unique_ptr<Post>> tmp_posts;
+            map<int, unique_ptr<Engagement>> tmp_eng;
+
+            // the parsed rows are dropped right after, so their strings move into the objects
+            for (size_t i = 0; i < urows.size(); ++i) {
+                User* userPtr = new User(urows[i].id, move(urows[i].username), move(urows[i].location));
+                tmp_users.insert(make_pair(urows[i].id, unique_ptr<User>(userPtr)));
+            }
+
+            // posts
+            for (size_t i = 0; i < prows.size(); ++i) {
+                Post* postPtr = new Post(prows[i].id, move(prows[i].content), move(prows[i].username), prows[i].views);
+                tmp_posts.insert(make_pair(prows[i].id, unique_ptr<Post>(postPtr)));
+            }
+
+            // engagements
+            for (size_t i = 0; i < erows.size(); ++i) {
+                Engagement* engPtr = new Engagement(erows[i].id, erows[i].postId,
+                                                    move(erows[i].username), move(erows[i].type),
+                                                    move(erows[i].comment), erows[i].ts);
+                tmp_eng.insert(make_pair(erows[i].id, unique_ptr<Engagement>(engPtr)));
+            }
+
+            construct_span.reset();
+            load_mem_.charge(LoadBuffer::RowObjects, [&] { return heap_bytes(tmp_users) + heap_bytes(tmp_posts) + heap_bytes(tmp_eng); },
+                             tmp_users.size() + tmp_posts.size() + tmp_eng.size());
+
+            // free the parse buffers and integrity sets before the snapshot build adds its own peak
+            vector<URow>().swap(urows);
+            vector<PRow>().swap(prows);
+            vector<ERow>().swap(erows);
+            unordered_set<string>().swap(usernames_set);
+            unordered_set<int>().swap(post_ids);
+            for (LoadBuffer b : {LoadBuffer::ParsedUsers, LoadBuffer::ParsedPosts, LoadBuffer::ParsedEngagements,
+                                 LoadBuffer::IntegritySets})
+                load_mem_.release(b);
+
+            // Atomic Commit
+            commit_load(tmp_users, tmp_posts, tmp_eng, &pool);
+            return true;
+
+        }
+
+        /**
+         * @brief Atomically increment a post’s view count and persist to CSV.
+         * @param post_id Target post id.
+         * @param views_count Amount to add (may be >1).
+         * @return true on success; false if post_id not found.
+         * @thread_safety Locks only the post's stripe; concurrent updates share one CSV rewrite.
+         * @side_effects Rewrites posts CSV with the updated row before returning.
+         */
+        bool updatePostViews(int post_id, int views_count) {
+            OpTimer timed(*metrics_, EngineOp::UpdatePostViews);
+            uint64_t ticket = 0;
+            if (!stage_post_views(post_id, views_count, ticket))
+                return false;
+
+            // write tmp then atomic rename (possibly by another updater on our behalf)
+            flush_post_views(ticket);
+            return true;
+        }
+
+        /**
+         * @brief Append a new engagement and persist to CSV.
+         * @param record Engagement to add.
+         * @thread_safety Foreign keys are checked against the snapshot; only the record's stripe is locked.
+         * @side_effects Appends to engagements CSV; ignores rows failing foreign-key checks.
+         *               In ingest mode the append happens later on the writer thread.
+         */
+        void addEngagementRecord(Engagement& record) {
+            OpTimer timed(*metrics_, EngineOp::AddEngagement);
+            if (ingest_) {
+                ingestEngagement(record);
+                return;
+            }
+            add_engagements({&record});
+        }
+    
+
+        /**
+         * @brief All comments by a user, ordered by (post_id, comment).
+         * @param user_id User id.
+         * @return Vector of <post_id, comment>.
+         * @thread_safety Runs on a pinned snapshot; never waits for writers.
+         * @complexity O(E) scan split across the pool for large tables, then one O(k log k) sort of the k hits.
+         */
+        vector<pair<int, string> > getAllUserComments(int user_id) {
+            OpTimer timed(*metrics_, EngineOp::GetAllUserComments);
+            using Comments = CommentsResult;
+            const string key = "comments:" + to_string(user_id);
+            if (auto hit = result_cache_.get(key)) return get<Comments>(move(*hit));
+            const uint64_t epoch = result_cache_.epoch();
+            shared_ptr<const DbSnapshot> snap = snapshot();
+
+            // Find username based on id
+            auto id_temp = snap->user_row->find(user_id);
+            if (id_temp == snap->user_row->end()) 
+                return {}; 
+
+            size_t row = id_temp->second;
+            const string& user_name = snap->users.segment(row).username->v[TableVersion<UserSegment>::slot(row)];
+
+            // Collect the comments per range, concatenate them, then sort once
+            Comments result = parallel_scan<Comments>(snap->engagements, scan_pool(snap->engagements.rows),
+                [&](const EngagementSegment& seg, size_t n, Comments& arr) {
+                    for (size_t i = 0; i < n; ++i) {
+                        if (seg.username->v[i] == user_name && seg.type->v[i] == "comment") {
+                            arr.push_back(make_pair(seg.postId->v[i], seg.comment->v[i]));
+                        }
+                    }
+                },
+                [](Comments& into, Comments& from) {
+                    into.insert(into.end(), make_move_iterator(from.begin()), make_move_iterator(from.end()));
+                });
+            sort(result.begin(), result.end());
+
+            size_t bytes = result.capacity() * sizeof(Comments::value_type);
+            for (const auto& c : result) bytes += c.second.capacity();
+            result_cache_.put(key, result, {user_name}, bytes, epoch);
+            return result;
+        }
+        
+
+        /**
+         * @brief Open a cursor over a user's comments (see CommentCursor).
+         * @param resume_token Start after this CommentCursor::token(); "" starts at the beginning.
+         * @param limit Upper bound on the items the caller will read; only that many rows are
+         *        sorted (partial sort), so paging costs O(E + limit log limit) instead of a full sort.
+         * @return An empty cursor if user_id does not exist; an empty cursor with ok() false if
+         *         resume_token is malformed.
+         * @thread_safety Runs on a pinned snapshot; never waits for writers.
+         */
+        CommentCursor openUserComments(int user_id, const string& resume_token = "", size_t limit = SIZE_MAX) {
+            OpTimer timed(*metrics_, EngineOp::OpenUserComments);
+            using Rows = vector<uint32_t>;
+            shared_ptr<const DbSnapshot> snap = snapshot();
+            auto id_temp = snap->user_row->find(user_id);
+            if (id_temp == snap->user_row->end())
+                return CommentCursor(snap, {});
+            size_t urow = id_temp->second;
+            const string& user_name = snap->users.segment(urow).username->v[TableVersion<UserSegment>::slot(urow)];
+
+            optional<tuple<int, string, int>> after;
+            if (!resume_token.empty()) {
+                after = CommentCursor::parse_token(resume_token);
+                if (!after) return CommentCursor(snap, {}, false);
+            }
+
+            // per-segment hits (absolute row numbers), concatenated in segment order
+            const auto& t = snap->engagements;
+            vector<Rows> hits((t.rows + kSegmentRows - 1) / kSegmentRows);
+            for_each_segment(t, scan_pool(t.rows), [&](size_t s, const EngagementSegment& seg, size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    if (seg.username->v[i] != user_name || seg.type->v[i] != "comment") continue;
+                    if (after && make_tuple(seg.postId->v[i], string_view(seg.comment->v[i]), seg.id->v[i]) <=
+                                 make_tuple(get<0>(*after), string_view(get<1>(*after)), get<2>(*after)))
+                        continue;
+                    hits[s].push_back(static_cast<uint32_t>(s * kSegmentRows + i));
+                }
+            });
+            Rows rows;
+            for (Rows& h : hits) rows.insert(rows.end(), h.begin(), h.end());
+
+            auto less = [&](uint32_t a, uint32_t b) {
+                return CommentCursor::key(*snap, a) < CommentCursor::key(*snap, b);
+            };
+            if (limit < rows.size()) {
+                partial_sort(rows.begin(), rows.begin() + limit, rows.end(), less);
+                rows.resize(limit);
+            } else {
+                sort(rows.begin(), rows.end(), less);
+            }
+            return CommentCursor(move(snap), move(rows));
+        }
+
+        /**
+         * @brief Count likes/comments for users in a location.
+         * @param location Exact location string.
+         * @return <likes_count, comments_count>.
+         * @thread_safety Runs on a pinned snapshot; never waits for writers.
+         * @complexity O(U + E); both scans are split across the pool for large tables.
+         */
+        pair<int,int> getAllEngagementsByLocation(string location) {
+            OpTimer timed(*metrics_, EngineOp::GetAllEngagementsByLocation);
+            using Names = unordered_set<string>;
+            const string key = "location:" + location;
+            if (auto hit = result_cache_.get(key)) return get<pair<int,int>>(*hit);
+            const uint64_t epoch = result_cache_.epoch();
+            shared_ptr<const DbSnapshot> snap = snapshot();
+
+            Names users_all = parallel_scan<Names>(snap->users, scan_pool(snap->users.rows),
+                [&](const UserSegment& seg, size_t n, Names& names) {
+                    for (size_t i = 0; i < n; ++i) {
+                        if (seg.location->v[i] == location) names.insert(seg.username->v[i]);
+                    }
+                },
+                [](Names& into, Names& from) { into.merge(from); });
+            if (users_all.empty()) 
+                return make_pair(0, 0);
+
+            // Scan engagements and count
+            pair<int,int> counts = parallel_scan<pair<int,int>>(snap->engagements, scan_pool(snap->engagements.rows),
+                [&](const EngagementSegment& seg, size_t n, pair<int,int>& counts) {
+                    for (size_t i = 0; i < n; ++i) {
+                        if (users_all.find(seg.username->v[i]) == users_all.end()) {
+                            continue;
+                        }
+                        if (seg.type->v[i] == "like") {
+                            counts.first++;
+                        } else if (seg.type->v[i] == "comment") {
+                            counts.second++;
+                        }
+                    }
+                },
+                [](pair<int,int>& into, pair<int,int>& from) {
+                    into.first += from.first;
+                    into.second += from.second;
+                });
+
+            // the result changes whenever any of these users engages or is renamed
+            vector<string> tags(users_all.begin(), users_all.end());
+            size_t bytes = 0;
+            for (const string& t : tags) bytes += t.capacity();
+            result_cache_.put(key, counts, move(tags), bytes, epoch);
+            return counts;
+        }
+
+        /**
+         * @brief Run a filter / group-by / aggregate query (see Query).
+         * @return Aggregates per group, sorted by group key.
+         * @thread_safety Runs on a pinned snapshot; never waits for writers.
+         * @complexity O(rows of the queried table); split across the pool for large tables.
+         */
+        QueryResult runQuery(const Query& q) {
+            OpTimer timed(*metrics_, EngineOp::RunQuery);
+            shared_ptr<const DbSnapshot> snap = snapshot();
+            switch (q.table()) {
+                case QueryTable::Users:
+                    return run_query(snap->users, q, scan_pool(snap->users.rows));
+                case QueryTable::Posts:
+                    return run_query(snap->posts, q, scan_pool(snap->posts.rows));
+                default:
+                    return run_query(snap->engagements, q, scan_pool(snap->engagements.rows));
+            }
+        }
+
+        /**
+         * @brief Run a hash join with grouped aggregates (see JoinQuery).
+         * @return Aggregates per group, sorted by group key.
+         * @thread_safety Runs on a pinned snapshot; never waits for writers.
+         * @complexity O(build rows + probe rows + matches); build and probe are split across the pool.
+         */
+        QueryResult runJoin(const JoinQuery& j) {
+            OpTimer timed(*metrics_, EngineOp::RunJoin);
+            shared_ptr<const DbSnapshot> snap = snapshot();
+            WorkStealingPool* pool = scan_pool(snap->engagements.rows + snap->posts.rows);
+            bool int_key = j.probeKey().is_int;
+            auto with_build = [&](const auto& probe) {
+                if (j.build().table() == QueryTable::Users) {
+                    return int_key ? run_join<long long>(probe, snap->users, j, pool)
+                                   : run_join<string_view>(probe, snap->users, j, pool);
+                }
+                return int_key ? run_join<long long>(probe, snap->posts, j, pool)
+                               : run_join<string_view>(probe, snap->posts, j, pool);
+            };
+            return j.probe().table() == QueryTable::Posts ? with_build(snap->posts) : with_build(snap->engagements);
+        }
+
+        /**
+         * @name Async API
+         * @brief Non-blocking variants of the public operations; results arrive through futures.
+         * @details Operations go to an internal scheduler that drains them in batches on the engine
+         *          pool. Operations submitted without waiting on each other are treated as
+         *          independent and may be reordered (reads run concurrently, view updates share one
+         *          posts rewrite, engagements share one append); updates to the same post keep their
+         *          submission order, and updateUserNameAsync is a barrier. Wait on a future, or
+         *          submit fenceAsync(), before submitting anything that must observe its effect.
+         * @thread_safety Safe to call concurrently.
+         */
+        ///@{
+        future<bool> updatePostViewsAsync(int post_id, int views_count) {
+            PendingOp op(PendingOp::Kind::PostViews);
+            op.post_id = post_id;
+            op.views_count = views_count;
+            future<bool> fut = op.views_done.get_future();
+            enqueue_async(move(op));
+            return fut;
+        }
+
+        // false if the record was rejected (unknown user or post)
+        future<bool> addEngagementRecordAsync(Engagement record) {
+            PendingOp op(PendingOp::Kind::Engagement);
+            op.record = make_unique<Engagement>(move(record));
+            future<bool> fut = op.eng_done.get_future();
+            enqueue_async(move(op));
+            return fut;
+        }
+
+        future<bool> updateUserNameAsync(int user_id, string new_username) {
+            auto task = make_shared<packaged_task<bool()>>([this, user_id, name = move(new_username)] {
+                return updateUserName(user_id, name);
+            });
+            future<bool> fut = task->get_future();
+            enqueue_async(PendingOp(PendingOp::Kind::Barrier, [task] { (*task)(); }));
+            return fut;
+        }
+
+        // Reads submitted after this observe every update and engagement submitted before it.
+        void fenceAsync() { enqueue_async(PendingOp(PendingOp::Kind::Fence)); }
+
+        future<vector<pair<int, string>>> getAllUserCommentsAsync(int user_id) {
+            return submit_read<vector<pair<int, string>>>([this, user_id] { return getAllUserComments(user_id); });
+        }
+
+        future<pair<int,int>> getAllEngagementsByLocationAsync(string location) {
+            return submit_read<pair<int,int>>([this, loc = move(location)] { return getAllEngagementsByLocation(loc); });
+        }
+        ///@}
+
+        /**
+         * @brief Route engagement inserts through a lock-free queue and a dedicated writer thread.
+         * @details Producers only claim a ring slot; the writer drains up to opts.max_batch records
+         *          at a time, validates them, appends them to the CSV with one write and publishes
+         *          one snapshot. While enabled, addEngagementRecord() enqueues and returns without
+         *          waiting for the disk; use ingestEngagement() + waitIngested() or flushIngest()
+         *          when durability confirmation is needed.
+         * @thread_safety Must not race with producers or with disableIngestMode().
+         */
+        void enableIngestMode(IngestOptions opts = IngestOptions()) {
+            if (ingest_) return;
+            ingest_ = make_unique<IngestState>(opts);
+            IngestState* st = ingest_.get();
+            st->writer = thread([this, st] { ingest_writer_loop(*st); });
+        }
+
+        /**
+         * @brief Drain everything queued, stop the writer thread and return to direct inserts.
+         */
+        void disableIngestMode() {
+            if (!ingest_) return;
+            ingest_->stop.store(true);
+            ingest_->wake_cv.notify_all();
+            ingest_->writer.join();
+            ingest_.reset();
+        }
+
+        /**
+         * @brief Queue an engagement for the ingest writer.
+         * @return Durability ticket for waitIngested(); 0 if the queue was full under
+         *         IngestBackpressure::Reject. Without ingest mode, inserts directly and returns 0.
+         * @thread_safety Lock-free for producers unless they have to wait for space.
+         */
+        uint64_t ingestEngagement(Engagement record) {
+            OpTimer timed(*metrics_, EngineOp::IngestEngagement);
+            IngestState* st = ingest_.get();
+            if (!st) {
+                add_engagements({&record});
+                return 0;
+            }
+            uint64_t ticket;
+            while ((ticket = st->ring.try_push(move(record))) == 0) {
+                if (st->opts.backpressure == IngestBackpressure::Reject) {
+                    st->rejected.fetch_add(1);
+                    return 0;
+                }
+                unique_lock<mutex> lk(st->mtx);
+                st->space_cv.wait_for(lk, chrono::milliseconds(1));
+            }
+            if (st->writer_sleeping.load()) {
+                lock_guard<mutex> lk(st->mtx);
+                st->wake_cv.notify_one();
+            }
+            return ticket;
+        }
+
+        /**
+         * @brief Wait until the record holding `ticket` is on disk and visible to readers.
+         */
+        void waitIngested(uint64_t ticket) {
+            IngestState* st = ingest_.get();
+            if (!st || ticket == 0) return;
+            unique_lock<mutex> lk(st->mtx);
+            st->durable_cv.wait(lk, [&] { return st->durable.load() >= ticket; });
+        }
+
+        // Wait until everything queued so far is durable.
+        void flushIngest() {
+            if (ingest_) waitIngested(ingest_->ring.issued());
+        }
+
+        // Records dropped by IngestBackpressure::Reject since ingest mode was enabled.
+        uint64_t ingestRejected() const { return ingest_ ? ingest_->rejected.load() : 0; }
+
+        /**
+         * @brief Minimum table size (rows) at which query scans go parallel.
+         * @thread_safety Safe to call concurrently with queries.
+         */
+        void setParallelScanMinRows(size_t rows) { parallel_scan_min_rows_.store(rows, memory_order_relaxed); }
+
+        /**
+         * @name Approximate analytics
+         * @brief Constant-time answers from sketches built by loads and maintained by
+         *        addEngagementRecord and updateUserName.
+         * @thread_safety Safe to call concurrently with writers.
+         */
+        ///@{
+        // Distinct usernames that engaged with post_id; exact up to 64, then relative standard
+        // error ~3.3% (HyperLogLog, 1 KiB per post), near exact below ~2500.
+        uint64_t approxUniqueEngagers(int post_id) const {
+            OpTimer timed(*metrics_, EngineOp::Sketches);
+            lock_guard<mutex> lk(sketch_mtx_);
+            auto it = sketches_.engagers.find(post_id);
+            return it == sketches_.engagers.end() ? 0 : it->second.estimate();
+        }
+
+        // Engagements by `username`; never below the true count, and above it by more than
+        // 0.017% of all engagements with probability <= 1.8% (count-min, 2^14 x 4).
+        uint64_t approxEngagementCount(const string& username) const {
+            OpTimer timed(*metrics_, EngineOp::Sketches);
+            lock_guard<mutex> lk(sketch_mtx_);
+            return sketches_.activity.estimate(username);
+        }
+
+        // Up to k (<= 64) most active usernames with their approxEngagementCount estimates.
+        vector<pair<string, uint64_t>> approxTopEngagers(size_t k) const {
+            OpTimer timed(*metrics_, EngineOp::Sketches);
+            lock_guard<mutex> lk(sketch_mtx_);
+            return sketches_.activity.top(k);
+        }
+        ///@}
+
+        /**
+         * @brief A user's most recent activity: engagements they made and engagements on their posts.
+         * @param limit At most this many entries (the feed keeps the latest 256).
+         * @return Newest first by timestamp, then engagement id.
+         * @complexity O(limit); independent of table sizes.
+         * @thread_safety Safe to call concurrently with writers.
+         */
+        vector<FeedEntry> getUserFeed(int user_id, size_t limit) const {
+            OpTimer timed(*metrics_, EngineOp::UserFeed);
+            shared_ptr<const DbSnapshot> snap = snapshot();
+            auto it = snap->user_row->find(user_id);
+            if (it == snap->user_row->end())
+                return {};
+            const string& name = snap->users.segment(it->second).username->v[TableVersion<UserSegment>::slot(it->second)];
+            lock_guard<mutex> lk(feed_mtx_);
+            return feeds_.recent(name, limit);
+        }
+
+        /**
+         * @name Time-series rollups
+         * @brief Like/comment counts per bucket for [from, to) (timestamps in seconds).
+         * @details Buckets are aligned to multiples of the granularity; the bucket containing
+         *          `from` is included. Only non-empty buckets are returned, in time order.
+         *          Location counts attribute an engagement to every location of the users
+         *          holding its username.
+         * @complexity O(log B + returned buckets); built by loads, maintained by
+         *             addEngagementRecord and updateUserName.
+         * @thread_safety Safe to call concurrently with writers.
+         */
+        ///@{
+        vector<RollupPoint> getPostEngagementSeries(int post_id, Granularity g, int64_t from, int64_t to) const {
+            OpTimer timed(*metrics_, EngineOp::EngagementSeries);
+            lock_guard<mutex> lk(rollup_mtx_);
+            return rollups_.post_series(post_id, g, from, to);
+        }
+        vector<RollupPoint> getLocationEngagementSeries(const string& location, Granularity g, int64_t from, int64_t to) const {
+            OpTimer timed(*metrics_, EngineOp::EngagementSeries);
+            lock_guard<mutex> lk(rollup_mtx_);
+            return rollups_.location_series(location, g, from, to);
+        }
+        ///@}
+
+        /**
+         * @brief Memory budget of the query result cache (default 64 MiB); 0 disables caching.
+         * @details getAllUserComments and getAllEngagementsByLocation results are cached until a
+         *          write touches one of the usernames they depend on (addEngagementRecord,
+         *          updateUserName) or the tables are reloaded.
+         */
+        void setResultCacheBytes(size_t bytes) { result_cache_.set_capacity(bytes); }
+
+        struct ResultCacheStats { uint64_t hits, misses; size_t entries, bytes; };
+        ResultCacheStats resultCacheStats() const {
+            return {result_cache_.hits(), result_cache_.misses(), result_cache_.size(), result_cache_.bytes()};
+        }
+
+        /**
+         * @brief Engine counters since construction: per-method latency histograms, CSV bytes
+         *        read/written, rows accepted/rejected per table, and table-lock wait vs hold.
+         * @thread_safety Safe to call concurrently; counters are read individually (relaxed), so
+         *                a snapshot taken under load is approximate across counters.
+         */
+        EngineStats stats() const { return metrics_->snapshot(); }
+
+        /**
+         * @brief Hand stats().to_text() to `sink` every `interval` from a background thread
+         *        (default sink: stderr). Replaces a running dump; stopped by stopStatsDump() or
+         *        destruction.
+         */
+        void startStatsDump(chrono::milliseconds interval, function<void(const string&)> sink = nullptr) {
+            if (!sink) sink = [](const string& text) { cerr << "[buzzdb stats]\n" << text; };
+            stats_dumper_.start(interval, [this] { return stats().to_text() + lock_reports_text(lockReport()); }, move(sink));
+        }
+        void stopStatsDump() { stats_dumper_.stop(); }
+
+        /**
+         * @brief Contention per lock class: the 16 stripes of each table, the posts file lock and
+         *        the version lock. Each report splits acquisitions, contended waits and exclusive
+         *        hold time by call site (the public operation, or "internal" for engine threads)
+         *        and lists which operations the waiters were stuck behind.
+         * @thread_safety Safe to call concurrently; counters are read individually.
+         */
+        vector<LockReport> lockReport() const {
+            return {locks_->users.report(), locks_->posts.report(), locks_->engagements.report(),
+                    locks_->posts_file.report(), locks_->version.report()};
+        }
+
+        /**
+         * @brief Estimated footprint per table (row objects + head snapshot columns), per index
+         *        (writer id maps, snapshot id -> row maps, username counts, derived views, result
+         *        cache) and per buffer of the last measured load (see trackLoadMemory), with its
+         *        transient peak and the budget.
+         * @thread_safety Safe to call concurrently; each structure is measured under its own
+         *                (shared) lock, so the tables may be measured at slightly different times.
+         * @complexity O(U + P + E) walk; meant for capacity planning, not hot paths.
+         */
+        MemoryReport memoryReport() const {
+            MemoryReport r;
+            shared_ptr<const DbSnapshot> snap = atomic_load(&snapshot_);
+            auto table = [&](const auto& t, const string& name, size_t columns) {
+                size_t total = 0, rows = 0;
+                auto lk = t.lock_all_shared();
+                for (size_t i = 0; i < t.kStripes; ++i) {
+                    total += heap_bytes(t.stripe_rows(i));
+                    rows += t.stripe_rows(i).size();
+                }
+                using Node = typename remove_reference_t<decltype(t.stripe_rows(0))>::value_type;
+                size_t map_bytes = rows * (kTreeNodeHeader + sizeof(Node));
+                r.tables.push_back({name, rows, total - map_bytes + columns, total - map_bytes + columns});
+                r.indexes.push_back({name + ".stripes", rows, map_bytes, map_bytes});
+            };
+            table(users, "users", heap_bytes(snap->users));
+            table(posts, "posts", heap_bytes(snap->posts));
+            table(engagements, "engagements", heap_bytes(snap->engagements));
+
+            auto index = [&](string name, size_t rows, size_t bytes) { r.indexes.push_back({move(name), rows, bytes, bytes}); };
+            if (snap->user_row) index("users.id_row", snap->user_row->size(), heap_bytes(*snap->user_row));
+            if (snap->post_row) index("posts.id_row", snap->post_row->size(), heap_bytes(*snap->post_row));
+            if (snap->username_count) index("users.username_count", snap->username_count->size(), heap_bytes(*snap->username_count));
+            {
+                shared_lock<ProfiledSharedMutex> lk(version_mtx_);
+                index("engagements.id_row", eng_row_.size(), heap_bytes(eng_row_));
+            }
+            { lock_guard<mutex> lk(sketch_mtx_); index("sketches", 0, sketches_.memory_bytes()); }
+            { lock_guard<mutex> lk(rollup_mtx_); index("rollups", 0, rollups_.memory_bytes()); }
+            { lock_guard<mutex> lk(feed_mtx_); index("feeds", 0, feeds_.memory_bytes()); }
+            index("result_cache", result_cache_.size(), result_cache_.bytes());
+
+            r.load = load_mem_.usage();
+            r.load_peak_bytes = load_mem_.peak();
+            r.budget_bytes = memory_budget_.load(memory_order_relaxed);
+            r.refused_loads = refused_loads_.load(memory_order_relaxed);
+            return r;
+        }
+
+        // Measure the buffers of later loads for memoryReport(); off by default, as measuring
+        // walks every parsed row and the new snapshot.
+        void trackLoadMemory(bool on) {
+            track_load_memory_.store(on, memory_order_relaxed);
+            load_mem_.set_enabled(on || memory_budget_.load(memory_order_relaxed));
+        }
+
+        /**
+         * @brief Cap on resident tables plus a load's transient buffers; 0 (the default) means none.
+         * @details A load whose projected peak exceeds the budget is refused before reading
+         *          anything. The projection is what the last measured load left resident plus
+         *          that load's transient peak, scaled by input file size (so writes since then
+         *          are not counted); a budget turns on load measuring. memoryReport().over_budget()
+         *          compares the measured peak.
+         */
+        void setMemoryBudget(size_t bytes) {
+            memory_budget_.store(bytes, memory_order_relaxed);
+            load_mem_.set_enabled(bytes || track_load_memory_.load(memory_order_relaxed));
+            if (bytes && !last_load_input_.load(memory_order_relaxed)) {
+                // no measured load yet: start the projection from what is resident now
+                resident_after_load_.store(memoryReport().resident_bytes(), memory_order_relaxed);
+            }
+        }
+
+        /**
+         * @brief Store the three table files as block files (see Block storage), or re-pack
+         *        block files, folding appended engagements into blocks.
+         * @details Loads read either format; renames and views updates keep a table's format,
+         *          and engagement appends land in the block file's raw tail.
+         * @return Raw CSV bytes vs. stored bytes over the three files.
+         * @thread_safety Takes every table stripe and the posts file lock, as updateUserName does.
+         * @side_effects Rewrites all three files (tmp file + rename each).
+         */
+        BlockFileStats compressStorage(size_t block_bytes = kBlockRawBytes) {
+            auto ul = users.lock_all();
+            auto pl = posts.lock_all();
+            auto el = engagements.lock_all();
+            lock_guard<ProfiledSharedMutex> file_lk(posts_file_mtx_);
+
+            BlockFileStats total;
+            for (const string* path : {&users_path_, &posts_path_, &engagements_path_}) {
+                string tmp = *path + ".tmp";
+                {
+                    LineReader in(*path);
+                    ASSERT_WITH_MESSAGE(in.is_open(), "File failed: " + *path);
+                    ofstream out(tmp, ios::binary | ios::trunc);
+                    ASSERT_WITH_MESSAGE(out.good(), "File failed: " + tmp);
+                    string_view line;
+                    while (in.next(line)) {
+                        out.write(line.data(), static_cast<streamsize>(line.size()));
+                        out.put('\n');
+                    }
+                    total.raw_bytes += static_cast<uint64_t>(out.tellp());
+                }
+                total.stored_bytes += keep_block_format(tmp, block_bytes);
+                total.blocks += BlockFile(tmp).blocks();
+                int rc = rename(tmp.c_str(), path->c_str());
+                ASSERT_WITH_MESSAGE(rc == 0, "rename failed for " + *path);
+            }
+            metrics_->add_written(total.stored_bytes);
+            return total;
+        }
+
+        /**
+         * @brief Record both loaders as Chrome trace-event spans: each file's parse on the thread
+         *        that ran it (with I/O, tokenizing, integer parsing, integrity filtering and object
+         *        construction times as args), integrity filtering, object construction, snapshot
+         *        and derived-view builds, per-table partitioning and the commit swap.
+         * @param output If non-empty, the trace is rewritten there after every load; otherwise
+         *               read it with loadTraceJson(). BUZZDB_TRACE=<path> enables this at startup.
+         * @thread_safety Safe to call concurrently; spans of loads already running may be lost.
+         */
+        void enableLoadTracing(bool on, string output = {}) {
+            trace_.set_output(move(output));
+            trace_.enable(on);
+        }
+
+        // Spans recorded so far as {"traceEvents": [...]} for chrome://tracing or ui.perfetto.dev.
+        string loadTraceJson() const { return trace_.to_json(); }
+        vector<TraceEvent> loadTraceEvents() const { return trace_.events(); }
+        void clearLoadTrace() { trace_.clear(); }
+
+        /**
+         * @brief Rename a user everywhere and persist to all CSVs.
+         * @param user_id Target user id.
+         * @param new_username New username.
+         * @return true if user exists and all rewrites succeed; otherwise false.
+         * @thread_safety Serialized updates; readers see a consistent state after commit.
+         * @side_effects Rewrites users, posts, and engagements CSVs.
+         */
+        bool updateUserName(int user_id, std::string new_username){    
+            OpTimer timed(*metrics_, EngineOp::UpdateUserName);
+            // TODO: add your implementation here.
+            //UNUSED(user_id);
+            //UNUSED(new_username);
+            //return false;
+            // take every stripe of the 3 tables, in the fixed order
+            auto requested = chrono::steady_clock::now();
+            auto ul = users.lock_all();
+            auto pl = posts.lock_all();
+            auto el = engagements.lock_all();
+            LockTimer held(*metrics_, requested);
+
+            auto uit = users.find(user_id);
+            if (uit == users.end()) 
+                return false; 
+            const string old_username = uit->second->username;
+            if (old_username == new_username) 
+                return true; 
+
+            // Rewrite users.csv id,username,location
+            {
+                const bool blocked = is_block_file(users_path_);
+                LineReader in(users_path_);
+                ASSERT_WITH_MESSAGE(in.is_open(), "File failed： " + users_path_);
+                string tmp_users = users_path_ + ".tmp";
+                ofstream out(tmp_users);
+                ASSERT_WITH_MESSAGE(out.good(), "File failed " + tmp_users);
+
+                string line; 
+                bool header_if = true;
+
+                while (in.getline(line)) {
+                    if (header_if) { 
+                        out << line << "\n"; 
+                        header_if = false; 
+                        continue; 
+                    }
+                    if (line.empty()) {
+                        out << line << "\n"; 
+                        continue; 
+                    }
+
+                    stringstream ss(line);
+                    string id_str, username, location;
+                    getline(ss, id_str, ',');
+                    getline(ss, username, ',');
+                    getline(ss, location,  ',');
+
+                    int id_val = 0;
+                    bool same_user = false;
+                    try {
+                        id_val = std::stoi(id_str);
+                        same_user = (id_val == user_id);
+                    } catch (...) {
+                        same_user = false; 
+                    }
+
+                    if (same_user) {
+                        out << id_str << "," << new_username << "," << location << "\n";
+                    } else {
+                        out << line << "\n";
+                    }
+                }
+                metrics_->add_written(static_cast<uint64_t>(out.tellp()));
+                out.close();
+                if (blocked) metrics_->add_written(keep_block_format(tmp_users));
+
+                remove(users_path_.c_str());
+                int rc = rename(tmp_users.c_str(), users_path_.c_str());
+                ASSERT_WITH_MESSAGE(rc == 0, "Update name failed: " + users_path_);
+            }
+
+            // Rewrite posts.csv id,content,username,views
+            {
+                // a post views group commit may be rewriting the same file
+                lock_guard<ProfiledSharedMutex> file_lk(posts_file_mtx_);
+                const bool blocked = is_block_file(posts_path_);
+                LineReader in(posts_path_);
+                ASSERT_WITH_MESSAGE(in.is_open(), "File failed： " + posts_path_);
+                string tmp_posts = posts_path_ + ".tmp";
+                ofstream out(tmp_posts);
+                ASSERT_WITH_MESSAGE(out.good(), "File failed： " + tmp_posts);
+
+                string line; 
+                bool header_if = true;
+
+                while (in.getline(line)) {
+                    if (header_if) {
+                        out << line << "\n"; 
+                        header_if = false; 
+                        continue; 
+                    }
+
+                    if (line.empty()) {
+                        out << line << "\n"; 
+                        continue; 
+                    }
+
+                    stringstream ss(line);
+                    string id_str, content, username, views;
+                    getline(ss, id_str,    ',');
+                    getline(ss, content, ',');
+                    getline(ss, username,   ',');
+                    getline(ss, views, ',');
+
+                    if (username == old_username) {
+                        out << id_str << "," << content << "," << new_username << "," << views << "\n";
+                    } else {
+                        out << line << "\n";
+                    }
+                }
+                metrics_->add_written(static_cast<uint64_t>(out.tellp()));
+                out.close();
+                if (blocked) metrics_->add_written(keep_block_format(tmp_posts));
+
+                remove(posts_path_.c_str());
+                int rc = rename(tmp_posts.c_str(), posts_path_.c_str());
+                ASSERT_WITH_MESSAGE(rc == 0, "Update name failed: " + posts_path_);
+            }
+
+            // Rewrite engagements.csv id,postId,username,type,comment,timestamp
+            {
+                const bool blocked = is_block_file(engagements_path_);
+                LineReader in(engagements_path_);
+                ASSERT_WITH_MESSAGE(in.is_open(), "File failed： " + engagements_path_);
+                string tmp_engage = engagements_path_ + ".tmp";
+                ofstream out(tmp_engage);
+                ASSERT_WITH_MESSAGE(out.good(), "File failed： " + tmp_engage);
+
+                string line; 
+                bool header_if = true;
+
+                while (in.getline(line)) {
+                    if (header_if) {
+                        out << line << "\n"; 
+                        header_if = false; 
+                        continue; 
+                    }
+
+                    if (line.empty()) {
+                        out << line << "\n"; 
+                        continue; 
+                    }
+
+                    stringstream ss(line);
+                    string id_str, postId_s, username, type, comment, timestamp;
+                    getline(ss, id_str,     ',');
+                    getline(ss, postId_s, ',');
+                    getline(ss, username,    ',');
+                    getline(ss, type,     ',');
+                    getline(ss, comment,  ',');
+                    getline(ss, timestamp,     ',');
+
+                    if (username == old_username) {
+                        out << id_str << "," << postId_s << "," << new_username << ","
+                            << type << "," << comment << "," << timestamp << "\n";
+                    } else {
+                        out << line << "\n";
+                    }
+                }
+                metrics_->add_written(static_cast<uint64_t>(out.tellp()));
+                out.close();
+                if (blocked) metrics_->add_written(keep_block_format(tmp_engage));
+
+                remove(engagements_path_.c_str());
+                int rc = rename(tmp_engage.c_str(), engagements_path_.c_str());
+                ASSERT_WITH_MESSAGE(rc == 0, "Update name failed: " + engagements_path_);
+            }
+
+            // Update in-memory state after rewrites
+            // update users
+            {
+    
+                unique_ptr<User>& user_ptr = uit->second; 
+                User* user = user_ptr.get();             
+                user->username = new_username;            
+            }
+
+            // update post
+            for (auto it = posts.begin();
+                it != posts.end(); ++it)
+            {
+                Post* post = it->second.get();
+                if (post->username == old_username) {
+                    post->username = new_username;
+                }
+            }
+
+            // update engagement; remember the rows whose derived-view entries change
+            vector<const Engagement*> renamed_rows, joined_rows;
+            for (auto it = engagements.begin();
+                it != engagements.end(); ++it)
+            {
+                Engagement* e = it->second.get();
+                if (e->username == old_username) {
+                    e->username = new_username;
+                    renamed_rows.push_back(e);
+                } else if (e->username == new_username) {
+                    joined_rows.push_back(e);
+                }
+            }
+
+            // publish the renamed version; readers on older versions keep the old name
+            publish_edit([&](DbSnapshot& next) {
+                size_t row = next.user_row->at(user_id);
+                cow_segments(next.users, {row / kSegmentRows}, [&](UserSegment& seg, size_t) {
+                    seg.username = cow_block(seg.username);
+                    seg.username->v[TableVersion<UserSegment>::slot(row)] = new_username;
+                });
+                auto names = make_shared<unordered_map<string, uint32_t>>(*next.username_count);
+                if (--(*names)[old_username] == 0) names->erase(old_username);
+                ++(*names)[new_username];
+                next.username_count = names;
+                rename_in_table(next.posts, old_username, new_username);
+                rename_in_table(next.engagements, old_username, new_username);
+            }, [&](vector<ReplChange>& log) {
+                log.push_back({'R', {to_string(user_id), new_username}});
+            });
+            result_cache_.invalidate(old_username);
+            result_cache_.invalidate(new_username);
+
+            // move the name's entries in the derived views; O(rows of the two names)
+            {
+                vector<int> post_ids;
+                for (const Engagement* e : renamed_rows) post_ids.push_back(e->postId);
+                sort(post_ids.begin(), post_ids.end());
+                post_ids.erase(unique(post_ids.begin(), post_ids.end()), post_ids.end());
+                lock_guard<mutex> lk(sketch_mtx_);
+                sketches_.rename_user(old_username, new_username, post_ids, renamed_rows.size());
+            }
+            {
+                // locations of the users still named old_username, if any
+                vector<string> old_locations;
+                if (snapshot()->username_count->count(old_username)) {
+                    for (const auto& kv : users) {
+                        const User& u = *kv.second;
+                        if (u.username == old_username &&
+                            find(old_locations.begin(), old_locations.end(), u.location) == old_locations.end())
+                            old_locations.push_back(u.location);
+                    }
+                }
+                lock_guard<mutex> lk(rollup_mtx_);
+                for (const Engagement* e : renamed_rows) rollups_.remove(e->postId, old_username, e->type, e->timestamp);
+                for (const Engagement* e : joined_rows) rollups_.remove(e->postId, new_username, e->type, e->timestamp);
+                rollups_.rename_user(old_username, new_username, uit->second->location, move(old_locations));
+                for (const Engagement* e : renamed_rows) rollups_.add(e->postId, new_username, e->type, e->timestamp);
+                for (const Engagement* e : joined_rows) rollups_.add(e->postId, new_username, e->type, e->timestamp);
+            }
+            {
+                lock_guard<mutex> lk(feed_mtx_);
+                feeds_.rename_user(old_username, new_username);
+            }
+
+            return true;
+                    
+        }
+
+        /**
+         * @brief The engine's shared worker pool (threads start on first call).
+         * @thread_safety Safe to call concurrently.
+         */
+        WorkStealingPool& threadPool() {
+            call_once(pool_once_, [this] { pool_ = make_unique<WorkStealingPool>(pool_threads_); });
+            return *pool_;
+        }
+
+        /**
+         * @brief Publish the current snapshot as a read-only image at `path` (see SharedImage).
+         * @details Worker processes attach with SharedImage::attach or follow new generations
+         *          with SharedImageReader. Each publish bumps the generation of the image it
+         *          replaces and swaps the file atomically.
+         * @return The new generation.
+         * @thread_safety Safe to call concurrently with readers and writers; serialize publishers
+         *                of the same path.
+         */
+        uint64_t publishImage(const string& path) {
+            OpTimer timed(*metrics_, EngineOp::PublishImage);
+            shared_ptr<const DbSnapshot> snap = snapshot();
+            auto previous = SharedImage::attach(path);
+            uint64_t generation = previous ? previous->generation() + 1 : 1;
+            previous.reset();
+            write_table_image(*snap, path, generation);
+            return generation;
+        }
+
+        /**
+         * @brief Start streaming committed changes to a read replica over `fd`.
+         * @details Writes the current version as a base snapshot to `base` (the replica's own
+         *          CSV triple), then ships every later version's changes through `fd`; the replica
+         *          side is a ReplicaFollower on a FlatFile opened on `base`. The engine ships through
+         *          its own duplicate of `fd` (switched to non-blocking mode), so the caller may
+         *          close its copy once this returns. A replica that falls more than the backlog
+         *          limit behind (see setReplicaBacklogLimit) is dropped and the duplicate closed;
+         *          the follower then reads end of stream, on a pipe once the caller has closed
+         *          its write end.
+         * @return The base version.
+         * @thread_safety Safe to call concurrently with readers and writers.
+         */
+        uint64_t attachReplica(int fd, const ShardPaths& base) {
+            shared_ptr<const DbSnapshot> snap;
+            size_t id;
+            {
+                // no version can be published between pinning the base and registering the fd
+                lock_guard<ProfiledSharedMutex> lk(version_mtx_);
+                snap = atomic_load(&snapshot_);
+                id = repl_.add_paused(fd);
+            }
+            write_snapshot_csv(*snap, base);
+            repl_.resume(id, snap->version);
+            return snap->version;
+        }
+
+        // Replicas still connected.
+        size_t replicaCount() const { return repl_.replicas(); }
+
+        // Unsent bytes a replica may fall behind before it is dropped (default 64 MiB).
+        void setReplicaBacklogLimit(size_t bytes) { repl_.set_max_backlog(bytes); }
+
+        /**
+         * @brief Pin the current read version.
+         * @return Immutable snapshot; stays valid (and unchanged) for as long as the caller holds it.
+         * @thread_safety Lock-free with respect to the table mutexes.
+         */
+        shared_ptr<const DbSnapshot> snapshot() const { return atomic_load(&snapshot_); }
+
+        // Accessors (unsynchronized; for single-threaded inspection)
+        StripedTable<User>& getUsers() { return users; }
+        StripedTable<Post>& getPosts() { return posts; }
+        StripedTable<Engagement>& getEngagements() { return engagements; }
+};
+
+// ----------------------------- Sharding -----------------------------
+
+/**
+ * @brief Hash-partitioned front-end over N FlatFile shards, each with its own CSV triple.
+ * @details Posts are placed by post id and engagements by their postId, so an engagement
+ *          always lives with its post. The users table is replicated to every shard (the
+ *          users directory), which keeps both foreign-key checks shard-local. Point operations
+ *          route to the owning shard; reads fan out over the front-end pool and merge.
+ *          updateUserName is applied to every shard in turn and is not atomic across them:
+ *          a concurrent reader may see the new name on some shards and the old on others.
+ *          If a later shard refuses the rename, the shards already renamed are renamed back.
+ * @thread_safety Same guarantees as FlatFile, per shard.
+ */
+class ShardedFlatFile {
+public:
+    /**
+     * @param pool_threads Scan workers shared out across the shards' pools; 0 uses
+     *        hardware_concurrency(). Every shard gets at least one.
+     */
+    explicit ShardedFlatFile(std::vector<ShardPaths> shards, unsigned pool_threads = 0)
+        : pool_(static_cast<unsigned>(shards.size())) {
+        ASSERT_WITH_MESSAGE(!shards.empty(), "ShardedFlatFile needs at least one shard");
+        if (pool_threads == 0) pool_threads = std::max(1u, std::thread::hardware_concurrency());
+        const unsigned per_shard = std::max<unsigned>(1, pool_threads / static_cast<unsigned>(shards.size()));
+        for (auto& p : shards) shards_.push_back(std::make_unique<FlatFile>(p.users, p.posts, p.engagements, per_shard));
+    }
+
+    size_t shards() const { return shards_.size(); }
+    FlatFile& shard(size_t i) { return *shards_[i]; }
+
+    // Fibonacci hash scaled onto [0, n)
+    static size_t shard_for(int post_id, size_t n) {
+        return static_cast<size_t>((uint64_t(uint32_t(post_id) * 2654435769u) * n) >> 32);
+    }
+    size_t shard_of_post(int post_id) const { return shard_for(post_id, shards_.size()); }
+
+    /**
+     * @brief Split one CSV triple into N shard triples named `<prefix><i>_{users,posts,engagements}.csv`.
+     * @details Users are copied to every shard; posts and engagements are routed by post id.
+     *          Rows are not validated here; each shard's loader applies the usual checks.
+     */
+    static std::vector<ShardPaths> split(const std::string& users_csv, const std::string& posts_csv,
+                                         const std::string& engagements_csv, size_t n, const std::string& prefix) {
+        std::vector<ShardPaths> paths;
+        for (size_t i = 0; i < n; ++i) {
+            std::string base = prefix + std::to_string(i);
+            paths.push_back({base + "_users.csv", base + "_posts.csv", base + "_engagements.csv"});
+        }
+        auto route = [&](const std::string& in, std::string ShardPaths::*out, int key_field) {
+            std::vector<std::ofstream> files;
+            for (const auto& p : paths) {
+                files.emplace_back(p.*out, std::ios::trunc);
+                ASSERT_WITH_MESSAGE(files.back().good(), "File failed: " + p.*out);
+            }
+            LineReader r(in);
+            ASSERT_WITH_MESSAGE(r.is_open(), "File failed: " + in);
+            std::string_view line;
+            bool header = true;
+            while (r.next(line)) {
+                if (header || key_field < 0) {
+                    for (auto& f : files) f << line << '\n';
+                    header = false;
+                    continue;
+                }
+                std::string_view field = line;
+                for (int k = 0; k < key_field; ++k) {
+                    size_t comma = field.find(',');
+                    field = comma == std::string_view::npos ? std::string_view() : field.substr(comma + 1);
+                }
+                int id = 0;
+                std::from_chars(field.data(), field.data() + field.size(), id);
+                files[shard_for(id, n)] << line << '\n';
+            }
+        };
+        route(users_csv, &ShardPaths::users, -1);
+        route(posts_csv, &ShardPaths::posts, 0);
+        route(engagements_csv, &ShardPaths::engagements, 1);
+        return paths;
+    }
+
+    // Load every shard concurrently.
+    void load() {
+        fan_out([](FlatFile& f) { f.loadFlatFile(); });
+    }
+
+    bool updatePostViews(int post_id, int views_count) {
+        return shards_[shard_of_post(post_id)]->updatePostViews(post_id, views_count);
+    }
+
+    void addEngagementRecord(Engagement& record) {
+        shards_[shard_of_post(record.postId)]->addEngagementRecord(record);
+    }
+
+    // All shards or none: the users directory is replicated, so a refusal on a later shard
+    // means the shards diverged, and the ones already renamed get the old name back.
+    bool updateUserName(int user_id, const std::string& new_username) {
+        std::string old_username;
+        {
+            auto snap = shards_[0]->snapshot();
+            auto it = snap->user_row->find(user_id);
+            if (it == snap->user_row->end()) return false;
+            old_username = snap->users.segment(it->second).username->v[TableVersion<UserSegment>::slot(it->second)];
+        }
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            if (shards_[i]->updateUserName(user_id, new_username)) continue;
+            while (i-- > 0) shards_[i]->updateUserName(user_id, old_username);
+            return false;
+        }
+        return true;
+    }
+
+    // Hits from every shard, concatenated and sorted once.
+    std::vector<std::pair<int, std::string>> getAllUserComments(int user_id) {
+        auto parts = gather<std::vector<std::pair<int, std::string>>>([&](FlatFile& f) { return f.getAllUserComments(user_id); });
+        std::vector<std::pair<int, std::string>> out;
+        for (auto& p : parts) out.insert(out.end(), std::make_move_iterator(p.begin()), std::make_move_iterator(p.end()));
+        std::sort(out.begin(), out.end());
+        return out;
+    }
+
+    // Every shard sees all users, and engagements are disjoint, so the counts add up.
+    std::pair<int, int> getAllEngagementsByLocation(const std::string& location) {
+        auto parts = gather<std::pair<int, int>>([&](FlatFile& f) { return f.getAllEngagementsByLocation(location); });
+        std::pair<int, int> out{0, 0};
+        for (const auto& p : parts) { out.first += p.first; out.second += p.second; }
+        return out;
+    }
+
+private:
+    std::vector<std::unique_ptr<FlatFile>> shards_;
+    WorkStealingPool pool_;   // fan-out; each shard scans on its own, smaller pool
+
+    void fan_out(const std::function<void(FlatFile&)>& fn) {
+        pool_.parallel_for(shards_.size(), [&](size_t i) { fn(*shards_[i]); });
+    }
+
+    template <typename R, typename Fn>
+    std::vector<R> gather(Fn&& fn) {
+        std::vector<R> out(shards_.size());
+        pool_.parallel_for(shards_.size(), [&](size_t i) { out[i] = fn(*shards_[i]); });
+        return out;
+    }
+};
+
+
+// ----------------------------- Read replicas -----------------------------
+
+struct ReplicaStatus {
+    uint64_t applied_version = 0;   // last primary version fully applied
+    uint64_t primary_version = 0;   // newest primary version heard of
+    double lag_seconds = 0;         // commit-to-apply delay of the last applied change; 0 when caught up
+    bool connected = true;          // false once the stream hit EOF or an error
+    bool stale = false;             // the primary reloaded; re-attach to continue
+};
+
+/**
+ * @brief Replica side of FlatFile::attachReplica(): applies the change stream to a local FlatFile.
+ * @details A background thread reads frames from `fd`. The B frame loads the base snapshot into
+ *          `replica`; V/E/R frames go through its public write API, so its files, snapshots,
+ *          caches and derived views stay consistent, and readers query `replica` as usual.
+ *          Nothing else may write to `replica`.
+ * @thread_safety status() and waitForVersion() are safe to call from any thread.
+ */
+class ReplicaFollower {
+public:
+    ReplicaFollower(FlatFile& replica, int fd) : replica_(replica), fd_(fd), thread_([this] { run(); }) {}
+
+    ~ReplicaFollower() {
+        stop_.store(true);
+        thread_.join();
+    }
+
+    ReplicaStatus status() const {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return status_;
+    }
+
+    // Wait until `version` is applied (or the stream ends); false on timeout or disconnect.
+    bool waitForVersion(uint64_t version, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lk(mtx_);
+        cv_.wait_for(lk, timeout, [&] { return status_.applied_version >= version || !status_.connected || status_.stale; });
+        return status_.applied_version >= version;
+    }
+
+private:
+    FlatFile& replica_;
+    int fd_;
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    ReplicaStatus status_;
+    std::atomic<bool> stop_{false};
+    std::thread thread_;   // last: starts after every other member is ready
+
+    void run() {
+        std::string buf;
+        char chunk[64 * 1024];
+        while (!stop_.load()) {
+            pollfd p{fd_, POLLIN, 0};
+            int rc = ::poll(&p, 1, 50);
+            if (rc < 0 && errno == EINTR) continue;
+            if (rc == 0) continue;
+            ssize_t n = rc > 0 ? ::read(fd_, chunk, sizeof(chunk)) : -1;
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            buf.append(chunk, static_cast<size_t>(n));
+
+            size_t off = 0;
+            while (buf.size() - off >= 4) {
+                uint32_t len = 0;
+                for (int i = 0; i < 4; ++i) len |= uint32_t(static_cast<unsigned char>(buf[off + i])) << (8 * i);
+                if (buf.size() - off - 4 < len) break;
+                apply(std::string_view(buf.data() + off + 4, len));
+                off += 4 + len;
+            }
+            buf.erase(0, off);
+        }
+        std::lock_guard<std::mutex> lk(mtx_);
+        status_.connected = false;
+        cv_.notify_all();
+    }
+
+    void apply(std::string_view payload) {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if (status_.stale) return;   // the base no longer matches the primary
+        }
+        std::vector<std::string> f;
+        size_t start = 0;
+        for (size_t i = 0; i <= payload.size(); ++i) {
+            if (i == payload.size() || payload[i] == '\0') {
+                f.emplace_back(payload.substr(start, i - start));
+                start = i + 1;
+            }
+        }
+        ASSERT_WITH_MESSAGE(f.size() >= 3 && f[0].size() == 1, "Malformed replication frame");
+        const char tag = f[0][0];
+        const uint64_t version = std::stoull(f[1]);
+        const int64_t commit_ns = std::stoll(f[2]);
+
+        switch (tag) {
+            case 'B':
+                replica_.loadFlatFile();
+                break;
+            case 'V': {
+                int post_id = std::stoi(f[3]), views = std::stoi(f[4]);
+                auto snap = replica_.snapshot();
+                auto row = snap->post_row->find(post_id);
+                if (row == snap->post_row->end()) break;
+                int current = snap->posts.segment(row->second).views->v[TableVersion<PostSegment>::slot(row->second)];
+                if (views != current) replica_.updatePostViews(post_id, views - current);
+                break;
+            }
+            case 'E': {
+                Engagement e(std::stoi(f[3]), std::stoi(f[4]), f[5], f[6], f[7], std::stoi(f[8]));
+                replica_.addEngagementRecord(e);
+                break;
+            }
+            case 'R':
+                replica_.updateUserName(std::stoi(f[3]), f[4]);
+                break;
+            default:
+                break;
+        }
+
+        std::lock_guard<std::mutex> lk(mtx_);
+        status_.primary_version = std::max(status_.primary_version, version);
+        if (tag == 'B' || tag == 'C') {
+            status_.applied_version = version;
+            status_.lag_seconds = tag == 'C' ? double(steady_now_ns() - commit_ns) / 1e9 : 0;
+        } else if (tag == 'H' && status_.applied_version >= version) {
+            status_.lag_seconds = 0;
+        } else if (tag == 'L') {
+            status_.stale = true;
+        }
+        cv_.notify_all();
+    }
+};
+
+// ----------------------------- Server -----------------------------
+// Binary protocol, little-endian. Every message is a uint32 length followed by that many bytes.
+//   request:  u8 opcode, u32 request id, arguments
+//   response: u32 request id, u8 status (1 = ok/true, 0 = false), result
+// Strings are u32 length + bytes. Responses on a connection come back in request order, so
+// clients may pipeline any number of requests.
+
+enum class WireOp : uint8_t {
+    Ping = 0,
+    UpdatePostViews = 1,       // i32 post_id, i32 delta                          -> status
+    AddEngagement = 2,         // i32 id, i32 post_id, str user, str type, str comment, i32 ts -> status (0: unknown user/post)
+    UpdateUserName = 3,        // i32 user_id, str new_name                       -> status
+    GetUserComments = 4,       // i32 user_id          -> u32 n, n * (i32 post_id, str comment)
+    GetLocationCounts = 5,     // str location         -> i32 likes, i32 comments
+};
+
+struct WireWriter {
+    std::string& out;
+    void u8(uint8_t v) { out += static_cast<char>(v); }
+    void u32(uint32_t v) { for (int i = 0; i < 4; ++i) out += static_cast<char>((v >> (8 * i)) & 0xff); }
+    void i32(int32_t v) { u32(static_cast<uint32_t>(v)); }
+    void str(std::string_view s) { u32(static_cast<uint32_t>(s.size())); out.append(s.data(), s.size()); }
+};
+
+struct WireReader {
+    const char* p;
+    const char* end;
+    bool ok = true;
+
+    bool need(size_t n) { ok = ok && static_cast<size_t>(end - p) >= n; return ok; }
+    uint8_t u8() { if (!need(1)) return 0; return static_cast<uint8_t>(*p++); }
+    uint32_t u32() {
+        if (!need(4)) return 0;
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) v |= uint32_t(static_cast<unsigned char>(p[i])) << (8 * i);
+        p += 4;
+        return v;
+    }
+    int32_t i32() { return static_cast<int32_t>(u32()); }
+    std::string str() {
+        uint32_t n = u32();
+        if (!need(n)) return {};
+        std::string s(p, n);
+        p += n;
+        return s;
+    }
+};
+
+// Wrap a message body in its length prefix.
+static void wire_frame(std::string& out, const std::string& body) {
+    WireWriter{out}.u32(static_cast<uint32_t>(body.size()));
+    out += body;
+}
+
+static void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+/**
+ * @brief Single-threaded epoll server exposing a FlatFile over TCP and Unix sockets.
+ * @details Each loop iteration reads every ready connection, decodes all complete (pipelined)
+ *          requests, and hands them to the FlatFile async API in arrival order. The async
+ *          scheduler batches same-kind mutations (view updates share one group commit,
+ *          engagements one append) and runs reads on the engine pool. The loop never waits for
+ *          a result: kCompleters threads each take a dispatched batch, wait on its futures,
+ *          encode the responses and wake the loop through an eventfd, which writes each
+ *          connection's responses in request order. New requests wait for the batch in flight
+ *          (large batches share group commits) unless it has run longer than kSlowBatch; then
+ *          they go out beside it, so a slow request delays only its own batch.
+ *          A frame longer than kMaxFrame closes its connection.
+ * @thread_safety start()/stop() from the owning thread; the loop runs on its own thread.
+ */
+class BuzzServer {
+public:
+    explicit BuzzServer(FlatFile& db) : db_(db) {
+        epfd_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ASSERT_WITH_MESSAGE(epfd_ >= 0 && wake_fd_ >= 0, "epoll setup failed");
+        watch(wake_fd_, EPOLLIN);
+    }
+
+    ~BuzzServer() {
+        stop();
+        for (auto& kv : conns_) close(kv.first);
+        for (int fd : listeners_) close(fd);
+        for (const auto& path : unix_paths_) unlink(path.c_str());
+        close(wake_fd_);
+        close(epfd_);
+    }
+
+    BuzzServer(const BuzzServer&) = delete;
+    BuzzServer& operator=(const BuzzServer&) = delete;
+
+    // Listen on 127.0.0.1:port (0 picks a free port); returns the bound port.
+    uint16_t listenTcp(uint16_t port) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ASSERT_WITH_MESSAGE(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 && listen(fd, 128) == 0,
+            "TCP listen failed: " + std::string(strerror(errno)));
+        socklen_t len = sizeof(addr);
+        getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+        add_listener(fd);
+        return ntohs(addr.sin_port);
+    }
+
+    void listenUnix(const std::string& path) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        ASSERT_WITH_MESSAGE(path.size() < sizeof(addr.sun_path), "Unix socket path too long: " + path);
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(path.c_str());
+        ASSERT_WITH_MESSAGE(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 && listen(fd, 128) == 0,
+            "Unix listen failed: " + std::string(strerror(errno)));
+        unix_paths_.push_back(path);
+        add_listener(fd);
+    }
+
+    static constexpr uint32_t kMaxFrame = 1u << 20;   // longest accepted request body
+    static constexpr size_t kCompleters = 4;          // threads waiting on request futures
+    static constexpr std::chrono::milliseconds kSlowBatch{50};
+
+    void start() {
+        loop_ = std::thread([this] { run(); });
+        for (size_t i = 0; i < kCompleters; ++i) completers_.emplace_back([this] { complete_loop(); });
+    }
+
+    // Stop the loop, then let the completers finish every dispatched request.
+    void stop() {
+        if (!loop_.joinable()) return;
+        stop_.store(true);
+        wake();
+        loop_.join();
+        {
+            std::lock_guard<std::mutex> lk(pending_mtx_);
+            completers_stop_ = true;
+        }
+        pending_cv_.notify_all();
+        for (auto& t : completers_) t.join();
+        completers_.clear();
+    }
+
+    uint64_t requestsServed() const { return served_.load(); }
+    uint64_t batches() const { return batches_.load(); }
+
+private:
+    struct Conn {
+        int fd;
+        uint64_t serial;                          // tells a reused fd from the closed connection
+        std::string in, out;
+        bool want_write = false;
+        uint64_t next_seq = 0;                    // sequence number of the next decoded request
+        uint64_t next_out = 0;                    // sequence number of the next response to write
+        std::map<uint64_t, std::string> early;    // frames finished ahead of next_out
+        uint64_t write_epoch = 0;                 // fence epoch of this connection's last mutation
+    };
+
+    // A decoded request waiting for a free completer; args is the body after op and id.
+    struct Staged {
+        int fd;
+        uint64_t serial, seq;
+        uint32_t id;
+        WireOp op;
+        std::string args;
+    };
+
+    // A dispatched request; finish() waits for its result and encodes it.
+    struct Pending {
+        int fd;
+        uint64_t serial, seq;
+        uint32_t id;
+        std::function<void(WireWriter&, uint8_t&)> finish;
+    };
+
+    struct Done {
+        int fd;
+        uint64_t serial, seq;
+        std::string frame;
+    };
+
+    FlatFile& db_;
+    int epfd_ = -1, wake_fd_ = -1;   // wake_fd_: stop() and finished responses
+    std::vector<int> listeners_;
+    std::vector<std::string> unix_paths_;
+    std::unordered_map<int, std::unique_ptr<Conn>> conns_;
+    uint64_t next_serial_ = 0;
+    std::vector<Staged> staged_;
+    size_t in_flight_ = 0;   // dispatched batches not yet delivered
+    uint64_t fence_epoch_ = 1;   // bumped by every fenceAsync() the loop submits
+    std::chrono::steady_clock::time_point last_dispatch_;
+    std::thread loop_;
+    std::vector<std::thread> completers_;
+    std::atomic<bool> stop_{false};
+    std::atomic<uint64_t> served_{0}, batches_{0};
+
+    std::mutex pending_mtx_;
+    std::condition_variable pending_cv_;
+    std::deque<std::vector<Pending>> pending_;   // dispatched batches
+    bool completers_stop_ = false;
+
+    std::mutex done_mtx_;
+    std::vector<Done> done_;
+    size_t done_batches_ = 0;
+
+    void wake() {
+        uint64_t one = 1;
+        ssize_t rc = write(wake_fd_, &one, sizeof(one));
+        UNUSED(rc);
+    }
+
+    void watch(int fd, uint32_t events, bool modify = false) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(epfd_, modify ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    void add_listener(int fd) {
+        set_nonblocking(fd);
+        listeners_.push_back(fd);
+        watch(fd, EPOLLIN);
+    }
+
+    void close_conn(int fd) {
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        conns_.erase(fd);
+    }
+
+    void run() {
+        std::vector<epoll_event> events(256);
+        while (!stop_.load()) {
+            // staged requests held back by a batch in flight are re-checked after kSlowBatch
+            int timeout = staged_.empty() ? 100 : static_cast<int>(kSlowBatch.count());
+            int n = epoll_wait(epfd_, events.data(), static_cast<int>(events.size()), timeout);
+            if (n < 0 && errno == EINTR) continue;
+            std::vector<Conn*> readable;
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == wake_fd_) {
+                    uint64_t count;
+                    ssize_t rc = read(wake_fd_, &count, sizeof(count));
+                    UNUSED(rc);
+                    deliver();
+                    continue;
+                }
+                if (std::find(listeners_.begin(), listeners_.end(), fd) != listeners_.end()) {
+                    accept_all(fd);
+                    continue;
+                }
+                auto it = conns_.find(fd);
+                if (it == conns_.end()) continue;
+                if (events[i].events & EPOLLOUT) flush(*it->second);
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) readable.push_back(it->second.get());
+            }
+            std::vector<int> closed;
+            for (Conn* c : readable) {
+                if (!read_all(*c)) closed.push_back(c->fd);
+            }
+            serve(readable, closed);
+            for (int fd : closed) close_conn(fd);
+            dispatch_staged();
+        }
+    }
+
+    void accept_all(int listener) {
+        for (;;) {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // fails harmlessly on Unix sockets
+            auto c = std::make_unique<Conn>();
+            c->fd = fd;
+            c->serial = ++next_serial_;
+            conns_[fd] = std::move(c);
+            watch(fd, EPOLLIN);
+        }
+    }
+
+    // Drain the socket into c.in; false on EOF or error.
+    bool read_all(Conn& c) {
+        char buf[64 * 1024];
+        for (;;) {
+            ssize_t n = read(c.fd, buf, sizeof(buf));
+            if (n > 0) { c.in.append(buf, static_cast<size_t>(n)); continue; }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+            return false;
+        }
+    }
+
+    void flush(Conn& c) {
+        while (!c.out.empty()) {
+            ssize_t n = ::send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+            if (n > 0) { c.out.erase(0, static_cast<size_t>(n)); continue; }
+            if (n < 0 && errno == EINTR) continue;
+            break;   // EAGAIN: wait for EPOLLOUT; a dead peer shows up as EPOLLHUP/EOF
+        }
+        bool want = !c.out.empty();
+        if (want != c.want_write) {
+            c.want_write = want;
+            watch(c.fd, EPOLLIN | (want ? uint32_t(EPOLLOUT) : 0u), true);
+        }
+    }
+
+    // Decode every complete request into the staged batch; a connection sending an oversized
+    // frame is added to `closed`.
+    void serve(const std::vector<Conn*>& ready, std::vector<int>& closed) {
+        for (Conn* c : ready) {
+            if (std::find(closed.begin(), closed.end(), c->fd) != closed.end()) continue;
+            size_t off = 0;
+            while (c->in.size() - off >= 4) {
+                WireReader hdr{c->in.data() + off, c->in.data() + c->in.size()};
+                uint32_t len = hdr.u32();
+                if (len > kMaxFrame) {
+                    closed.push_back(c->fd);
+                    break;
+                }
+                if (c->in.size() - off - 4 < len) break;
+                WireReader r{c->in.data() + off + 4, c->in.data() + off + 4 + len};
+                off += 4 + len;
+                auto op = static_cast<WireOp>(r.u8());
+                uint32_t id = r.u32();
+                staged_.push_back({c->fd, c->serial, c->next_seq++, id, op, std::string(r.p, r.end)});
+            }
+            c->in.erase(0, off);
+        }
+        dispatch_staged();
+    }
+
+    // Hand the staged requests to the engine as one batch when nothing is in flight, or when
+    // the newest batch in flight is slow and a completer is free.
+    void dispatch_staged() {
+        if (staged_.empty() || in_flight_ >= kCompleters) return;
+        auto now = std::chrono::steady_clock::now();
+        if (in_flight_ > 0 && now - last_dispatch_ < kSlowBatch) return;
+        last_dispatch_ = now;
+        std::vector<Pending> batch;
+        batch.reserve(staged_.size());
+        for (Staged& s : staged_) {
+            order_after_own_writes(s);
+            WireReader r{s.args.data(), s.args.data() + s.args.size()};
+            batch.push_back({s.fd, s.serial, s.seq, s.id, dispatch(s.op, r)});
+        }
+        staged_.clear();
+        ++in_flight_;
+        {
+            std::lock_guard<std::mutex> lk(pending_mtx_);
+            pending_.push_back(std::move(batch));
+        }
+        pending_cv_.notify_one();
+        batches_.fetch_add(1);
+    }
+
+    // The engine may run a read ahead of writes submitted before it; a read that follows an
+    // unfenced mutation from its own connection is fenced so it sees that write.
+    void order_after_own_writes(const Staged& s) {
+        auto it = conns_.find(s.fd);
+        if (it == conns_.end() || it->second->serial != s.serial) return;
+        Conn& c = *it->second;
+        switch (s.op) {
+            case WireOp::UpdatePostViews:
+            case WireOp::AddEngagement:
+                c.write_epoch = fence_epoch_;
+                break;
+            case WireOp::GetUserComments:
+            case WireOp::GetLocationCounts:
+                if (c.write_epoch == fence_epoch_) {
+                    db_.fenceAsync();
+                    ++fence_epoch_;
+                }
+                break;
+            default:
+                break;   // renames are barriers already
+        }
+    }
+
+    // Completer thread: wait for one batch's results and hand its frames to the loop.
+    void complete_loop() {
+        for (;;) {
+            std::vector<Pending> batch;
+            {
+                std::unique_lock<std::mutex> lk(pending_mtx_);
+                pending_cv_.wait(lk, [&] { return completers_stop_ || !pending_.empty(); });
+                if (pending_.empty()) return;
+                batch = std::move(pending_.front());
+                pending_.pop_front();
+            }
+            std::vector<Done> done;
+            done.reserve(batch.size());
+            for (Pending& p : batch) {
+                std::string body;
+                WireWriter w{body};
+                w.u32(p.id);
+                uint8_t status = 0;
+                std::string result;
+                WireWriter rw{result};
+                p.finish(rw, status);
+                w.u8(status);
+                body += result;
+                done.push_back({p.fd, p.serial, p.seq, {}});
+                wire_frame(done.back().frame, body);
+            }
+            {
+                std::lock_guard<std::mutex> lk(done_mtx_);
+                for (Done& d : done) done_.push_back(std::move(d));
+                ++done_batches_;
+            }
+            wake();
+        }
+    }
+
+    // Loop thread: queue finished frames on their (still open) connections, in request order.
+    void deliver() {
+        std::vector<Done> done;
+        {
+            std::lock_guard<std::mutex> lk(done_mtx_);
+            done.swap(done_);
+            in_flight_ -= done_batches_;
+            done_batches_ = 0;
+        }
+        std::vector<Conn*> touched;
+        for (Done& d : done) {
+            auto it = conns_.find(d.fd);
+            if (it == conns_.end() || it->second->serial != d.serial) continue;
+            Conn& c = *it->second;
+            c.early.emplace(d.seq, std::move(d.frame));
+            while (!c.early.empty() && c.early.begin()->first == c.next_out) {
+                c.out += c.early.begin()->second;
+                c.early.erase(c.early.begin());
+                ++c.next_out;
+                served_.fetch_add(1);
+            }
+            touched.push_back(&c);
+        }
+        std::sort(touched.begin(), touched.end());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+        for (Conn* c : touched) {
+            if (!c->out.empty()) flush(*c);
+        }
+        dispatch_staged();
+    }
+
+    std::function<void(WireWriter&, uint8_t&)> dispatch(WireOp op, WireReader& r) {
+        switch (op) {
+            case WireOp::UpdatePostViews: {
+                int post = r.i32(), delta = r.i32();
+                if (!r.ok) break;
+                auto fut = std::make_shared<std::future<bool>>(db_.updatePostViewsAsync(post, delta));
+                return [fut](WireWriter&, uint8_t& st) { st = fut->get(); };
+            }
+            case WireOp::AddEngagement: {
+                int id = r.i32(), post = r.i32();
+                std::string user = r.str(), type = r.str(), comment = r.str();
+                int ts = r.i32();
+                if (!r.ok) break;
+                auto fut = std::make_shared<std::future<bool>>(
+                    db_.addEngagementRecordAsync(Engagement(id, post, std::move(user), std::move(type), std::move(comment), ts)));
+                return [fut](WireWriter&, uint8_t& st) { st = fut->get(); };
+            }
+            case WireOp::UpdateUserName: {
+                int user = r.i32();
+                std::string name = r.str();
+                if (!r.ok) break;
+                auto fut = std::make_shared<std::future<bool>>(db_.updateUserNameAsync(user, std::move(name)));
+                return [fut](WireWriter&, uint8_t& st) { st = fut->get(); };
+            }
+            case WireOp::GetUserComments: {
+                int user = r.i32();
+                if (!r.ok) break;
+                auto fut = std::make_shared<std::future<std::vector<std::pair<int, std::string>>>>(db_.getAllUserCommentsAsync(user));
+                return [fut](WireWriter& w, uint8_t& st) {
+                    auto rows = fut->get();
+                    w.u32(static_cast<uint32_t>(rows.size()));
+                    for (const auto& row : rows) { w.i32(row.first); w.str(row.second); }
+                    st = 1;
+                };
+            }
+            case WireOp::GetLocationCounts: {
+                std::string loc = r.str();
+                if (!r.ok) break;
+                auto fut = std::make_shared<std::future<std::pair<int, int>>>(db_.getAllEngagementsByLocationAsync(std::move(loc)));
+                return [fut](WireWriter& w, uint8_t& st) {
+                    auto counts = fut->get();
+                    w.i32(counts.first);
+                    w.i32(counts.second);
+                    st = 1;
+                };
+            }
+            case WireOp::Ping:
+                return [](WireWriter&, uint8_t& st) { st = 1; };
+        }
+        return [](WireWriter&, uint8_t& st) { st = 0; };   // malformed or unknown request
+    }
+};
+
+struct WireResponse {
+    uint32_t id = 0;
+    uint8_t status = 0;
+    std::string result;
+};
+
+/**
+ * @brief Blocking client for BuzzServer. send*() queue a request and return its id; flush()
+ *        writes everything queued; receive() returns the next response (in request order).
+ * @thread_safety One client per thread.
+ */
+class BuzzClient {
+public:
+    static BuzzClient tcp(uint16_t port) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ASSERT_WITH_MESSAGE(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0,
+            "connect failed: " + std::string(strerror(errno)));
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        return BuzzClient(fd);
+    }
+
+    static BuzzClient unix_socket(const std::string& path) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        ASSERT_WITH_MESSAGE(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0,
+            "connect failed: " + std::string(strerror(errno)));
+        return BuzzClient(fd);
+    }
+
+    BuzzClient(BuzzClient&& o) noexcept : fd_(o.fd_), next_id_(o.next_id_), out_(std::move(o.out_)), in_(std::move(o.in_)) { o.fd_ = -1; }
+    BuzzClient(const BuzzClient&) = delete;
+    ~BuzzClient() { if (fd_ >= 0) close(fd_); }
+
+    uint32_t sendPing() { return send(WireOp::Ping, [](WireWriter&) {}); }
+    uint32_t sendUpdatePostViews(int post_id, int delta) {
+        return send(WireOp::UpdatePostViews, [&](WireWriter& w) { w.i32(post_id); w.i32(delta); });
+    }
+    uint32_t sendAddEngagement(const Engagement& e) {
+        return send(WireOp::AddEngagement, [&](WireWriter& w) {
+            w.i32(e.id); w.i32(e.postId); w.str(e.username); w.str(e.type); w.str(e.comment); w.i32(e.timestamp);
+        });
+    }
+    uint32_t sendUpdateUserName(int user_id, const std::string& name) {
+        return send(WireOp::UpdateUserName, [&](WireWriter& w) { w.i32(user_id); w.str(name); });
+    }
+    uint32_t sendGetUserComments(int user_id) {
+        return send(WireOp::GetUserComments, [&](WireWriter& w) { w.i32(user_id); });
+    }
+    uint32_t sendGetLocationCounts(const std::string& location) {
+        return send(WireOp::GetLocationCounts, [&](WireWriter& w) { w.str(location); });
+    }
+
+    void flush() {
+        ASSERT_WITH_MESSAGE(write_fully(fd_, out_), "server connection lost");
+        out_.clear();
+    }
+
+    WireResponse receive() {
+        for (;;) {
+            if (in_.size() >= 4) {
+                WireReader hdr{in_.data(), in_.data() + in_.size()};
+                uint32_t len = hdr.u32();
+                if (in_.size() - 4 >= len) {
+                    WireReader r{in_.data() + 4, in_.data() + 4 + len};
+                    WireResponse resp;
+                    resp.id = r.u32();
+                    resp.status = r.u8();
+                    resp.result.assign(r.p, r.end);
+                    in_.erase(0, 4 + len);
+                    return resp;
+                }
+            }
+            char buf[64 * 1024];
+            ssize_t n = read(fd_, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) continue;
+            ASSERT_WITH_MESSAGE(n > 0, "server connection lost");
+            in_.append(buf, static_cast<size_t>(n));
+        }
+    }
+
+    // Round-trip helpers.
+    bool updatePostViews(int post_id, int delta) { sendUpdatePostViews(post_id, delta); flush(); return receive().status; }
+    bool addEngagement(const Engagement& e) { sendAddEngagement(e); flush(); return receive().status; }
+    bool updateUserName(int user_id, const std::string& name) { sendUpdateUserName(user_id, name); flush(); return receive().status; }
+    std::vector<std::pair<int, std::string>> getAllUserComments(int user_id) {
+        sendGetUserComments(user_id);
+        flush();
+        return decodeComments(receive());
+    }
+    std::pair<int, int> getAllEngagementsByLocation(const std::string& location) {
+        sendGetLocationCounts(location);
+        flush();
+        return decodeLocationCounts(receive());
+    }
+
+    static std::vector<std::pair<int, std::string>> decodeComments(const WireResponse& resp) {
+        WireReader r{resp.result.data(), resp.result.data() + resp.result.size()};
+        std::vector<std::pair<int, std::string>> out(r.u32());
+        for (auto& row : out) { row.first = r.i32(); row.second = r.str(); }
+        return out;
+    }
+    static std::pair<int, int> decodeLocationCounts(const WireResponse& resp) {
+        WireReader r{resp.result.data(), resp.result.data() + resp.result.size()};
+        int likes = r.i32();
+        return {likes, r.i32()};
+    }
+
+private:
+    int fd_;
+    uint32_t next_id_ = 1;
+    std::string out_, in_;
+
+    explicit BuzzClient(int fd) : fd_(fd) {}
+
+    template <typename Args>
+    uint32_t send(WireOp op, Args&& args) {
+        std::string body;
+        WireWriter w{body};
+        w.u8(static_cast<uint8_t>(op));
+        uint32_t id = next_id_++;
+        w.u32(id);
+        args(w);
+        wire_frame(out_, body);
+        return id;
+    }
+};
+
+struct LoadGenResult {
+    uint64_t requests = 0;
+    double seconds = 0;
+    double requests_per_second = 0;
+};
+
+/**
+ * @brief Local load generator: `clients` connections, each keeping `depth` requests in flight.
+ * @details The mix is 50% view updates, 25% comment reads, 25% location reads over the
+ *          given ids; deterministic per seed.
+ */
+static LoadGenResult run_load_generator(uint16_t port, unsigned clients, uint64_t requests_per_client, unsigned depth,
+                                        const std::vector<int>& post_ids, const std::vector<int>& user_ids,
+                                        const std::vector<std::string>& locations, uint32_t seed = 42) {
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c] {
+            BuzzClient cl = BuzzClient::tcp(port);
+            std::mt19937 rng(seed + c);
+            uint64_t sent = 0, received = 0;
+            while (received < requests_per_client) {
+                while (sent < requests_per_client && sent - received < depth) {
+                    uint32_t pick = rng() % 4;
+                    if (pick < 2) cl.sendUpdatePostViews(post_ids[rng() % post_ids.size()], 1);
+                    else if (pick == 2) cl.sendGetUserComments(user_ids[rng() % user_ids.size()]);
+                    else cl.sendGetLocationCounts(locations[rng() % locations.size()]);
+                    ++sent;
+                }
+                cl.flush();
+                cl.receive();
+                ++received;
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    LoadGenResult res;
+    res.requests = uint64_t(clients) * requests_per_client;
+    res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    res.requests_per_second = res.seconds > 0 ? double(res.requests) / res.seconds : 0;
+    return res;
+}
+
+// ----------------------------- Data generator -----------------------------
+// Deterministic synthetic datasets in the loaders' CSV format. Popularity is Zipf-skewed:
+// a few users write most posts and engagements, a few posts draw most engagements, and a
+// few cities hold most users. The same spec and seed always produce byte-identical files.
+
+// splitmix64: tiny, fast, and good enough for workload generation.
+struct GenRng {
+    uint64_t state;
+
+    explicit GenRng(uint64_t seed) : state(seed) {}
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+    double uniform() { return double(next() >> 11) * 0x1.0p-53; }   // [0, 1)
+    uint64_t below(uint64_t n) { return next() % n; }
+};
+
+/**
+ * @brief Zipf(n, s) sampler over ranks 1..n using rejection-inversion (Hörmann & Derflinger).
+ * @details O(1) memory and expected O(1) time per draw, so it scales to 100M-element domains.
+ */
+class ZipfSampler {
+public:
+    ZipfSampler(uint64_t n, double s) : n_(n), s_(s) {
+        h_x1_ = h_integral(1.5) - 1.0;
+        h_n_ = h_integral(double(n) + 0.5);
+        squeeze_ = 2.0 - h_integral_inverse(h_integral(2.5) - h(2.0));
+    }
+
+    uint64_t operator()(GenRng& rng) const {
+        for (;;) {
+            double u = h_n_ + rng.uniform() * (h_x1_ - h_n_);
+            double x = h_integral_inverse(u);
+            double k = std::floor(x + 0.5);
+            if (k < 1) k = 1;
+            else if (k > double(n_)) k = double(n_);
+            if (k - x <= squeeze_ || u >= h_integral(k + 0.5) - h(k)) return static_cast<uint64_t>(k);
+        }
+    }
+
+private:
+    uint64_t n_;
+    double s_, h_x1_, h_n_, squeeze_;
+
+    // log1p(x)/x and expm1(x)/x, with series near 0
+    static double helper1(double x) { return std::fabs(x) > 1e-8 ? std::log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x)); }
+    static double helper2(double x) { return std::fabs(x) > 1e-8 ? std::expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x)); }
+    double h(double x) const { return std::exp(-s_ * std::log(x)); }
+    double h_integral(double x) const { double lx = std::log(x); return helper2((1 - s_) * lx) * lx; }
+    double h_integral_inverse(double x) const {
+        double t = x * (1 - s_);
+        if (t < -1) t = -1;
+        return std::exp(helper1(t) * x);
+    }
+};
+
+// Bijection on [0, n) that scatters popular ranks over the id space.
+static uint64_t scatter_rank(uint64_t rank, uint64_t n) {
+    uint64_t mult = 2654435761ULL % n;
+    while (n > 1 && std::gcd(mult, n) != 1) ++mult;
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(rank) * mult + 12345) % n);
+}
+
+struct DatasetSpec {
+    size_t users = 10000;
+    size_t posts = 8000;
+    size_t engagements = 10000;
+    size_t locations = 50;
+    double user_skew = 1.05;       // Zipf exponent for who posts and engages
+    double post_skew = 1.1;        // Zipf exponent for which posts draw engagement
+    double location_skew = 0.9;
+    double like_fraction = 0.6;
+    uint64_t seed = 42;
+
+    // Shape a dataset around `engagements` rows, keeping the fixtures' table ratios.
+    static DatasetSpec scaled(size_t engagements, uint64_t seed = 42) {
+        DatasetSpec d;
+        d.engagements = engagements;
+        d.users = std::max<size_t>(100, engagements);
+        d.posts = std::max<size_t>(100, engagements * 4 / 5);
+        d.locations = std::min<size_t>(1000, std::max<size_t>(10, engagements / 2000));
+        d.seed = seed;
+        return d;
+    }
+};
+
+/**
+ * @brief Write a dataset as a users/posts/engagements CSV triple.
+ * @details Users are ids 0..users-1 named user<id>; posts are 1..posts; engagements 1..N with
+ *          non-decreasing timestamps. Every foreign key resolves.
+ * @complexity O(rows), constant memory beyond the output buffers.
+ */
+static void generate_dataset(const DatasetSpec& spec, const ShardPaths& out) {
+    ASSERT_WITH_MESSAGE(spec.users > 0 && spec.posts > 0 && spec.locations > 0, "empty dataset spec");
+    GenRng rng(spec.seed);
+    ZipfSampler pick_user(spec.users, spec.user_skew);
+    ZipfSampler pick_post(spec.posts, spec.post_skew);
+    ZipfSampler pick_loc(spec.locations, spec.location_skew);
+    auto user_of = [&] { return scatter_rank(pick_user(rng) - 1, spec.users); };
+    auto open = [](const std::string& path, const char* header) {
+        auto f = std::make_unique<std::ofstream>(path, std::ios::trunc | std::ios::binary);
+        ASSERT_WITH_MESSAGE(f->good(), "File failed: " + path);
+        *f << header;
+        return f;
+    };
+
+    std::string buf;
+    auto emit = [&](std::ofstream& f, bool last) {
+        if (buf.size() >= (1u << 20) || last) { f.write(buf.data(), static_cast<std::streamsize>(buf.size())); buf.clear(); }
+    };
+
+    auto users = open(out.users, "id,username,location\n");
+    for (size_t id = 0; id < spec.users; ++id) {
+        buf += std::to_string(id) + ",user" + std::to_string(id) + ",city" + std::to_string(pick_loc(rng)) + "\n";
+        emit(*users, id + 1 == spec.users);
+    }
+    users.reset();
+
+    auto posts = open(out.posts, "id,content,username,views\n");
+    for (size_t id = 1; id <= spec.posts; ++id) {
+        size_t words = 3 + rng.below(12);
+        buf += std::to_string(id) + ",";
+        for (size_t w = 0; w < words; ++w) buf += (w ? " w" : "w") + std::to_string(rng.below(5000));
+        buf += ",user" + std::to_string(user_of()) + "," + std::to_string(rng.below(1000)) + "\n";
+        emit(*posts, id == spec.posts);
+    }
+    posts.reset();
+
+    auto engs = open(out.engagements, "id,postId,username,type,comment,timestamp\n");
+    uint64_t ts = 0;
+    for (size_t id = 1; id <= spec.engagements; ++id) {
+        ts += rng.below(4);
+        uint64_t post = scatter_rank(pick_post(rng) - 1, spec.posts) + 1;
+        buf += std::to_string(id) + "," + std::to_string(post) + ",user" + std::to_string(user_of());
+        if (rng.uniform() < spec.like_fraction) buf += ",like,None,";
+        else buf += ",comment,c" + std::to_string(rng.below(1000)) + ",";
+        buf += std::to_string(ts) + "\n";
+        emit(*engs, id == spec.engagements);
+    }
+    if (spec.engagements == 0) emit(*engs, true);
+}
+
+#ifndef MAIN_DEFINED
+#define MAIN_DEFINED
+
+// ---------- Helpers (timing, memory, CPU, copying) ----------
+
+static size_t peakRSSkB() {
+    struct rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+#if defined(__APPLE__) && defined(__MACH__)
+    // On macOS, ru_maxrss is in bytes.
+    return static_cast<size_t>(ru.ru_maxrss / 1024);
+#else
+    // On Linux, ru_maxrss is in kilobytes.
+    return static_cast<size_t>(ru.ru_maxrss);
+#endif
+}
+
+static double cpu_user_seconds() {
+    struct rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+}
+
+static double cpu_sys_seconds() {
+    struct rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+class ScopedTimer {
+    std::string label;
+    std::chrono::steady_clock::time_point t0;
+    double limit_sec; // if > 0, assert wall-time under this
+public:
+    explicit ScopedTimer(std::string s, double limit = -1.0)
+        : label(std::move(s)), t0(std::chrono::steady_clock::now()), limit_sec(limit) {}
+    ~ScopedTimer() {
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        std::cout << label << ": " << sec << " s\n";
+        if (limit_sec > 0) {
+            ASSERT_WITH_MESSAGE(sec < limit_sec, label + " too slow: " + std::to_string(sec) + "s (limit " + std::to_string(limit_sec) + "s)");
+        }
+    }
+};
+
+// Function to copy files line by line
+void copy_files(const std::vector<std::string>& input_files, const std::vector<std::string>& output_files) {
+    for (size_t i = 0; i < input_files.size(); i++) {
+        std::ifstream src(input_files[i]);
+        std::ofstream dst(output_files[i], std::ios::trunc);
+        ASSERT_WITH_MESSAGE(src.is_open(), "copy_files: cannot open " + input_files[i]);
+        ASSERT_WITH_MESSAGE(dst.is_open(), "copy_files: cannot open " + output_files[i]);
+        std::string line;
+        while (std::getline(src, line)) {
+            dst << line << "\n";
+        }
+    }
+}
+
+// Overwrite the 'views' column for a specific post_id in a CSV file (header preserved).
+static void rewrite_post_views_file(const std::string& posts_csv_path, int post_id, int new_views) {
+    rewrite_post_views_batch(posts_csv_path, {{post_id, new_views}});
+}
+
+// Quick referential-integrity sweep
+// ensure every engagement.postId exists in posts.
+// With a pool, each engagement stripe is checked as its own range.
+static bool check_no_dangling_post_ids(const StripedTable<Engagement>& eng,
+                                       const StripedTable<Post>& posts,
+                                       WorkStealingPool* pool = nullptr) {
+    std::atomic<bool> ok{true};
+    auto check_stripe = [&](size_t s) {
+        for (const auto& kv : eng.stripe_rows(s)) {
+            if (!ok.load(std::memory_order_relaxed)) return;
+            if (posts.find(kv.second->postId) == posts.end()) { ok = false; return; }
+        }
+    };
+    if (pool) {
+        pool->parallel_for(StripedTable<Engagement>::kStripes, check_stripe);
+    } else {
+        for (size_t s = 0; s < StripedTable<Engagement>::kStripes; ++s) check_stripe(s);
+    }
+    return ok.load();
+}
+
+// ---------- Benchmark driver ----------
+// `<binary> bench [scale...] [--seed N] [--updates N] [--inserts N] [--renames N] [--queries N] [--keep]`
+// generates a dataset per scale (engagement rows; see DatasetSpec::scaled) and prints one JSON
+// object per (scale, operation) line on stdout.
+
+struct BenchConfig {
+    std::vector<size_t> scales{10000, 100000, 1000000};
+    uint64_t seed = 42;
+    size_t updates = 1000;
+    size_t inserts = 1000;
+    size_t renames = 10;        // each rename rewrites the users file and rebuilds derived views
+    size_t queries = 200;
+    std::string prefix = "bench";
+    bool keep_files = false;
+};
+
+struct BenchSample {
+    std::string op;
+    size_t scale = 0;
+    std::vector<double> latency_us;
+    double seconds = 0;
+    double cpu_user = 0, cpu_sys = 0;
+    size_t peak_rss_kb = 0;
+};
+
+// Reset the kernel's high-water mark so each operation reports its own peak (Linux only).
+static void reset_peak_rss() {
+    std::ofstream f("/proc/self/clear_refs");
+    if (f) f << "5";
+}
+
+// VmHWM since the last reset_peak_rss(); falls back to the process-lifetime peak.
+static size_t peak_rss_since_reset_kB() {
+    std::ifstream f("/proc/self/status");
+    std::string line;
+    while (std::getline(f, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) return std::strtoull(line.c_str() + 6, nullptr, 10);
+    }
+    return peakRSSkB();
+}
+
+static double percentile_sorted(const std::vector<double>& v, double p) {
+    if (v.empty()) return 0;
+    size_t i = static_cast<size_t>(std::ceil(p * double(v.size())));
+    return v[std::min(v.size() - 1, i ? i - 1 : 0)];
+}
+
+// Time `n` calls of fn(i) individually, plus CPU and peak RSS across the whole run.
+template <typename Fn>
+static BenchSample bench_op(const std::string& op, size_t scale, size_t n, Fn&& fn) {
+    BenchSample s;
+    s.op = op;
+    s.scale = scale;
+    s.latency_us.reserve(n);
+    reset_peak_rss();
+    double u0 = cpu_user_seconds(), s0 = cpu_sys_seconds();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        auto t0 = std::chrono::steady_clock::now();
+        fn(i);
+        s.latency_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+    }
+    s.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    s.cpu_user = cpu_user_seconds() - u0;
+    s.cpu_sys = cpu_sys_seconds() - s0;
+    s.peak_rss_kb = peak_rss_since_reset_kB();
+    return s;
+}
+
+static void print_bench_json(std::ostream& out, BenchSample s) {
+    std::sort(s.latency_us.begin(), s.latency_us.end());
+    const size_t ops = s.latency_us.size();
+    out << "{\"scale\":" << s.scale << ",\"op\":\"" << s.op << "\",\"ops\":" << ops
+        << ",\"seconds\":" << s.seconds
+        << ",\"ops_per_sec\":" << (s.seconds > 0 ? double(ops) / s.seconds : 0)
+        << ",\"p50_us\":" << percentile_sorted(s.latency_us, 0.50)
+        << ",\"p90_us\":" << percentile_sorted(s.latency_us, 0.90)
+        << ",\"p99_us\":" << percentile_sorted(s.latency_us, 0.99)
+        << ",\"p999_us\":" << percentile_sorted(s.latency_us, 0.999)
+        << ",\"max_us\":" << (ops ? s.latency_us.back() : 0)
+        << ",\"cpu_user_s\":" << s.cpu_user << ",\"cpu_sys_s\":" << s.cpu_sys
+        << ",\"peak_rss_kb\":" << s.peak_rss_kb << "}\n";
+}
+
+/**
+ * @brief Generate, load and exercise one dataset per configured scale.
+ * @details Point lookups follow the dataset's own Zipf skew. The result cache is disabled so
+ *          query numbers measure the scans, not cache hits.
+ */
+static void run_benchmark(const BenchConfig& cfg, std::ostream& out) {
+    for (size_t scale : cfg.scales) {
+        DatasetSpec spec = DatasetSpec::scaled(scale, cfg.seed);
+        const std::string base = cfg.prefix + "_" + std::to_string(scale) + "_";
+        ShardPaths paths{base + "users.csv", base + "posts.csv", base + "engagements.csv"};
+        print_bench_json(out, bench_op("generate", scale, 1, [&](size_t) { generate_dataset(spec, paths); }));
+        {
+            FlatFile db(paths.users, paths.posts, paths.engagements);
+            db.setResultCacheBytes(0);
+            print_bench_json(out, bench_op("load", scale, 1, [&](size_t) { db.loadFlatFile(); }));
+
+            GenRng rng(cfg.seed ^ scale);
+            ZipfSampler pick_user(spec.users, spec.user_skew);
+            ZipfSampler pick_post(spec.posts, spec.post_skew);
+            auto user = [&] { return static_cast<int>(scatter_rank(pick_user(rng) - 1, spec.users)); };
+            auto post = [&] { return static_cast<int>(scatter_rank(pick_post(rng) - 1, spec.posts) + 1); };
+
+            print_bench_json(out, bench_op("update_post_views", scale, cfg.updates, [&](size_t) {
+                db.updatePostViews(post(), 1);
+            }));
+            print_bench_json(out, bench_op("add_engagement", scale, cfg.inserts, [&](size_t i) {
+                bool like = rng.uniform() < spec.like_fraction;
+                Engagement e(static_cast<int>(spec.engagements + 1 + i), post(), "user" + std::to_string(user()),
+                             like ? "like" : "comment", like ? "None" : "bench", static_cast<int>(i));
+                db.addEngagementRecord(e);
+            }));
+            print_bench_json(out, bench_op("update_user_name", scale, cfg.renames, [&](size_t i) {
+                db.updateUserName(user(), "renamed" + std::to_string(i));
+            }));
+            print_bench_json(out, bench_op("get_user_comments", scale, cfg.queries, [&](size_t) {
+                db.getAllUserComments(user());
+            }));
+            print_bench_json(out, bench_op("get_location_counts", scale, cfg.queries, [&](size_t) {
+                db.getAllEngagementsByLocation("city" + std::to_string(1 + rng.below(spec.locations)));
+            }));
+            print_bench_json(out, bench_op("query_group_by_type", scale, cfg.queries, [&](size_t) {
+                db.runQuery(Query(QueryTable::Engagements).groupBy("type").count());
+            }));
+        }
+        if (!cfg.keep_files) {
+            for (const std::string* f : {&paths.users, &paths.posts, &paths.engagements}) {
+                std::remove(f->c_str());
+                std::remove((*f + ".tmp").c_str());
+            }
+        }
+    }
+}
+
+// Parse `bench` arguments; unknown flags are fatal so typos don't silently run defaults.
+static BenchConfig parse_bench_args(int argc, char* argv[]) {
+    BenchConfig cfg;
+    std::vector<size_t> scales;
+    auto number = [&](int& i) {
+        ASSERT_WITH_MESSAGE(i + 1 < argc, std::string("missing value for ") + argv[i]);
+        return std::strtoull(argv[++i], nullptr, 10);
+    };
+    for (int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--seed") cfg.seed = number(i);
+        else if (a == "--updates") cfg.updates = number(i);
+        else if (a == "--inserts") cfg.inserts = number(i);
+        else if (a == "--renames") cfg.renames = number(i);
+        else if (a == "--queries") cfg.queries = number(i);
+        else if (a == "--keep") cfg.keep_files = true;
+        else if (!a.empty() && std::isdigit(static_cast<unsigned char>(a[0]))) scales.push_back(std::strtoull(a.c_str(), nullptr, 10));
+        else ASSERT_WITH_MESSAGE(false, "unknown bench argument: " + a);
+    }
+    if (!scales.empty()) cfg.scales = scales;
+    return cfg;
+}
+
+// ---------- Performance regression harness ----------
+// `<binary> perf [--baseline FILE] [--update] [--samples N] [--warmups N] [--tolerance F]`
+// Each case runs warm-ups, then N timed samples with the measuring thread pinned to one CPU.
+// A case regresses only when the bootstrap 95% confidence interval of
+// median(current) / median(baseline) lies entirely above 1 + tolerance, so noise widens the
+// interval instead of failing the run. Missing baselines are recorded, not failed.
+
+struct PerfCase {
+    std::string name;
+    std::function<void()> run;              // timed
+    std::function<void()> setup = nullptr;  // untimed, before every warm-up and sample
+    bool pin = true;                        // false for cases whose samples start new thread pools
+};
+
+struct PerfOptions {
+    size_t warmups = 3;
+    size_t samples = 15;
+    double tolerance = 0.10;
+    int cpu = 0;
+};
+
+struct PerfVerdict {
+    std::string name;
+    double baseline_median = 0, current_median = 0;
+    double ratio = 1, ci_low = 1, ci_high = 1;
+    bool regression = false;
+    bool recorded = false;   // no baseline existed; the current samples became it
+};
+
+// Pin the calling thread to one CPU for the lifetime of the guard; threads it creates
+// meanwhile inherit the pin, hence PerfCase::pin.
+class ScopedCpuPin {
+public:
+    explicit ScopedCpuPin(int cpu) {
+#if defined(__linux__)
+        saved_ok_ = pthread_getaffinity_np(pthread_self(), sizeof(saved_), &saved_) == 0;
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu % std::max(1, CPU_COUNT(&saved_)), &one);
+        pinned_ = saved_ok_ && pthread_setaffinity_np(pthread_self(), sizeof(one), &one) == 0;
+#else
+        UNUSED(cpu);
+#endif
+    }
+    ~ScopedCpuPin() {
+#if defined(__linux__)
+        if (pinned_) pthread_setaffinity_np(pthread_self(), sizeof(saved_), &saved_);
+#endif
+    }
+    bool pinned() const { return pinned_; }
+
+private:
+    bool pinned_ = false;
+#if defined(__linux__)
+    bool saved_ok_ = false;
+    cpu_set_t saved_{};
+#endif
+};
+
+static double median_of(std::vector<double> v) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    size_t m = v.size() / 2;
+    return v.size() % 2 ? v[m] : (v[m - 1] + v[m]) / 2;
+}
+
+static std::vector<double> sample_perf_case(const PerfCase& c, const PerfOptions& opt) {
+    auto once = [&] {
+        if (c.setup) c.setup();
+        auto t0 = std::chrono::steady_clock::now();
+        c.run();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    };
+    for (size_t i = 0; i < opt.warmups; ++i) once();
+    std::optional<ScopedCpuPin> pin;
+    if (c.pin) pin.emplace(opt.cpu);
+    std::vector<double> out;
+    for (size_t i = 0; i < opt.samples; ++i) out.push_back(once());
+    return out;
+}
+
+/**
+ * @brief Compare two sample sets by the ratio of their medians.
+ * @details The 95% interval comes from 2000 paired bootstrap resamples with a fixed seed, so
+ *          the verdict is a pure function of the samples.
+ */
+static PerfVerdict compare_perf_samples(const std::string& name, const std::vector<double>& baseline,
+                                        const std::vector<double>& current, double tolerance) {
+    PerfVerdict v;
+    v.name = name;
+    v.baseline_median = median_of(baseline);
+    v.current_median = median_of(current);
+    if (baseline.empty() || current.empty() || v.baseline_median <= 0) return v;
+    v.ratio = v.current_median / v.baseline_median;
+
+    GenRng rng(0x5eed);
+    std::vector<double> ratios, b(baseline.size()), c(current.size());
+    for (int r = 0; r < 2000; ++r) {
+        for (auto& x : b) x = baseline[rng.below(baseline.size())];
+        for (auto& x : c) x = current[rng.below(current.size())];
+        double mb = median_of(b);
+        if (mb > 0) ratios.push_back(median_of(c) / mb);
+    }
+    std::sort(ratios.begin(), ratios.end());
+    v.ci_low = percentile_sorted(ratios, 0.025);
+    v.ci_high = percentile_sorted(ratios, 0.975);
+    v.regression = v.ci_low > 1 + tolerance;
+    return v;
+}
+
+// Baselines as text lines "name count s1 s2 ..." (seconds); one file per machine.
+class PerfBaselineStore {
+public:
+    explicit PerfBaselineStore(std::string path) : path_(std::move(path)) {
+        std::ifstream in(path_);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream ss(line);
+            std::string name;
+            size_t n = 0;
+            if (!(ss >> name >> n)) continue;
+            std::vector<double> v(n);
+            for (auto& x : v) ss >> x;
+            if (ss) series_[name] = std::move(v);
+        }
+    }
+
+    const std::vector<double>* get(const std::string& name) const {
+        auto it = series_.find(name);
+        return it == series_.end() ? nullptr : &it->second;
+    }
+    void put(const std::string& name, std::vector<double> samples) { series_[name] = std::move(samples); }
+
+    void save() const {
+        std::ofstream out(path_, std::ios::trunc);
+        ASSERT_WITH_MESSAGE(out.good(), "File failed: " + path_);
+        out << std::setprecision(9);
+        for (const auto& kv : series_) {
+            out << kv.first << " " << kv.second.size();
+            for (double x : kv.second) out << " " << x;
+            out << "\n";
+        }
+    }
+
+private:
+    std::string path_;
+    std::map<std::string, std::vector<double>> series_;
+};
+
+// Sample every case, compare with (or record) its baseline, and print one line per case.
+static std::vector<PerfVerdict> run_perf_suite(const std::vector<PerfCase>& cases, PerfBaselineStore& store,
+                                               const PerfOptions& opt, bool update, std::ostream& report) {
+    std::vector<PerfVerdict> verdicts;
+    for (const PerfCase& c : cases) {
+        std::vector<double> samples = sample_perf_case(c, opt);
+        const std::vector<double>* base = store.get(c.name);
+        PerfVerdict v;
+        if (base && !update) {
+            v = compare_perf_samples(c.name, *base, samples, opt.tolerance);
+        } else {
+            v.name = c.name;
+            v.baseline_median = v.current_median = median_of(samples);
+            v.recorded = true;
+            store.put(c.name, samples);
+        }
+        report << std::left << std::setw(24) << v.name << std::right << std::fixed << std::setprecision(6)
+               << " base " << v.baseline_median << "s  now " << v.current_median << "s  ratio "
+               << std::setprecision(3) << v.ratio << " [" << v.ci_low << ", " << v.ci_high << "]  "
+               << (v.recorded ? "RECORDED" : v.regression ? "REGRESSION" : "ok") << "\n";
+        report.unsetf(std::ios::floatfield);
+        verdicts.push_back(v);
+    }
+    store.save();
+    return verdicts;
+}
+
+// The standard suite over the fixture copies: loaders, view updates and the queries.
+static std::vector<PerfCase> standard_perf_cases(FlatFile& db) {
+    int post = db.getPosts().begin()->first;
+    int user = db.getUsers().begin()->first;
+    std::string location = db.getUsers().begin()->second->location;
+    std::vector<PerfCase> cases;
+    cases.push_back({"load_serial", [] {
+        FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff.loadFlatFile();
+    }, nullptr, false});
+    cases.push_back({"load_parallel", [] {
+        FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff.loadMultipleFlatFilesInParallel();
+    }, nullptr, false});
+    cases.push_back({"update_post_views", [&db, post] { db.updatePostViews(post, 1); }});
+    cases.push_back({"get_user_comments", [&db, user] { db.getAllUserComments(user); }});
+    cases.push_back({"get_location_counts", [&db, location] { db.getAllEngagementsByLocation(location); }});
+    cases.push_back({"query_group_by_type", [&db] { db.runQuery(Query(QueryTable::Engagements).groupBy("type").count()); }});
+    return cases;
+}
+
+int main(int argc, char* argv[]) {
+    bool execute_all = false;
+    std::string selected_test = "-1";
+    int seed = std::chrono::system_clock::now().time_since_epoch().count();
+
+    if (argc >= 2 && std::string(argv[1]) == "bench") {
+        run_benchmark(parse_bench_args(argc, argv), std::cout);
+        return 0;
+    }
+    if (argc >= 2 && std::string(argv[1]) == "perf") {
+        PerfOptions opt;
+        std::string baseline = "perf_baseline.txt";
+        bool update = false;
+        for (int i = 2; i < argc; ++i) {
+            std::string a = argv[i];
+            bool has_value = i + 1 < argc;
+            if (a == "--baseline" && has_value) baseline = argv[++i];
+            else if (a == "--update") update = true;
+            else if (a == "--samples" && has_value) opt.samples = std::strtoull(argv[++i], nullptr, 10);
+            else if (a == "--warmups" && has_value) opt.warmups = std::strtoull(argv[++i], nullptr, 10);
+            else if (a == "--tolerance" && has_value) opt.tolerance = std::strtod(argv[++i], nullptr);
+            else ASSERT_WITH_MESSAGE(false, "unknown perf argument: " + a);
+        }
+        copy_files({"users.csv", "posts.csv", "engagements.csv"}, {"users_copy.csv", "posts_copy.csv", "engagements_copy.csv"});
+        FlatFile db("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        db.loadFlatFile();
+        db.setResultCacheBytes(0);   // time the queries, not cache hits
+        PerfBaselineStore store(baseline);
+        auto verdicts = run_perf_suite(standard_perf_cases(db), store, opt, update, std::cout);
+        bool regressed = std::any_of(verdicts.begin(), verdicts.end(), [](const PerfVerdict& v) { return v.regression; });
+        return regressed ? 1 : 0;
+    }
+
+    if(argc < 2) {
+        execute_all = true;
+    } else {
+        selected_test = argv[1];
+    }
+
+    // duplicate copies of test input files to avoid modifying originals
+    std::vector<std::string> input_files = {"users.csv", "posts.csv", "engagements.csv"};
+    std::vector<std::string> output_files = {"users_copy.csv", "posts_copy.csv", "engagements_copy.csv"};
+    srand(seed);
+
+    // Test 1: LoadCSV [Single threaded]
+    if (execute_all || selected_test == "1") {
+        std::cout << "Executing Test 1: Single threaded loadFlatFile" << std::endl;
+
+        auto start_time = std::chrono::steady_clock::now();
+        FlatFile flatFile("users.csv", "posts.csv", "engagements.csv");
+        flatFile.loadFlatFile();
+        auto end_time = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed_seconds = end_time - start_time;
+        std::cout << "Elapsed time: " << elapsed_seconds.count() << "s\n";
+
+        std::set<std::string> usernames, post_usernames;
+        std::set<int> engagement_post_ids, post_ids;
+        for (auto& entry : flatFile.getUsers()) {
+            usernames.insert(entry.second->username);
+        }
+        for (auto& entry : flatFile.getPosts()) {
+            post_ids.insert(entry.second->id);
+            post_usernames.insert(entry.second->username);
+        }
+        for (auto& entry : flatFile.getEngagements()) {
+            engagement_post_ids.insert(entry.second->postId);
+        }
+
+        ASSERT_WITH_MESSAGE(usernames.size() == 10000, "users size mismatch. Expected: 10000 Actual: " + std::to_string(usernames.size()));
+        ASSERT_WITH_MESSAGE(post_usernames.size() == 4000, "posts users size mismatch. Expected: 4000 Actual: " + std::to_string(post_usernames.size()));
+        ASSERT_WITH_MESSAGE(flatFile.getEngagements().size() == 10000, "engagements size mismatch. Expected: 10000 Actual: " + std::to_string(flatFile.getEngagements().size()));
+
+        ASSERT_WITH_MESSAGE(usernames.find("knorman") != usernames.end(), "user knorman not found in flatfile DB");
+        ASSERT_WITH_MESSAGE(usernames.find("wchaney") != usernames.end(), "user wchaney not found in flatfile DB");
+        ASSERT_WITH_MESSAGE(usernames.find("richardbishop") != usernames.end(), "user richardbishop not found in flatfile DB");
+
+        ASSERT_WITH_MESSAGE(engagement_post_ids.find(1496) != engagement_post_ids.end(), "post 1496 missing");
+        ASSERT_WITH_MESSAGE(engagement_post_ids.find(6936) != engagement_post_ids.end(), "post 6936 missing");
+        ASSERT_WITH_MESSAGE(engagement_post_ids.find(4826) != engagement_post_ids.end(), "post 4826 missing");
+
+        std::vector<std::string> username_intersection;
+        std::vector<int> post_ids_intersection;
+        username_intersection.reserve(std::min(usernames.size(), post_usernames.size()));
+        post_ids_intersection.reserve(std::min(post_ids.size(), engagement_post_ids.size()));
+
+        set_intersection(usernames.begin(), usernames.end(),
+                         post_usernames.begin(), post_usernames.end(),
+                         back_inserter(username_intersection));
+
+        set_intersection(post_ids.begin(), post_ids.end(),
+                         engagement_post_ids.begin(), engagement_post_ids.end(),
+                         back_inserter(post_ids_intersection));
+
+        ASSERT_WITH_MESSAGE(username_intersection.size() == post_usernames.size(), "username mismatch in posts and users.");
+        ASSERT_WITH_MESSAGE(post_ids_intersection.size() == engagement_post_ids.size(), "post ids mismatch in posts and engagements.");
+
+        std::cout << "Test 1: PASSED" << std::endl;
+    }
+
+    // Test 2: Parallel loader must be faster 
+    if (execute_all || selected_test == "2") {
+        std::cout << "Executing Test 2: Parallel loader speedup vs serial\n";
+        copy_files(input_files, output_files);
+
+        auto time_once = [](auto&& fn){
+            auto t0 = std::chrono::steady_clock::now();
+            fn();
+            auto t1 = std::chrono::steady_clock::now();
+            return std::chrono::duration<double>(t1 - t0).count();
+        };
+        auto median = [](std::vector<double> v){
+            std::sort(v.begin(), v.end());
+            return v[v.size()/2];
+        };
+
+        // Functions to run each mode on the SAME (copy) paths
+        auto run_serial = [&](){
+            FlatFile ff("users_copy.csv","posts_copy.csv","engagements_copy.csv");
+            ff.loadFlatFile();
+            // sanity: non-empty
+            ASSERT_WITH_MESSAGE(!ff.getUsers().empty() && !ff.getPosts().empty() && !ff.getEngagements().empty(),
+                                "serial load produced empty structures");
+        };
+        auto run_parallel = [&](){
+            FlatFile ff("users_copy.csv","posts_copy.csv","engagements_copy.csv");
+            ff.loadMultipleFlatFilesInParallel();
+            ASSERT_WITH_MESSAGE(!ff.getUsers().empty() && !ff.getPosts().empty() && !ff.getEngagements().empty(),
+                                "parallel load produced empty structures");
+        };
+
+        // Warm-ups, then interleaved samples so drift hits both modes alike
+        std::vector<double> ts_serial, ts_parallel;
+        for (int i = 0; i < 2; ++i) { run_serial(); run_parallel(); }
+        for (int i = 0; i < 11; ++i) {
+            ts_serial.push_back(time_once(run_serial));
+            ts_parallel.push_back(time_once(run_parallel));
+        }
+        double serial_s = median(ts_serial);
+        double parallel_s = median(ts_parallel);
+
+        std::cout << "Serial median:   " << serial_s   << " s\n";
+        std::cout << "Parallel median: " << parallel_s << " s\n";
+
+        // Fail only when the parallel loader is *significantly* slower than allowed: with >= 2
+        // cores it must not lose to the serial loader, on one core it may cost up to 50% more.
+        unsigned cores = std::thread::hardware_concurrency();
+        double allowance = (cores >= 2) ? 0.0 : 0.50;
+        PerfVerdict v = compare_perf_samples("parallel_vs_serial", ts_serial, ts_parallel, allowance);
+        std::cout << "Parallel/serial: " << v.ratio << " (95% CI " << v.ci_low << " - " << v.ci_high << ")\n";
+        ASSERT_WITH_MESSAGE(!v.regression,
+            "Parallel loader significantly slower than serial (serial=" + std::to_string(serial_s) +
+            "s, parallel=" + std::to_string(parallel_s) + "s, CI low=" + std::to_string(v.ci_low) +
+            ", cores=" + std::to_string(cores) + ")");
+
+        // Final equivalence check: both paths load the same cardinalities.
+        {
+            FlatFile a("users_copy.csv","posts_copy.csv","engagements_copy.csv"); a.loadFlatFile();
+            FlatFile b("users_copy.csv","posts_copy.csv","engagements_copy.csv"); b.loadMultipleFlatFilesInParallel();
+            ASSERT_WITH_MESSAGE(a.getUsers().size() == b.getUsers().size(), "users size mismatch between serial and parallel");
+            ASSERT_WITH_MESSAGE(a.getPosts().size() == b.getPosts().size(), "posts size mismatch between serial and parallel");
+            ASSERT_WITH_MESSAGE(a.getEngagements().size() == b.getEngagements().size(), "engagements size mismatch between serial and parallel");
+        }
+
+        std::cout << "Test 2: PASSED\n";
+    }
+
+    // Test 3: GetAllUserComments
     if (execute_all || selected_test == "3") {
         std::cout << "Executing Test 3: GetAllUserComments" << std::endl;
 
-        // invalid user id
+        // invalid user id
+        {
+            FlatFile flatFile("users.csv", "posts.csv", "engagements.csv");
+            flatFile.loadFlatFile();
+
+            int user_id = 10001 + (std::rand() % 1000);
+            auto found_comments = flatFile.getAllUserComments(user_id);
+            ASSERT_WITH_MESSAGE(found_comments.empty(), "Invalid user id should return empty comments");
+        }
+
+        // valid user id with added comments and ordering
+        {
+            std::vector<std::pair<int, std::string>> expected_comments;
+            int user_id = -1;
+
+            copy_files(input_files, output_files);
+
+            {
+                FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+                flatFile.loadFlatFile();
+
+                // find a valid user id with comments
+                std::map<std::string, int> user_names;
+                std::vector<int> user_ids;
+                for (auto& entry : flatFile.getEngagements()) {
+                    if (entry.second->type == "comment") user_names[entry.second->username]++;
+                }
+                for (auto& entry : flatFile.getUsers()) {
+                    if (user_names[entry.second->username] > 1) user_ids.push_back(entry.second->id);
+                }
+
+                user_id = user_ids[std::rand() % user_ids.size()];
+                std::cout << "Testing for a valid user_id: " << user_id << std::endl;
+
+                expected_comments = flatFile.getAllUserComments(user_id);
+
+                // add two comments to test ordering ties
+                Engagement record1 = Engagement(100010, expected_comments[0].first + 1, flatFile.getUsers()[user_id]->username, "comment", "comment1", 100);
+                flatFile.addEngagementRecord(record1);
+                expected_comments.push_back({ record1.postId, record1.comment });
+
+                Engagement record2 = Engagement(100011, expected_comments[0].first, flatFile.getUsers()[user_id]->username, "comment", "comment2", 101);
+                flatFile.addEngagementRecord(record2);
+                expected_comments.push_back({ record2.postId, record2.comment });
+
+                std::sort(expected_comments.begin(), expected_comments.end());
+            }
+
+            {
+                FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+                flatFile.loadFlatFile();
+
+                auto found_comments = flatFile.getAllUserComments(user_id);
+                ASSERT_WITH_MESSAGE(found_comments == expected_comments,
+                    "Expected and actual comments mismatch (size/order must match)");
+            }
+        }
+
+        std::cout << "Test 3: PASSED" << std::endl;
+    }
+
+    // Test 4: GetAllEngagementsByLocation
+    if (execute_all || selected_test == "4") {
+        std::cout << "Executing Test 4: GetAllEngagementsByLocation" << std::endl;
+
+        std::string location = "InvalidLocation";
+        std::pair<int, int> expected_engagements;
+        {
+            FlatFile flatFile("users.csv", "posts.csv", "engagements.csv");
+            flatFile.loadFlatFile();
+            expected_engagements = flatFile.getAllEngagementsByLocation(location);
+            ASSERT_WITH_MESSAGE(expected_engagements.first == 0 && expected_engagements.second == 0, "Invalid location should return 0 engagements");
+        }
+
+        {
+            copy_files(input_files, output_files);
+
+            FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+            flatFile.loadFlatFile();
+
+            std::vector<std::string> locations;
+            std::string username = "";
+
+            for (auto& entry : flatFile.getUsers()) {
+                locations.push_back(entry.second->location);
+            }
+
+            location = locations[std::rand() % locations.size()];
+            for (auto& entry : flatFile.getUsers()) {
+                if (entry.second->location == location) { username = entry.second->username; break; }
+            }
+            std::cout << "Testing for a valid location: " << location << std::endl;
+            expected_engagements = flatFile.getAllEngagementsByLocation(location);
+
+            for (int i = 0; i < rand() % 20 + 1; i++) {
+                int type = rand() % 2;
+                Engagement record = Engagement(100010 + i, 1, username, type ? "like" : "comment",
+                    type ? "None" : "Howdy!", 100);
+                flatFile.addEngagementRecord(record);
+                if (type) ++expected_engagements.first; else ++expected_engagements.second;
+            }
+
+            auto actual_engagements = flatFile.getAllEngagementsByLocation(location);
+            ASSERT_WITH_MESSAGE(actual_engagements == expected_engagements,
+                "Expected vs actual engagements mismatch");
+        }
+
+        {
+            FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+            flatFile.loadFlatFile();
+            auto actual_engagements = flatFile.getAllEngagementsByLocation(location);
+            ASSERT_WITH_MESSAGE(actual_engagements == expected_engagements,
+                "Mismatch after reload");
+        }
+
+        std::cout << "Test 4: PASSED" << std::endl;
+    }
+
+    // Test 5: UpdateUserName
+    if (execute_all || selected_test == "5") {
+        std::cout << "Executing Test 5: UpdateUserName" << std::endl;
+
+        {
+            FlatFile flatFile("users.csv", "posts.csv", "engagements.csv");
+            flatFile.loadFlatFile();
+            int user_id = 100001 + (std::rand() % 1000);
+            bool status = flatFile.updateUserName(user_id, "new_username");
+            ASSERT_WITH_MESSAGE(!status, "Invalid user id should return false");
+        }
+
+        int user_id = -1;
+        int prev_posts_count = 0, prev_engagements_count = 0;
+        std::string old_username;
+        std::string new_username = "new_username";
+        {
+            copy_files(input_files, output_files);
+
+            FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+            flatFile.loadFlatFile();
+
+            std::map<std::string, int> posts_count, engagements_count;
+            for (auto& entry : flatFile.getPosts()) posts_count[entry.second->username]++;
+            for (auto& entry : flatFile.getEngagements()) engagements_count[entry.second->username]++;
+
+            std::vector<int> user_ids;
+            for (auto& entry : flatFile.getUsers()) {
+                if (posts_count[entry.second->username] >= 1 && engagements_count[entry.second->username] >= 1) {
+                    user_ids.push_back(entry.second->id);
+                }
+            }
+            user_id = user_ids[std::rand() % user_ids.size()];
+            old_username = flatFile.getUsers()[user_id]->username;
+
+            std::cout << "Testing for valid user_id: " << user_id << std::endl;
+            prev_posts_count = posts_count[old_username];
+            prev_engagements_count = engagements_count[old_username];
+
+            bool status = flatFile.updateUserName(user_id, new_username);
+            ASSERT_WITH_MESSAGE(status, "Valid user id should return true");
+        }
+
+        {
+            FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+            flatFile.loadFlatFile();
+
+            ASSERT_WITH_MESSAGE(flatFile.getUsers()[user_id]->username == new_username, "Username not updated in users.csv");
+
+            int new_posts_count = 0, new_engagements_count = 0;
+            for (auto& entry : flatFile.getPosts()) {
+                auto uname = entry.second->username;
+                ASSERT_WITH_MESSAGE(uname != old_username, "Old username still exists in posts.");
+                if (uname == new_username) ++new_posts_count;
+            }
+            for (auto& entry : flatFile.getEngagements()) {
+                auto uname = entry.second->username;
+                ASSERT_WITH_MESSAGE(uname != old_username, "Old username still exists in engagements.");
+                if (uname == new_username) ++new_engagements_count;
+            }
+
+            ASSERT_WITH_MESSAGE(prev_posts_count == new_posts_count, "Posts count changed after username update.");
+            ASSERT_WITH_MESSAGE(prev_engagements_count == new_engagements_count, "Engagements count changed after username update.");
+        }
+
+        std::cout << "Test 5: PASSED" << std::endl;
+    }
+
+    // Test 6: In-place rewrite must survive line length increases
+    if (execute_all || selected_test == "6") {
+        std::cout << "Executing Test 6: Line-growth safety\n";
+        copy_files(input_files, output_files);
+
+        const int target_post = 19;   // reuse a known-good post id
+        // Force starting views to a 2-digit value 
+        // so increments cross into 3+ digits
+        rewrite_post_views_file("posts_copy.csv", target_post, 95);
+
+        // Now  enough to cross 100 (and beyond)
+        {
+            FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+            ff.loadFlatFile();
+            int start = ff.getPosts()[target_post]->views;
+            int total_add = 0;
+            for (int k = 0; k < 10; ++k) {
+                // +1 ten times; 95 -> 105
+                ff.updatePostViews(target_post, 1);
+                total_add += 1;
+            }
+            // Reload from disk to detect CSV corruption
+            FlatFile ff2("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+            ff2.loadFlatFile();
+            int got = ff2.getPosts()[target_post]->views;
+            ASSERT_WITH_MESSAGE(got == start + total_add,
+                "Digit-growth rewrite corrupted file. expected " + std::to_string(start+total_add) + " got " + std::to_string(got));
+        }
+        std::cout << "Test 6: PASSED\n";
+    }
+
+        // Test 7: UpdatePostViews_ValidPostId (concurrent)
+    if (execute_all || selected_test == "7") {
+        std::cout << "Executing Test 7: [ATOMICITY] UpdatePostViews_ValidPostId" << std::endl;
+
+        // parameters used below; change here if you tweak the test
+        const int kThreads = 10;
+        const int kUpdatesPerThread = 10; // j = 0..9, adds (j+1)
+
+        // helper to compute total  robustly
+        auto per_thread_inc = []() {
+            int s = 0;
+            for (int j = 0; j < kUpdatesPerThread; ++j) s += (j + 1);
+            return s; // 55 with current settings
+        };
+        const int total_increment = kThreads * per_thread_inc();
+
+        int post_id_to_update = 19;
+        int initial_views = 0;
+        {
+            copy_files(input_files, output_files);
+            
+            FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+            flatFile.loadFlatFile();
+
+            auto& posts = flatFile.getPosts();
+            ASSERT_WITH_MESSAGE(posts.count(post_id_to_update),
+                "Test setup error: post_id not found");
+            initial_views = posts[post_id_to_update]->views;
+
+            // Clear, direct assertion on the initial value
+            ASSERT_WITH_MESSAGE(initial_views >= 0,
+                "Post should not start with a negative number of views");
+
+            std::vector<std::thread> threads;
+            threads.reserve(kThreads);
+            for (int i = 0; i < kThreads; ++i) {
+                threads.emplace_back([&flatFile, post_id_to_update] {
+                    for (int j = 0; j < kUpdatesPerThread; ++j) {
+                        bool ok = flatFile.updatePostViews(post_id_to_update, j + 1);
+                        ASSERT_WITH_MESSAGE(ok, "updatePostViews failed");
+                    }
+                });
+            }
+            for (auto& t : threads) t.join();
+        }
+
+        // Re-open to verify persisted value == initial + total_increment
         {
+            FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+            flatFile.loadFlatFile();
+            int final_views = flatFile.getPosts()[post_id_to_update]->views;
+
+            ASSERT_WITH_MESSAGE(final_views == initial_views + total_increment,
+                "Post views not updated correctly. Expected " +
+                std::to_string(initial_views + total_increment) + " got " +
+                std::to_string(final_views));
+        }
+        std::cout << "Test 7: PASSED" << std::endl;
+    }
+
+    // Test 8: UpdatePostViews_InvalidPostId
+    if (execute_all || selected_test == "8") {
+        std::cout << "Executing Test 8: UpdatePostViews_InvalidPostId" << std::endl;
+
+        try {
             FlatFile flatFile("users.csv", "posts.csv", "engagements.csv");
             flatFile.loadFlatFile();
 
-            int user_id = 10001 + (std::rand() % 1000);
-            auto found_comments = flatFile.getAllUserComments(user_id);
-            ASSERT_WITH_MESSAGE(found_comments.empty(), "Invalid user id should return empty comments");
+            bool status = flatFile.updatePostViews(100001 + (std::rand() % 1000), 1);
+            ASSERT_WITH_MESSAGE(!status, "Invalid post id should return false");
+        } catch (const std::exception& e) {
+            std::cout << "Exception occurred: " << e.what() << std::endl;
+            throw;
         }
 
-        // valid user id with added comments and ordering
+        std::cout << "Test 8: PASSED" << std::endl;
+    }
+
+    // Test 9: Resource ceilings (wall time, CPU, memory) during load
+    if (execute_all || selected_test == "9") {
+        std::cout << "Executing Test 9: Performance/resource guardrails\n";
+
+        auto kb_to_mb = [](size_t kb) { return static_cast<double>(kb) / 1024.0; };
+        std::cout.setf(std::ios::fixed);
+        std::cout << std::setprecision(2);
+
+        size_t before_kb = peakRSSkB();
+        double u0 = cpu_user_seconds();
+        double s0 = cpu_sys_seconds();
+
         {
-            std::vector<std::pair<int, std::string>> expected_comments;
-            int user_id = -1;
+            // ScopedTimer prints wall time unconditionally on destruction.
+            ScopedTimer timer("Full loadFlatFile wall", 30.0); // 30s wall limit
+            FlatFile flatFile("users.csv", "posts.csv", "engagements.csv");
+            flatFile.loadFlatFile();
+        }
 
-            copy_files(input_files, output_files);
+        size_t after_kb = peakRSSkB();
+        double u1 = cpu_user_seconds();
+        double s1 = cpu_sys_seconds();
 
-            {
-                FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-                flatFile.loadFlatFile();
+        double user_cpu = u1 - u0;
+        double sys_cpu  = s1 - s0;
+        size_t delta_kb = (after_kb > before_kb) ? (after_kb - before_kb) : 0;
 
-                // find a valid user id with comments
-                std::map<std::string, int> user_names;
-                std::vector<int> user_ids;
-                for (auto& entry : flatFile.getEngagements()) {
-                    if (entry.second->type == "comment") user_names[entry.second->username]++;
-                }
-                for (auto& entry : flatFile.getUsers()) {
-                    if (user_names[entry.second->username] > 1) user_ids.push_back(entry.second->id);
-                }
+        // Always print a resource report, even if assertions will pass.
+        std::cout << "  CPU (user): " << user_cpu << " s\n"
+                << "  CPU (sys) : " << sys_cpu  << " s\n"
+                << "  Peak RSS  : +" << kb_to_mb(delta_kb) << " MB"
+                << "  (from " << kb_to_mb(before_kb) << " MB to " << kb_to_mb(after_kb) << " MB)\n";
 
-                user_id = user_ids[std::rand() % user_ids.size()];
-                std::cout << "Testing for a valid user_id: " << user_id << std::endl;
+        // Keep the guardrails
+        ASSERT_WITH_MESSAGE(user_cpu < 2, "Excessive user CPU time: " + std::to_string(user_cpu) + "s");
+        ASSERT_WITH_MESSAGE(sys_cpu  < 1, "Excessive sys CPU time: "   + std::to_string(sys_cpu)  + "s");
+        ASSERT_WITH_MESSAGE(delta_kb < 25 * 1024,
+            "Peak RSS increased by > 25 MB: " + std::to_string(delta_kb/1024) + " MB");
 
-                expected_comments = flatFile.getAllUserComments(user_id);
+        std::cout << "Test 9: PASSED\n";
+    }
 
-                // add two comments to test ordering ties
-                Engagement record1 = Engagement(100010, expected_comments[0].first + 1, flatFile.getUsers()[user_id]->username, "comment", "comment1", 100);
-                flatFile.addEngagementRecord(record1);
-                expected_comments.push_back({ record1.postId, record1.comment });
+    // Test 10: Reader/Writer concurrency sanity
+    if (execute_all || selected_test == "10") {
+        std::cout << "Executing Test 10: [ISOLATION] Reader/Writer concurrency sanity" << std::endl;
 
-                Engagement record2 = Engagement(100011, expected_comments[0].first, flatFile.getUsers()[user_id]->username, "comment", "comment2", 101);
-                flatFile.addEngagementRecord(record2);
-                expected_comments.push_back({ record2.postId, record2.comment });
+        copy_files(input_files, output_files);
+        FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff.loadFlatFile();
 
-                std::sort(expected_comments.begin(), expected_comments.end());
-            }
+        const int target_post  = 19;
+        const int writer_iters = 200;
 
-            {
-                FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-                flatFile.loadFlatFile();
+        // Capture baseline so we assert monotonic persistence.
+        ASSERT_WITH_MESSAGE(ff.getPosts().count(target_post), "Target post not found");
+        int base_views = ff.getPosts().at(target_post)->views;
 
-                auto found_comments = flatFile.getAllUserComments(user_id);
-                ASSERT_WITH_MESSAGE(found_comments == expected_comments,
-                    "Expected and actual comments mismatch (size/order must match)");
+        std::atomic<bool> writer_done{false};
+
+        std::thread writer([&](){
+            for (int i = 0; i < writer_iters; ++i) {
+                bool ok = ff.updatePostViews(target_post, 1);
+                ASSERT_WITH_MESSAGE(ok, "Writer failed to ");
             }
+            writer_done.store(true, std::memory_order_release);
+        });
+
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 8; ++t) {
+            readers.emplace_back([&](){
+                while (!writer_done.load(std::memory_order_acquire)) {
+                    auto p = ff.getAllEngagementsByLocation("NowhereLikely"); // cheap read
+                    ASSERT_WITH_MESSAGE(p.first >= 0 && p.second >= 0, "Negative counts?");
+                    std::this_thread::yield(); // keep CPU friendly
+                }
+            });
         }
 
-        std::cout << "Test 3: PASSED" << std::endl;
+        writer.join();
+        for (auto &r : readers) r.join();
+
+        FlatFile ff2("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff2.loadFlatFile();
+        ASSERT_WITH_MESSAGE(ff2.getPosts().count(target_post), "Missing target post after writer");
+        int after = ff2.getPosts().at(target_post)->views;
+
+        ASSERT_WITH_MESSAGE(after >= base_views + writer_iters,
+            "Writer s not persisted: expected at least " +
+            std::to_string(base_views + writer_iters) + " got " + std::to_string(after));
+
+        std::cout << "Test 10: PASSED\n";
     }
 
-    // Test 4: GetAllEngagementsByLocation
-    if (execute_all || selected_test == "4") {
-        std::cout << "Executing Test 4: GetAllEngagementsByLocation" << std::endl;
+    // Test 11: Crash-during-write durability (best-effort)
+    if (execute_all || selected_test == "11") {
+        std::cout << "Executing Test 11: [DURABILITY] Crash-during-write durability\n";
+#if defined(__unix__) || defined(__APPLE__)
+        copy_files(input_files, output_files);
+        const int pid_target = 19;
 
-        std::string location = "InvalidLocation";
-        std::pair<int, int> expected_engagements;
-        {
-            FlatFile flatFile("users.csv", "posts.csv", "engagements.csv");
-            flatFile.loadFlatFile();
-            expected_engagements = flatFile.getAllEngagementsByLocation(location);
-            ASSERT_WITH_MESSAGE(expected_engagements.first == 0 && expected_engagements.second == 0, "Invalid location should return 0 engagements");
+        // Put views near a boundary to encourage wider lines during write
+        rewrite_post_views_file("posts_copy.csv", pid_target, 99);
+
+        pid_t child = fork();
+        ASSERT_WITH_MESSAGE(child >= 0, "fork failed");
+
+        if (child == 0) {
+            // CHILD: loop writes for a while
+            FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+            ff.loadFlatFile();
+            for (int i = 0; i < 1000000; ++i) {
+                ff.updatePostViews(pid_target, 1);
+                if ((i % 1000) == 0) { /* give parent time window */ usleep(1000); }
+            }
+            _exit(0);
+        } else {
+            // PARENT: kill child mid-flight
+            usleep(50000); // 50ms
+            kill(child, SIGKILL);
+            usleep(20000); // settle
+
+            // Now try to reload; file must be parseable and value not garbage
+            FlatFile ff2("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+            try {
+                ff2.loadFlatFile();
+            } catch (...) {
+                ASSERT_WITH_MESSAGE(false, "CSV became unparseable after crash");
+            }
+            auto it = ff2.getPosts().find(pid_target);
+            ASSERT_WITH_MESSAGE(it != ff2.getPosts().end(), "Target post missing after crash");
+            int v = it->second->views;
+            ASSERT_WITH_MESSAGE(v >= 99, "Views regressed to below starting value");
+            // NOTE: We cannot assert exact value due to kill timing; we only assert it isn't torn/unreadable.
         }
+        std::cout << "Test 11: PASSED\n";
+#else
+        std::cout << "Skipping Test 11 on non-POSIX platform.\n";
+#endif
+    }
+
+    // Test 12: Referential integrity (no dangling engagement.postId)
+    if (execute_all || selected_test == "12") {
+        std::cout << "Executing Test 12: [CONSISTENCY] Referential integrity\n";
+        copy_files(input_files, output_files);
 
+        // Load, then append an invalid engagement that references a non-existent postId.
         {
-            copy_files(input_files, output_files);
+            FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+            ff.loadFlatFile();
 
-            FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-            flatFile.loadFlatFile();
+            // Find a username to reuse
+            std::string uname = ff.getUsers().begin()->second->username;
+            int nonexistent_post = 99999999;
+            Engagement bad(100000001, nonexistent_post, uname, "comment", "bad-fk", 123);
+            ff.addEngagementRecord(bad);
+        }
 
-            std::vector<std::string> locations;
-            std::string username = "";
+        // Reload and run an RI sweep: this must fail in a "bad" implementation.
+        {
+            FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+            ff.loadFlatFile();
+            bool ok = check_no_dangling_post_ids(ff.getEngagements(), ff.getPosts(), &ff.threadPool());
+            ASSERT_WITH_MESSAGE(ok, "Detected dangling engagement.postId; implementation should prevent or clean this");
+        }
+        std::cout << "Test 12: PASSED\n";
+    }
 
-            for (auto& entry : flatFile.getUsers()) {
-                locations.push_back(entry.second->location);
-            }
+    // Test 13: No type corruption — stoi over numeric fields should never throw
+    if (execute_all || selected_test == "13") {
+        std::cout << "Executing Test 13: [CONSISTENCY] Type sanity for numerics" << std::endl;
 
-            location = locations[std::rand() % locations.size()];
-            for (auto& entry : flatFile.getUsers()) {
-                if (entry.second->location == location) { username = entry.second->username; break; }
+        auto check_numeric_columns = [](const std::string& path, int numeric_cols_mask){
+            std::ifstream f(path);
+            ASSERT_WITH_MESSAGE(f.is_open(), "Cannot open " + path);
+            std::string line; bool header = true;
+            while (std::getline(f, line)) {
+                if (header) { header = false; continue; }
+                if (line.empty()) continue;
+                std::stringstream ss(line);
+                std::vector<std::string> cols;
+                std::string cell;
+                while (std::getline(ss, cell, ',')) cols.push_back(cell);
+                for (size_t i=0; i<cols.size(); ++i) {
+                    if (numeric_cols_mask & (1<<i)) {
+                        try { (void)std::stoi(cols[i]); }
+                        catch (...) { ASSERT_WITH_MESSAGE(false, "Non-numeric where numeric required in " + path); }
+                    }
+                }
             }
-            std::cout << "Testing for a valid location: " << location << std::endl;
-            expected_engagements = flatFile.getAllEngagementsByLocation(location);
+        };
+
+        // users: id (0) numeric
+        check_numeric_columns("users.csv", (1<<0));
+        // posts: id (0), views (3) numeric
+        check_numeric_columns("posts.csv", (1<<0) | (1<<3));
+        // engagements: id (0), postId (1), timestamp (5) numeric
+        check_numeric_columns("engagements.csv", (1<<0) | (1<<1) | (1<<5));
+
+        std::cout << "Test 13: PASSED\n";
+    }
+
+    // Test 14: MVCC snapshot reads are isolated from later writes
+    if (execute_all || selected_test == "14") {
+        std::cout << "Executing Test 14: [ISOLATION] MVCC snapshot reads\n";
+        copy_files(input_files, output_files);
+
+        FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff.loadFlatFile();
+
+        const int target_post = 19;
+        int user_id = ff.getUsers().begin()->first;
+        std::string old_name = ff.getUsers().begin()->second->username;
+
+        auto view_of = [&](const DbSnapshot& snap, int post_id) {
+            size_t row = snap.post_row->at(post_id);
+            return snap.posts.segment(row).views->v[TableVersion<PostSegment>::slot(row)];
+        };
+        auto name_of = [&](const DbSnapshot& snap, int uid) {
+            size_t row = snap.user_row->at(uid);
+            return snap.users.segment(row).username->v[TableVersion<UserSegment>::slot(row)];
+        };
+
+        std::shared_ptr<const DbSnapshot> pinned = ff.snapshot();
+        int pinned_views = view_of(*pinned, target_post);
+        size_t pinned_rows = pinned->engagements.rows;
+
+        ASSERT_WITH_MESSAGE(ff.updatePostViews(target_post, 7), "updatePostViews failed");
+        ASSERT_WITH_MESSAGE(ff.updateUserName(user_id, "mvcc_renamed"), "updateUserName failed");
+        Engagement rec(100020, target_post, "mvcc_renamed", "comment", "mvcc", 1);
+        ff.addEngagementRecord(rec);
+
+        std::shared_ptr<const DbSnapshot> head = ff.snapshot();
+        ASSERT_WITH_MESSAGE(head->version > pinned->version, "head version did not advance");
+        ASSERT_WITH_MESSAGE(view_of(*pinned, target_post) == pinned_views, "pinned snapshot saw a later views update");
+        ASSERT_WITH_MESSAGE(name_of(*pinned, user_id) == old_name, "pinned snapshot saw a later rename");
+        ASSERT_WITH_MESSAGE(pinned->engagements.rows == pinned_rows, "pinned snapshot saw a later append");
+        ASSERT_WITH_MESSAGE(view_of(*head, target_post) == pinned_views + 7, "head missing views update");
+        ASSERT_WITH_MESSAGE(name_of(*head, user_id) == "mvcc_renamed", "head missing rename");
+        ASSERT_WITH_MESSAGE(head->engagements.rows == pinned_rows + 1, "head missing append");
+
+        auto comments = ff.getAllUserComments(user_id);
+        ASSERT_WITH_MESSAGE(std::find(comments.begin(), comments.end(), std::make_pair(target_post, std::string("mvcc"))) != comments.end(),
+            "new comment not visible through the head snapshot");
+
+        std::cout << "Test 14: PASSED\n";
+    }
 
-            for (int i = 0; i < rand() % 20 + 1; i++) {
-                int type = rand() % 2;
-                Engagement record = Engagement(100010 + i, 1, username, type ? "like" : "comment",
-                    type ? "None" : "Howdy!", 100);
-                flatFile.addEngagementRecord(record);
-                if (type) ++expected_engagements.first; else ++expected_engagements.second;
+    // Test 15: Striped writers on different rows
+    if (execute_all || selected_test == "15") {
+        std::cout << "Executing Test 15: [ATOMICITY] Striped updates on different posts\n";
+        copy_files(input_files, output_files);
+
+        const int kThreads = 8;
+        const int kIters = 25;
+        std::vector<int> post_ids;
+        std::map<int, int> start_views;
+        std::string uname;
+        {
+            FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+            ff.loadFlatFile();
+            for (auto& entry : ff.getPosts()) {
+                if ((int)post_ids.size() == kThreads) break;
+                post_ids.push_back(entry.first);
+                start_views[entry.first] = entry.second->views;
             }
+            uname = ff.getPosts().at(post_ids[0])->username;
+            size_t eng_before = ff.getEngagements().size();
 
-            auto actual_engagements = flatFile.getAllEngagementsByLocation(location);
-            ASSERT_WITH_MESSAGE(actual_engagements == expected_engagements,
-                "Expected vs actual engagements mismatch");
+            std::vector<std::thread> threads;
+            for (int t = 0; t < kThreads; ++t) {
+                threads.emplace_back([&, t] {
+                    for (int i = 0; i < kIters; ++i) {
+                        ASSERT_WITH_MESSAGE(ff.updatePostViews(post_ids[t], 1), "updatePostViews failed");
+                        Engagement rec(200000 + t * kIters + i, post_ids[t], uname, "like", "None", i);
+                        ff.addEngagementRecord(rec);
+                    }
+                });
+            }
+            for (auto& th : threads) th.join();
+            ASSERT_WITH_MESSAGE(ff.getEngagements().size() == eng_before + kThreads * kIters, "lost in-memory engagements");
+            ASSERT_WITH_MESSAGE(ff.snapshot()->engagements.rows == eng_before + kThreads * kIters, "lost snapshot engagements");
         }
 
-        {
-            FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-            flatFile.loadFlatFile();
-            auto actual_engagements = flatFile.getAllEngagementsByLocation(location);
-            ASSERT_WITH_MESSAGE(actual_engagements == expected_engagements,
-                "Mismatch after reload");
+        FlatFile ff2("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff2.loadFlatFile();
+        for (int pid : post_ids) {
+            int got = ff2.getPosts().at(pid)->views;
+            ASSERT_WITH_MESSAGE(got == start_views[pid] + kIters,
+                "post " + std::to_string(pid) + " expected " + std::to_string(start_views[pid] + kIters) + " got " + std::to_string(got));
         }
-
-        std::cout << "Test 4: PASSED" << std::endl;
+        for (int t = 0; t < kThreads; ++t) {
+            ASSERT_WITH_MESSAGE(ff2.getEngagements().count(200000 + t * kIters), "appended engagement missing after reload");
+        }
+        std::cout << "Test 15: PASSED\n";
     }
 
-    // Test 5: UpdateUserName
-    if (execute_all || selected_test == "5") {
-        std::cout << "Executing Test 5: UpdateUserName" << std::endl;
+    // Test 16: Engine thread pool
+    if (execute_all || selected_test == "16") {
+        std::cout << "Executing Test 16: Work-stealing thread pool\n";
+        copy_files(input_files, output_files);
 
-        {
-            FlatFile flatFile("users.csv", "posts.csv", "engagements.csv");
-            flatFile.loadFlatFile();
-            int user_id = 100001 + (std::rand() % 1000);
-            bool status = flatFile.updateUserName(user_id, "new_username");
-            ASSERT_WITH_MESSAGE(!status, "Invalid user id should return false");
+        FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv", 3);
+        WorkStealingPool& pool = ff.threadPool();
+        ASSERT_WITH_MESSAGE(pool.size() == 3, "pool size not configurable");
+
+        // nested fan-out from inside pool tasks must not deadlock
+        std::atomic<long> sum{0};
+        std::vector<std::future<void>> outer;
+        for (int i = 0; i < 16; ++i) {
+            outer.push_back(pool.submit([&pool, &sum] {
+                pool.parallel_for(100, [&sum](size_t k) { sum += static_cast<long>(k); });
+            }));
         }
+        for (auto& f : outer) pool.wait(f);
+        ASSERT_WITH_MESSAGE(sum.load() == 16L * 4950, "parallel_for lost work");
+
+        // repeated parallel loads reuse the same pool
+        for (int i = 0; i < 3; ++i) ff.loadMultipleFlatFilesInParallel();
+        ASSERT_WITH_MESSAGE(&ff.threadPool() == &pool, "pool was recreated");
+        FlatFile serial("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        serial.loadFlatFile();
+        ASSERT_WITH_MESSAGE(ff.getEngagements().size() == serial.getEngagements().size() &&
+                            ff.snapshot()->engagements.rows == serial.snapshot()->engagements.rows,
+                            "pool-built tables differ from serial load");
+
+        std::cout << "Test 16: PASSED\n";
+    }
 
-        int user_id = -1;
-        int prev_posts_count = 0, prev_engagements_count = 0;
-        std::string old_username;
-        std::string new_username = "new_username";
-        {
-            copy_files(input_files, output_files);
+    // Test 17: Parallel partitioned scans match serial scans
+    if (execute_all || selected_test == "17") {
+        std::cout << "Executing Test 17: Parallel partitioned scans\n";
+
+        FlatFile par("users.csv", "posts.csv", "engagements.csv", 4);
+        FlatFile ser("users.csv", "posts.csv", "engagements.csv");
+        par.loadMultipleFlatFilesInParallel();
+        ser.loadFlatFile();
+        par.setParallelScanMinRows(0);
+        ser.setParallelScanMinRows(SIZE_MAX);
+
+        std::set<std::string> locations;
+        for (auto& entry : ser.getUsers()) locations.insert(entry.second->location);
+        for (const auto& loc : locations) {
+            ASSERT_WITH_MESSAGE(par.getAllEngagementsByLocation(loc) == ser.getAllEngagementsByLocation(loc),
+                "parallel location counts differ for " + loc);
+        }
+        int checked = 0;
+        for (auto& entry : ser.getUsers()) {
+            if (++checked > 200) break;
+            ASSERT_WITH_MESSAGE(par.getAllUserComments(entry.first) == ser.getAllUserComments(entry.first),
+                "parallel comments differ for user " + std::to_string(entry.first));
+        }
+        ASSERT_WITH_MESSAGE(check_no_dangling_post_ids(par.getEngagements(), par.getPosts(), &par.threadPool()),
+            "parallel RI sweep found a dangling post id");
 
-            FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-            flatFile.loadFlatFile();
+        std::cout << "Test 17: PASSED\n";
+    }
 
-            std::map<std::string, int> posts_count, engagements_count;
-            for (auto& entry : flatFile.getPosts()) posts_count[entry.second->username]++;
-            for (auto& entry : flatFile.getEngagements()) engagements_count[entry.second->username]++;
+    // Test 18: Async API
+    if (execute_all || selected_test == "18") {
+        std::cout << "Executing Test 18: Async query/mutation API\n";
+        copy_files(input_files, output_files);
 
-            std::vector<int> user_ids;
-            for (auto& entry : flatFile.getUsers()) {
-                if (posts_count[entry.second->username] >= 1 && engagements_count[entry.second->username] >= 1) {
-                    user_ids.push_back(entry.second->id);
-                }
+        const int target_post = 19;
+        int start_views = 0;
+        int user_id = -1;
+        std::string location;
+        {
+            FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv", 2);
+            ff.loadFlatFile();
+            start_views = ff.getPosts().at(target_post)->views;
+            user_id = ff.getUsers().begin()->first;
+            std::string uname = ff.getUsers().begin()->second->username;
+            location = ff.getUsers().begin()->second->location;
+            auto base_counts = ff.getAllEngagementsByLocation(location);
+
+            std::vector<std::future<bool>> updates;
+            std::vector<std::future<bool>> appends;
+            for (int i = 0; i < 50; ++i) {
+                updates.push_back(ff.updatePostViewsAsync(target_post, 2));
+                appends.push_back(ff.addEngagementRecordAsync(
+                    Engagement(300000 + i, target_post, uname, "comment", "async" + std::to_string(i), i)));
             }
-            user_id = user_ids[std::rand() % user_ids.size()];
-            old_username = flatFile.getUsers()[user_id]->username;
+            auto missing = ff.updatePostViewsAsync(99999999, 1);
+            auto orphan = ff.addEngagementRecordAsync(Engagement(300100, 99999999, uname, "like", "None", 0));
+            for (auto& f : updates) ASSERT_WITH_MESSAGE(f.get(), "async views update failed");
+            for (auto& f : appends) ASSERT_WITH_MESSAGE(f.get(), "async append rejected");
+            ASSERT_WITH_MESSAGE(!missing.get(), "async update of a missing post should return false");
+            ASSERT_WITH_MESSAGE(!orphan.get(), "async append to a missing post should return false");
+
+            auto counts = ff.getAllEngagementsByLocationAsync(location).get();
+            ASSERT_WITH_MESSAGE(counts.second == base_counts.second + 50, "async appends not visible to async read");
+            auto comments = ff.getAllUserCommentsAsync(user_id).get();
+            ASSERT_WITH_MESSAGE(comments.size() >= 50, "async comments query missed appended comments");
+            ASSERT_WITH_MESSAGE(std::is_sorted(comments.begin(), comments.end()), "async comments not ordered");
+
+            ASSERT_WITH_MESSAGE(ff.updateUserNameAsync(user_id, "async_renamed").get(), "async rename failed");
+        }
 
-            std::cout << "Testing for valid user_id: " << user_id << std::endl;
-            prev_posts_count = posts_count[old_username];
-            prev_engagements_count = engagements_count[old_username];
+        FlatFile ff2("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff2.loadFlatFile();
+        ASSERT_WITH_MESSAGE(ff2.getPosts().at(target_post)->views == start_views + 100, "async views not persisted");
+        ASSERT_WITH_MESSAGE(ff2.getEngagements().count(300049), "async engagement not persisted");
+        ASSERT_WITH_MESSAGE(ff2.getUsers().at(user_id)->username == "async_renamed", "async rename not persisted");
+        std::cout << "Test 18: PASSED\n";
+    }
 
-            bool status = flatFile.updateUserName(user_id, new_username);
-            ASSERT_WITH_MESSAGE(status, "Valid user id should return true");
-        }
+    // Test 19: MPSC ingest queue with a dedicated writer
+    if (execute_all || selected_test == "19") {
+        std::cout << "Executing Test 19: [DURABILITY] Ingest queue and writer thread\n";
+        copy_files(input_files, output_files);
 
+        // ring semantics: full ring rejects, pops come back in ticket order
         {
-            FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-            flatFile.loadFlatFile();
+            MpscRing<int> ring(4);
+            for (int i = 0; i < 4; ++i) ASSERT_WITH_MESSAGE(ring.try_push(int(i)) == uint64_t(i + 1), "bad ticket");
+            ASSERT_WITH_MESSAGE(ring.try_push(99) == 0, "full ring accepted a push");
+            int v = -1;
+            ASSERT_WITH_MESSAGE(ring.try_pop(v) && v == 0, "ring popped out of order");
+            ASSERT_WITH_MESSAGE(ring.try_push(4) == 5, "freed slot not reusable");
+        }
 
-            ASSERT_WITH_MESSAGE(flatFile.getUsers()[user_id]->username == new_username, "Username not updated in users.csv");
+        const int kProducers = 8;
+        const int kPerProducer = 250;
+        size_t eng_before = 0;
+        {
+            FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+            ff.loadFlatFile();
+            eng_before = ff.getEngagements().size();
+            std::string uname = ff.getUsers().begin()->second->username;
 
-            int new_posts_count = 0, new_engagements_count = 0;
-            for (auto& entry : flatFile.getPosts()) {
-                auto uname = entry.second->username;
-                ASSERT_WITH_MESSAGE(uname != old_username, "Old username still exists in posts.");
-                if (uname == new_username) ++new_posts_count;
-            }
-            for (auto& entry : flatFile.getEngagements()) {
-                auto uname = entry.second->username;
-                ASSERT_WITH_MESSAGE(uname != old_username, "Old username still exists in engagements.");
-                if (uname == new_username) ++new_engagements_count;
+            IngestOptions opts;
+            opts.capacity = 64;   // small enough that producers hit backpressure
+            opts.max_batch = 32;
+            ff.enableIngestMode(opts);
+
+            std::vector<std::thread> producers;
+            std::atomic<uint64_t> last_ticket{0};
+            for (int t = 0; t < kProducers; ++t) {
+                producers.emplace_back([&, t] {
+                    for (int i = 0; i < kPerProducer; ++i) {
+                        Engagement rec(400000 + t * kPerProducer + i, 1, uname, "like", "None", i);
+                        if (i % 2) {
+                            ff.addEngagementRecord(rec);
+                        } else {
+                            uint64_t ticket = ff.ingestEngagement(rec);
+                            ASSERT_WITH_MESSAGE(ticket > 0, "blocking ingest returned no ticket");
+                            uint64_t prev = last_ticket.load();
+                            while (prev < ticket && !last_ticket.compare_exchange_weak(prev, ticket)) {}
+                        }
+                    }
+                });
             }
-
-            ASSERT_WITH_MESSAGE(prev_posts_count == new_posts_count, "Posts count changed after username update.");
-            ASSERT_WITH_MESSAGE(prev_engagements_count == new_engagements_count, "Engagements count changed after username update.");
+            for (auto& p : producers) p.join();
+            ff.waitIngested(last_ticket.load());
+            ff.flushIngest();
+            ASSERT_WITH_MESSAGE(ff.snapshot()->engagements.rows == eng_before + kProducers * kPerProducer,
+                "flushed ingest not visible in snapshot");
+            ff.disableIngestMode();
         }
 
-        std::cout << "Test 5: PASSED" << std::endl;
+        FlatFile ff2("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff2.loadFlatFile();
+        ASSERT_WITH_MESSAGE(ff2.getEngagements().size() == eng_before + kProducers * kPerProducer,
+            "ingested engagements missing after reload");
+        std::cout << "Test 19: PASSED\n";
     }
 
-    // Test 6: In-place rewrite must survive line length increases
-    if (execute_all || selected_test == "6") {
-        std::cout << "Executing Test 6: Line-growth safety\n";
+    // Test 20: io_uring / pread file I/O layer
+    if (execute_all || selected_test == "20") {
+        std::cout << "Executing Test 20: [IO] Line reader and batched appends\n";
         copy_files(input_files, output_files);
 
-        const int target_post = 19;   // reuse a known-good post id
-        // Force starting views to a 2-digit value 
-        // so increments cross into 3+ digits
-        rewrite_post_views_file("posts_copy.csv", target_post, 95);
-
-        // Now  enough to cross 100 (and beyond)
+        // small chunks so many lines straddle buffer boundaries; no trailing newline at EOF
+        const std::string probe = "io_probe.txt";
         {
-            FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-            ff.loadFlatFile();
-            int start = ff.getPosts()[target_post]->views;
-            int total_add = 0;
-            for (int k = 0; k < 10; ++k) {
-                // +1 ten times; 95 -> 105
-                ff.updatePostViews(target_post, 1);
-                total_add += 1;
+            std::ofstream out(probe, std::ios::trunc);
+            for (int i = 0; i < 5000; ++i) out << i << ",row" << std::string(i % 37, 'x') << "\n";
+            out << "\n" << "last-line-without-newline";
+        }
+        std::vector<std::string> expected;
+        {
+            std::ifstream in(probe);
+            std::string line;
+            while (std::getline(in, line)) expected.push_back(line);
+        }
+        for (const char* mode : {"uring", "pread"}) {
+            if (std::string(mode) == "pread") setenv("BUZZDB_IO", "pread", 1);
+            for (size_t chunk : {size_t(4096), size_t(1) << 20}) {
+                LineReader r(probe, chunk, 3);
+                ASSERT_WITH_MESSAGE(r.is_open(), "line reader failed to open");
+                std::vector<std::string> got;
+                std::string line;
+                while (r.getline(line)) got.push_back(line);
+                ASSERT_WITH_MESSAGE(got == expected,
+                    std::string("line reader (") + r.backend() + ") differs from std::getline");
             }
-            // Reload from disk to detect CSV corruption
-            FlatFile ff2("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-            ff2.loadFlatFile();
-            int got = ff2.getPosts()[target_post]->views;
-            ASSERT_WITH_MESSAGE(got == start + total_add,
-                "Digit-growth rewrite corrupted file. expected " + std::to_string(start+total_add) + " got " + std::to_string(got));
+            unsetenv("BUZZDB_IO");
         }
-        std::cout << "Test 6: PASSED\n";
+        std::remove(probe.c_str());
+
+        // concurrent appends from several threads land exactly once
+        FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff.loadFlatFile();
+        const size_t eng_before = ff.getEngagements().size();
+        const std::string uname = ff.getUsers().begin()->second->username;
+        std::vector<int> post_ids;
+        for (auto it = ff.getPosts().begin(); it != ff.getPosts().end() && post_ids.size() < 8; ++it)
+            post_ids.push_back(it->first);
+        const int kThreads = static_cast<int>(post_ids.size()), kPerThread = 50;
+        std::vector<std::thread> writers;
+        for (int t = 0; t < kThreads; ++t) {
+            writers.emplace_back([&, t] {
+                for (int i = 0; i < kPerThread; ++i) {
+                    Engagement rec(500000 + t * kPerThread + i, post_ids[t], uname, "comment", "io test", i);
+                    ff.addEngagementRecord(rec);
+                }
+            });
+        }
+        for (auto& w : writers) w.join();
+
+        FlatFile ff2("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff2.loadFlatFile();
+        ASSERT_WITH_MESSAGE(ff2.getEngagements().size() == eng_before + kThreads * kPerThread,
+            "batched appends lost or duplicated rows");
+        std::cout << "Test 20: PASSED\n";
     }
 
-        // Test 7: UpdatePostViews_ValidPostId (concurrent)
-    if (execute_all || selected_test == "7") {
-        std::cout << "Executing Test 7: [ATOMICITY] UpdatePostViews_ValidPostId" << std::endl;
+    // Test 21: columnar filter / group-by / aggregate queries
+    if (execute_all || selected_test == "21") {
+        std::cout << "Executing Test 21: [QUERY] Vectorized filter and aggregate queries\n";
+        copy_files(input_files, output_files);
+        FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff.loadFlatFile();
 
-        // parameters used below; change here if you tweak the test
-        const int kThreads = 10;
-        const int kUpdatesPerThread = 10; // j = 0..9, adds (j+1)
+        // likes per post after a timestamp, checked against a plain scan
+        long long t0 = 0;
+        for (const auto& kv : ff.getEngagements()) t0 += kv.second->timestamp;
+        t0 /= std::max<size_t>(1, ff.getEngagements().size());
+        std::map<long long, long long> expect_likes;
+        std::map<long long, std::pair<long long, long long>> expect_ts;   // min/max timestamp per post
+        for (const auto& kv : ff.getEngagements()) {
+            const Engagement& e = *kv.second;
+            if (e.type != "like" || e.timestamp <= t0) continue;
+            ++expect_likes[e.postId];
+            auto it = expect_ts.emplace(e.postId, std::make_pair((long long)e.timestamp, (long long)e.timestamp)).first;
+            it->second.first = std::min<long long>(it->second.first, e.timestamp);
+            it->second.second = std::max<long long>(it->second.second, e.timestamp);
+        }
+        Query likes = Query(QueryTable::Engagements)
+                          .where("type", CmpOp::Eq, "like")
+                          .where("timestamp", CmpOp::Gt, t0)
+                          .groupBy("postId")
+                          .count().min("timestamp").max("timestamp");
+        for (size_t min_rows : {size_t(1), size_t(1) << 30}) {   // parallel, then serial
+            ff.setParallelScanMinRows(min_rows);
+            QueryResult r = ff.runQuery(likes);
+            ASSERT_WITH_MESSAGE(r.columns.size() == 4 && r.columns[0] == "postId", "unexpected result columns");
+            ASSERT_WITH_MESSAGE(r.rows.size() == expect_likes.size(), "wrong number of groups");
+            for (const QueryRow& row : r.rows) {
+                long long post = std::get<long long>(row.key);
+                ASSERT_WITH_MESSAGE(expect_likes[post] == row.values[0], "count mismatch");
+                ASSERT_WITH_MESSAGE(expect_ts[post].first == row.values[1] && expect_ts[post].second == row.values[2],
+                    "min/max mismatch");
+            }
+        }
 
-        // helper to compute total  robustly
-        auto per_thread_inc = []() {
-            int s = 0;
-            for (int j = 0; j < kUpdatesPerThread; ++j) s += (j + 1);
-            return s; // 55 with current settings
-        };
-        const int total_increment = kThreads * per_thread_inc();
+        // ungrouped sum over posts, and a string group key on users
+        long long views_total = 0;
+        for (const auto& kv : ff.getPosts()) views_total += kv.second->views;
+        QueryResult total = ff.runQuery(Query(QueryTable::Posts).count().sum("views"));
+        ASSERT_WITH_MESSAGE(total.rows.size() == 1 && total.rows[0].values[0] == (long long)ff.getPosts().size() &&
+                            total.rows[0].values[1] == views_total, "ungrouped aggregate mismatch");
+
+        std::map<std::string, long long> per_location;
+        for (const auto& kv : ff.getUsers()) ++per_location[kv.second->location];
+        QueryResult locs = ff.runQuery(Query(QueryTable::Users).groupBy("location").count());
+        ASSERT_WITH_MESSAGE(locs.rows.size() == per_location.size(), "wrong location groups");
+        for (const QueryRow& row : locs.rows) {
+            ASSERT_WITH_MESSAGE(per_location[std::get<std::string>(row.key)] == row.values[0], "location count mismatch");
+        }
 
-        int post_id_to_update = 19;
-        int initial_views = 0;
-        {
-            copy_files(input_files, output_files);
-            
-            FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-            flatFile.loadFlatFile();
+        QueryResult none = ff.runQuery(Query(QueryTable::Posts).where("id", CmpOp::Lt, -1LL).count());
+        ASSERT_WITH_MESSAGE(none.rows.empty(), "empty selection should produce no rows");
+        long long viewed = 0;
+        for (const auto& kv : ff.getPosts()) viewed += kv.second->views > 0;
+        QueryResult any_views = ff.runQuery(Query(QueryTable::Posts).where("views", CmpOp::Gt, 0).count());
+        ASSERT_WITH_MESSAGE(any_views.rows.size() == (viewed ? 1u : 0u) && (!viewed || any_views.rows[0].values[0] == viewed),
+            "int literal predicate mismatch");
+        std::cout << "Test 21: PASSED\n";
+    }
 
-            auto& posts = flatFile.getPosts();
-            ASSERT_WITH_MESSAGE(posts.count(post_id_to_update),
-                "Test setup error: post_id not found");
-            initial_views = posts[post_id_to_update]->views;
+    // Test 22: hash join + group-by across tables
+    if (execute_all || selected_test == "22") {
+        std::cout << "Executing Test 22: [QUERY] Hash join and group-by across tables\n";
+        copy_files(input_files, output_files);
+        FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff.loadFlatFile();
 
-            // Clear, direct assertion on the initial value
-            ASSERT_WITH_MESSAGE(initial_views >= 0,
-                "Post should not start with a negative number of views");
+        std::multimap<std::string, const User*> users_by_name;
+        for (const auto& kv : ff.getUsers()) users_by_name.emplace(kv.second->username, kv.second.get());
+        const std::string location = ff.getUsers().begin()->second->location;
 
-            std::vector<std::thread> threads;
-            threads.reserve(kThreads);
-            for (int i = 0; i < kThreads; ++i) {
-                threads.emplace_back([&flatFile, post_id_to_update] {
-                    for (int j = 0; j < kUpdatesPerThread; ++j) {
-                        bool ok = flatFile.updatePostViews(post_id_to_update, j + 1);
-                        ASSERT_WITH_MESSAGE(ok, "updatePostViews failed");
-                    }
-                });
+        // total views of posts by users in a location
+        long long expect_views = 0;
+        for (const auto& kv : ff.getPosts()) {
+            auto range = users_by_name.equal_range(kv.second->username);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (it->second->location == location) expect_views += kv.second->views;
             }
-            for (auto& t : threads) t.join();
         }
+        JoinQuery views(QueryTable::Posts, "username", QueryTable::Users, "username");
+        views.build().where("location", CmpOp::Eq, location);
+        views.probe().sum("views");
+
+        // engagements per post author (engagements -> posts on postId)
+        std::map<std::string, long long> expect_per_author;
+        for (const auto& kv : ff.getEngagements()) {
+            auto post = ff.getPosts().find(kv.second->postId);
+            if (post != ff.getPosts().end()) ++expect_per_author[post->second->username];
+        }
+        JoinQuery per_author(QueryTable::Engagements, "postId", QueryTable::Posts, "id");
+        per_author.build().groupBy("username");
+        per_author.probe().count();
+
+        // likes per engager location
+        std::map<std::string, long long> expect_likes_by_loc;
+        for (const auto& kv : ff.getEngagements()) {
+            if (kv.second->type != "like") continue;
+            auto range = users_by_name.equal_range(kv.second->username);
+            for (auto it = range.first; it != range.second; ++it) ++expect_likes_by_loc[it->second->location];
+        }
+        JoinQuery likes_by_loc(QueryTable::Engagements, "username", QueryTable::Users, "username");
+        likes_by_loc.probe().where("type", CmpOp::Eq, "like").count();
+        likes_by_loc.build().groupBy("location");
+
+        for (size_t min_rows : {size_t(1), size_t(1) << 30}) {   // parallel, then serial
+            ff.setParallelScanMinRows(min_rows);
+            QueryResult v = ff.runJoin(views);
+            ASSERT_WITH_MESSAGE(v.rows.size() == 1 && v.rows[0].values[0] == expect_views, "join sum mismatch");
+
+            QueryResult a = ff.runJoin(per_author);
+            ASSERT_WITH_MESSAGE(a.rows.size() == expect_per_author.size(), "wrong author groups");
+            for (const QueryRow& row : a.rows) {
+                ASSERT_WITH_MESSAGE(expect_per_author[std::get<std::string>(row.key)] == row.values[0],
+                    "per-author count mismatch");
+            }
 
-        // Re-open to verify persisted value == initial + total_increment
-        {
-            FlatFile flatFile("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-            flatFile.loadFlatFile();
-            int final_views = flatFile.getPosts()[post_id_to_update]->views;
-
-            ASSERT_WITH_MESSAGE(final_views == initial_views + total_increment,
-                "Post views not updated correctly. Expected " +
-                std::to_string(initial_views + total_increment) + " got " +
-                std::to_string(final_views));
+            QueryResult l = ff.runJoin(likes_by_loc);
+            ASSERT_WITH_MESSAGE(l.rows.size() == expect_likes_by_loc.size(), "wrong location groups");
+            for (const QueryRow& row : l.rows) {
+                ASSERT_WITH_MESSAGE(expect_likes_by_loc[std::get<std::string>(row.key)] == row.values[0],
+                    "likes-by-location mismatch");
+            }
         }
-        std::cout << "Test 7: PASSED" << std::endl;
+        std::cout << "Test 22: PASSED\n";
     }
 
-    // Test 8: UpdatePostViews_InvalidPostId
-    if (execute_all || selected_test == "8") {
-        std::cout << "Executing Test 8: UpdatePostViews_InvalidPostId" << std::endl;
+    // Test 23: query result cache and its invalidation
+    if (execute_all || selected_test == "23") {
+        std::cout << "Executing Test 23: [CACHE] Result cache invalidation\n";
+        copy_files(input_files, output_files);
+        FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff.loadFlatFile();
 
-        try {
-            FlatFile flatFile("users.csv", "posts.csv", "engagements.csv");
-            flatFile.loadFlatFile();
+        // two users with distinct names and locations
+        auto uit = ff.getUsers().begin();
+        const User a = *uit->second;
+        const User* b_ptr = nullptr;
+        for (; uit != ff.getUsers().end(); ++uit) {
+            if (uit->second->username != a.username && uit->second->location != a.location) { b_ptr = uit->second.get(); break; }
+        }
+        ASSERT_WITH_MESSAGE(b_ptr != nullptr, "fixture needs two users in different locations");
+        const User b = *b_ptr;
+        const int post_id = ff.getPosts().begin()->first;
+
+        auto comments_a = ff.getAllUserComments(a.id);
+        auto comments_b = ff.getAllUserComments(b.id);
+        auto loc_a = ff.getAllEngagementsByLocation(a.location);
+        auto loc_b = ff.getAllEngagementsByLocation(b.location);
+        auto before = ff.resultCacheStats();
+        ASSERT_WITH_MESSAGE(ff.getAllUserComments(a.id) == comments_a && ff.getAllEngagementsByLocation(b.location) == loc_b,
+            "cached result differs");
+        ASSERT_WITH_MESSAGE(ff.resultCacheStats().hits == before.hits + 2, "repeated reads should hit the cache");
+
+        // a comment by `a` invalidates a's entries only
+        Engagement c(600001, post_id, a.username, "comment", "cached?", 1);
+        ff.addEngagementRecord(c);
+        comments_a.push_back({post_id, "cached?"});
+        std::sort(comments_a.begin(), comments_a.end());
+        ++loc_a.second;
+        before = ff.resultCacheStats();
+        ASSERT_WITH_MESSAGE(ff.getAllUserComments(a.id) == comments_a, "stale comments after insert");
+        ASSERT_WITH_MESSAGE(ff.getAllEngagementsByLocation(a.location) == loc_a, "stale location counts after insert");
+        ASSERT_WITH_MESSAGE(ff.getAllUserComments(b.id) == comments_b && ff.getAllEngagementsByLocation(b.location) == loc_b,
+            "unrelated results changed");
+        auto after = ff.resultCacheStats();
+        ASSERT_WITH_MESSAGE(after.misses == before.misses + 2 && after.hits == before.hits + 2,
+            "invalidation should be limited to the writing user");
+
+        // renaming `a` to b's name moves a's engagements into b's results
+        ASSERT_WITH_MESSAGE(ff.updateUserName(a.id, b.username), "rename failed");
+        auto merged = comments_a;
+        merged.insert(merged.end(), comments_b.begin(), comments_b.end());
+        std::sort(merged.begin(), merged.end());
+        ASSERT_WITH_MESSAGE(ff.getAllUserComments(b.id) == merged, "stale comments after rename");
+        FlatFile fresh("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        fresh.loadFlatFile();
+        ASSERT_WITH_MESSAGE(ff.getAllEngagementsByLocation(a.location) == fresh.getAllEngagementsByLocation(a.location) &&
+                            ff.getAllEngagementsByLocation(b.location) == fresh.getAllEngagementsByLocation(b.location),
+            "stale location counts after rename");
+
+        // a tiny budget evicts, reload clears
+        ff.setResultCacheBytes(1);
+        ff.getAllUserComments(b.id);
+        ASSERT_WITH_MESSAGE(ff.resultCacheStats().entries == 0, "entries larger than the budget must not be kept");
+        ff.setResultCacheBytes(size_t(64) << 20);
+        ff.getAllUserComments(b.id);
+        ASSERT_WITH_MESSAGE(ff.resultCacheStats().entries == 1, "entry should be cached again");
+        ff.loadFlatFile();
+        ASSERT_WITH_MESSAGE(ff.resultCacheStats().entries == 0, "reload must clear the cache");
+        std::cout << "Test 23: PASSED\n";
+    }
 
-            bool status = flatFile.updatePostViews(100001 + (std::rand() % 1000), 1);
-            ASSERT_WITH_MESSAGE(!status, "Invalid post id should return false");
-        } catch (const std::exception& e) {
-            std::cout << "Exception occurred: " << e.what() << std::endl;
-            throw;
+    // Test 24: comment cursors and resume tokens
+    if (execute_all || selected_test == "24") {
+        std::cout << "Executing Test 24: [CURSOR] Paged user comments\n";
+        copy_files(input_files, output_files);
+        FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff.loadFlatFile();
+
+        // the user with the most comments, plus a few extra (including a duplicate pair)
+        std::map<std::string, int> per_name;
+        for (const auto& kv : ff.getEngagements()) {
+            if (kv.second->type == "comment") ++per_name[kv.second->username];
+        }
+        int user_id = -1, best = -1;
+        for (const auto& kv : ff.getUsers()) {
+            if (per_name[kv.second->username] > best) { best = per_name[kv.second->username]; user_id = kv.first; }
+        }
+        const std::string uname = ff.getUsers()[user_id]->username;
+        const int post_id = ff.getPosts().begin()->first;
+        for (int i = 0; i < 6; ++i) {
+            Engagement e(700000 + i, post_id + i % 2, uname, "comment", i < 2 ? "dup" : "page " + std::to_string(i), i);
+            ff.addEngagementRecord(e);
+        }
+        auto expected = ff.getAllUserComments(user_id);
+
+        auto collect = [&](size_t page_size) {
+            std::vector<std::pair<int, std::string>> got;
+            std::string token;
+            for (;;) {
+                CommentCursor cur = ff.openUserComments(user_id, token, page_size);
+                auto page = cur.page(page_size);
+                for (const auto& item : page) got.push_back({item.first, std::string(item.second)});
+                if (page.size() < page_size) break;
+                token = cur.token();
+            }
+            return got;
+        };
+        for (size_t page_size : {size_t(1), size_t(2), size_t(5), size_t(1000)}) {
+            ASSERT_WITH_MESSAGE(collect(page_size) == expected, "paged comments differ from getAllUserComments");
         }
 
-        std::cout << "Test 8: PASSED" << std::endl;
+        // one cursor read to the end matches too, and its views survive later writes
+        CommentCursor all = ff.openUserComments(user_id);
+        ASSERT_WITH_MESSAGE(ff.updateUserName(user_id, uname + "_renamed"), "rename failed");
+        std::vector<std::pair<int, std::string>> streamed;
+        CommentCursor::Item item;
+        while (all.next(item)) streamed.push_back({item.first, std::string(item.second)});
+        ASSERT_WITH_MESSAGE(streamed == expected && all.done(), "cursor lost rows after a concurrent rename");
+
+        ASSERT_WITH_MESSAGE(ff.openUserComments(-12345).done(), "unknown user should yield nothing");
+        for (const char* bad : {"garbage", "1:", "x:2:c", ":1:c"}) {
+            CommentCursor rejected = ff.openUserComments(user_id, bad);
+            ASSERT_WITH_MESSAGE(!rejected.ok() && rejected.done(), std::string("malformed token accepted: ") + bad);
+        }
+        ASSERT_WITH_MESSAGE(ff.openUserComments(user_id).ok(), "valid cursor reported an error");
+        std::cout << "Test 24: PASSED\n";
     }
 
-    // Test 9: Resource ceilings (wall time, CPU, memory) during load
-    if (execute_all || selected_test == "9") {
-        std::cout << "Executing Test 9: Performance/resource guardrails\n";
+    // Test 25: HyperLogLog / count-min sketches
+    if (execute_all || selected_test == "25") {
+        std::cout << "Executing Test 25: [SKETCH] Approximate unique engagers and heavy hitters\n";
 
-        auto kb_to_mb = [](size_t kb) { return static_cast<double>(kb) / 1024.0; };
-        std::cout.setf(std::ios::fixed);
-        std::cout << std::setprecision(2);
+        // standalone HLL accuracy at a few cardinalities
+        for (uint64_t n : {uint64_t(10), uint64_t(1000), uint64_t(100000)}) {
+            HyperLogLog hll;
+            for (uint64_t i = 0; i < n; ++i) hll.add(sketch_hash("user" + std::to_string(i)));
+            double err = std::fabs(double(hll.estimate()) - double(n)) / double(n);
+            ASSERT_WITH_MESSAGE(err < 0.1, "HyperLogLog error above 10% at n=" + std::to_string(n));
+        }
+        // small counters are exact, smaller than the registers, and can swap a value
+        HyperLogLog small;
+        for (int i = 0; i < 40; ++i) small.add(sketch_hash("user" + std::to_string(i % 20)));
+        ASSERT_WITH_MESSAGE(small.sparse() && small.estimate() == 20 && small.memory_bytes() < HyperLogLog::kRegisters,
+            "small HyperLogLog not exact and sparse");
+        small.replace(sketch_hash("user0"), sketch_hash("user1"));
+        ASSERT_WITH_MESSAGE(small.estimate() == 19, "sparse replace not exact");
 
-        size_t before_kb = peakRSSkB();
-        double u0 = cpu_user_seconds();
-        double s0 = cpu_sys_seconds();
+        copy_files(input_files, output_files);
+        FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff.loadMultipleFlatFilesInParallel();
 
-        {
-            // ScopedTimer prints wall time unconditionally on destruction.
-            ScopedTimer timer("Full loadFlatFile wall", 30.0); // 30s wall limit
-            FlatFile flatFile("users.csv", "posts.csv", "engagements.csv");
-            flatFile.loadFlatFile();
+        std::map<int, std::set<std::string>> engagers;
+        std::map<std::string, uint64_t> activity;
+        for (const auto& kv : ff.getEngagements()) {
+            engagers[kv.second->postId].insert(kv.second->username);
+            ++activity[kv.second->username];
+        }
+        for (const auto& kv : engagers) {
+            double exact = double(kv.second.size());
+            ASSERT_WITH_MESSAGE(std::fabs(double(ff.approxUniqueEngagers(kv.first)) - exact) <= 0.1 * exact + 1,
+                "unique engagers estimate off for post " + std::to_string(kv.first));
+        }
+        for (const auto& kv : activity) {
+            ASSERT_WITH_MESSAGE(ff.approxEngagementCount(kv.first) >= kv.second, "count-min undercounted");
+        }
+
+        // one user becomes the heaviest engager through incremental inserts
+        const std::string heavy = ff.getUsers().begin()->second->username;
+        const int post_id = ff.getPosts().begin()->first;
+        const size_t before_unique = ff.approxUniqueEngagers(post_id);
+        for (int i = 0; i < 500; ++i) {
+            Engagement e(800000 + i, post_id, heavy, "like", "None", i);
+            ff.addEngagementRecord(e);
+        }
+        auto top = ff.approxTopEngagers(1);
+        ASSERT_WITH_MESSAGE(top.size() == 1 && top[0].first == heavy && top[0].second >= activity[heavy] + 500,
+            "heavy hitter not reported");
+        ASSERT_WITH_MESSAGE(ff.approxUniqueEngagers(post_id) <= before_unique + 1,
+            "repeat engagements must not raise the distinct count");
+
+        // a rename moves the activity to the new name without changing distinct counts
+        const uint64_t heavy_count = ff.approxEngagementCount(heavy);
+        const uint64_t unique_before = ff.approxUniqueEngagers(post_id);
+        ASSERT_WITH_MESSAGE(ff.updateUserName(ff.getUsers().begin()->first, heavy + "_x"), "rename failed");
+        top = ff.approxTopEngagers(1);
+        ASSERT_WITH_MESSAGE(top.size() == 1 && top[0].first == heavy + "_x", "rename not reflected in sketches");
+        ASSERT_WITH_MESSAGE(ff.approxEngagementCount(heavy + "_x") >= heavy_count &&
+                            ff.approxEngagementCount(heavy) < 500, "rename did not move the count");
+        ASSERT_WITH_MESSAGE(ff.approxUniqueEngagers(post_id) == unique_before, "rename changed the distinct count");
+        std::cout << "Test 25: PASSED\n";
+    }
+
+    // Test 26: time-bucketed rollups
+    if (execute_all || selected_test == "26") {
+        std::cout << "Executing Test 26: [ROLLUP] Time-bucketed engagement series\n";
+        copy_files(input_files, output_files);
+        FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff.loadMultipleFlatFilesInParallel();
+
+        const int post_id = ff.getEngagements().begin()->second->postId;
+        const std::string location = ff.getUsers().begin()->second->location;
+        std::set<std::string> names_in_location;
+        for (const auto& kv : ff.getUsers()) {
+            if (kv.second->location == location) names_in_location.insert(kv.second->username);
         }
+        auto brute = [&](bool by_post, Granularity g, int64_t from, int64_t to) {
+            const int64_t w = bucket_seconds(g);
+            std::map<int64_t, RollupPoint> buckets;
+            for (const auto& kv : ff.getEngagements()) {
+                const Engagement& e = *kv.second;
+                if (e.type != "like" && e.type != "comment") continue;
+                if (by_post ? e.postId != post_id : !names_in_location.count(e.username)) continue;
+                int64_t start = (int64_t(e.timestamp) / w - (int64_t(e.timestamp) % w < 0)) * w;
+                if (start + w <= from || start >= to) continue;
+                RollupPoint& p = buckets.emplace(start, RollupPoint{start}).first->second;
+                if (e.type == "like") ++p.likes; else ++p.comments;
+            }
+            std::vector<RollupPoint> out;
+            for (const auto& kv : buckets) out.push_back(kv.second);
+            return out;
+        };
+        auto check = [&](const char* when) {
+            for (Granularity g : {Granularity::Minute, Granularity::Hour, Granularity::Day}) {
+                for (auto window : {std::make_pair(INT64_MIN / 2, INT64_MAX / 2), std::make_pair(int64_t(50), int64_t(5000))}) {
+                    ASSERT_WITH_MESSAGE(ff.getPostEngagementSeries(post_id, g, window.first, window.second) ==
+                                        brute(true, g, window.first, window.second),
+                        std::string("post series mismatch ") + when);
+                    ASSERT_WITH_MESSAGE(ff.getLocationEngagementSeries(location, g, window.first, window.second) ==
+                                        brute(false, g, window.first, window.second),
+                        std::string("location series mismatch ") + when);
+                }
+            }
+        };
+        check("after load");
 
-        size_t after_kb = peakRSSkB();
-        double u1 = cpu_user_seconds();
-        double s1 = cpu_sys_seconds();
+        std::string uname = *names_in_location.begin();
+        for (int i = 0; i < 40; ++i) {
+            Engagement e(900000 + i, post_id, uname, i % 3 ? "like" : "comment", i % 3 ? "None" : "hi", 100 * i + 7);
+            ff.addEngagementRecord(e);
+        }
+        check("after inserts");
+        // overwriting an id moves its counts instead of adding them again
+        for (int i = 0; i < 10; ++i) {
+            Engagement e(900000 + i, post_id, uname, i % 2 ? "like" : "comment", "again", 100000 + 3600 * i);
+            ff.addEngagementRecord(e);
+        }
+        check("after overwrites");
 
-        double user_cpu = u1 - u0;
-        double sys_cpu  = s1 - s0;
-        size_t delta_kb = (after_kb > before_kb) ? (after_kb - before_kb) : 0;
+        // renames move the user's rows between names and locations
+        auto rename = [&](const std::string& to) {
+            int id = -1;
+            for (const auto& kv : ff.getUsers()) {
+                if (kv.second->username == uname && kv.second->location == location) { id = kv.first; break; }
+            }
+            ASSERT_WITH_MESSAGE(id != -1 && ff.updateUserName(id, to), "rename failed");
+            names_in_location.clear();
+            for (const auto& kv : ff.getUsers()) {
+                if (kv.second->location == location) names_in_location.insert(kv.second->username);
+            }
+        };
+        rename(uname + "_r");
+        check("after rename");
+        std::string elsewhere;
+        for (const auto& kv : ff.getUsers()) {
+            if (kv.second->location != location) { elsewhere = kv.second->username; break; }
+        }
+        uname += "_r";
+        rename(elsewhere);
+        check("after rename onto another location's name");
+        ASSERT_WITH_MESSAGE(ff.getPostEngagementSeries(-1, Granularity::Day, 0, 1 << 30).empty(), "unknown post has a series");
+        std::cout << "Test 26: PASSED\n";
+    }
 
-        // Always print a resource report, even if assertions will pass.
-        std::cout << "  CPU (user): " << user_cpu << " s\n"
-                << "  CPU (sys) : " << sys_cpu  << " s\n"
-                << "  Peak RSS  : +" << kb_to_mb(delta_kb) << " MB"
-                << "  (from " << kb_to_mb(before_kb) << " MB to " << kb_to_mb(after_kb) << " MB)\n";
+    // Test 27: materialized activity feeds
+    if (execute_all || selected_test == "27") {
+        std::cout << "Executing Test 27: [FEED] Per-user activity feed\n";
+        copy_files(input_files, output_files);
+        FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        ff.loadMultipleFlatFilesInParallel();
 
-        // Keep the guardrails
-        ASSERT_WITH_MESSAGE(user_cpu < 2, "Excessive user CPU time: " + std::to_string(user_cpu) + "s");
-        ASSERT_WITH_MESSAGE(sys_cpu  < 1, "Excessive sys CPU time: "   + std::to_string(sys_cpu)  + "s");
-        ASSERT_WITH_MESSAGE(delta_kb < 25 * 1024,
-            "Peak RSS increased by > 25 MB: " + std::to_string(delta_kb/1024) + " MB");
+        // a post author; their feed gets their own engagements and those on their posts
+        const Post& post = *ff.getPosts().begin()->second;
+        int user_id = -1;
+        for (const auto& kv : ff.getUsers()) {
+            if (kv.second->username == post.username) { user_id = kv.first; break; }
+        }
+        ASSERT_WITH_MESSAGE(user_id != -1, "fixture post without author");
+        std::string other;
+        for (const auto& kv : ff.getUsers()) {
+            if (kv.second->username != post.username) { other = kv.second->username; break; }
+        }
 
-        std::cout << "Test 9: PASSED\n";
+        auto brute = [&](size_t limit) {
+            std::vector<std::tuple<int, int, int>> rows;   // (timestamp, id, kind)
+            for (const auto& kv : ff.getEngagements()) {
+                const Engagement& e = *kv.second;
+                auto p = ff.getPosts().find(e.postId);
+                int kind = (e.username == post.username ? FeedEntry::kOwn : 0) |
+                           (p != ff.getPosts().end() && p->second->username == post.username ? FeedEntry::kOnMyPost : 0);
+                if (kind) rows.emplace_back(e.timestamp, e.id, kind);
+            }
+            std::sort(rows.rbegin(), rows.rend());
+            rows.resize(std::min({rows.size(), limit, ActivityFeeds::kFeedLength}));
+            return rows;
+        };
+        auto matches = [&](size_t limit) {
+            auto feed = ff.getUserFeed(user_id, limit);
+            auto expect = brute(limit);
+            if (feed.size() != expect.size()) return false;
+            for (size_t i = 0; i < feed.size(); ++i) {
+                if (std::make_tuple(int(feed[i].timestamp), int(feed[i].engagement_id), int(feed[i].kind)) != expect[i]) return false;
+            }
+            return true;
+        };
+        ASSERT_WITH_MESSAGE(matches(10) && matches(1000), "feed differs after load");
+
+        // someone else engages with the author's post, and the author engages elsewhere
+        const int elsewhere = std::next(ff.getPosts().begin())->first;
+        for (int i = 0; i < 300; ++i) {
+            Engagement e(910000 + i, i % 2 ? post.id : elsewhere, i % 2 ? other : post.username,
+                         i % 3 ? "like" : "comment", i % 3 ? "None" : "feed", 1000000 + i);
+            ff.addEngagementRecord(e);
+        }
+        ASSERT_WITH_MESSAGE(matches(5) && matches(1000), "feed differs after inserts");
+
+        // renaming the author onto `other` merges both feeds
+        ASSERT_WITH_MESSAGE(ff.updateUserName(user_id, other), "rename failed");
+        ASSERT_WITH_MESSAGE(matches(5) && matches(1000), "feed differs after rename");
+        ASSERT_WITH_MESSAGE(ff.getUserFeed(user_id, 1000).size() == ActivityFeeds::kFeedLength, "feed not bounded");
+        ASSERT_WITH_MESSAGE(ff.getUserFeed(-1, 10).empty(), "unknown user has a feed");
+        std::cout << "Test 27: PASSED\n";
     }
 
-    // Test 10: Reader/Writer concurrency sanity
-    if (execute_all || selected_test == "10") {
-        std::cout << "Executing Test 10: [ISOLATION] Reader/Writer concurrency sanity" << std::endl;
-
+    // Test 28: sharded front-end
+    if (execute_all || selected_test == "28") {
+        std::cout << "Executing Test 28: [SHARD] Hash-partitioned shards with scatter-gather\n";
         copy_files(input_files, output_files);
-        FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-        ff.loadFlatFile();
+        auto paths = ShardedFlatFile::split("users_copy.csv", "posts_copy.csv", "engagements_copy.csv", 4, "shard");
+        FlatFile single("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        single.loadFlatFile();
+        {
+            ShardedFlatFile sharded(paths, 8);
+            sharded.load();
+            for (size_t i = 0; i < sharded.shards(); ++i) {
+                ASSERT_WITH_MESSAGE(sharded.shard(i).threadPool().size() == 2, "shard pools not sized from the budget");
+            }
 
-        const int target_post  = 19;
-        const int writer_iters = 200;
+            size_t posts = 0, engagements = 0;
+            for (size_t i = 0; i < sharded.shards(); ++i) {
+                ASSERT_WITH_MESSAGE(sharded.shard(i).getUsers().size() == single.getUsers().size(), "users not replicated");
+                for (const auto& kv : sharded.shard(i).getPosts()) {
+                    ASSERT_WITH_MESSAGE(sharded.shard_of_post(kv.first) == i, "post on the wrong shard");
+                }
+                posts += sharded.shard(i).getPosts().size();
+                engagements += sharded.shard(i).getEngagements().size();
+            }
+            ASSERT_WITH_MESSAGE(posts == single.getPosts().size() && engagements == single.getEngagements().size(),
+                "shards lost or duplicated rows");
+
+            // routed writes, then scatter-gather reads against the unsharded engine
+            const User& u = *single.getUsers().begin()->second;
+            int n = 0;
+            for (auto it = single.getPosts().begin(); it != single.getPosts().end() && n < 20; ++it, ++n) {
+                Engagement e(920000 + n, it->first, u.username, n % 2 ? "like" : "comment", n % 2 ? "None" : "sharded", n);
+                Engagement e2 = e;
+                sharded.addEngagementRecord(e);
+                single.addEngagementRecord(e2);
+                ASSERT_WITH_MESSAGE(sharded.updatePostViews(it->first, 3) == single.updatePostViews(it->first, 3), "routing failed");
+            }
+            ASSERT_WITH_MESSAGE(sharded.getAllUserComments(u.id) == single.getAllUserComments(u.id), "comments differ");
+            std::set<std::string> locations;
+            for (const auto& kv : single.getUsers()) locations.insert(kv.second->location);
+            for (const auto& loc : locations) {
+                ASSERT_WITH_MESSAGE(sharded.getAllEngagementsByLocation(loc) == single.getAllEngagementsByLocation(loc),
+                    "location counts differ: " + loc);
+            }
+            ASSERT_WITH_MESSAGE(!sharded.updateUserName(-1, "nobody"), "renamed an unknown user");
+            ASSERT_WITH_MESSAGE(sharded.updateUserName(u.id, u.username + "_s"), "sharded rename failed");
+        }
 
-        // Capture baseline so we assert monotonic persistence.
-        ASSERT_WITH_MESSAGE(ff.getPosts().count(target_post), "Target post not found");
-        int base_views = ff.getPosts().at(target_post)->views;
+        // everything was persisted per shard
+        ShardedFlatFile reloaded(paths);
+        reloaded.load();
+        ASSERT_WITH_MESSAGE(single.updateUserName(single.getUsers().begin()->first, single.getUsers().begin()->second->username + "_s"),
+            "rename failed");
+        const int uid = single.getUsers().begin()->first;
+        ASSERT_WITH_MESSAGE(reloaded.getAllUserComments(uid) == single.getAllUserComments(uid), "comments differ after reload");
+        size_t views_sharded = 0, views_single = 0;
+        for (size_t i = 0; i < reloaded.shards(); ++i) {
+            for (const auto& kv : reloaded.shard(i).getPosts()) views_sharded += kv.second->views;
+        }
+        for (const auto& kv : single.getPosts()) views_single += kv.second->views;
+        ASSERT_WITH_MESSAGE(views_sharded == views_single, "views differ after reload");
 
-        std::atomic<bool> writer_done{false};
+        for (const auto& p : paths) {
+            for (const std::string* f : {&p.users, &p.posts, &p.engagements}) {
+                std::remove(f->c_str());
+                std::remove((*f + ".tmp").c_str());
+            }
+        }
+        std::cout << "Test 28: PASSED\n";
+    }
 
-        std::thread writer([&](){
-            for (int i = 0; i < writer_iters; ++i) {
-                bool ok = ff.updatePostViews(target_post, 1);
-                ASSERT_WITH_MESSAGE(ok, "Writer failed to ");
+    // Test 29: log-shipping read replica
+    if (execute_all || selected_test == "29") {
+        std::cout << "Executing Test 29: [REPLICA] Log shipping to a read replica\n";
+        copy_files(input_files, output_files);
+        const ShardPaths base{"replica_users.csv", "replica_posts.csv", "replica_engagements.csv"};
+        int sv[2];
+        ASSERT_WITH_MESSAGE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "socketpair failed");
+        {
+            FlatFile primary("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+            primary.loadFlatFile();
+            // some history before the replica attaches
+            const int first_post = primary.getPosts().begin()->first;
+            primary.updatePostViews(first_post, 5);
+
+            FlatFile replica(base.users, base.posts, base.engagements);
+            uint64_t base_version = primary.attachReplica(sv[0], base);
+            ReplicaFollower follower(replica, sv[1]);
+            ASSERT_WITH_MESSAGE(follower.waitForVersion(base_version, std::chrono::seconds(10)), "base not applied");
+
+            // views, engagements (several writers) and a rename
+            const User& u = *primary.getUsers().begin()->second;
+            std::vector<std::thread> writers;
+            for (int t = 0; t < 4; ++t) {
+                writers.emplace_back([&, t] {
+                    int n = 0;
+                    for (auto it = primary.getPosts().begin(); n < 10; ++it, ++n) {
+                        primary.updatePostViews(it->first, t + 1);
+                        Engagement e(930000 + t * 10 + n, it->first, u.username, n % 2 ? "like" : "comment", "replicated", n);
+                        primary.addEngagementRecord(e);
+                    }
+                });
+            }
+            for (auto& w : writers) w.join();
+            ASSERT_WITH_MESSAGE(primary.updateUserName(u.id, u.username + "_r"), "rename failed");
+
+            const uint64_t head = primary.snapshot()->version;
+            ASSERT_WITH_MESSAGE(follower.waitForVersion(head, std::chrono::seconds(10)), "replica did not catch up");
+            ReplicaStatus st = follower.status();
+            ASSERT_WITH_MESSAGE(st.connected && !st.stale && st.applied_version == head && st.lag_seconds >= 0,
+                "unexpected replica status");
+
+            ASSERT_WITH_MESSAGE(replica.getAllUserComments(u.id) == primary.getAllUserComments(u.id), "replica comments differ");
+            std::set<std::string> locations;
+            for (const auto& kv : primary.getUsers()) locations.insert(kv.second->location);
+            for (const auto& loc : locations) {
+                ASSERT_WITH_MESSAGE(replica.getAllEngagementsByLocation(loc) == primary.getAllEngagementsByLocation(loc),
+                    "replica location counts differ");
+            }
+            for (const auto& kv : primary.getPosts()) {
+                ASSERT_WITH_MESSAGE(replica.getPosts().at(kv.first)->views == kv.second->views, "replica views differ");
             }
-            writer_done.store(true, std::memory_order_release);
-        });
 
-        std::vector<std::thread> readers;
-        for (int t = 0; t < 8; ++t) {
-            readers.emplace_back([&](){
-                while (!writer_done.load(std::memory_order_acquire)) {
-                    auto p = ff.getAllEngagementsByLocation("NowhereLikely"); // cheap read
-                    ASSERT_WITH_MESSAGE(p.first >= 0 && p.second >= 0, "Negative counts?");
-                    std::this_thread::yield(); // keep CPU friendly
+            // heartbeats keep the replica's view of the primary current while idle
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            st = follower.status();
+            ASSERT_WITH_MESSAGE(st.primary_version == head && st.lag_seconds == 0, "heartbeat not applied");
+
+            // a replica that stops reading is dropped at its backlog limit without holding up the other
+            {
+                const ShardPaths stalled_base{"stalled_users.csv", "stalled_posts.csv", "stalled_engagements.csv"};
+                int stalled[2];
+                ASSERT_WITH_MESSAGE(socketpair(AF_UNIX, SOCK_STREAM, 0, stalled) == 0, "socketpair failed");
+                int small = 4096;
+                setsockopt(stalled[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+                setsockopt(stalled[1], SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+                primary.setReplicaBacklogLimit(64 * 1024);
+                primary.attachReplica(stalled[0], stalled_base);
+                ASSERT_WITH_MESSAGE(primary.replicaCount() == 2, "stalled replica not attached");
+                const int post = primary.getPosts().begin()->first;
+                for (int i = 0; i < 20000 && primary.replicaCount() == 2; ++i) {
+                    Engagement e(940000 + i, post, u.username, "comment", "backlog filler text", i);
+                    primary.addEngagementRecord(e);
                 }
-            });
+                ASSERT_WITH_MESSAGE(primary.replicaCount() == 1, "stalled replica not dropped");
+                const uint64_t now = primary.snapshot()->version;
+                ASSERT_WITH_MESSAGE(follower.waitForVersion(now, std::chrono::seconds(10)), "healthy replica held up");
+                // the dropped replica's stream ends after what was already sent
+                fcntl(stalled[1], F_SETFL, fcntl(stalled[1], F_GETFL, 0) | O_NONBLOCK);
+                char sink[4096];
+                ssize_t got = 0;
+                for (int i = 0; i < 1000 && (got = read(stalled[1], sink, sizeof(sink))) != 0; ++i) {
+                    if (got < 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                ASSERT_WITH_MESSAGE(got == 0, "dropped replica's stream not shut down");
+                close(stalled[0]);
+                close(stalled[1]);
+                for (const std::string* f : {&stalled_base.users, &stalled_base.posts, &stalled_base.engagements}) {
+                    std::remove(f->c_str());
+                }
+            }
+
+            // the same over a pipe, whose follower is told by end of stream once it reads again
+            {
+                const ShardPaths piped_base{"piped_users.csv", "piped_posts.csv", "piped_engagements.csv"};
+                int p[2];
+                ASSERT_WITH_MESSAGE(pipe(p) == 0, "pipe failed");
+                fcntl(p[1], F_SETPIPE_SZ, 4096);
+                primary.attachReplica(p[1], piped_base);
+                close(p[1]);   // the engine ships through its own copy
+                ASSERT_WITH_MESSAGE(primary.replicaCount() == 2, "piped replica not attached");
+                const int post = primary.getPosts().begin()->first;
+                for (int i = 0; i < 20000 && primary.replicaCount() == 2; ++i) {
+                    Engagement e(960000 + i, post, u.username, "comment", "backlog filler text", i);
+                    primary.addEngagementRecord(e);
+                }
+                ASSERT_WITH_MESSAGE(primary.replicaCount() == 1, "stalled pipe replica not dropped");
+                {
+                    FlatFile piped(piped_base.users, piped_base.posts, piped_base.engagements);
+                    ReplicaFollower late(piped, p[0]);
+                    for (int i = 0; i < 1000 && late.status().connected; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    ASSERT_WITH_MESSAGE(!late.status().connected, "dropped pipe replica still looks connected");
+                }
+                close(p[0]);
+                for (const std::string* f : {&piped_base.users, &piped_base.posts, &piped_base.engagements}) {
+                    std::remove(f->c_str());
+                    std::remove((*f + ".tmp").c_str());
+                }
+            }
+
+            // a reload on the primary invalidates the replica's base
+            primary.loadFlatFile();
+            for (int i = 0; i < 200 && !follower.status().stale; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            ASSERT_WITH_MESSAGE(follower.status().stale, "replica not told about the reload");
         }
+        close(sv[0]);
+        close(sv[1]);
+        for (const std::string* f : {&base.users, &base.posts, &base.engagements}) {
+            std::remove(f->c_str());
+            std::remove((*f + ".tmp").c_str());
+        }
+        std::cout << "Test 29: PASSED\n";
+    }
 
-        writer.join();
-        for (auto &r : readers) r.join();
+    // Test 30: embedded server with pipelined clients
+    if (execute_all || selected_test == "30") {
+        std::cout << "Executing Test 30: [SERVER] Binary protocol over TCP and Unix sockets\n";
+        copy_files(input_files, output_files);
+        FlatFile served("users_copy.csv", "posts_copy.csv", "engagements_copy.csv", 4);   // reads can overtake writes
+        served.loadFlatFile();
+        FlatFile direct("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        direct.loadFlatFile();
+        const std::string sock_path = "buzzdb_test.sock";
+        {
+            BuzzServer server(served);
+            uint16_t port = server.listenTcp(0);
+            server.listenUnix(sock_path);
+            server.start();
+
+            BuzzClient tcp = BuzzClient::tcp(port);
+            BuzzClient ux = BuzzClient::unix_socket(sock_path);
+            tcp.sendPing();
+            tcp.flush();
+            ASSERT_WITH_MESSAGE(tcp.receive().status == 1, "ping failed");
+
+            // an oversized frame closes that connection only
+            {
+                int raw = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                sockaddr_in addr{};
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons(port);
+                addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                ASSERT_WITH_MESSAGE(connect(raw, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0, "connect failed");
+                std::string hdr;
+                WireWriter{hdr}.u32(BuzzServer::kMaxFrame + 1);
+                ASSERT_WITH_MESSAGE(write_fully(raw, hdr), "write failed");
+                char byte;
+                ASSERT_WITH_MESSAGE(read(raw, &byte, 1) <= 0, "oversized frame did not close the connection");
+                close(raw);
+            }
+            tcp.sendPing();
+            tcp.flush();
+            ASSERT_WITH_MESSAGE(tcp.receive().status == 1, "server stopped after an oversized frame");
+
+            // pipelined mutations: one flush, responses in request order
+            std::vector<int> post_ids;
+            for (const auto& kv : direct.getPosts()) post_ids.push_back(kv.first);
+            const User& u = *direct.getUsers().begin()->second;
+            std::vector<uint32_t> ids;
+            for (int i = 0; i < 64; ++i) {
+                int post = post_ids[static_cast<size_t>(i) % post_ids.size()];
+                ids.push_back(tcp.sendUpdatePostViews(post, i + 1));
+                direct.updatePostViews(post, i + 1);
+                Engagement e(930000 + i, post, u.username, i % 2 ? "like" : "comment", i % 2 ? "None" : "served", i);
+                ids.push_back(tcp.sendAddEngagement(e));
+                direct.addEngagementRecord(e);
+            }
+            ids.push_back(tcp.sendUpdatePostViews(-1, 5));
+            tcp.flush();
+            for (size_t i = 0; i < ids.size(); ++i) {
+                WireResponse r = tcp.receive();
+                ASSERT_WITH_MESSAGE(r.id == ids[i], "responses out of order");
+                ASSERT_WITH_MESSAGE(r.status == (i + 1 < ids.size() ? 1 : 0), "unexpected status");
+            }
+            ASSERT_WITH_MESSAGE(!tcp.addEngagement(Engagement(939999, -1, u.username, "like", "None", 0)),
+                "engagement on a missing post reported as applied");
+
+            // reads over the Unix socket match the engine
+            ASSERT_WITH_MESSAGE(ux.getAllUserComments(u.id) == direct.getAllUserComments(u.id), "comments differ");
+            std::set<std::string> locations;
+            for (const auto& kv : direct.getUsers()) locations.insert(kv.second->location);
+            for (const auto& loc : locations) {
+                ASSERT_WITH_MESSAGE(ux.getAllEngagementsByLocation(loc) == direct.getAllEngagementsByLocation(loc),
+                    "location counts differ: " + loc);
+            }
+            for (int post : post_ids) {
+                ASSERT_WITH_MESSAGE(served.getPosts().at(post)->views == direct.getPosts().at(post)->views, "views differ");
+            }
 
-        FlatFile ff2("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-        ff2.loadFlatFile();
-        ASSERT_WITH_MESSAGE(ff2.getPosts().count(target_post), "Missing target post after writer");
-        int after = ff2.getPosts().at(target_post)->views;
+            // a read pipelined behind a write on the same connection sees that write
+            for (int i = 0; i < 50; ++i) {
+                Engagement e(931000 + i, post_ids[static_cast<size_t>(i) % post_ids.size()], u.username, "comment",
+                             "pipelined" + std::to_string(i), i);
+                direct.addEngagementRecord(e);
+                tcp.sendAddEngagement(e);
+                tcp.sendGetUserComments(u.id);
+            }
+            tcp.flush();
+            for (int i = 0; i < 50; ++i) {
+                ASSERT_WITH_MESSAGE(tcp.receive().status == 1, "pipelined append failed");
+                auto rows = BuzzClient::decodeComments(tcp.receive());
+                const std::string want = "pipelined" + std::to_string(i);
+                ASSERT_WITH_MESSAGE(std::any_of(rows.begin(), rows.end(), [&](const auto& row) { return row.second == want; }),
+                    "pipelined read missed its own write");
+            }
+            ASSERT_WITH_MESSAGE(ux.getAllUserComments(u.id) == direct.getAllUserComments(u.id), "comments differ after pipelining");
 
-        ASSERT_WITH_MESSAGE(after >= base_views + writer_iters,
-            "Writer s not persisted: expected at least " +
-            std::to_string(base_views + writer_iters) + " got " + std::to_string(after));
+            ASSERT_WITH_MESSAGE(ux.updateUserName(u.id, u.username + "_srv") && direct.updateUserName(u.id, u.username + "_srv"),
+                "rename failed");
+            ASSERT_WITH_MESSAGE(!ux.updateUserName(-1, "nobody"), "rename of a missing user succeeded");
 
-        std::cout << "Test 10: PASSED\n";
+            std::vector<int> user_ids;
+            for (const auto& kv : direct.getUsers()) user_ids.push_back(kv.first);
+            LoadGenResult load = run_load_generator(port, 4, 2000, 32, post_ids, user_ids,
+                std::vector<std::string>(locations.begin(), locations.end()));
+            std::cout << "Load generator: " << load.requests << " requests in " << load.seconds << "s ("
+                      << static_cast<long long>(load.requests_per_second) << " req/s, "
+                      << server.requestsServed() << " served in " << server.batches() << " batches)\n";
+            ASSERT_WITH_MESSAGE(server.requestsServed() >= load.requests, "server dropped requests");
+            server.stop();
+        }
+        ASSERT_WITH_MESSAGE(access(sock_path.c_str(), F_OK) != 0, "Unix socket not removed");
+        std::cout << "Test 30: PASSED\n";
     }
 
-    // Test 11: Crash-during-write durability (best-effort)
-    if (execute_all || selected_test == "11") {
-        std::cout << "Executing Test 11: [DURABILITY] Crash-during-write durability\n";
-#if defined(__unix__) || defined(__APPLE__)
+    // Test 31: shared read-only table image
+    if (execute_all || selected_test == "31") {
+        std::cout << "Executing Test 31: [IMAGE] Shared read-only table image across processes\n";
         copy_files(input_files, output_files);
-        const int pid_target = 19;
-
-        // Put views near a boundary to encourage wider lines during write
-        rewrite_post_views_file("posts_copy.csv", pid_target, 99);
+        FlatFile db("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        db.loadFlatFile();
+        const std::string image_path = "buzzdb_test.img";
+        std::remove(image_path.c_str());
+        SharedImageReader reader(image_path);
+        ASSERT_WITH_MESSAGE(reader.current() == nullptr, "image before the first publish");
+
+        ASSERT_WITH_MESSAGE(db.publishImage(image_path) == 1, "first generation should be 1");
+        auto img = reader.current();
+        ASSERT_WITH_MESSAGE(img && img->generation() == 1, "reader did not attach");
+        ASSERT_WITH_MESSAGE(img->userCount() == db.getUsers().size() && img->postCount() == db.getPosts().size() &&
+                            img->engagementCount() == db.getEngagements().size(), "row counts differ");
+
+        std::set<std::string> locations;
+        for (const auto& kv : db.getUsers()) {
+            locations.insert(kv.second->location);
+            auto u = img->getUser(kv.first);
+            ASSERT_WITH_MESSAGE(u && u->username == kv.second->username, "user lookup differs");
+            ASSERT_WITH_MESSAGE(img->getAllUserComments(kv.first) == db.getAllUserComments(kv.first), "comments differ");
+        }
+        for (const auto& loc : locations) {
+            ASSERT_WITH_MESSAGE(img->getAllEngagementsByLocation(loc) == db.getAllEngagementsByLocation(loc),
+                "location counts differ: " + loc);
+        }
+        ASSERT_WITH_MESSAGE(!img->getUser(-1) && img->getAllUserComments(-1).empty() &&
+                            img->getAllEngagementsByLocation("nowhere") == std::make_pair(0, 0), "missing keys");
 
+        // another process maps the same image and answers from it
+        const int post = db.getPosts().begin()->first;
+        const int views = db.getPosts().begin()->second->views;
+        const auto expected = db.getAllUserComments(db.getUsers().begin()->first);
         pid_t child = fork();
-        ASSERT_WITH_MESSAGE(child >= 0, "fork failed");
-
         if (child == 0) {
-            // CHILD: loop writes for a while
-            FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-            ff.loadFlatFile();
-            for (int i = 0; i < 1000000; ++i) {
-                ff.updatePostViews(pid_target, 1);
-                if ((i % 1000) == 0) { /* give parent time window */ usleep(1000); }
-            }
-            _exit(0);
-        } else {
-            // PARENT: kill child mid-flight
-            usleep(50000); // 50ms
-            kill(child, SIGKILL);
-            usleep(20000); // settle
+            auto mine = SharedImage::attach(image_path);
+            bool ok = mine && mine->getPost(post) && mine->getPost(post)->views == views &&
+                      mine->getAllUserComments(db.getUsers().begin()->first) == expected;
+            _exit(ok ? 0 : 1);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        ASSERT_WITH_MESSAGE(WIFEXITED(status) && WEXITSTATUS(status) == 0, "child process query failed");
+
+        // a new generation replaces the image atomically; the old mapping stays readable
+        db.updatePostViews(post, 1000);
+        ASSERT_WITH_MESSAGE(db.publishImage(image_path) == 2, "generation not bumped");
+        auto next = reader.current();
+        ASSERT_WITH_MESSAGE(next && next->generation() == 2 && next->getPost(post)->views == views + 1000,
+            "reader did not switch generation");
+        ASSERT_WITH_MESSAGE(img->getPost(post)->views == views, "old generation changed under its reader");
+
+        // damaged images are refused instead of mapped
+        {
+            std::ifstream in(image_path, std::ios::binary);
+            const std::string good((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            const std::string bad_path = image_path + ".bad";
+            auto attach_patched = [&](const std::function<void(ImageHeader&)>& patch, size_t keep) {
+                std::string bytes = good.substr(0, keep);
+                ImageHeader h;
+                std::memcpy(&h, bytes.data(), sizeof(h));
+                patch(h);
+                std::memcpy(&bytes[0], &h, sizeof(h));
+                std::ofstream(bad_path, std::ios::binary | std::ios::trunc) << bytes;
+                return SharedImage::attach(bad_path);
+            };
+            ASSERT_WITH_MESSAGE(attach_patched([](ImageHeader&) {}, good.size()), "intact copy refused");
+            ASSERT_WITH_MESSAGE(!attach_patched([&](ImageHeader& h) { h.file_bytes = good.size() / 2; }, good.size() / 2),
+                "truncated image attached");
+            ASSERT_WITH_MESSAGE(!attach_patched([&](ImageHeader& h) { h.sections[kImgEngComment].offset = good.size() - 8; }, good.size()),
+                "section past the end attached");
+            ASSERT_WITH_MESSAGE(!attach_patched([](ImageHeader& h) { h.engagements += 1000; }, good.size()),
+                "row count beyond its sections attached");
+            ASSERT_WITH_MESSAGE(!attach_patched([](ImageHeader& h) { h.sections[kImgStrings].count = 0; }, good.size()),
+                "string references past the arena attached");
+            std::remove(bad_path.c_str());
+        }
+        std::remove(image_path.c_str());
+        std::cout << "Test 31: PASSED\n";
+    }
 
-            // Now try to reload; file must be parseable and value not garbage
-            FlatFile ff2("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-            try {
-                ff2.loadFlatFile();
-            } catch (...) {
-                ASSERT_WITH_MESSAGE(false, "CSV became unparseable after crash");
+    // Test 32: synthetic data generator and benchmark driver
+    if (execute_all || selected_test == "32") {
+        std::cout << "Executing Test 32: [BENCH] Deterministic skewed generator and benchmark output\n";
+        auto slurp = [](const std::string& path) {
+            std::ifstream f(path, std::ios::binary);
+            return std::string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        };
+        ShardPaths a{"gen_a_users.csv", "gen_a_posts.csv", "gen_a_engagements.csv"};
+        ShardPaths b{"gen_b_users.csv", "gen_b_posts.csv", "gen_b_engagements.csv"};
+        DatasetSpec spec = DatasetSpec::scaled(20000, 7);
+        generate_dataset(spec, a);
+        generate_dataset(spec, b);
+        ASSERT_WITH_MESSAGE(slurp(a.users) == slurp(b.users) && slurp(a.posts) == slurp(b.posts) &&
+                            slurp(a.engagements) == slurp(b.engagements), "same seed produced different data");
+        spec.seed = 8;
+        generate_dataset(spec, b);
+        ASSERT_WITH_MESSAGE(slurp(a.engagements) != slurp(b.engagements), "seed ignored");
+
+        FlatFile db(a.users, a.posts, a.engagements);
+        db.loadFlatFile();
+        ASSERT_WITH_MESSAGE(db.getUsers().size() == spec.users && db.getPosts().size() == spec.posts &&
+                            db.getEngagements().size() == spec.engagements, "generated rows rejected by the loader");
+        ASSERT_WITH_MESSAGE(check_no_dangling_post_ids(db.getEngagements(), db.getPosts()), "dangling post ids");
+
+        // skew: the busiest 1% of users account for a large share of engagements
+        std::unordered_map<std::string, size_t> per_user;
+        for (const auto& kv : db.getEngagements()) per_user[kv.second->username]++;
+        std::vector<size_t> counts;
+        for (const auto& kv : per_user) counts.push_back(kv.second);
+        std::sort(counts.rbegin(), counts.rend());
+        size_t top = 0;
+        for (size_t i = 0; i < spec.users / 100 && i < counts.size(); ++i) top += counts[i];
+        ASSERT_WITH_MESSAGE(top * 5 > spec.engagements, "engagements are not skewed: top 1% has " + std::to_string(top));
+
+        BenchConfig cfg;
+        cfg.scales = {5000, 10000};
+        cfg.updates = 20;
+        cfg.inserts = 50;
+        cfg.renames = 2;
+        cfg.queries = 10;
+        cfg.prefix = "bench_test";
+        std::stringstream json;
+        run_benchmark(cfg, json);
+        std::cout << json.str();
+        std::string line;
+        size_t lines = 0;
+        while (std::getline(json, line)) {
+            ++lines;
+            for (const char* key : {"\"scale\":", "\"op\":", "\"ops_per_sec\":", "\"p99_us\":", "\"peak_rss_kb\":", "\"cpu_user_s\":"}) {
+                ASSERT_WITH_MESSAGE(line.find(key) != std::string::npos, std::string("bench output lacks ") + key);
             }
-            auto it = ff2.getPosts().find(pid_target);
-            ASSERT_WITH_MESSAGE(it != ff2.getPosts().end(), "Target post missing after crash");
-            int v = it->second->views;
-            ASSERT_WITH_MESSAGE(v >= 99, "Views regressed to below starting value");
-            // NOTE: We cannot assert exact value due to kill timing; we only assert it isn't torn/unreadable.
         }
-        std::cout << "Test 11: PASSED\n";
-#else
-        std::cout << "Skipping Test 11 on non-POSIX platform.\n";
-#endif
+        ASSERT_WITH_MESSAGE(lines == 2 * 8, "expected 8 operations per scale, got " + std::to_string(lines));
+        for (const ShardPaths* p : {&a, &b}) {
+            for (const std::string* f : {&p->users, &p->posts, &p->engagements}) std::remove(f->c_str());
+        }
+        std::cout << "Test 32: PASSED\n";
     }
 
-    // Test 12: Referential integrity (no dangling engagement.postId)
-    if (execute_all || selected_test == "12") {
-        std::cout << "Executing Test 12: [CONSISTENCY] Referential integrity\n";
+    // Test 33: statistical performance gate
+    if (execute_all || selected_test == "33") {
+        std::cout << "Executing Test 33: [PERF] Baseline comparison with confidence intervals\n";
+        // synthetic samples: noise alone must not trip the gate, a 50% slowdown must
+        GenRng rng(33);
+        auto noisy = [&](double median, double jitter, size_t n) {
+            std::vector<double> v;
+            for (size_t i = 0; i < n; ++i) v.push_back(median * (1 + jitter * (rng.uniform() - 0.5)));
+            return v;
+        };
+        std::vector<double> base = noisy(1.0, 0.4, 15);
+        ASSERT_WITH_MESSAGE(!compare_perf_samples("same", base, base, 0.10).regression, "identical samples flagged");
+        ASSERT_WITH_MESSAGE(!compare_perf_samples("noise", base, noisy(1.05, 0.4, 15), 0.10).regression, "noise flagged");
+        std::vector<double> outliers = noisy(1.0, 0.2, 15);
+        outliers[3] = outliers[9] = 10.0;   // two stalls do not move a median
+        ASSERT_WITH_MESSAGE(!compare_perf_samples("stalls", base, outliers, 0.10).regression, "outliers flagged");
+        PerfVerdict slow = compare_perf_samples("slow", base, noisy(1.5, 0.2, 15), 0.10);
+        ASSERT_WITH_MESSAGE(slow.regression && slow.ci_low > 1.1 && slow.ratio > 1.3, "slowdown missed");
+
+        // record, then compare against the recorded baseline
+        const std::string path = "perf_test_baseline.txt";
+        std::remove(path.c_str());
         copy_files(input_files, output_files);
-
-        // Load, then append an invalid engagement that references a non-existent postId.
+        FlatFile db("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        db.loadFlatFile();
+        db.setResultCacheBytes(0);
+        PerfOptions opt;
+        opt.warmups = 1;
+        opt.samples = 5;
+        opt.tolerance = 4.0;   // timing on shared test machines; the synthetic cases above cover the statistics
+        std::vector<PerfCase> cases = standard_perf_cases(db);
+        cases.erase(cases.begin(), cases.begin() + 2);   // Test 2 already samples the loaders
         {
-            FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-            ff.loadFlatFile();
+            PerfBaselineStore store(path);
+            auto first = run_perf_suite(cases, store, opt, false, std::cout);
+            ASSERT_WITH_MESSAGE(std::all_of(first.begin(), first.end(), [](const PerfVerdict& v) { return v.recorded; }),
+                "first run should record baselines");
+        }
+        PerfBaselineStore reloaded(path);
+        ASSERT_WITH_MESSAGE(reloaded.get("get_user_comments") && reloaded.get("get_user_comments")->size() == opt.samples,
+            "baseline not persisted");
+        auto second = run_perf_suite(cases, reloaded, opt, false, std::cout);
+        for (const PerfVerdict& v : second) {
+            ASSERT_WITH_MESSAGE(!v.recorded && !v.regression, "unexpected verdict for " + v.name);
+        }
+        std::remove(path.c_str());
+        std::cout << "Test 33: PASSED\n";
+    }
 
-            // Find a username to reuse
-            std::string uname = ff.getUsers().begin()->second->username;
-            int nonexistent_post = 99999999;
-            Engagement bad(100000001, nonexistent_post, uname, "comment", "bad-fk", 123);
-            ff.addEngagementRecord(bad);
+    // Test 34: engine metrics
+    if (execute_all || selected_test == "34") {
+        std::cout << "Executing Test 34: [STATS] Latency histograms, I/O and reject counters\n";
+        // histogram accuracy: percentiles within one sub-bucket (1/16) of the truth
+        LatencyHistogram h;
+        for (uint64_t v = 1; v <= 100000; ++v) h.record(v * 100);
+        ASSERT_WITH_MESSAGE(h.count() == 100000 && h.max() == 10000000, "histogram totals");
+        for (double q : {0.5, 0.9, 0.99, 0.999}) {
+            double truth = q * 10000000, got = double(h.percentile(q));
+            ASSERT_WITH_MESSAGE(std::fabs(got - truth) <= truth / 16, "p" + std::to_string(q) + " off: " + std::to_string(got));
+        }
+        for (uint64_t v : {0ull, 1ull, 15ull, 16ull, 17ull, 1000ull, (1ull << 40) + 5, ~0ull}) {
+            size_t i = LatencyHistogram::index_of(v);
+            ASSERT_WITH_MESSAGE(i < LatencyHistogram::kBuckets, "bucket out of range");
+            double mid = double(LatencyHistogram::midpoint_of(i));
+            ASSERT_WITH_MESSAGE(std::fabs(mid - double(v)) <= double(v) / 16 + 1, "bucket midpoint off for " + std::to_string(v));
         }
 
-        // Reload and run an RI sweep: this must fail in a "bad" implementation.
+        copy_files(input_files, output_files);
+        FlatFile db("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        db.loadFlatFile();
+        EngineStats s = db.stats();
+        uintmax_t on_disk = 0;
+        for (const auto& f : output_files) on_disk += std::filesystem::file_size(f);
+        ASSERT_WITH_MESSAGE(s.bytes_read == on_disk, "bytes read " + std::to_string(s.bytes_read) + " vs " + std::to_string(on_disk));
+        ASSERT_WITH_MESSAGE(s.rows_loaded[0] == db.getUsers().size() && s.rows_loaded[1] == db.getPosts().size() &&
+                            s.rows_loaded[2] == db.getEngagements().size(), "loaded rows");
+        // the fixtures carry one orphan post and two dangling engagements
+        ASSERT_WITH_MESSAGE(s.rows_rejected[1] >= 1 && s.rows_rejected[2] >= 2, "integrity rejects not counted");
+        ASSERT_WITH_MESSAGE(s.op(EngineOp::LoadFlatFile).count == 1, "load not timed");
+
+        const int post = db.getPosts().begin()->first;
+        const User& u = *db.getUsers().begin()->second;
+        for (int i = 0; i < 10; ++i) db.updatePostViews(post, 1);
+        Engagement good(940000, post, u.username, "like", "None", 1);
+        Engagement bad(940001, -5, u.username, "like", "None", 1);
+        db.addEngagementRecord(good);
+        db.addEngagementRecord(bad);
+        for (int i = 0; i < 5; ++i) db.getAllUserComments(u.id);
+        db.getAllEngagementsByLocation(u.location);
+
+        std::vector<std::string> dumps;
+        std::mutex dumps_mtx;
+        db.startStatsDump(std::chrono::milliseconds(10), [&](const std::string& text) {
+            std::lock_guard<std::mutex> lk(dumps_mtx);
+            dumps.push_back(text);
+        });
+        for (int i = 0; i < 200; ++i) {
+            { std::lock_guard<std::mutex> lk(dumps_mtx); if (!dumps.empty()) break; }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        db.stopStatsDump();
+
+        EngineStats t = db.stats();
+        ASSERT_WITH_MESSAGE(t.op(EngineOp::UpdatePostViews).count == 10 && t.op(EngineOp::AddEngagement).count == 2 &&
+                            t.op(EngineOp::GetAllUserComments).count == 5 &&
+                            t.op(EngineOp::GetAllEngagementsByLocation).count == 1, "op counts");
+        const LatencySummary& upd = t.op(EngineOp::UpdatePostViews);
+        ASSERT_WITH_MESSAGE(upd.p50_us > 0 && upd.p50_us <= upd.p99_us && upd.p99_us <= upd.max_us, "percentiles not ordered");
+        ASSERT_WITH_MESSAGE(t.rows_rejected[2] == s.rows_rejected[2] + 1, "insert reject not counted");
+        ASSERT_WITH_MESSAGE(t.bytes_written > good.toCSV().size(), "writes not counted");
+        ASSERT_WITH_MESSAGE(t.lock_wait.count >= 11 && t.lock_hold.count == t.lock_wait.count, "lock timings");
+        ASSERT_WITH_MESSAGE(!dumps.empty() && dumps[0].find("updatePostViews") != std::string::npos &&
+                            dumps[0].find("reject_rate") != std::string::npos, "periodic dump");
+        std::cout << t.to_text();
+        std::cout << "Test 34: PASSED\n";
+    }
+
+    // Test 35: lock contention profiler
+    if (execute_all || selected_test == "35") {
+        std::cout << "Executing Test 35: [LOCKS] Contention by lock, call site and holder\n";
+        // deterministic contention: a "rename" holds the lock while an "update" waits for it
         {
-            FlatFile ff("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
-            ff.loadFlatFile();
-            bool ok = check_no_dangling_post_ids(ff.getEngagements(), ff.getPosts());
-            ASSERT_WITH_MESSAGE(ok, "Detected dangling engagement.postId; implementation should prevent or clean this");
+            LockProfile profile("probe");
+            ProfiledSharedMutex m;
+            m.set_profile(&profile);
+            std::atomic<bool> held{false};
+            std::thread holder([&] {
+                tl_lock_site = static_cast<uint8_t>(EngineOp::UpdateUserName);
+                std::lock_guard<ProfiledSharedMutex> lk(m);
+                held = true;
+                std::this_thread::sleep_for(std::chrono::milliseconds(30));
+            });
+            while (!held) std::this_thread::yield();
+            std::thread waiter([&] {
+                tl_lock_site = static_cast<uint8_t>(EngineOp::UpdatePostViews);
+                std::unique_lock<ProfiledSharedMutex> lk(m);
+            });
+            holder.join();
+            waiter.join();
+            { std::shared_lock<ProfiledSharedMutex> rd(m); }   // uncontended reader, "internal" site
+
+            LockReport r = profile.report();
+            ASSERT_WITH_MESSAGE(r.acquisitions == 3 && r.contended == 1 && r.hold.count == 2, "probe counts");
+            ASSERT_WITH_MESSAGE(r.sites.front().site == "updatePostViews" && r.sites.front().wait_us > 5000, "wait by site");
+            ASSERT_WITH_MESSAGE(r.blockers.size() == 1 && r.blockers[0].waiter == "updatePostViews" &&
+                                r.blockers[0].holder == "updateUserName", "blocker attribution");
+            auto rename = std::find_if(r.sites.begin(), r.sites.end(), [](const LockSiteStats& s) { return s.site == "updateUserName"; });
+            ASSERT_WITH_MESSAGE(rename != r.sites.end() && rename->max_hold_us > 20000, "hold time");
         }
-        std::cout << "Test 12: PASSED\n";
+
+        // engine locks: renames hold every stripe across three file rewrites
+        copy_files(input_files, output_files);
+        FlatFile db("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        db.loadFlatFile();
+        const int user = db.getUsers().begin()->first;
+        std::vector<int> post_ids;
+        for (const auto& kv : db.getPosts()) post_ids.push_back(kv.first);
+        std::atomic<bool> done{false};
+        std::thread renamer([&] {
+            for (int i = 0; i < 4; ++i) db.updateUserName(user, "contended" + std::to_string(i));
+            done = true;
+        });
+        std::vector<std::thread> updaters;
+        for (int t = 0; t < 3; ++t) {
+            updaters.emplace_back([&, t] {
+                for (size_t i = t; !done; i += 3) db.updatePostViews(post_ids[i % post_ids.size()], 1);
+            });
+        }
+        renamer.join();
+        for (auto& th : updaters) th.join();
+
+        std::vector<LockReport> reports = db.lockReport();
+        ASSERT_WITH_MESSAGE(reports.size() == 5, "one report per lock class");
+        auto find = [&](const std::string& name) {
+            return *std::find_if(reports.begin(), reports.end(), [&](const LockReport& r) { return r.name == name; });
+        };
+        LockReport posts_r = find("posts.stripes");
+        auto site = [&](const std::string& name) {
+            auto it = std::find_if(posts_r.sites.begin(), posts_r.sites.end(), [&](const LockSiteStats& s) { return s.site == name; });
+            ASSERT_WITH_MESSAGE(it != posts_r.sites.end(), "no posts stripe traffic from " + name);
+            return *it;
+        };
+        ASSERT_WITH_MESSAGE(site("updateUserName").acquisitions >= 4 * StripedTable<Post>::kStripes, "rename acquisitions");
+        ASSERT_WITH_MESSAGE(site("updateUserName").max_hold_us > site("updatePostViews").max_hold_us, "rename should hold longest");
+        ASSERT_WITH_MESSAGE(find("posts.file").acquisitions > 0 && find("version").acquisitions > 0, "file/version locks");
+        for (const LockBlocker& b : posts_r.blockers) {
+            ASSERT_WITH_MESSAGE(b.holder == "updateUserName" || b.holder == "updatePostViews" || b.holder == "loadFlatFile",
+                "unexpected holder " + b.holder);
+        }
+        std::cout << lock_reports_text(reports);
+        std::cout << "Test 35: PASSED\n";
     }
 
-    // Test 13: No type corruption — stoi over numeric fields should never throw
-    if (execute_all || selected_test == "13") {
-        std::cout << "Executing Test 13: [CONSISTENCY] Type sanity for numerics" << std::endl;
+    // Test 36: load-phase tracing
+    if (execute_all || selected_test == "36") {
+        std::cout << "Executing Test 36: [TRACE] Load phases as Chrome trace events\n";
+        copy_files(input_files, output_files);
+        FlatFile db("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        db.loadFlatFile();
+        ASSERT_WITH_MESSAGE(db.loadTraceEvents().empty(), "tracing is off by default");
+
+        auto named = [](const std::vector<TraceEvent>& evs, const std::string& name) {
+            auto it = std::find_if(evs.begin(), evs.end(), [&](const TraceEvent& e) { return e.name == name; });
+            ASSERT_WITH_MESSAGE(it != evs.end(), "missing span " + name);
+            return *it;
+        };
+        auto arg = [](const TraceEvent& e, const std::string& key) {
+            for (const auto& kv : e.args) if (kv.first == key) return kv.second;
+            ASSERT_WITH_MESSAGE(false, "missing arg " + key);
+            return 0.0;
+        };
+        auto within = [](const TraceEvent& inner, const TraceEvent& outer) {
+            return inner.ts_ns >= outer.ts_ns && inner.ts_ns + inner.dur_ns <= outer.ts_ns + outer.dur_ns;
+        };
 
-        auto check_numeric_columns = [](const std::string& path, int numeric_cols_mask){
-            std::ifstream f(path);
-            ASSERT_WITH_MESSAGE(f.is_open(), "Cannot open " + path);
-            std::string line; bool header = true;
-            while (std::getline(f, line)) {
-                if (header) { header = false; continue; }
-                if (line.empty()) continue;
-                std::stringstream ss(line);
-                std::vector<std::string> cols;
-                std::string cell;
-                while (std::getline(ss, cell, ',')) cols.push_back(cell);
-                for (size_t i=0; i<cols.size(); ++i) {
-                    if (numeric_cols_mask & (1<<i)) {
-                        try { (void)std::stoi(cols[i]); }
-                        catch (...) { ASSERT_WITH_MESSAGE(false, "Non-numeric where numeric required in " + path); }
-                    }
-                }
+        db.enableLoadTracing(true, "load_trace.json");
+        db.loadFlatFile();
+        std::vector<TraceEvent> evs = db.loadTraceEvents();
+        TraceEvent load = named(evs, "loadFlatFile");
+        for (const char* file : {"users_copy.csv", "posts_copy.csv", "engagements_copy.csv"}) {
+            TraceEvent parse = named(evs, std::string("parse ") + file);
+            ASSERT_WITH_MESSAGE(within(parse, load) && parse.tid == load.tid, "serial parse runs inside the load");
+            double phases = arg(parse, "io_ms") + arg(parse, "tokenize_ms") + arg(parse, "parse_int_ms") +
+                            arg(parse, "filter_ms") + arg(parse, "construct_ms");
+            ASSERT_WITH_MESSAGE(phases > 0 && phases <= parse.dur_ns / 1e6 + 0.01, "phase times fit the span");
+            ASSERT_WITH_MESSAGE(arg(parse, "rows") > 0 && arg(parse, "bytes") > 0, "rows/bytes");
+        }
+        ASSERT_WITH_MESSAGE(arg(named(evs, "parse engagements_copy.csv"), "filter_ms") > 0, "integrity checks timed");
+        for (const char* stage : {"index usernames", "build snapshot", "build derived views", "partition users",
+                                  "partition posts", "partition engagements", "commit swap"}) {
+            ASSERT_WITH_MESSAGE(within(named(evs, stage), load), std::string("stage outside load: ") + stage);
+        }
+
+        // the written file is complete JSON with one "X" event per span plus process metadata
+        std::ifstream in("load_trace.json");
+        std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        size_t complete = 0;
+        for (size_t pos = 0; (pos = json.find("\"ph\":\"X\"", pos)) != std::string::npos; ++pos) ++complete;
+        ASSERT_WITH_MESSAGE(json.rfind("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 0) == 0 &&
+                            json.find("\n]}") != std::string::npos && complete == evs.size(), "trace file");
+
+        // parallel load: users/posts parse on pool workers while the caller parses engagements
+        db.clearLoadTrace();
+        db.loadMultipleFlatFilesInParallel();
+        evs = db.loadTraceEvents();
+        TraceEvent pload = named(evs, "loadMultipleFlatFilesInParallel");
+        TraceEvent pusers = named(evs, "parse users_copy.csv");
+        TraceEvent pengs = named(evs, "parse engagements_copy.csv");
+        ASSERT_WITH_MESSAGE(pusers.tid != pload.tid && pengs.tid == pload.tid, "per-thread spans");
+        ASSERT_WITH_MESSAGE(within(pusers, pload) && within(named(evs, "referential integrity"), pload) &&
+                            within(named(evs, "construct objects"), pload), "parallel stages");
+        // parse rows are counted before the integrity filter
+        ASSERT_WITH_MESSAGE(arg(pengs, "rows") >= db.getEngagements().size() && arg(pusers, "rows") >= db.getUsers().size(), "rows");
+
+        db.enableLoadTracing(false);
+        db.clearLoadTrace();
+        db.loadMultipleFlatFilesInParallel();
+        ASSERT_WITH_MESSAGE(db.loadTraceEvents().empty(), "disabled again");
+        std::remove("load_trace.json");
+        std::cout << "Test 36: PASSED\n";
+    }
+
+    // Test 37: memory accounting
+    if (execute_all || selected_test == "37") {
+        std::cout << "Executing Test 37: [MEMORY] Footprint per table, index and load buffer\n";
+        copy_files(input_files, output_files);
+        FlatFile db("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        db.loadMultipleFlatFilesInParallel();
+        ASSERT_WITH_MESSAGE(db.memoryReport().load.empty() && db.memoryReport().load_peak_bytes == 0,
+            "loads are not measured unless asked");
+        db.trackLoadMemory(true);
+        db.loadMultipleFlatFilesInParallel();
+        MemoryReport r = db.memoryReport();
+
+        ASSERT_WITH_MESSAGE(r.tables.size() == 3, "three tables");
+        ASSERT_WITH_MESSAGE(r.find("users")->rows == db.getUsers().size() && r.find("posts")->rows == db.getPosts().size() &&
+                            r.find("engagements")->rows == db.getEngagements().size(), "table rows");
+        // every row is at least its object plus one column cell per field
+        ASSERT_WITH_MESSAGE(r.find("users")->bytes_per_row() > sizeof(User) + sizeof(int) + 2 * sizeof(std::string), "users B/row");
+        ASSERT_WITH_MESSAGE(r.find("engagements")->bytes_per_row() > sizeof(Engagement), "engagements B/row");
+        ASSERT_WITH_MESSAGE(r.find("posts.stripes")->bytes == db.getPosts().size() * (kTreeNodeHeader + sizeof(std::pair<const int, std::unique_ptr<Post>>)),
+                            "stripe map nodes");
+        for (const char* name : {"users.id_row", "posts.id_row", "users.username_count", "engagements.id_row",
+                                 "sketches", "rollups", "feeds", "result_cache"}) {
+            ASSERT_WITH_MESSAGE(r.find(name) != nullptr, std::string("missing index ") + name);
+        }
+        ASSERT_WITH_MESSAGE(r.find("sketches")->bytes >= HeavyHitters::kWidth * HeavyHitters::kDepth * sizeof(uint64_t), "sketch counters");
+
+        // parallel load buffers: all released after the commit, peaks kept
+        size_t sum = 0, largest = 0;
+        for (const char* name : {"parsed users", "parsed posts", "parsed engagements", "integrity sets", "row objects", "new snapshot"}) {
+            const MemoryUsage* u = r.find(name);
+            ASSERT_WITH_MESSAGE(u && u->peak_bytes > 0 && u->bytes == 0, std::string("load buffer ") + name);
+            sum += u->peak_bytes;
+            largest = std::max(largest, u->peak_bytes);
+        }
+        ASSERT_WITH_MESSAGE(r.find("parsed engagements")->rows >= db.getEngagements().size(), "parsed rows");
+        // parse buffers are freed before the snapshot is built, so the peak is below the sum
+        ASSERT_WITH_MESSAGE(r.load_peak_bytes >= largest && r.load_peak_bytes < sum, "load peak");
+        ASSERT_WITH_MESSAGE(r.peak_bytes() == r.resident_bytes() + r.load_peak_bytes, "peak");
+
+        // the serial loader parses straight into row maps
+        db.loadFlatFile();
+        MemoryReport s = db.memoryReport();
+        ASSERT_WITH_MESSAGE(s.find("row objects") == nullptr && s.find("parsed users")->peak_bytes > 0, "serial buffers");
+        ASSERT_WITH_MESSAGE(s.find("engagements")->rows == r.find("engagements")->rows, "same tables");
+
+        ASSERT_WITH_MESSAGE(!s.over_budget(), "no budget by default");
+        db.setMemoryBudget(s.peak_bytes() * 2);
+        ASSERT_WITH_MESSAGE(!db.memoryReport().over_budget(), "within budget");
+        ASSERT_WITH_MESSAGE(db.loadFlatFile(), "load within budget refused");
+        db.setMemoryBudget(s.resident_bytes() / 2);
+        MemoryReport tight = db.memoryReport();
+        ASSERT_WITH_MESSAGE(tight.over_budget() && tight.to_text().find("EXCEEDED") != std::string::npos, "over budget");
+
+        // a load that would not fit is refused before it reads anything
+        const size_t engagements_before = db.getEngagements().size();
+        ASSERT_WITH_MESSAGE(!db.loadMultipleFlatFilesInParallel() && !db.loadFlatFile(), "over-budget load admitted");
+        tight = db.memoryReport();
+        ASSERT_WITH_MESSAGE(tight.refused_loads == 2 && db.getEngagements().size() == engagements_before, "refused load changed state");
+        FlatFile fresh("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        fresh.setMemoryBudget(1024);
+        ASSERT_WITH_MESSAGE(!fresh.loadFlatFile() && fresh.getUsers().empty(), "first load projected from file sizes");
+        std::cout << tight.to_text();
+        std::cout << "Test 37: PASSED\n";
+    }
+
+    // Test 38: block-compressed storage
+    if (execute_all || selected_test == "38") {
+        std::cout << "Executing Test 38: [BLOCKS] Block-compressed tables with parallel decompression\n";
+        // codec round trips: empty, tiny, overlapping runs, text, incompressible bytes
+        std::mt19937 rng(38);
+        std::string noise(5000, '\0');
+        for (char& c : noise) c = static_cast<char>(rng());
+        for (const std::string& in : {std::string(), std::string("a"), std::string(1000, 'z'), std::string("abcabcabcabcabcd"),
+                                      std::string("1,user1,city1\n2,user2,city2\n3,user3,city1\n"), noise}) {
+            std::string packed = lz_compress(in);
+            std::string out(in.size(), '\0');
+            ASSERT_WITH_MESSAGE(lz_decompress(packed, out.data(), out.size()) && out == in, "codec round trip");
+            if (!in.empty()) {
+                ASSERT_WITH_MESSAGE(!lz_decompress(std::string_view(packed).substr(0, packed.size() / 2), out.data(), out.size()),
+                                    "truncated input rejected");
             }
-        };
+        }
 
-        // users: id (0) numeric
-        check_numeric_columns("users.csv", (1<<0));
-        // posts: id (0), views (3) numeric
-        check_numeric_columns("posts.csv", (1<<0) | (1<<3));
-        // engagements: id (0), postId (1), timestamp (5) numeric
-        check_numeric_columns("engagements.csv", (1<<0) | (1<<1) | (1<<5));
+        // reference tables from the CSVs
+        copy_files(input_files, output_files);
+        FlatFile csv_db("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        csv_db.loadFlatFile();
+        uint64_t csv_read = csv_db.stats().bytes_read;
+
+        std::vector<std::string> blk_files = {"users_blk.csv", "posts_blk.csv", "engagements_blk.csv"};
+        copy_files(input_files, blk_files);
+        FlatFile db(blk_files[0], blk_files[1], blk_files[2]);
+        BlockFileStats st = db.compressStorage(16 << 10);   // small blocks: several ranges per table
+        uintmax_t on_disk = 0, raw = 0;
+        for (size_t i = 0; i < 3; ++i) {
+            ASSERT_WITH_MESSAGE(is_block_file(blk_files[i]) && !is_block_file(output_files[i]), "formats");
+            on_disk += std::filesystem::file_size(blk_files[i]);
+            raw += std::filesystem::file_size(output_files[i]);
+        }
+        ASSERT_WITH_MESSAGE(st.raw_bytes == raw && st.stored_bytes == on_disk && st.blocks > 6, "compression stats");
+        ASSERT_WITH_MESSAGE(st.ratio() < 0.7, "repeated names/locations should compress");
+        BlockFile posts_file(blk_files[1]);
+        uint64_t lines = 0;
+        for (size_t i = 0; i < posts_file.blocks(); ++i) lines += posts_file.entry(i).lines;
+        std::ifstream posts_csv(output_files[1]);
+        std::string posts_text((std::istreambuf_iterator<char>(posts_csv)), std::istreambuf_iterator<char>());
+        ASSERT_WITH_MESSAGE(posts_file.raw_bytes() == posts_text.size() &&
+                            lines == uint64_t(std::count(posts_text.begin(), posts_text.end(), '\n')), "block index");
+
+        auto same_tables = [&](FlatFile& a, FlatFile& b) {
+            ASSERT_WITH_MESSAGE(a.getUsers().size() == b.getUsers().size() && a.getPosts().size() == b.getPosts().size() &&
+                                a.getEngagements().size() == b.getEngagements().size(), "table sizes");
+            for (const auto& kv : a.getUsers()) {
+                const User& u = *b.getUsers().at(kv.first);
+                ASSERT_WITH_MESSAGE(u.username == kv.second->username && u.location == kv.second->location, "user rows");
+            }
+            for (const auto& kv : a.getPosts()) {
+                const Post& p = *b.getPosts().at(kv.first);
+                ASSERT_WITH_MESSAGE(p.views == kv.second->views && p.content == kv.second->content && p.username == kv.second->username, "post rows");
+            }
+            for (const auto& kv : a.getEngagements()) {
+                const Engagement& e = *b.getEngagements().at(kv.first);
+                ASSERT_WITH_MESSAGE(e.comment == kv.second->comment && e.username == kv.second->username && e.postId == kv.second->postId &&
+                                    e.timestamp == kv.second->timestamp, "engagement rows");
+            }
+        };
 
-        std::cout << "Test 13: PASSED\n";
+        // both loaders read block files; the parallel one parses block ranges on the pool
+        db.loadFlatFile();
+        same_tables(csv_db, db);
+        uint64_t before = db.stats().bytes_read;
+        db.enableLoadTracing(true);
+        db.loadMultipleFlatFilesInParallel();
+        db.enableLoadTracing(false);
+        same_tables(csv_db, db);
+        ASSERT_WITH_MESSAGE(db.stats().bytes_read - before == on_disk - 3 * sizeof(BlockFileHeader) -
+                                                               st.blocks * sizeof(BlockIndexEntry) &&
+                            db.stats().bytes_read - before < csv_read * 0.7, "fewer bytes read");
+        size_t ranges = 0;
+        for (const TraceEvent& e : db.loadTraceEvents()) ranges += e.name.rfind("parse engagements_blk.csv [", 0) == 0;
+        ASSERT_WITH_MESSAGE(ranges == std::min<size_t>(BlockFile(blk_files[2]).blocks(), db.threadPool().size() + 1),
+                            "one task per block range");
+
+        // appends go to the raw tail, rewrites keep the block format; same results as on CSVs
+        for (FlatFile* f : {&csv_db, &db}) {
+            Engagement e(99999001, csv_db.getPosts().begin()->first, csv_db.getUsers().begin()->second->username, "comment", "tail row", 1700000000);
+            f->addEngagementRecord(e);
+            f->updatePostViews(csv_db.getPosts().begin()->first, 7);
+            f->updateUserName(std::next(csv_db.getUsers().begin())->first, "renamed_blk");
+            Engagement e2(99999002, csv_db.getPosts().begin()->first, "renamed_blk", "like", "", 1700000001);
+            f->addEngagementRecord(e2);
+        }
+        ASSERT_WITH_MESSAGE(is_block_file(blk_files[0]) && is_block_file(blk_files[1]) && BlockFile(blk_files[2]).tail_bytes() > 0,
+                            "format kept, appends in tail");
+        FlatFile csv_again("users_copy.csv", "posts_copy.csv", "engagements_copy.csv");
+        csv_again.loadFlatFile();
+        FlatFile blk_again(blk_files[0], blk_files[1], blk_files[2]);
+        blk_again.loadMultipleFlatFilesInParallel();
+        same_tables(csv_again, blk_again);
+        ASSERT_WITH_MESSAGE(blk_again.getEngagements().count(99999002) == 1, "tail rows loaded");
+
+        // re-packing folds the tail into blocks
+        blk_again.compressStorage();
+        ASSERT_WITH_MESSAGE(BlockFile(blk_files[2]).tail_bytes() == 0, "tail folded");
+        blk_again.loadFlatFile();
+        same_tables(csv_again, blk_again);
+        for (const auto& f : blk_files) std::remove(f.c_str());
+        std::cout << "stored " << st.stored_bytes << " of " << st.raw_bytes << " bytes in " << st.blocks << " blocks\n";
+        std::cout << "Test 38: PASSED\n";
     }
 
     // Cleanup copies created by tests